@@ -0,0 +1,99 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file BoundingVolumeHierarchy.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 09/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef BOUNDINGVOLUMEHIERARCHY_H_
+#define BOUNDINGVOLUMEHIERARCHY_H_
+
+#include <vector>
+#include <cstddef>
+#include <ngl/Vec3.h>
+#include "Frustum.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class BoundingVolumeHierarchy
+/// @brief this class stores a binary tree of axis aligned bounding boxes over a set of items, so that the items in
+/// view can be found without testing each one against the frustum - used by Forest to cull its trees
+//----------------------------------------------------------------------------------------------------------------------
+
+class BoundingVolumeHierarchy
+{
+public:
+
+  //CONSTRUCTORS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for BoundingVolumeHierarchy class
+  //--------------------------------------------------------------------------------------------------------------------
+  BoundingVolumeHierarchy() = default;
+
+  //NODE STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct Node
+  /// @brief a node of the hierarchy, covering the items m_ids[m_first] to m_ids[m_first+m_count-1] - a node is a
+  /// leaf if m_left is 0, otherwise its children are m_nodes[m_left] and m_nodes[m_left+1]
+  //--------------------------------------------------------------------------------------------------------------------
+  struct Node
+  {
+    ngl::Vec3 m_min;
+    ngl::Vec3 m_max;
+    size_t m_first;
+    size_t m_count;
+    size_t m_left;
+  };
+
+  //PUBLIC MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the nodes of the hierarchy, with the root at index 0
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<Node> m_nodes;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the ids of the items (their indexes in the lists passed to build()), ordered so that every node covers
+  /// a contiguous range
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<size_t> m_ids;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the bounding boxes of the items, in the same order as m_ids
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<ngl::Vec3> m_mins;
+  std::vector<ngl::Vec3> m_maxs;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief nodes with this many items or less aren't split any further
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_maxLeafSize = 4;
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief builds the hierarchy, splitting each node at the median of its items along its longest axis
+  /// @param [in] _mins, _maxs, the bounding boxes of the items
+  //--------------------------------------------------------------------------------------------------------------------
+  void build(const std::vector<ngl::Vec3> &_mins, const std::vector<ngl::Vec3> &_maxs);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief finds the items whose bounding boxes are in view, skipping every node that is outside the frustum
+  /// @param [in] _frustum, the frustum to test against
+  /// @param [out] _inside, appended with the ids of items completely inside the frustum
+  /// @param [out] _intersecting, appended with the ids of items that cross the edge of the frustum
+  //--------------------------------------------------------------------------------------------------------------------
+  void findVisible(const Frustum &_frustum, std::vector<size_t> &_inside, std::vector<size_t> &_intersecting) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of items stored
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t size() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief remove all nodes and items
+  //--------------------------------------------------------------------------------------------------------------------
+  void clear();
+
+private:
+
+  //PRIVATE METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief finds the bounds of the given node and splits it if it holds more than m_maxLeafSize items
+  //--------------------------------------------------------------------------------------------------------------------
+  void buildNode(size_t _node);
+
+};
+
+#endif //BOUNDINGVOLUMEHIERARCHY_H_
@@ -10,11 +10,15 @@
 
 #include <iostream>
 #include <vector>
+#include <memory>
 #include <random>
 #include <ngl/Vec3.h>
 #include <ngl/Mat4.h>
 #include "LSystem.h"
-#include "TerrainGenerator.h"
+#include "TerrainHeightQuery.h"
+#include "SpatialHash.h"
+#include "Frustum.h"
+#include "BoundingVolumeHierarchy.h"
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @class Forest
@@ -32,17 +36,20 @@ public:
   //--------------------------------------------------------------------------------------------------------------------
   Forest() = default;
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief user ctor for Forest class: assigns variables, fills the instance caches of each LSystem, and performs
-  /// tree scattering and instancing algorithm
+  /// @brief user ctor for Forest class: assigns variables and performs tree scattering and instancing algorithm
+  /// @note the tree types passed in must already have had their instance caches filled (see SpeciesCache), they
+  /// are shared with any other forest using them rather than copied
+  /// @param [in] _usePoissonDisk, whether to scatter trees with scatterForestPoissonDisk() instead of uniformly
+  /// @param [in] _treeRadii, the minimum spacing around each tree type, used by poisson disk scattering
   //--------------------------------------------------------------------------------------------------------------------
-  Forest(const std::vector<LSystem> &_treeTypes, float _width,
-         std::vector<size_t> &_numTrees, int _numHeroTrees, TerrainGenerator _terrainGen,
-         size_t _seed, bool _useSeed);
+  Forest(const std::vector<std::shared_ptr<const LSystem>> &_treeTypes, float _width,
+         std::vector<size_t> &_numTrees, std::shared_ptr<const TerrainHeightQuery> _terrainHeights,
+         size_t _seed, bool _useSeed, bool _usePoissonDisk=false, const std::vector<float> &_treeRadii={});
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief user ctor for painted forests, performs less actions on construction and assigns less variables
   /// because tree scattering is no longer needed when trees are painted onto terrain individually
   //--------------------------------------------------------------------------------------------------------------------
-  Forest(const std::vector<LSystem> &_treeTypes, int _numHeroTrees, size_t _seed, bool _useSeed);
+  Forest(const std::vector<std::shared_ptr<const LSystem>> &_treeTypes, size_t _seed, bool _useSeed);
 
   //TREE STRUCT
   //--------------------------------------------------------------------------------------------------------------------
@@ -57,6 +64,9 @@ public:
     size_t m_type;
     /// @brief transform matrix for tree, representing position and orientation
     ngl::Mat4 m_transform;
+    /// @brief worldspace bounding box of the tree, grown by createTree() to hold the bounding sphere of each instance
+    ngl::Vec3 m_boundsMin;
+    ngl::Vec3 m_boundsMax;
   };
 
   //CACHE INDEX STRUCT
@@ -75,11 +85,62 @@ public:
     size_t m_innerIndex;
   };
 
+  //TREE HANDLE STRUCTS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct TransformHandle
+  /// @brief records one transform a tree added to m_transformCache: the slot it went into and its position there
+  //--------------------------------------------------------------------------------------------------------------------
+  struct TransformHandle
+  {
+    /// @brief ctor for TransformHandle struct, assigns both member variables
+    TransformHandle(CacheIndex _cacheIndex, size_t _position);
+    CacheIndex m_cacheIndex;
+    size_t m_position;
+  };
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct TransformOwner
+  /// @brief the reverse of a TransformHandle: the tree (index in m_treeData) that a transform belongs to, and the
+  /// index of the TransformHandle in that tree's handle list
+  //--------------------------------------------------------------------------------------------------------------------
+  struct TransformOwner
+  {
+    /// @brief ctor for TransformOwner struct, assigns both member variables
+    TransformOwner(size_t _tree, size_t _handle);
+    size_t m_tree;
+    size_t m_handle;
+  };
+
+  //LOD SETTINGS STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct LODSettings
+  /// @brief settings for choosing the level of detail of each tree in findVisibleTransforms() - level i is drawn
+  /// with the instances allowed by level i of the tree type's LOD chain (LSystem::m_LODMaxAges), and levels past the
+  /// end of the chain are drawn as skeletal lines
+  //--------------------------------------------------------------------------------------------------------------------
+  struct LODSettings
+  {
+    /// @brief position of the camera in the same space as the forest
+    ngl::Vec3 m_cameraPosition;
+    /// @brief distances from the camera at which each coarser level begins, in increasing order - with no distances
+    /// every tree is drawn at full detail
+    std::vector<float> m_distances;
+    /// @brief a tree only changes level once it is this fraction of the boundary's distance past the boundary, so
+    /// that trees near a boundary don't flicker between levels as the camera moves
+    float m_hysteresis = 0.1f;
+    /// @brief the most trees that can change level in one call (0 for no limit), so that big camera moves spread
+    /// their changes over a few frames rather than popping every tree at once - trees appearing for the first time
+    /// always go straight to their level
+    size_t m_maxChangesPerUpdate = 0;
+    /// @brief returns true if the two settings are the same, so would choose the same levels
+    bool operator==(const LODSettings &_lod) const;
+  };
+
   //PUBLIC MEMBER VARIABLES
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief the LSystems used to describe the trees in the forest
+  /// @brief the LSystems used to describe the trees in the forest - these are immutable species shared between all
+  /// forests built from the same tree types, each one already holding its hero geometry and filled instance cache
   //--------------------------------------------------------------------------------------------------------------------
-  std::vector<LSystem> m_treeTypes;
+  std::vector<std::shared_ptr<const LSystem>> m_treeTypes;
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief number of trees of each LSystem type in forest
   //--------------------------------------------------------------------------------------------------------------------
@@ -89,17 +150,33 @@ public:
   //--------------------------------------------------------------------------------------------------------------------
   float m_width;
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief stores positions and types of trees in the forest when scatterForest() is used to determine tree positions
+  /// @brief worldspace x and z coordinates of the centre of the forest, used when the forest is one tile of a larger
+  /// world (see ForestTileManager)
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_centreX = 0;
+  float m_centreZ = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief stores positions and types of trees in the forest, whether they were scattered or painted
   //--------------------------------------------------------------------------------------------------------------------
   std::vector<Tree> m_treeData;
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief the number of hero trees created for each tree type to fill the instance cache
+  /// @brief spatial index of the trees in m_treeData by their XZ position, where the id of each tree is its index in
+  /// m_treeData - used for spacing checks when painting and for finding the trees near a point
+  //--------------------------------------------------------------------------------------------------------------------
+  SpatialHash m_treeHash;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief height queries over the terrain heightmap, used to place scattered trees on the terrain
+  //--------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<const TerrainHeightQuery> m_terrainHeights;
   //--------------------------------------------------------------------------------------------------------------------
-  int m_numHeroTrees;  
+  /// @brief toggle to determine whether trees are scattered with a guaranteed minimum spacing
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief terrain generation object storing the perlin noise module that determines the heightmap of the terrain
+  bool m_usePoissonDisk = false;
   //--------------------------------------------------------------------------------------------------------------------
-  TerrainGenerator m_terrainGen;
+  /// @brief minimum distance from each tree of a given type to any other tree (for two trees of different types the
+  /// larger of their radii is used) - if there are less radii than tree types, the last radius is used for the rest
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_treeRadii;
 
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief random number generator used for randomness in tree scattering and choosing instances
@@ -122,9 +199,40 @@ public:
   std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> m_transformCache;
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief vector of CacheIndex objects representing transformCache index levels that have been recently changed
-  /// to inform which vaos need to be rebuilt in NGLScene
+  /// to inform which vaos need to be updated in NGLScene - each index is only listed once until
+  /// clearAdjustedCacheIndexes() is called
   //--------------------------------------------------------------------------------------------------------------------
   std::vector<CacheIndex> m_adjustedCacheIndexes;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief matches the structure of m_transformCache, storing the position of the first transform in each slot that
+  /// has changed since clearAdjustedCacheIndexes() was last called (or SIZE_MAX for unchanged slots), so that only
+  /// the transforms from there onwards need to be uploaded again
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<CACHE_STRUCTURE(size_t)> m_firstAdjustedTransform;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to determine whether transforms keep track of their owners so that trees can be removed again -
+  /// this is only turned on for painted forests, since it costs memory for every transform
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_trackTransformOwners = false;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief for each tree in m_treeData, handles to all of the transforms it added to m_transformCache, used to
+  /// gather the transforms of the trees in view and to remove trees
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<std::vector<TransformHandle>> m_treeHandles;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief matches the structure of m_transformCache, storing the owner of each transform (only filled if
+  /// m_trackTransformOwners is true)
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<CACHE_STRUCTURE(std::vector<TransformOwner>)> m_transformOwners;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief hierarchy of the bounding boxes of the trees in m_treeData, where the id of each tree is its index in
+  /// m_treeData - used to find the trees in view without testing every one
+  //--------------------------------------------------------------------------------------------------------------------
+  BoundingVolumeHierarchy m_treeBVH;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief set when trees are added or removed, so that updateTreeBVH() knows m_treeBVH needs rebuilding
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_rebuildTreeBVH = false;
 
 
   //PUBLIC METHODS
@@ -137,31 +245,107 @@ public:
   //--------------------------------------------------------------------------------------------------------------------
   void seedRandomEngine();
   //--------------------------------------------------------------------------------------------------------------------
+  /// @brief scatters the trees with the method given by m_usePoissonDisk, indexes them in m_treeHash and then
+  /// creates the forest - called on construction of scattered forests
+  //--------------------------------------------------------------------------------------------------------------------
+  void generateForest();
+  //--------------------------------------------------------------------------------------------------------------------
   /// @brief scatter points randomly across the terrain to fill m_treePositions
   //--------------------------------------------------------------------------------------------------------------------
   void scatterForest();
   //--------------------------------------------------------------------------------------------------------------------
+  /// @brief scatter points across the terrain to fill m_treeData, such that no two trees are closer than their
+  /// radii in m_treeRadii - uses dart throwing over a background grid, split into tiles that are filled in parallel
+  /// @note if the requested number of trees doesn't fit with the given spacing, as many as possible are placed
+  //--------------------------------------------------------------------------------------------------------------------
+  void scatterForestPoissonDisk();
+  //--------------------------------------------------------------------------------------------------------------------
   /// @ref Kenwood et al, Efficient Procedural Generation of Forests, 2014
   /// @brief recursively adds to m_transformCache to represent the create geometry of a tree by picking instances from
   /// the instance cache of one of the LSystems
-  /// @param [in] treeType, the index (in m_treeTypes) of the LSystem whose instance cache we're using
+  /// @param [in] tree, the index of the tree in m_treeData, whose type gives the LSystem whose instance cache we're
+  /// using and whose bounds and handles are updated with each instance
   /// @param [in] transform, matrix representing the transform of the current instance relative to the origin
   /// @param [in] id, age, the id and age of the current branch instance
   //--------------------------------------------------------------------------------------------------------------------
-  void createTree(size_t _treeType, ngl::Mat4 _transform, size_t _id, size_t _age);
+  void createTree(size_t _tree, ngl::Mat4 _transform, size_t _id, size_t _age);
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief chooses a random instance from the instance cache of the given tree type at the given id, age and index
   //--------------------------------------------------------------------------------------------------------------------
-  Instance * getInstance(LSystem &_treeType, size_t _id, size_t _age, size_t &_innerIndex);
+  const Instance * getInstance(const LSystem &_treeType, size_t _id, size_t _age, size_t &_innerIndex);
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief creates a forest by calling createTree() for each point in m_treeData
+  /// @brief creates a forest by calling createTree() for each point in m_treeData, then builds m_treeBVH
   //--------------------------------------------------------------------------------------------------------------------
   void createForest();
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief different way of filling m_transformCache, by creating transform from a given position vector and using
-  /// it to call createTree() - used to add points that have been painted onto the terrain to the forest
+  /// it to call createTree() - used to add points that have been painted onto the terrain to the forest, the new tree
+  /// is also added to m_treeData and m_treeHash
   //--------------------------------------------------------------------------------------------------------------------
   void addTreeToForest(ngl::Vec3 &_point, size_t _treeType);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief rebuilds m_treeHash from the positions in m_treeData
+  //--------------------------------------------------------------------------------------------------------------------
+  void indexTrees();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief removes a tree from the forest using its handles - each of its transforms is swap-removed with the last
+  /// transform in the same slot, so this only costs as much as the number of instances in the tree
+  /// @param [in] _tree, the index of the tree in m_treeData (the last tree in m_treeData takes this index)
+  //--------------------------------------------------------------------------------------------------------------------
+  void removeTree(size_t _tree);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief removes all trees within the given XZ distance of a point, returns the number of trees removed
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t eraseTreesWithin(const ngl::Vec3 &_point, float _radius);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief rebuilds m_treeBVH from the bounds of the trees in m_treeData
+  //--------------------------------------------------------------------------------------------------------------------
+  void buildTreeBVH();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief rebuilds m_treeBVH only if trees have been added or removed since it was last built - painting and
+  /// erasing change many trees at once, so this is called once before culling rather than after every change
+  //--------------------------------------------------------------------------------------------------------------------
+  void updateTreeBVH();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief fills _visibleTransforms with the transforms in m_transformCache that are in view, so that only they need
+  /// to be drawn - trees completely in view keep all their transforms, while for trees crossing the edge of the view
+  /// each instance is tested using its bounding sphere
+  /// @param [in] _frustum, the view frustum in the same space as the forest
+  /// @param [out] _visibleTransforms, resized to match m_transformCache, keeping the memory it already had
+  //--------------------------------------------------------------------------------------------------------------------
+  void findVisibleTransforms(const Frustum &_frustum,
+                             std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> &_visibleTransforms) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief as above, but also chooses a level of detail for each visible tree and buckets the transforms by level:
+  /// each slot of _visibleTransforms lists the transforms drawn in full detail first, followed by those drawn as
+  /// skeletal lines, with instances too fine for a tree's level left out altogether
+  /// @param [in] _lod, the settings used to choose the levels
+  /// @param [in,out] _treeLODs, the level of each tree in m_treeData from the previous call, updated to the new
+  /// levels (trees not yet given a level are marked with SIZE_MAX)
+  /// @param [out] _numDetailedTransforms, the number of transforms at the start of each slot drawn in full detail
+  //--------------------------------------------------------------------------------------------------------------------
+  void findVisibleTransforms(const Frustum &_frustum, const LODSettings &_lod, std::vector<size_t> &_treeLODs,
+                             std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> &_visibleTransforms,
+                             std::vector<CACHE_STRUCTURE(size_t)> &_numDetailedTransforms) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the level of detail a tree at the given distance from the camera should be drawn at
+  /// @param [in] _distance, the distance from the camera
+  /// @param [in] _currentLOD, the tree's current level, or SIZE_MAX if it doesn't have one yet
+  //--------------------------------------------------------------------------------------------------------------------
+  static size_t chooseLOD(const LODSettings &_lod, float _distance, size_t _currentLOD);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the largest factor the transform scales lengths by, used to scale bounding sphere radii
+  //--------------------------------------------------------------------------------------------------------------------
+  static float getMaxScale(const ngl::Mat4 &_transform);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds a slot to m_adjustedCacheIndexes if it isn't there already and records the position of its first
+  /// changed transform
+  //--------------------------------------------------------------------------------------------------------------------
+  void markAdjusted(const CacheIndex &_cacheIndex, size_t _position);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief empties m_adjustedCacheIndexes once NGLScene has updated the corresponding vaos
+  //--------------------------------------------------------------------------------------------------------------------
+  void clearAdjustedCacheIndexes();
 
 };
 
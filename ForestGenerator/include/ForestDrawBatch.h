@@ -0,0 +1,132 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file ForestDrawBatch.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 11/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef FORESTDRAWBATCH_H_
+#define FORESTDRAWBATCH_H_
+
+#include <vector>
+#include <memory>
+#include <ngl/Mat4.h>
+#include "InstanceCacheMacros.h"
+#include "LSystem.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class ForestDrawBatch
+/// @brief this class builds the indirect draw commands for drawing a whole forest with one multi-draw call per
+/// shader: the hero buffers of all of the forest's tree types are laid out one after another in combined buffers, the
+/// transforms of every slot are packed into one transform list, and each non-empty slot gets a command drawing its
+/// index range with its transforms. No GL calls are made here, so that the command lists can be checked on the CPU
+//----------------------------------------------------------------------------------------------------------------------
+
+class ForestDrawBatch
+{
+public:
+
+  //CONSTRUCTORS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for ForestDrawBatch class
+  //--------------------------------------------------------------------------------------------------------------------
+  ForestDrawBatch() = default;
+
+  //DRAW COMMAND STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct DrawCommand
+  /// @brief one indirect draw, laid out exactly as the DrawElementsIndirectCommand read by glMultiDrawElementsIndirect
+  //--------------------------------------------------------------------------------------------------------------------
+  struct DrawCommand
+  {
+    /// @brief number of indices to draw
+    GLuint m_count;
+    /// @brief number of transforms to draw them with
+    GLuint m_instanceCount;
+    /// @brief first index in the combined index buffer
+    GLuint m_firstIndex;
+    /// @brief added to every index, to move the tree type's indices to its vertices in the combined buffers
+    GLint m_baseVertex;
+    /// @brief first transform in the combined transform buffer
+    GLuint m_baseInstance;
+  };
+
+  //GEOMETRY OFFSETS STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct GeometryOffsets
+  /// @brief where one tree type's vertices and indices start in the combined buffers of one kind of geometry
+  //--------------------------------------------------------------------------------------------------------------------
+  struct GeometryOffsets
+  {
+    size_t m_baseVertex = 0;
+    size_t m_firstIndex = 0;
+  };
+
+  //PUBLIC MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the tree types whose geometry is combined, in the same order as the forest's m_treeTypes
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<std::shared_ptr<const LSystem>> m_treeTypes;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the offsets of each tree type's hero branch, leaf and polygon buffers in the combined buffers
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<GeometryOffsets> m_branchOffsets;
+  std::vector<GeometryOffsets> m_leafOffsets;
+  std::vector<GeometryOffsets> m_polygonOffsets;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the total number of vertices and indices in each of the combined buffers
+  //--------------------------------------------------------------------------------------------------------------------
+  GeometryOffsets m_branchTotals;
+  GeometryOffsets m_leafTotals;
+  GeometryOffsets m_polygonTotals;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the commands for each shader: branches, leaves and polygons draw the detailed transforms of each slot and
+  /// skeletal commands draw the rest of the slot's transforms as lines with the branch geometry
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<DrawCommand> m_branchCommands;
+  std::vector<DrawCommand> m_leafCommands;
+  std::vector<DrawCommand> m_polygonCommands;
+  std::vector<DrawCommand> m_skeletalCommands;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the transforms of every slot one after another, each slot's detailed transforms before its skeletal ones
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<ngl::Mat4> m_transforms;
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief lays out the hero buffers of the given tree types one after another, filling the offsets and totals
+  //--------------------------------------------------------------------------------------------------------------------
+  void setTreeTypes(const std::vector<std::shared_ptr<const LSystem>> &_treeTypes);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief rebuilds the command lists and transforms, drawing every transform in full detail
+  /// @param [in] _transforms, the transforms of each slot, in the same structure as Forest::m_transformCache
+  //--------------------------------------------------------------------------------------------------------------------
+  void build(const std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> &_transforms);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief as above, but only the first _numDetailedTransforms of each slot are drawn in full detail and the rest
+  /// are drawn as skeletal lines, as found by Forest::findVisibleTransforms()
+  //--------------------------------------------------------------------------------------------------------------------
+  void build(const std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> &_transforms,
+             const std::vector<CACHE_STRUCTURE(size_t)> &_numDetailedTransforms);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief removes all commands and transforms
+  //--------------------------------------------------------------------------------------------------------------------
+  void clear();
+
+private:
+
+  //PRIVATE METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds a command drawing the index range [_start,_end) of a tree type's hero buffers, if it isn't empty
+  //--------------------------------------------------------------------------------------------------------------------
+  static void addCommand(std::vector<DrawCommand> &_commands, const GeometryOffsets &_offsets,
+                         size_t _start, size_t _end, size_t _baseInstance, size_t _instanceCount);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief shared implementation of the build methods, with _numDetailedTransforms null when everything is detailed
+  //--------------------------------------------------------------------------------------------------------------------
+  void buildCommands(const std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> &_transforms,
+                     const std::vector<CACHE_STRUCTURE(size_t)> *_numDetailedTransforms);
+
+};
+
+#endif //FORESTDRAWBATCH_H_
@@ -0,0 +1,120 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file ForestTileManager.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 07/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef FORESTTILEMANAGER_H_
+#define FORESTTILEMANAGER_H_
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <utility>
+#include "Forest.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class ForestTileManager
+/// @brief this class splits a forest world into square tiles, each of which is its own Forest generated
+/// deterministically from the world seed and the tile coordinates - only the tiles around the camera are kept
+/// resident, so memory use depends on the area around the camera rather than the size of the world
+//----------------------------------------------------------------------------------------------------------------------
+
+class ForestTileManager
+{
+public:
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief integer coordinates of a tile, the tile (i,j) covering worldspace x in [i,i+1)*tileSize and z in
+  /// [j,j+1)*tileSize
+  //--------------------------------------------------------------------------------------------------------------------
+  typedef std::pair<int,int> TileCoord;
+
+  //CONSTRUCTORS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for ForestTileManager class
+  //--------------------------------------------------------------------------------------------------------------------
+  ForestTileManager() = default;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief user ctor for ForestTileManager class, tiles are only built once update() is called
+  /// @param [in] _treeTypes, the tree types shared by every tile
+  /// @param [in] _tileSize, the width of each tile
+  /// @param [in] _numTreesPerTile, number of trees of each type in a tile
+  /// @param [in] _terrainHeights, height queries used to place the trees on the terrain
+  /// @param [in] _seed, _useSeed, the world seed, which is chosen by time if _useSeed is false
+  /// @param [in] _usePoissonDisk, _treeRadii, as in the Forest ctor
+  //--------------------------------------------------------------------------------------------------------------------
+  ForestTileManager(const std::vector<std::shared_ptr<const LSystem>> &_treeTypes, float _tileSize,
+                    const std::vector<size_t> &_numTreesPerTile,
+                    std::shared_ptr<const TerrainHeightQuery> _terrainHeights,
+                    size_t _seed, bool _useSeed, bool _usePoissonDisk=false, const std::vector<float> &_treeRadii={});
+
+  //PUBLIC MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief parameters every tile is generated with
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<std::shared_ptr<const LSystem>> m_treeTypes;
+  float m_tileSize = 200;
+  std::vector<size_t> m_numTreesPerTile;
+  std::shared_ptr<const TerrainHeightQuery> m_terrainHeights;
+  bool m_usePoissonDisk = false;
+  std::vector<float> m_treeRadii;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the seed the tile seeds are derived from
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_worldSeed = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief if greater than 0, only tiles overlapping the square of this width centred on the origin are built
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_worldWidth = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief tiles up to this many tiles away from the camera's tile are built, and tiles more than one tile further
+  /// away than this are evicted (the gap between the two stops tiles being rebuilt as the camera moves back and forth)
+  //--------------------------------------------------------------------------------------------------------------------
+  int m_residencyRadius = 2;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the maximum number of tiles built by one call to update(), to spread the cost over several frames
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_maxTilesBuiltPerUpdate = 2;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the resident tiles
+  //--------------------------------------------------------------------------------------------------------------------
+  std::map<TileCoord, std::unique_ptr<Forest>> m_tiles;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief tiles built and evicted since clearChanges() was last called, so NGLScene knows which VAOs to change
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<TileCoord> m_builtTiles;
+  std::vector<TileCoord> m_evictedTiles;
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief evicts tiles far from the camera and builds the nearest missing tiles around it, within the budget
+  /// @param [in] _x, _z, worldspace position of the camera
+  /// @returns true if any tiles were built or evicted
+  //--------------------------------------------------------------------------------------------------------------------
+  bool update(float _x, float _z);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the tile containing worldspace position (x,z)
+  //--------------------------------------------------------------------------------------------------------------------
+  TileCoord getTileCoord(float _x, float _z) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the seed of a tile, found by hashing the world seed with the tile coordinates
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t getTileSeed(TileCoord _coord) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief generates the forest for a tile - this doesn't depend on which other tiles exist
+  //--------------------------------------------------------------------------------------------------------------------
+  std::unique_ptr<Forest> buildTile(TileCoord _coord) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the resident tile at the given coordinates, or nullptr if it isn't resident
+  //--------------------------------------------------------------------------------------------------------------------
+  const Forest * getTile(TileCoord _coord) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief empties m_builtTiles and m_evictedTiles
+  //--------------------------------------------------------------------------------------------------------------------
+  void clearChanges();
+
+};
+
+#endif //FORESTTILEMANAGER_H_
@@ -0,0 +1,84 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file Frustum.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 09/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef FRUSTUM_H_
+#define FRUSTUM_H_
+
+#include <ngl/Vec3.h>
+#include <ngl/Vec4.h>
+#include <ngl/Mat4.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class Frustum
+/// @brief this class stores the six clipping planes of a view frustum, extracted from an MVP matrix, so that bounding
+/// volumes can be tested against the view before anything is sent to the GPU
+//----------------------------------------------------------------------------------------------------------------------
+
+class Frustum
+{
+public:
+
+  //CONSTRUCTORS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for Frustum class, all planes are zero so everything is treated as visible
+  //--------------------------------------------------------------------------------------------------------------------
+  Frustum() = default;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief user ctor for Frustum class, extracting the planes from the given matrix - the planes are in whichever
+  /// space the matrix transforms from, eg. passing in the MVP gives planes in model space
+  /// @param [in] _MVP, matrix transforming to clip space (as passed to the shaders)
+  //--------------------------------------------------------------------------------------------------------------------
+  Frustum(const ngl::Mat4 &_MVP);
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief result of testing a bounding volume against the frustum
+  //--------------------------------------------------------------------------------------------------------------------
+  enum Intersection {OUTSIDE, INTERSECTING, INSIDE};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief plane mask with a bit set for each of the six planes, as passed to testSphere() for the outermost sphere
+  //--------------------------------------------------------------------------------------------------------------------
+  static constexpr int m_allPlanes = 0x3f;
+
+  //PUBLIC MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the left, right, bottom, top, near and far planes, stored as (normal, distance) with the normals
+  /// normalised and pointing into the frustum, so a point p is inside a plane if dot(normal,p) + distance >= 0
+  //--------------------------------------------------------------------------------------------------------------------
+  ngl::Vec4 m_planes[6] = {ngl::Vec4(0,0,0,0), ngl::Vec4(0,0,0,0), ngl::Vec4(0,0,0,0),
+                           ngl::Vec4(0,0,0,0), ngl::Vec4(0,0,0,0), ngl::Vec4(0,0,0,0)};
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief tests an axis aligned bounding box against the frustum
+  /// @param [in] _min, _max, the corners of the box
+  /// @returns OUTSIDE if the box is completely outside one of the planes, INSIDE if it is completely inside all of
+  /// them and INTERSECTING otherwise (which can include some boxes near the corners that don't actually overlap)
+  //--------------------------------------------------------------------------------------------------------------------
+  Intersection testBox(const ngl::Vec3 &_min, const ngl::Vec3 &_max) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns false if the sphere is completely outside one of the planes
+  //--------------------------------------------------------------------------------------------------------------------
+  bool intersectsSphere(const ngl::Vec3 &_centre, float _radius) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief tests a sphere against the planes in _planeMask only, for hierarchies of nested spheres: the planes that
+  /// the sphere is completely inside are removed from the mask, so that the spheres nested in it only need testing
+  /// against the planes that are left, and none at all once the mask is 0. Planes that are all zero, as in the default
+  /// frustum, can't cull anything and are removed as well
+  /// @param [in] _centre, _radius, the sphere
+  /// @param [in,out] _planeMask, bit i is set if m_planes[i] still needs testing
+  /// @returns OUTSIDE if the sphere is completely outside one of the planes, INSIDE if the mask is left empty and
+  /// INTERSECTING otherwise
+  //--------------------------------------------------------------------------------------------------------------------
+  Intersection testSphere(const ngl::Vec3 &_centre, float _radius, int &_planeMask) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns true if the two frusta have exactly the same planes
+  //--------------------------------------------------------------------------------------------------------------------
+  bool operator==(const Frustum &_frustum) const;
+
+};
+
+#endif //FRUSTUM_H_
@@ -8,6 +8,7 @@
 #ifndef INSTANCE_H_
 #define INSTANCE_H_
 
+#include <ngl/Vec3.h>
 #include <ngl/Mat4.h>
 
 
@@ -72,6 +73,12 @@ public:
   size_t m_instancePolygonStart;
   size_t m_instancePolygonEnd;
   //--------------------------------------------------------------------------------------------------------------------
+  /// @brief bounding sphere of everything the instance draws from all three hero buffers, in the same space as the
+  /// hero vertices - filled by LSystem::computeInstanceBounds() and used to cull instances that are out of view
+  //--------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_boundingCentre;
+  float m_boundingRadius = 0;
+  //--------------------------------------------------------------------------------------------------------------------
   /// @brief list of exit points of the instance where we cill for a new instance in the forest creation algorithm
   //--------------------------------------------------------------------------------------------------------------------
   std::vector<ExitPoint> m_exitPoints;
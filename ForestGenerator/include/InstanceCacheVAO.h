@@ -75,6 +75,20 @@ class NGL_DLLEXPORT InstanceCacheVAO : public AbstractVAO
     //----------------------------------------------------------------------------------------------------------------------
     virtual void setData(const AbstractVAO::VertexData &_data) override;
     //----------------------------------------------------------------------------------------------------------------------
+    /// @brief alternative to setData() which binds vertex and index buffers shared with other VAOs instead of creating
+    /// new ones, so the VAO only owns its transform buffer and draws its own range of the shared index buffer - the
+    /// shared buffers are left alone by removeVAO() and must be deleted by whoever made them, after this VAO is removed
+    /// @param [in] _vertexBuffer, _indexBuffer, the ids of the shared buffers
+    /// @param [in] _indexStart, _indexCount, the range of the index buffer to draw
+    /// @param [in] _instanceCount, _transformData, the transforms to draw the range with
+    /// @param [in] _indexType, data type of the index data
+    /// @param [in] _transformUsage, the usage hint for the transform buffer - GL_DYNAMIC_DRAW if the transforms will
+    /// be patched with updateTransforms()
+    //----------------------------------------------------------------------------------------------------------------------
+    void setSharedData(GLuint _vertexBuffer, GLuint _indexBuffer, unsigned int _indexStart, unsigned int _indexCount,
+                       unsigned int _instanceCount, const GLvoid *_transformData, GLenum _indexType=GL_UNSIGNED_SHORT,
+                       GLenum _transformUsage=GL_STATIC_DRAW);
+    //----------------------------------------------------------------------------------------------------------------------
     /// @brief return the id of the buffer, if there is only 1 buffer just return this
     /// if we have the more than one buffer the sub class manages the id's
     /// @param _buffer index (default to 0 for single buffer VAO's)
@@ -86,6 +100,28 @@ class NGL_DLLEXPORT InstanceCacheVAO : public AbstractVAO
      /// @param _mode the access more
      //----------------------------------------------------------------------------------------------------------------------
      Real * mapBuffer(unsigned int _index=0, GLenum _accessMode=GL_READ_WRITE) override;
+     //----------------------------------------------------------------------------------------------------------------------
+     /// @brief update the transform buffer without touching the vertex and index data, only uploading the transforms
+     /// from _firstChanged onwards - the buffer grows geometrically, so appending transforms one brush stroke at a
+     /// time only occasionally needs to reallocate it
+     /// @param [in] _transformData, pointer to the full array of transforms
+     /// @param [in] _instanceCount, the new number of transforms (and instances to draw)
+     /// @param [in] _firstChanged, the index of the first transform that differs from the data already uploaded
+     //----------------------------------------------------------------------------------------------------------------------
+     void updateTransforms(const GLvoid *_transformData, unsigned int _instanceCount, unsigned int _firstChanged);
+     //----------------------------------------------------------------------------------------------------------------------
+     /// @brief return the number of instances currently drawn
+     //----------------------------------------------------------------------------------------------------------------------
+     unsigned int getInstanceCount() const {return m_instanceCount;}
+     //----------------------------------------------------------------------------------------------------------------------
+     /// @brief draw a range of the transforms in the transform buffer rather than all of them, by offsetting the
+     /// transform attribute pointers for the draw call - the VAO must be bound. This is the per-slot path's
+     /// equivalent of a base instance, since these VAOs are drawn with plain instanced draws rather than through
+     /// the ForestDrawBatch commands
+     /// @param [in] _firstInstance, the index of the first transform to draw
+     /// @param [in] _instanceCount, the number of transforms to draw
+     //----------------------------------------------------------------------------------------------------------------------
+     void drawInstances(unsigned int _firstInstance, unsigned int _instanceCount);
 
 
   protected :
@@ -98,12 +134,30 @@ class NGL_DLLEXPORT InstanceCacheVAO : public AbstractVAO
     }
 
   private :
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief create the transform buffer with the given usage hint and point attributes 1-4 at it, one transform per
+    /// instance
+    //----------------------------------------------------------------------------------------------------------------------
+    void setTransformData(const GLvoid *_transformData, unsigned int _instanceCount, GLenum _usage);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief delete the buffers this VAO owns
+    //----------------------------------------------------------------------------------------------------------------------
+    void deleteBuffers();
+
     //----------------------------------------------------------------------------------------------------------------------
     /// @brief the id of the buffers for the VAO
     //----------------------------------------------------------------------------------------------------------------------
     GLuint m_buffer=0;
     GLuint m_idxBuffer=0;
     GLuint m_transformBuffer=0;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief false if m_buffer and m_idxBuffer were passed to setSharedData() rather than made by setData()
+    //----------------------------------------------------------------------------------------------------------------------
+    bool m_ownsBuffers = true;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief offset in bytes of the first index drawn from m_idxBuffer
+    //----------------------------------------------------------------------------------------------------------------------
+    size_t m_indexOffset = 0;
 
     //----------------------------------------------------------------------------------------------------------------------
     /// @brief data type of the index data (e.g. GL_UNSIGNED_INT)
@@ -113,6 +167,10 @@ class NGL_DLLEXPORT InstanceCacheVAO : public AbstractVAO
     /// @brief number of instances we will be drawing for the given branch
     //----------------------------------------------------------------------------------------------------------------------
     GLuint m_instanceCount;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief number of transforms the transform buffer has room for
+    //----------------------------------------------------------------------------------------------------------------------
+    GLuint m_transformCapacity = 0;
 
 
 };
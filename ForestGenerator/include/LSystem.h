@@ -13,6 +13,7 @@
 #include <ngl/Vec3.h>
 #include <ngl/Mat4.h>
 #include "Instance.h"
+#include "MeshSimplifier.h"
 #include "InstanceCacheMacros.h"
 #include "PrintFunctions.h"
 
@@ -215,6 +216,32 @@ public:
   /// @brief boolean toggle to determine whether we should be filling hero buffers or regular buffers
   //--------------------------------------------------------------------------------------------------------------------
   bool m_forestMode = false;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of levels in the LOD chain made by computeLODChain()
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_numLODLevels = 3;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the LOD chain used when drawing this species in forests: level i only draws the instances with ages up to
+  /// m_LODMaxAges[i] - since the age of an instance is the generation its branch was made in, this draws the tree as
+  /// if it had been grown for less generations while reusing the same instance cache and exit points. Trees further
+  /// away than the last level are drawn with the last level's instances as skeletal lines (see Forest::LODSettings)
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<size_t> m_LODMaxAges = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief fractions of the full triangle count of the baked hero trees to make simplified meshes for
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_simplificationFractions = {0.5f, 0.25f, 0.1f};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief whether fillInstanceCache() also bakes m_simplifiedMeshes - baking and simplifying every hero tree is
+  /// slow and nothing draws the meshes yet, so it is left off unless m_bakeSimplifiedMeshes is ticked in the ui
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_bakeSimplifiedMeshes = false;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the hero trees baked into triangle meshes and simplified to each of m_simplificationFractions, with a
+  /// range of indices for each instance in the instance cache - unlike m_LODMaxAges these keep the silhouette of the
+  /// full tree, so they suit trees too far away for the missing generations to go unnoticed
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<MeshSimplifier::Mesh> m_simplifiedMeshes = {};
 
 
 
@@ -277,6 +304,20 @@ public:
   ///@brief calls createGeometry() in m_forestMode to makes hero trees to fill instance cache
   //--------------------------------------------------------------------------------------------------------------------
   void fillInstanceCache(int _numHeroTrees);
+  //--------------------------------------------------------------------------------------------------------------------
+  ///@brief finds the bounding sphere of each instance in the instance cache from its index ranges in the hero
+  /// buffers, allowing for the thickness of branches and the size of leaves added by the geometry shaders
+  //--------------------------------------------------------------------------------------------------------------------
+  void computeInstanceBounds();
+  //--------------------------------------------------------------------------------------------------------------------
+  ///@brief fills m_LODMaxAges with m_numLODLevels levels, each dropping about the same number of generations
+  //--------------------------------------------------------------------------------------------------------------------
+  void computeLODChain();
+  //--------------------------------------------------------------------------------------------------------------------
+  ///@brief fills m_simplifiedMeshes by baking and simplifying the hero trees with a MeshSimplifier, returning false
+  /// if any of the meshes could not be simplified to its fraction of the triangles
+  //--------------------------------------------------------------------------------------------------------------------
+  bool computeSimplifiedMeshes();
 };
 
 
@@ -40,6 +40,10 @@ private slots:
   /// @brief slot to switch between the controls for the different tree generation methods
   void on_m_treeGenMethod_currentIndexChanged(int index);
 
+  /// @brief slots to choose a heightmap or terrain file to import the terrain from or export it to
+  void on_m_importTerrain_clicked();
+  void on_m_exportTerrain_clicked();
+
 private:
   /// @brief our user interface
   Ui::MainWindow *m_ui;
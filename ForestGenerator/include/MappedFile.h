@@ -0,0 +1,74 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file MappedFile.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 11/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class MappedFile
+/// @brief this class maps a whole file read-only into memory, so that binary data can be copied straight out of it
+/// rather than read through a stream. Where POSIX mmap isn't available the file is read into a buffer instead
+//----------------------------------------------------------------------------------------------------------------------
+
+class MappedFile
+{
+public:
+
+  //CONSTRUCTORS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for MappedFile class, with no file open
+  //--------------------------------------------------------------------------------------------------------------------
+  MappedFile() = default;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief dtor for MappedFile class, unmapping the file
+  //--------------------------------------------------------------------------------------------------------------------
+  ~MappedFile();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the class owns its mapping, so it can't be copied
+  //--------------------------------------------------------------------------------------------------------------------
+  MappedFile(const MappedFile &_file) = delete;
+  MappedFile &operator=(const MappedFile &_file) = delete;
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief maps a file, unmapping any file that was already mapped
+  /// @returns false if the file couldn't be opened
+  //--------------------------------------------------------------------------------------------------------------------
+  bool open(const std::string &_fileName);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief unmaps the file
+  //--------------------------------------------------------------------------------------------------------------------
+  void close();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the contents of the file, or nullptr if none is mapped or it is empty
+  //--------------------------------------------------------------------------------------------------------------------
+  const unsigned char *getData() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the length of the file in bytes
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t getSize() const;
+
+private:
+
+  //PRIVATE MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the mapping and its length
+  //--------------------------------------------------------------------------------------------------------------------
+  void *m_mapping = nullptr;
+  size_t m_size = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the contents of the file when it is read rather than mapped
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<unsigned char> m_buffer = {};
+
+};
+
+#endif //MAPPEDFILE_H_
@@ -0,0 +1,185 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file MeshSimplifier.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 11/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef MESHSIMPLIFIER_H_
+#define MESHSIMPLIFIER_H_
+
+#include <vector>
+#include <ngl/Vec3.h>
+#include "InstanceCacheMacros.h"
+
+class LSystem;
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class MeshSimplifier
+/// @brief this class bakes the hero trees of an LSystem into a triangle mesh on the CPU, with the tubes the geometry
+/// shader would make from the branches, the polygons and a card for each leaf, and then simplifies the mesh by edge
+/// collapse under a quadric error metric (Garland and Heckbert, 1997). Every instance in the instance cache keeps its
+/// own range of the index buffer, so the simplified meshes can be instanced in exactly the same way as the hero buffers
+//----------------------------------------------------------------------------------------------------------------------
+
+class MeshSimplifier
+{
+public:
+
+  //CONSTRUCTORS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for MeshSimplifier class
+  //--------------------------------------------------------------------------------------------------------------------
+  MeshSimplifier() = default;
+
+  //RANGE STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct Range
+  /// @brief indexes to the beginning and end of an instance in the index buffer of a Mesh
+  //--------------------------------------------------------------------------------------------------------------------
+  struct Range
+  {
+    size_t m_start = 0;
+    size_t m_end = 0;
+  };
+
+  //MESH STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct Mesh
+  /// @brief a baked tree, drawn with GL_TRIANGLES
+  //--------------------------------------------------------------------------------------------------------------------
+  struct Mesh
+  {
+    /// @brief vertex positions, in the same space as the hero vertices
+    std::vector<ngl::Vec3> m_vertices;
+    /// @brief triangle indices, grouped by instance
+    std::vector<GLuint> m_indices;
+    /// @brief vertices that simplify() must never move or remove (the corners of the leaf cards)
+    std::vector<bool> m_fixedVertices;
+    /// @brief the range of m_indices drawn for each instance, in the same structure as LSystem::m_instanceCache
+    CACHE_STRUCTURE(Range) m_instanceRanges;
+
+    /// @brief number of triangles in the mesh
+    size_t getNumTriangles() const;
+  };
+
+  //LEAF CARD STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct LeafCard
+  /// @brief a leaf plane, defined in the same way as the leaf geometry shaders: half of m_right to either side of
+  /// m_position, extending m_direction forwards
+  //--------------------------------------------------------------------------------------------------------------------
+  struct LeafCard
+  {
+    ngl::Vec3 m_position;
+    ngl::Vec3 m_direction;
+    ngl::Vec3 m_right;
+  };
+
+  //PUBLIC MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of sides of the tubes baked around each branch (the forest geometry shader uses 8)
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_numSides = 8;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief weight of the planes added along open edges (such as the ends of the tubes), which stop the outline of
+  /// the mesh from shrinking as it is simplified
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_boundaryWeight = 100.0f;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief maximum number of times buildLOD() doubles the leaf cluster size while trying to fit the leaf budget
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_maxClusteringPasses = 8;
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief bakes every instance of a tree type into a single mesh
+  /// @param [in] _treeType, an LSystem whose instance cache has been filled
+  /// @param [in] _leafClusterSize, size of the cells leaves are clustered in (see clusterLeaves()), 0 for no clustering
+  //--------------------------------------------------------------------------------------------------------------------
+  Mesh bakeTree(const LSystem &_treeType, float _leafClusterSize) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief collapses edges, cheapest first, until the mesh has no more than _targetTriangles triangles or no more
+  /// edges can be collapsed without folding the mesh over - edges never cross instances since each instance is baked
+  /// with its own vertices, so the instance ranges stay valid
+  //--------------------------------------------------------------------------------------------------------------------
+  Mesh simplify(const Mesh &_mesh, size_t _targetTriangles) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief bakes and simplifies a tree to the given fraction of its full triangle count: leaves are clustered into
+  /// bigger cards until they fit their share of the budget, then the branches and polygons are simplified to fit the
+  /// rest
+  /// @param [in] _treeType, an LSystem whose instance cache has been filled
+  /// @param [in] _fraction, the fraction of the full triangle count to simplify to
+  /// @param [out] _lod, the simplified mesh
+  /// @return false if the mesh could not be simplified within the budget without folding over, in which case _lod
+  /// is the smallest mesh that was found
+  //--------------------------------------------------------------------------------------------------------------------
+  bool buildLOD(const LSystem &_treeType, float _fraction, Mesh &_lod) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief merges leaves whose positions fall in the same cell of a grid into one larger card, with the average
+  /// position and orientation of the leaves and sides scaled by the square root of their number, so that the cards
+  /// cover about the same area as the leaves they replace
+  /// @param [in] _leaves, the leaves to cluster
+  /// @param [in] _cellSize, size of the grid cells
+  //--------------------------------------------------------------------------------------------------------------------
+  static std::vector<LeafCard> clusterLeaves(const std::vector<LeafCard> &_leaves, float _cellSize);
+
+private:
+
+  //QUADRIC STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct Quadric
+  /// @brief the symmetric 4x4 matrix giving the sum of squared distances to a set of planes, stored as its upper
+  /// triangle: a^2, ab, ac, ad, b^2, bc, bd, c^2, cd, d^2 for a plane ax+by+cz+d=0
+  //--------------------------------------------------------------------------------------------------------------------
+  struct Quadric
+  {
+    double m_q[10] = {0,0,0,0,0,0,0,0,0,0};
+
+    /// @brief adds the plane with unit normal _normal through _point, scaled by _weight
+    void addPlane(const ngl::Vec3 &_normal, const ngl::Vec3 &_point, double _weight);
+    /// @brief adds another quadric to this one
+    void add(const Quadric &_q);
+    /// @brief the weighted sum of squared distances from _point to the planes
+    double evaluate(const ngl::Vec3 &_point) const;
+    /// @brief finds the point with the lowest error, returning false if the quadric is singular
+    bool findMinimum(ngl::Vec3 &_point) const;
+  };
+
+  //COLLAPSE STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct Collapse
+  /// @brief a candidate edge collapse, merging vertex m_b into m_a at m_position - the versions of the vertices when
+  /// it was made let stale candidates be skipped when they come off the queue
+  //--------------------------------------------------------------------------------------------------------------------
+  struct Collapse
+  {
+    double m_cost;
+    GLuint m_a;
+    GLuint m_b;
+    size_t m_versionA;
+    size_t m_versionB;
+    ngl::Vec3 m_position;
+
+    /// @brief ordered so that a std::priority_queue gives the cheapest collapse first
+    bool operator<(const Collapse &_other) const;
+  };
+
+  //PRIVATE METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief finds the best position to collapse an edge to and the error of collapsing it there
+  //--------------------------------------------------------------------------------------------------------------------
+  Collapse findCollapse(GLuint _a, GLuint _b, const std::vector<ngl::Vec3> &_vertices,
+                        const std::vector<Quadric> &_quadrics, const std::vector<size_t> &_versions) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds a tube around the branch segments in m_heroIndices[_start] to m_heroIndices[_end-1] to the mesh
+  //--------------------------------------------------------------------------------------------------------------------
+  void bakeBranches(const LSystem &_treeType, size_t _start, size_t _end, Mesh &_mesh) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds a leaf card as two triangles to the mesh, with its corners fixed
+  //--------------------------------------------------------------------------------------------------------------------
+  void bakeLeafCard(const LeafCard &_card, Mesh &_mesh) const;
+
+};
+
+#endif //MESHSIMPLIFIER_H_
@@ -12,6 +12,7 @@
 #define NGLSCENE_H_
 
 #include <vector>
+#include <map>
 
 #include <ngl/AbstractVAO.h>
 #include <ngl/Mat4.h>
@@ -23,8 +24,12 @@
 #include <math.h>
 #include "Camera.h"
 #include "Forest.h"
+#include "ForestDrawBatch.h"
+#include "ForestTileManager.h"
 #include "Grid.h"
+#include "SpeciesCache.h"
 #include "TerrainData.h"
+#include "TerrainHeightQuery.h"
 #include "noiseutils.h"
 
 #include <QEvent>
@@ -217,11 +222,54 @@ public slots:
   //----------------------------------------------------------------------------------------------------------------------
   void toggleTerrainWireframe( bool _mode );
   //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a slot to toggle whether the terrain is refined in parallel or serially within a time budget each frame
+  /// @param[in] mode, the mode passed from m_parallelRefinement_terrain
+  //----------------------------------------------------------------------------------------------------------------------
+  void toggleTerrainParallelRefinement( bool _mode );
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a slot to toggle whether forest instances outside the view are culled before drawing
+  /// @param[in] mode, the mode passed from m_cull_forest
+  //----------------------------------------------------------------------------------------------------------------------
+  void toggleForestCulling( bool _mode );
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a slot to toggle whether distant forest trees are drawn with less detail
+  /// @param[in] mode, the mode passed from m_LOD_forest
+  //----------------------------------------------------------------------------------------------------------------------
+  void toggleForestLOD( bool _mode );
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a slot to toggle whether forests are drawn with one multi-draw call per shader when OpenGL 4.3 is available
+  /// @param[in] mode, the mode passed from m_multiDraw_forest
+  //----------------------------------------------------------------------------------------------------------------------
+  void toggleForestMultiDraw( bool _mode );
+  //----------------------------------------------------------------------------------------------------------------------
   /// @brief a slot to set the base level of detail for the terrain, which
   /// determines the initial dimensions of the heightmap grid
   /// @param[in] LOD, the int passed from m_LOD
   //----------------------------------------------------------------------------------------------------------------------
   void setLOD(int _LOD);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a slot to set how many times finer than the mesh the heightmap is generated, paging it to a file when
+  /// this is above 1
+  /// @param[in] stride, the int passed from m_terrainPageStride in ui
+  //----------------------------------------------------------------------------------------------------------------------
+  void setTerrainPageStride(int _stride);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a slot to set the number of times the terrain texture repeats across the terrain, which only refills the
+  /// terrain's UVs
+  /// @param[in] UVRepeat, the int passed from m_terrainUVRepeat in ui
+  //----------------------------------------------------------------------------------------------------------------------
+  void setTerrainUVRepeat(int _UVRepeat);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a slot to replace the terrain with one loaded from a file - .raw and .pgm files are loaded as 16-bit
+  /// heightmaps and any other file as one saved by exportTerrain()
+  /// @param[in] _fileName, the file to load
+  //----------------------------------------------------------------------------------------------------------------------
+  void importTerrain(QString _fileName);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a slot to save the terrain to a file, in the format given by its extension as for importTerrain()
+  /// @param[in] _fileName, the file to save to
+  //----------------------------------------------------------------------------------------------------------------------
+  void exportTerrain(QString _fileName);
 
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief a slot to toggle whether or not we are currently painting trees onto the terrain
@@ -268,6 +316,11 @@ public slots:
   //----------------------------------------------------------------------------------------------------------------------
   void setInstancingProb(double _instancingProb);
   //----------------------------------------------------------------------------------------------------------------------
+  /// @brief slot to set whether all L-Systems bake simplified meshes of their hero trees into the instance cache
+  /// @param[in] _bake, the bool passed from m_bakeSimplifiedMeshes in ui
+  //----------------------------------------------------------------------------------------------------------------------
+  void toggleBakeSimplifiedMeshes(bool _bake);
+  //----------------------------------------------------------------------------------------------------------------------
   /// @brief slot to set the seed for both forest members
   /// @param[in] _seed, the int passed from m_seed in ui
   //----------------------------------------------------------------------------------------------------------------------
@@ -368,21 +421,73 @@ protected:
   //----------------------------------------------------------------------------------------------------------------------
   int m_terrainDimension = 129;
   //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the number of times the terrain texture repeats across the terrain, set by m_terrainUVRepeat in the ui
+  //----------------------------------------------------------------------------------------------------------------------
+  int m_terrainUVRepeat = 4;
+  //----------------------------------------------------------------------------------------------------------------------
   /// @brief float to store the user-specified error tolerance passed into the LOD algorithm in m_terrain
   //----------------------------------------------------------------------------------------------------------------------
   float m_tolerance = 0.02f;
   //----------------------------------------------------------------------------------------------------------------------
+  /// @brief time in milliseconds m_terrain may spend refining each frame - a refinement that takes longer is finished
+  /// over the next frames while the last complete mesh is drawn, this only applies to the serial refinement
+  //----------------------------------------------------------------------------------------------------------------------
+  double m_terrainRefinementBudget = 4.0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to determine whether the terrain quadrants are refined in parallel all at once, or serially within
+  /// m_terrainRefinementBudget each frame, copied into m_terrain whenever it is rebuilt
+  //----------------------------------------------------------------------------------------------------------------------
+  bool m_parallelTerrainRefinement = true;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to determine whether the terrain outside the view is left unrefined, so that only the terrain in
+  /// view is drawn in detail
+  //----------------------------------------------------------------------------------------------------------------------
+  bool m_cullTerrain = true;
+  //----------------------------------------------------------------------------------------------------------------------
   /// @brief bool determining whether or not to draw the terrain in wireframe
   //----------------------------------------------------------------------------------------------------------------------
   bool m_terrainWireframe = false;
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief module storing the perlin noise used to generate the terrain
+  /// @brief height queries over the heightmap of the most recently generated terrain, shared with the forests and
+  /// used for placing and picking points on the terrain
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<const TerrainHeightQuery> m_terrainHeights;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief how many times finer than the mesh the heightmap is generated, set by m_terrainPageStride in the ui -
+  /// above 1 the heightmap is paged to m_terrainPageFile rather than held in memory, so that it can be larger than
+  /// memory. The refinement never reads the pages: m_terrain is built from every m_terrainPageStride'th value, loaded
+  /// into m_terrainGen, so the mesh has the detail of the base LOD and only the height queries see the full heightmap
+  //----------------------------------------------------------------------------------------------------------------------
+  int m_terrainPageStride = 1;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the file the heightmap is paged to, in the user's cache directory, set on construction
+  //----------------------------------------------------------------------------------------------------------------------
+  std::string m_terrainPageFile;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the paged heightmap, kept between generations so that only the tiles whose settings changed are redone
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<PagedHeightMap> m_terrainPages;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the heights that 0 and 65535 stand for in imported and exported 16-bit heightmaps
   //----------------------------------------------------------------------------------------------------------------------
-  noise::module::Perlin m_perlinModule;
+  float m_terrainFileMinHeight = -100;
+  float m_terrainFileMaxHeight = 100;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a file saved by exportTerrain() to load the first terrain from instead of generating it, if it is set
+  //----------------------------------------------------------------------------------------------------------------------
+  std::string m_terrainStartupFile = "";
 
 
   //GENERAL FOREST VARIABLES
   //----------------------------------------------------------------------------------------------------------------------
+  /// @brief cache of tree types, so that forests are only given new hero trees when the species parameters change
+  //----------------------------------------------------------------------------------------------------------------------
+  SpeciesCache m_speciesCache;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief immutable tree types made from m_LSystems, shared between m_scatteredForest and m_paintedForest
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<std::shared_ptr<const LSystem>> m_treeTypes;
+  //----------------------------------------------------------------------------------------------------------------------
   /// @brief the Forest object we use when generating forests with the tree scattering method
   //----------------------------------------------------------------------------------------------------------------------
   Forest m_scatteredForest;
@@ -394,6 +499,42 @@ protected:
   /// @brief toggle to determine which forest type we're rendering with
   //----------------------------------------------------------------------------------------------------------------------
   bool m_usePaintedForest = true;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to determine whether the scattered forest keeps its trees at least m_minTreeDist apart
+  //----------------------------------------------------------------------------------------------------------------------
+  bool m_usePoissonDisk = false;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to determine whether the scattered forest is streamed in tiles around the camera
+  //----------------------------------------------------------------------------------------------------------------------
+  bool m_useForestTiles = false;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to determine whether only the forest instances in view are sent to the GPU each frame
+  //----------------------------------------------------------------------------------------------------------------------
+  bool m_cullForest = true;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to determine whether distant forest trees are drawn with less detail
+  //----------------------------------------------------------------------------------------------------------------------
+  bool m_useForestLOD = true;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief toggle to determine whether forests are drawn with glMultiDrawElementsIndirect, and whether the context
+  /// supports it (it needs OpenGL 4.3, so on older contexts each slot is drawn separately whatever the toggle says)
+  //----------------------------------------------------------------------------------------------------------------------
+  bool m_useForestMultiDraw = true;
+  bool m_supportsMultiDraw = false;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the distances at which forest trees drop to each coarser level of detail, shared by every forest - the
+  /// default LSystem LOD chain has three levels, so trees past the last distance are drawn as skeletal lines
+  //----------------------------------------------------------------------------------------------------------------------
+  Forest::LODSettings m_forestLOD;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the tiles of the streamed forest, with the number of trees in each tile set so that the density matches
+  /// m_numTrees over the whole terrain
+  //----------------------------------------------------------------------------------------------------------------------
+  ForestTileManager m_forestTiles;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief width of each tile of the streamed forest
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_forestTileSize = 200;
 
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief number of hero trees to create for each LSystem when filling the instance cache
@@ -414,7 +555,7 @@ protected:
 
   //FOREST PAINT VARIABLES
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief the index of the current L-System we're using to paint trees
+  /// @brief the index of the current L-System we're using to paint trees, or m_numTreeTabs for the eraser
   //----------------------------------------------------------------------------------------------------------------------
   size_t m_paintBrushNum = 0;
   //----------------------------------------------------------------------------------------------------------------------
@@ -430,22 +571,14 @@ protected:
   //----------------------------------------------------------------------------------------------------------------------
   bool m_drawingLine = false;
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief the spacing between painted trees
+  /// @brief the spacing between painted trees, also used as the spacing for poisson disk scattering
   //----------------------------------------------------------------------------------------------------------------------
   float m_minTreeDist = 20;
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief the error tolerance when picking a point on the terrain with the mouse
+  /// @brief how far a point picked with the mouse may be from the terrain to count as being on it
   //----------------------------------------------------------------------------------------------------------------------
   float m_rayPickTolerance = 0.1f;
 
-  //----------------------------------------------------------------------------------------------------------------------
-  /// @brief list of vertices corresponding to points where the user has painted trees onto the terrain
-  //----------------------------------------------------------------------------------------------------------------------
-  std::vector<ngl::Vec3> m_paintPoints = {};
-  //----------------------------------------------------------------------------------------------------------------------
-  /// @brief corresponding index list to allow us to draw these points with GL_POINTS
-  //----------------------------------------------------------------------------------------------------------------------
-  std::vector<GLshort> m_paintPointIndices = {};
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief list of vertices to describe the temporary lines painted onto the terrain as we paint trees
   //----------------------------------------------------------------------------------------------------------------------
@@ -466,9 +599,10 @@ protected:
   //----------------------------------------------------------------------------------------------------------------------
   std::unique_ptr<ngl::AbstractVAO> m_paintLineVAO;
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief terrain VAO
+  /// @brief terrain VAO, with its vertex attributes uploaded once per terrain and its triangle strip indices streamed
+  /// into m_terrainIndexBuffer each time the terrain is refined
   //----------------------------------------------------------------------------------------------------------------------
-  std::unique_ptr<ngl::AbstractVAO> m_terrainVAO;
+  GLuint m_terrainVAO = 0;
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief VAOs for the LSystems
   //----------------------------------------------------------------------------------------------------------------------
@@ -476,15 +610,118 @@ protected:
   std::vector<std::unique_ptr<ngl::AbstractVAO>> m_leafVAOs;
   std::vector<std::unique_ptr<ngl::AbstractVAO>> m_polygonVAOs;
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief VAOs for the Forests, stored as nested vectors corresponding to instance caches:
+  /// @struct SpeciesBuffers
+  /// @brief the hero buffers of one tree type uploaded to the GPU once, to be bound by the VAOs of every slot of every
+  /// forest using that tree type - the buffers are deleted when the last forest using them lets go of them
+  //----------------------------------------------------------------------------------------------------------------------
+  struct SpeciesBuffers
+  {
+    SpeciesBuffers() = default;
+    SpeciesBuffers(const SpeciesBuffers &) = delete;
+    SpeciesBuffers &operator=(const SpeciesBuffers &) = delete;
+    ~SpeciesBuffers();
+
+    /// @brief the tree type the buffers were made from, held so that it can't be replaced by a new tree type at the
+    /// same address while the buffers are still in m_speciesBuffers
+    std::shared_ptr<const LSystem> m_treeType;
+    GLuint m_vertexBuffer = 0;
+    GLuint m_indexBuffer = 0;
+    GLuint m_rightBuffer = 0;
+    GLuint m_thicknessBuffer = 0;
+    GLuint m_leafVertexBuffer = 0;
+    GLuint m_leafIndexBuffer = 0;
+    GLuint m_leafDirectionBuffer = 0;
+    GLuint m_leafRightBuffer = 0;
+    GLuint m_polygonVertexBuffer = 0;
+    GLuint m_polygonIndexBuffer = 0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the species buffers currently on the GPU, looked up by tree type
+  //----------------------------------------------------------------------------------------------------------------------
+  std::map<const LSystem *, std::weak_ptr<SpeciesBuffers>> m_speciesBuffers;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @struct BatchBuffers
+  /// @brief the hero buffers of a list of tree types combined one after another in the layout of
+  /// ForestDrawBatch::setTreeTypes(), uploaded once and shared by every forest batch drawing those tree types - the
+  /// painted forest, the scattered forest and every forest tile usually all use the same list
+  //----------------------------------------------------------------------------------------------------------------------
+  struct BatchBuffers
+  {
+    /// @brief the tree types the buffers were made from, held for the same reason as SpeciesBuffers::m_treeType
+    std::vector<std::shared_ptr<const LSystem>> m_treeTypes;
+    SpeciesBuffers m_buffers;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the batch buffers currently on the GPU, looked up by their list of tree types
+  //----------------------------------------------------------------------------------------------------------------------
+  std::map<std::vector<const LSystem *>, std::weak_ptr<BatchBuffers>> m_batchBuffers;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @struct ForestBatch
+  /// @brief everything needed to draw a forest with one glMultiDrawElementsIndirect call per shader: the shared hero
+  /// buffers of its tree types, a branch, leaf and polygon VAO reading them, and the forest's own transform and
+  /// indirect command buffers filled from m_batch
+  //----------------------------------------------------------------------------------------------------------------------
+  struct ForestBatch
+  {
+    ForestBatch() = default;
+    ForestBatch(const ForestBatch &) = delete;
+    ForestBatch &operator=(const ForestBatch &) = delete;
+    ~ForestBatch();
+
+    ForestDrawBatch m_batch;
+    std::shared_ptr<BatchBuffers> m_buffers;
+    GLuint m_VAOs[3] = {0,0,0};
+    GLuint m_transformBuffer = 0;
+    GLuint m_commandBuffer = 0;
+    /// @brief whether the buffers hold every transform of the forest, unchanged since they were uploaded
+    bool m_upToDate = false;
+    /// @brief whether the buffers hold the transforms in view instead, and the ForestVAOs::m_visibleVersion they were
+    /// filled from
+    bool m_isCulled = false;
+    size_t m_culledVersion = 0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @struct ForestVAOs
+  /// @brief the VAOs used to render one forest, along with the buffers of each tree type bound to them, stored as
+  /// nested vectors corresponding to instance caches:
   /// layers separate by: treetype / id / age / different instances of a given id and index
   //----------------------------------------------------------------------------------------------------------------------
-  std::vector<CACHE_STRUCTURE(std::unique_ptr<ngl::AbstractVAO>)> m_forestVAOs;
-  std::vector<CACHE_STRUCTURE(std::unique_ptr<ngl::AbstractVAO>)> m_forestLeafVAOs;
-  std::vector<CACHE_STRUCTURE(std::unique_ptr<ngl::AbstractVAO>)> m_forestPolygonVAOs;
-  std::vector<CACHE_STRUCTURE(std::unique_ptr<ngl::AbstractVAO>)> m_paintedForestVAOs;
-  std::vector<CACHE_STRUCTURE(std::unique_ptr<ngl::AbstractVAO>)> m_paintedForestLeafVAOs;
-  std::vector<CACHE_STRUCTURE(std::unique_ptr<ngl::AbstractVAO>)> m_paintedForestPolygonVAOs;
+  struct ForestVAOs
+  {
+    std::vector<CACHE_STRUCTURE(std::unique_ptr<ngl::AbstractVAO>)> m_VAOs;
+    std::vector<CACHE_STRUCTURE(std::unique_ptr<ngl::AbstractVAO>)> m_leafVAOs;
+    std::vector<CACHE_STRUCTURE(std::unique_ptr<ngl::AbstractVAO>)> m_polygonVAOs;
+    /// @brief the shared buffers of each tree type, which every slot's VAOs draw a range of - the slot VAOs and these
+    /// are only made once the forest is drawn without multi-draw calls
+    std::vector<std::shared_ptr<SpeciesBuffers>> m_speciesBuffers;
+    /// @brief the buffers for drawing the whole forest with multi-draw calls, made the first time it is drawn that way
+    std::unique_ptr<ForestBatch> m_batch;
+    /// @brief the transforms in view found by the last call to cullForestVAOs(), kept to reuse their memory
+    std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> m_visibleTransforms;
+    /// @brief how many of the transforms in each slot are drawn in full detail, the rest being skeletal lines
+    std::vector<CACHE_STRUCTURE(size_t)> m_numDetailedTransforms;
+    /// @brief the current level of detail of each tree in the forest
+    std::vector<size_t> m_treeLODs;
+    /// @brief the frustum and level of detail settings m_visibleTransforms was last found with, so that it is only
+    /// found again when the view or the forest changes - m_visibleVersion counts the times it has been found
+    Frustum m_visibleFrustum;
+    Forest::LODSettings m_visibleLOD;
+    bool m_visibleUpToDate = false;
+    size_t m_visibleVersion = 0;
+    /// @brief whether the slot VAOs' transform buffers hold only the transforms in view rather than every transform,
+    /// and the m_visibleVersion they were filled from
+    bool m_isCulled = false;
+    size_t m_culledVersion = 0;
+    /// @brief the usage hint for the slot VAOs' transform buffers - the painted forest's are patched with every brush
+    /// stroke, so it makes them GL_DYNAMIC_DRAW
+    GLenum m_transformUsage = GL_STATIC_DRAW;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief VAOs for the scattered and painted forests, and for each resident tile of m_forestTiles
+  //----------------------------------------------------------------------------------------------------------------------
+  ForestVAOs m_scatteredForestVAOs;
+  ForestVAOs m_paintedForestVAOs;
+  std::map<ForestTileManager::TileCoord, ForestVAOs> m_forestTileVAOs;
 
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief bools to tell paintGL whether or not we need to rebuild a given VAO
@@ -492,10 +729,14 @@ protected:
   bool m_buildTreeVAO = false;
   bool m_buildForestVAOs = false;
   bool m_buildPaintLineVAO = true;
+  bool m_buildTerrainVAO = true;
+  bool m_updateTerrainUVs = false;
 
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief variables storing the buffer ids for the buffers used by each VAO
   //----------------------------------------------------------------------------------------------------------------------
+  GLuint m_terrainVertexBuffer = 0;
+  GLuint m_terrainIndexBuffer = 0;
   GLuint m_terrainNormalBuffer = 0;
   GLuint m_terrainTangentBuffer = 0;
   GLuint m_terrainBitangentBuffer = 0;
@@ -504,14 +745,11 @@ protected:
   std::vector<GLuint> m_treeThicknessBuffers = {0,0,0};
   std::vector<GLuint> m_treeLeafDirectionBuffers = {0,0,0};
   std::vector<GLuint> m_treeLeafRightBuffers = {0,0,0};
-  std::vector<CACHE_STRUCTURE(GLuint)> m_forestRightBuffers = {{},{},{}};
-  std::vector<CACHE_STRUCTURE(GLuint)> m_forestThicknessBuffers = {{},{},{}};
-  std::vector<CACHE_STRUCTURE(GLuint)> m_forestLeafDirectionBuffers = {{},{},{}};
-  std::vector<CACHE_STRUCTURE(GLuint)> m_forestLeafRightBuffers = {{},{},{}};
-  std::vector<CACHE_STRUCTURE(GLuint)> m_paintedForestRightBuffers = {{},{},{}};
-  std::vector<CACHE_STRUCTURE(GLuint)> m_paintedForestThicknessBuffers = {{},{},{}};
-  std::vector<CACHE_STRUCTURE(GLuint)> m_paintedForestLeafDirectionBuffers = {{},{},{}};
-  std::vector<CACHE_STRUCTURE(GLuint)> m_paintedForestLeafRightBuffers = {{},{},{}};
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the number of indices m_terrainIndexBuffer has room for, and the number drawn
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t m_terrainIndexCapacity = 0;
+  size_t m_terrainIndexCount = 0;
 
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief variables storing the texture ids for each texture object
@@ -541,17 +779,73 @@ protected:
   //----------------------------------------------------------------------------------------------------------------------
   void resizeGL(int _w, int _h) override;
   //----------------------------------------------------------------------------------------------------------------------
+  /// @brief remakes m_treeTypes from the current state of m_LSystems, reusing cached species where possible
+  //----------------------------------------------------------------------------------------------------------------------
+  void updateTreeTypes();
+  //----------------------------------------------------------------------------------------------------------------------
   /// @brief updates forest class when L-Systems change
   //----------------------------------------------------------------------------------------------------------------------
   void updateScatteredForest();
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief apply LOD algorithm to terrain and rebuild m_terrainVAO accordingly
+  /// @brief brings the heightmap in m_terrainGen up to date with its settings and remakes m_terrain and m_terrainHeights
+  /// from it, redoing only the stages that the changed settings affect
+  //----------------------------------------------------------------------------------------------------------------------
+  void generateTerrain();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief loads the heightmap from a file into m_terrainGen, in the format given by its extension, and remakes
+  /// m_terrain and m_terrainHeights from it
+  /// @returns false if the file couldn't be loaded, in which case the terrain is left as it was
+  //----------------------------------------------------------------------------------------------------------------------
+  bool loadTerrain(const std::string &_fileName);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief remakes m_terrain and m_terrainHeights from the heightmap in m_terrainGen
+  /// @param [in] _sameGrid, whether the heightmap may be on the same grid as m_terrain, in which case m_terrain only
+  /// takes the new heights rather than being rebuilt
+  /// @param [in] _pages, the paged heightmap that m_terrainGen was loaded from, for m_terrainHeights to sample instead
+  /// of m_terrainGen if it is set
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildTerrain(bool _sameGrid=false, std::shared_ptr<PagedHeightMap> _pages=nullptr);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief apply LOD algorithm to terrain if the camera or tolerance has changed enough to need it, and stream the new
+  /// indices to m_terrainVAO, building it first if the terrain has changed
   //----------------------------------------------------------------------------------------------------------------------
   void refineTerrain();
   //----------------------------------------------------------------------------------------------------------------------
+  /// @brief rebuilds m_forestTiles with the current forest settings, removing all resident tiles
+  //----------------------------------------------------------------------------------------------------------------------
+  void updateForestTiles();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the worldspace position of the current camera, undoing the mouse transform
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 getCameraPosition();
+  //----------------------------------------------------------------------------------------------------------------------
   /// @brief calls bind, then draw, thenunbind on the given VAO, just created to save repetition
   //----------------------------------------------------------------------------------------------------------------------
   void drawVAO(std::unique_ptr<ngl::AbstractVAO> &_VAO);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief draws every VAO of a forest with the forest shaders
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawForestVAOs(ForestVAOs &_vaos);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief draws one slot of a forest: the transforms drawn in full detail with the forest, leaf and polygon shaders
+  /// and the rest with the skeletal forest shader
+  /// @param [in] treeNum, id, age, index: the identifiers for the position of the VAO in the VAO cache structure
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawForestSlot(ForestVAOs &_vaos, size_t _treeNum, size_t _id, size_t _age, size_t _index);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief culls a forest's VAOs to the view and chooses the level of detail of its trees if m_cullForest or
+  /// m_useForestLOD are set (or restores all its transforms if neither is), then draws them
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawForest(const Forest &_forest, ForestVAOs &_vaos, const Frustum &_frustum);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief draws a forest with one glMultiDrawElementsIndirect call per shader, rebuilding its command lists from the
+  /// transforms in view when they change if m_cullForest or m_useForestLOD are set, or when the forest changes if not
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawForestBatch(const Forest &_forest, ForestVAOs &_vaos, const Frustum &_frustum);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the view frustum in the space the forests are drawn in, found from the same MVP as the shaders
+  //----------------------------------------------------------------------------------------------------------------------
+  Frustum getViewFrustum();
 
 
   //VAO BUILDING METHODS
@@ -567,17 +861,33 @@ protected:
   void buildSimpleIndexVAO(std::unique_ptr<ngl::AbstractVAO> &_vao, std::vector<ngl::Vec3> &_vertices,
                            std::vector<dataType> &_indices, GLenum _mode, GLenum _indexType);
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief build a VAO using my InstanceCacheVAO class by binding vertex and index data
+  /// @brief build a VAO using my InstanceCacheVAO class by binding shared vertex and index buffers
   /// @param [in] vao, the vao to bind
-  /// @param [in] vertices, list of vertices to use for rendering
-  /// @param [in] indices, list of indexes corresponding to the vertices
+  /// @param [in] vertexBuffer, the buffer of vertices to use for rendering
+  /// @param [in] indexBuffer, the buffer of indexes corresponding to the vertices
   /// @param [in] transforms, list of transforms for each instance
-  /// @param [in] instanceStart and end, the start and end points of the supplied index list for this instance
+  /// @param [in] instanceStart and end, the start and end points of the index buffer for this instance
   /// @param [in] mode, the openGL drawing mode
+  /// @param [in] transformUsage, the usage hint for the transform buffer
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildInstanceCacheVAO(std::unique_ptr<ngl::AbstractVAO> &_vao, GLuint _vertexBuffer, GLuint _indexBuffer,
+                             const std::vector<ngl::Mat4> &_transforms,
+                             size_t _instanceStart, size_t _instanceEnd, GLenum _mode, GLenum _transformUsage);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the buffers of a tree type, uploading them if no forest is using them yet
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<SpeciesBuffers> getSpeciesBuffers(const std::shared_ptr<const LSystem> &_treeType);
   //----------------------------------------------------------------------------------------------------------------------
-  void buildInstanceCacheVAO(std::unique_ptr<ngl::AbstractVAO> &_vao, std::vector<ngl::Vec3> &_vertices,
-                             std::vector<GLshort> &_indices, std::vector<ngl::Mat4> &_transforms,
-                             size_t _instanceStart, size_t _instanceEnd, GLenum _mode);
+  /// @brief returns the combined buffers of a list of tree types, uploading them if no forest batch is using them yet
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<BatchBuffers> getBatchBuffers(const std::vector<std::shared_ptr<const LSystem>> &_treeTypes);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief upload data to a new buffer, without binding it to a VAO
+  /// @param [in] target, the buffer target (GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER)
+  /// @param [in] bufferSize, the size of the buffer to be used
+  /// @param [in] bufferData, a pointer the data for the buffer
+  //----------------------------------------------------------------------------------------------------------------------
+  GLuint createBuffer(GLenum _target, size_t _bufferSize, const GLvoid *_bufferData);
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief method used to bind more data to supplement the data sent to a VAO by the above two methods
   /// (note this method requires the vao to be bound before calling)
@@ -592,10 +902,23 @@ protected:
   //----------------------------------------------------------------------------------------------------------------------
   void buildGridVAO();
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief build m_terrainVAO to store data for rendering the terrain
+  /// @brief build m_terrainVAO to store data for rendering the terrain, uploading the vertex attributes of m_terrain
   //----------------------------------------------------------------------------------------------------------------------
   void buildTerrainVAO();
   //----------------------------------------------------------------------------------------------------------------------
+  /// @brief copy the current indices of m_terrain into m_terrainIndexBuffer through a mapped pointer, orphaning the
+  /// old contents so that the copy doesn't wait for the last frame's draw to finish
+  //----------------------------------------------------------------------------------------------------------------------
+  void updateTerrainIndices();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief copy the current UVs of m_terrain into m_terrainUVBuffer, leaving the rest of m_terrainVAO as it is
+  //----------------------------------------------------------------------------------------------------------------------
+  void updateTerrainUVs();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief delete m_terrainVAO and its buffers
+  //----------------------------------------------------------------------------------------------------------------------
+  void removeTerrainVAO();
+  //----------------------------------------------------------------------------------------------------------------------
   /// @brief build tree, leaf or polygon VAO to store data for rendering an LSystem
   /// @param [in] _treeNum, the index of the LSystem VAO to build
   //----------------------------------------------------------------------------------------------------------------------
@@ -604,13 +927,83 @@ protected:
   void buildPolygonVAO(size_t _treeNum);
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief build tree, leaf or polygon forest VAO to store data for rendering LSystem instances in forests
+  /// @param [in] _forest, the forest whose transforms we use
+  /// @param [in] _vaos, the VAOs of that forest
+  /// @param [in] treeNum, id, age, index: the identifiers for the position of the VAO in the VAO cache structure
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildForestVAO(const Forest &_forest, ForestVAOs &_vaos,
+                      size_t _treeNum, size_t _id, size_t _age, size_t _index);
+  void buildForestLeafVAO(const Forest &_forest, ForestVAOs &_vaos,
+                          size_t _treeNum, size_t _id, size_t _age, size_t _index);
+  void buildForestPolygonVAO(const Forest &_forest, ForestVAOs &_vaos,
+                             size_t _treeNum, size_t _id, size_t _age, size_t _index);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief update the transform buffers of the tree, leaf and polygon VAOs for one slot of m_paintedForest after
+  /// trees have been painted or erased, uploading only the changed transforms rather than rebuilding the VAOs
+  /// @param [in] treeNum, id, age, index: the identifiers for the position of the VAO in the VAO cache structure
+  //----------------------------------------------------------------------------------------------------------------------
+  void updatePaintedForestVAOs(size_t _treeNum, size_t _id, size_t _age, size_t _index);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief upload a list of transforms to the tree, leaf and polygon VAOs of one slot of a forest
+  /// @param [in] _vaos, the VAOs of the forest
   /// @param [in] treeNum, id, age, index: the identifiers for the position of the VAO in the VAO cache structure
-  /// @param [in] _usePaintedForest, a bool to determine whether we use VAOs corresponding to m_paintedForest
-  /// or corresponding to m_scatteredForest
+  /// @param [in] _transforms, the transforms to draw
+  /// @param [in] _firstChanged, the first transform that differs from those already uploaded
+  //----------------------------------------------------------------------------------------------------------------------
+  void setForestVAOTransforms(ForestVAOs &_vaos, size_t _treeNum, size_t _id, size_t _age, size_t _index,
+                              const std::vector<ngl::Mat4> &_transforms, size_t _firstChanged);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief replace the transform buffers of a forest with only the transforms of the instances in view, so that
+  /// instances out of view cost neither vertex nor geometry shader work, bucketed by level of detail if
+  /// m_useForestLOD is set - nothing is uploaded if the transforms in view haven't changed since the last call
+  //----------------------------------------------------------------------------------------------------------------------
+  void cullForestVAOs(const Forest &_forest, ForestVAOs &_vaos, const Frustum &_frustum);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief fill the visible transform lists of a forest's VAOs with the instances in view, bucketed by level of
+  /// detail if m_useForestLOD is set, without uploading them anywhere - they are only found again if the frustum,
+  /// the level of detail settings or the forest have changed since they were last found
+  //----------------------------------------------------------------------------------------------------------------------
+  void findVisibleForestTransforms(const Forest &_forest, ForestVAOs &_vaos, const Frustum &_frustum);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief upload every transform of a forest again if its transform buffers were last filled by cullForestVAOs()
+  //----------------------------------------------------------------------------------------------------------------------
+  void uncullForestVAOs(const Forest &_forest, ForestVAOs &_vaos);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build all VAOs used for rendering a forest, replacing any VAOs already in _vaos - the slot VAOs are left
+  /// until they are needed if the forest will be drawn with multi-draw calls
   //----------------------------------------------------------------------------------------------------------------------
-  void buildForestVAO(size_t _treeNum, size_t _id, size_t _age, size_t _index, bool _usePaintedForest);
-  void buildForestLeafVAO(size_t _treeNum, size_t _id, size_t _age, size_t _index, bool _usePaintedForest);
-  void buildForestPolygonVAO(size_t _treeNum, size_t _id, size_t _age, size_t _index, bool _usePaintedForest);
+  void buildForestVAOs(const Forest &_forest, ForestVAOs &_vaos);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the VAOs of every slot of a forest, for drawing it without multi-draw calls
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildForestSlotVAOs(const Forest &_forest, ForestVAOs &_vaos);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief remove all VAOs and buffers used for rendering a forest
+  //----------------------------------------------------------------------------------------------------------------------
+  void removeForestVAOs(ForestVAOs &_vaos);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the VAOs for drawing a forest with multi-draw calls, reading the combined hero buffers of its tree
+  /// types
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildForestBatch(const Forest &_forest, ForestVAOs &_vaos);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief set up one VAO of a forest batch: the vertices and indices, the batch transforms as per-instance
+  /// attributes 1-4 and up to two extra per-vertex attributes 5 and 6 (a buffer of 0 skips the attribute)
+  /// @param [in] _attributeSize5, _attributeSize6, the number of floats per vertex in each extra attribute
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildForestBatchVAO(GLuint _vao, GLuint _vertexBuffer, GLuint _indexBuffer, GLuint _transformBuffer,
+                           GLuint _attributeBuffer5, GLint _attributeSize5,
+                           GLuint _attributeBuffer6, GLint _attributeSize6);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief upload the transforms and draw commands of a forest batch, orphaning the old buffer storage
+  //----------------------------------------------------------------------------------------------------------------------
+  void uploadForestBatch(ForestBatch &_batch);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief upload one kind of hero data from every tree type to a single buffer, one tree type after another
+  //----------------------------------------------------------------------------------------------------------------------
+  template<class dataType>
+  GLuint createCombinedBuffer(GLenum _target, const std::vector<std::shared_ptr<const LSystem>> &_treeTypes,
+                              std::vector<dataType> LSystem::*_data);
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief build all VAOs used for rendering m_scatteredForest
   //----------------------------------------------------------------------------------------------------------------------
@@ -619,6 +1012,14 @@ protected:
   /// @brief build all VAOs used for rendering m_paintedForest
   //----------------------------------------------------------------------------------------------------------------------
   void buildPaintedForestVAOs();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the VAOs of tiles that m_forestTiles has built, and remove those of tiles it has evicted
+  //----------------------------------------------------------------------------------------------------------------------
+  void updateForestTileVAOs();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief remove the VAOs of every forest tile
+  //----------------------------------------------------------------------------------------------------------------------
+  void removeForestTileVAOs();
 
 
   //SHADER METHODS
@@ -684,13 +1085,13 @@ protected:
 
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief create a projected ray from the mouse cursor to determine where the point on the terrain that the mouse
-  /// is pointing to (if such a point exists)
+  /// is pointing to (if such a point exists), by intersecting it with the terrain in m_terrainHeights
   /// @param [in] screenX, screenY, the screen x and y coordinates of the mouse cursor
   //----------------------------------------------------------------------------------------------------------------------
   ngl::Vec3 getProjectedPointOnTerrain(float _screenX, float _screenY);
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief add a given point to m_paintedPoints and use to create a new tree in m_paintedForest if the point lies
-  /// on the terrain
+  /// @brief use a given point to create a new tree in m_paintedForest if the point lies on the terrain and isn't too
+  /// close to another tree, or to erase the trees around it if the eraser brush is selected
   /// @param [in] point, the world space coordinates of the point to be added
   //----------------------------------------------------------------------------------------------------------------------
   void addPointToPaintedForest(ngl::Vec3 &_point);
@@ -0,0 +1,224 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file PagedHeightMap.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 11/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef PAGEDHEIGHTMAP_H_
+#define PAGEDHEIGHTMAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class PagedHeightMap
+/// @brief this class keeps a heightmap too large to hold in memory in a file, split into square tiles which are
+/// memory mapped as they are needed. At most m_maxCachedTiles tiles are mapped at once, the least recently used one
+/// being unmapped to make room for the next. Each tile is stamped with the settings it was generated with, and a tile
+/// whose stamp doesn't match m_stamp is stale - stale tiles are only generated again, with m_generateTile, by
+/// generateStaleTiles(), and reading one in the meantime gives the values it was last generated with. The values are
+/// arranged as in TerrainGenerator, with x along the rows and z down the columns. The file is mapped with POSIX mmap,
+/// so it can't be opened on other platforms
+//----------------------------------------------------------------------------------------------------------------------
+
+class PagedHeightMap
+{
+public:
+
+  //CONSTRUCTORS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for PagedHeightMap class, with no file open
+  //--------------------------------------------------------------------------------------------------------------------
+  PagedHeightMap() = default;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief dtor for PagedHeightMap class, unmapping the tiles and closing the file
+  //--------------------------------------------------------------------------------------------------------------------
+  ~PagedHeightMap();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the class owns its file and mappings, so it can't be copied
+  //--------------------------------------------------------------------------------------------------------------------
+  PagedHeightMap(const PagedHeightMap &_pages) = delete;
+  PagedHeightMap &operator=(const PagedHeightMap &_pages) = delete;
+
+  //TILE INFO STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct TileInfo
+  /// @brief what the file stores about each tile besides its values, in a table after the header
+  //--------------------------------------------------------------------------------------------------------------------
+  struct TileInfo
+  {
+    /// @brief the stamp of the settings the tile was generated with, or 0 if it has never been generated
+    uint64_t m_stamp;
+    /// @brief the lowest and highest values in the tile
+    float m_minHeight;
+    float m_maxHeight;
+  };
+
+  //PUBLIC MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the width of the heightmap grid, the worldspace distance between neighbouring values and the width of
+  /// the tiles in values - these are set by create() and open()
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_dimension = 0;
+  float m_scale = 1;
+  size_t m_tileSize = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the most tiles that are mapped at once
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_maxCachedTiles = 64;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the stamp of the current generation settings, which mustn't be 0 since that marks tiles that have never
+  /// been generated
+  //--------------------------------------------------------------------------------------------------------------------
+  uint64_t m_stamp = 1;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief generates the _width by _depth values from grid position (_firstX,_firstZ) into _heights, whose rows are
+  /// _rowLength values apart - it is called for several tiles at once by generateStaleTiles()
+  //--------------------------------------------------------------------------------------------------------------------
+  std::function<void(size_t _firstX, size_t _firstZ, size_t _width, size_t _depth, size_t _rowLength,
+                     float *_heights)> m_generateTile;
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief creates a file for a heightmap, replacing any file of the same name - every tile starts out stale
+  /// @param [in] _fileName, the file to create
+  /// @param [in] _dimension, the width of the heightmap grid
+  /// @param [in] _scale, the worldspace distance between neighbouring values
+  /// @param [in] _tileSize, the width of the tiles in values
+  /// @returns false if the file couldn't be created
+  //--------------------------------------------------------------------------------------------------------------------
+  bool create(const std::string &_fileName, size_t _dimension, float _scale, size_t _tileSize=256);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief opens a file made by create(), keeping its tiles and their stamps
+  /// @returns false if the file doesn't exist or isn't a heightmap file
+  //--------------------------------------------------------------------------------------------------------------------
+  bool open(const std::string &_fileName);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief unmaps all of the tiles and closes the file
+  //--------------------------------------------------------------------------------------------------------------------
+  void close();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns true if a file is open
+  //--------------------------------------------------------------------------------------------------------------------
+  bool isOpen() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the number of tiles along each side of the grid
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t getNumTilesPerSide() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the value at grid position (_x,_z), mapping its tile if it isn't already
+  //--------------------------------------------------------------------------------------------------------------------
+  float getValue(size_t _x, size_t _z);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief reads the values at _count grid positions (_x[i],_z[i]) into _values, locking the cache once for all of
+  /// them and only looking a tile up again when the next position is in a different tile - positions outside the
+  /// grid read as 0, as in getValue()
+  //--------------------------------------------------------------------------------------------------------------------
+  void getValues(const size_t *_x, const size_t *_z, float *_values, size_t _count);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief reads every _stride'th value of the _width by _depth block of samples from grid position
+  /// (_firstX,_firstZ) into _values, a tile at a time so that each tile is only mapped once
+  //--------------------------------------------------------------------------------------------------------------------
+  void readRegion(size_t _firstX, size_t _firstZ, size_t _width, size_t _depth, size_t _stride, float *_values);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief generates every stale tile, sharing them between all of the available cores
+  /// @returns the number of tiles generated
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t generateStaleTiles();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns what the file stores about a tile
+  //--------------------------------------------------------------------------------------------------------------------
+  TileInfo getTileInfo(size_t _tileX, size_t _tileZ);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the number of tiles currently mapped
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t getNumCachedTiles();
+
+private:
+
+  //PRIVATE STRUCTS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct FileHeader
+  /// @brief the start of the file, followed by the TileInfo table and then the tiles, each of m_tileSize rows of
+  /// m_tileSize values - values beyond the edge of the grid are left as padding. The data is in the byte order of the
+  /// machine that wrote it
+  //--------------------------------------------------------------------------------------------------------------------
+  struct FileHeader
+  {
+    char m_magic[8];
+    uint32_t m_version;
+    uint32_t m_tileSize;
+    uint64_t m_dimension;
+    float m_scale;
+    uint32_t m_padding;
+  };
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct CachedTile
+  /// @brief a mapped tile, with the use count of the last time it was read
+  //--------------------------------------------------------------------------------------------------------------------
+  struct CachedTile
+  {
+    size_t m_tile;
+    void *m_mapping;
+    size_t m_mappingLength;
+    float *m_heights;
+    size_t m_lastUse;
+  };
+
+  //PRIVATE MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the file descriptor of the open file, or -1
+  //--------------------------------------------------------------------------------------------------------------------
+  int m_file = -1;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the mapping of the header and TileInfo table, which stays mapped while the file is open
+  //--------------------------------------------------------------------------------------------------------------------
+  void *m_infoMapping = nullptr;
+  size_t m_infoMappingLength = 0;
+  TileInfo *m_tileInfo = nullptr;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief where the first tile starts in the file
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_dataOffset = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the mapped tiles, and for each tile its position in m_cachedTiles or m_notCached
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<CachedTile> m_cachedTiles = {};
+  std::vector<size_t> m_cacheSlots = {};
+  static constexpr size_t m_notCached = size_t(-1);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief counts tile reads, to find the least recently used tile
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_useCount = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief guards the cache and the TileInfo table, so that the heights can be read from several threads
+  //--------------------------------------------------------------------------------------------------------------------
+  std::mutex m_mutex;
+
+  //PRIVATE METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief maps the header and TileInfo table of the newly opened file and sets up an empty cache
+  //--------------------------------------------------------------------------------------------------------------------
+  bool mapInfo(const std::string &_fileName);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the values of a tile, mapping it if it isn't already, or nullptr if it can't be mapped - m_mutex
+  /// must be locked, and the pointer is only valid while it is
+  //--------------------------------------------------------------------------------------------------------------------
+  const float *getTile(size_t _tile);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief maps one tile of the file on its own
+  //--------------------------------------------------------------------------------------------------------------------
+  bool mapTile(size_t _tile, CachedTile &_mappedTile) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief generates a tile into its mapped values with m_generateTile and updates its TileInfo
+  //--------------------------------------------------------------------------------------------------------------------
+  void generateTile(size_t _tile, float *_heights);
+
+};
+
+#endif //PAGEDHEIGHTMAP_H_
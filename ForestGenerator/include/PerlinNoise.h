@@ -0,0 +1,86 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file PerlinNoise.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 11/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef PERLINNOISE_H_
+#define PERLINNOISE_H_
+
+#include <cstddef>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class PerlinNoise
+/// @brief this class evaluates the same gradient noise as the libnoise Perlin module (with its standard quality), but
+/// a whole row of samples at a time, so that the samples can be computed 4 at once with SSE2 where it is available.
+/// It doesn't depend on libnoise itself: the gradient vectors are given to it in m_gradients, and TerrainGenerator
+/// reads them from libnoise so that the heightmaps match the ones the Perlin module gives. The vectorised samples are
+/// computed in single precision, and are within m_tolerance of the double precision values from getValue()
+//----------------------------------------------------------------------------------------------------------------------
+
+class PerlinNoise
+{
+public:
+
+  //CONSTRUCTORS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for PerlinNoise class
+  //--------------------------------------------------------------------------------------------------------------------
+  PerlinNoise() = default;
+
+  //PUBLIC MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief noise settings, with the same meaning and defaults as the libnoise Perlin module
+  //--------------------------------------------------------------------------------------------------------------------
+  int m_octaves = 6;
+  double m_frequency = 1;
+  double m_persistence = 0.5;
+  double m_lacunarity = 2;
+  int m_seed = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the 256 gradient vectors the lattice points hash to, as x, y and z one after another - each is stored
+  /// already multiplied by the 2.12 that libnoise scales its gradient noise by
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_gradients = std::vector<float>(768, 0.0f);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the largest difference between getRow() and getValue(), per unit of noise
+  //--------------------------------------------------------------------------------------------------------------------
+  static constexpr float m_tolerance = 1e-5f;
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the noise value at (_x,_y,_z), computed in double precision in the same way as
+  /// noise::module::Perlin::GetValue() - the only difference is that the gradients are stored in single precision
+  //--------------------------------------------------------------------------------------------------------------------
+  double getValue(double _x, double _y, double _z) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief fills _values with the noise at (_x+i*_dx,_y,_z) for i=0 to _count-1
+  //--------------------------------------------------------------------------------------------------------------------
+  void getRow(double _x, double _dx, double _y, double _z, size_t _count, float *_values) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the index of the gradient vector that a lattice point hashes to, as libnoise does
+  //--------------------------------------------------------------------------------------------------------------------
+  static int getGradientIndex(int _ix, int _iy, int _iz, int _seed);
+
+private:
+
+  //PRIVATE METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the libnoise gradient noise at one lattice point, with the gradient's 2.12 scale already applied
+  //--------------------------------------------------------------------------------------------------------------------
+  double getGradientNoise(double _x, double _y, double _z, int _ix, int _iy, int _iz, int _seed) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief interpolates the gradient noise of the lattice cell around (_x,_y,_z) with the libnoise cubic s-curve
+  //--------------------------------------------------------------------------------------------------------------------
+  double getCoherentNoise(double _x, double _y, double _z, int _seed) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds one octave of noise, scaled by _persistence, to each of the _count values of a row
+  //--------------------------------------------------------------------------------------------------------------------
+  void addOctaveToRow(double _x, double _dx, double _y, double _z, int _seed, float _persistence,
+                      size_t _count, float *_values) const;
+
+};
+
+#endif //PERLINNOISE_H_
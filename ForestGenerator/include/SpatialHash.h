@@ -0,0 +1,110 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file SpatialHash.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 05/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef SPATIALHASH_H_
+#define SPATIALHASH_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class SpatialHash
+/// @brief this class indexes points on the XZ plane by the grid cell they lie in, so that finding the points near a
+/// given position only needs to look at a few cells rather than every point - used by Forest to store its trees
+//----------------------------------------------------------------------------------------------------------------------
+
+class SpatialHash
+{
+public:
+
+  //CONSTRUCTORS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for SpatialHash class
+  //--------------------------------------------------------------------------------------------------------------------
+  SpatialHash() = default;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief user ctor for SpatialHash class
+  /// @param [in] _cellSize, the width of the grid cells - queries are fastest when their radius is close to this
+  //--------------------------------------------------------------------------------------------------------------------
+  SpatialHash(float _cellSize);
+
+  //ENTRY STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct Entry
+  /// @brief a point stored in the hash, along with the id it was inserted with
+  //--------------------------------------------------------------------------------------------------------------------
+  struct Entry
+  {
+    size_t m_id;
+    float m_x;
+    float m_z;
+  };
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief add a point to the hash
+  /// @param [in] _id, the id used to refer to the point, eg. the index of a tree in Forest::m_treeData
+  /// @param [in] _x, _z, the position of the point
+  //--------------------------------------------------------------------------------------------------------------------
+  void insert(size_t _id, float _x, float _z);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief remove a point from the hash, returns false if there was no point with the given id at that position
+  //--------------------------------------------------------------------------------------------------------------------
+  bool remove(size_t _id, float _x, float _z);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns true if any point lies strictly within the given distance of (x,z)
+  //--------------------------------------------------------------------------------------------------------------------
+  bool hasPointWithin(float _x, float _z, float _radius) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief appends the ids of all points lying strictly within the given distance of (x,z) to _ids
+  //--------------------------------------------------------------------------------------------------------------------
+  void findPointsWithin(float _x, float _z, float _radius, std::vector<size_t> &_ids) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of points stored
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t size() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief remove all points, keeping the cell size
+  //--------------------------------------------------------------------------------------------------------------------
+  void clear();
+
+private:
+
+  //PRIVATE MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief width of the grid cells
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_cellSize = 20;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the occupied cells, keyed by getKey() - empty cells are removed so the map only grows with the points
+  //--------------------------------------------------------------------------------------------------------------------
+  std::unordered_map<uint64_t, std::vector<Entry>> m_cells;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of points stored
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_size = 0;
+
+  //PRIVATE METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the cell coordinate containing the given position along one axis
+  //--------------------------------------------------------------------------------------------------------------------
+  int getCell(float _pos) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief packs a pair of cell coordinates into a single key
+  //--------------------------------------------------------------------------------------------------------------------
+  static uint64_t getKey(int _cellX, int _cellZ);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief calls _func(entry) for every point within the given distance of (x,z), stopping early if it returns false
+  //--------------------------------------------------------------------------------------------------------------------
+  template<typename F>
+  void forEachPointWithin(float _x, float _z, float _radius, F _func) const;
+
+};
+
+#endif //SPATIALHASH_H_
@@ -0,0 +1,96 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file SpeciesCache.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 01/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef SPECIESCACHE_H_
+#define SPECIESCACHE_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include "LSystem.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class SpeciesCache
+/// @brief this class stores the immutable tree types (or species) used by forests, keyed by every LSystem parameter
+/// that affects hero generation, so that rebuilding a forest with unchanged species doesn't need to refill the
+/// instance caches
+//----------------------------------------------------------------------------------------------------------------------
+
+
+class SpeciesCache
+{
+public:
+
+  //CONSTRUCTOR
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for SpeciesCache class
+  //--------------------------------------------------------------------------------------------------------------------
+  SpeciesCache() = default;
+
+  //PUBLIC MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the maximum number of species kept in the cache that are no longer used by any forest
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_maxUnusedSpecies = 6;
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the tree type for the given LSystem and hero count, only creating it (and running hero
+  /// generation) if there is no cached species with identical parameters
+  /// @param [in] _LSystem, the LSystem describing the species
+  /// @param [in] _numHeroTrees, the number of hero trees used to fill the instance cache
+  //--------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<const LSystem> getTreeType(const LSystem &_LSystem, int _numHeroTrees);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief creates a new immutable tree type by copying the LSystem and filling the instance cache of the copy
+  //--------------------------------------------------------------------------------------------------------------------
+  static std::shared_ptr<const LSystem> createTreeType(const LSystem &_LSystem, int _numHeroTrees);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief builds the key used to look up a species, from all parameters that affect fillInstanceCache()
+  //--------------------------------------------------------------------------------------------------------------------
+  static std::string getKey(const LSystem &_LSystem, int _numHeroTrees);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief number of species currently stored
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t size() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief remove all species from the cache (forests still using them keep them alive)
+  //--------------------------------------------------------------------------------------------------------------------
+  void clear();
+
+private:
+
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct Entry
+  /// @brief a cached species along with the time it was last requested
+  //--------------------------------------------------------------------------------------------------------------------
+  struct Entry
+  {
+    std::shared_ptr<const LSystem> m_treeType;
+    size_t m_lastUsed;
+  };
+
+  //PRIVATE MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the cached species
+  //--------------------------------------------------------------------------------------------------------------------
+  std::map<std::string, Entry> m_species;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief counter incremented on every request, used to find the least recently used species
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_requestCount = 0;
+
+  //PRIVATE METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief removes the least recently used species that are only referenced by the cache itself, until there are
+  /// at most m_maxUnusedSpecies of them left
+  //--------------------------------------------------------------------------------------------------------------------
+  void pruneUnusedSpecies();
+
+};
+
+#endif //SPECIESCACHE_H_
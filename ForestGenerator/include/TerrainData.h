@@ -14,7 +14,9 @@
 #include <cmath>
 #include <iostream>
 #include <vector>
+#include <functional>
 #include <ngl/Vec3.h>
+#include "Frustum.h"
 #include "TerrainGenerator.h"
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -50,73 +52,52 @@ public:
   //PUBLIC STRUCT
   //--------------------------------------------------------------------------------------------------------------------
   /// @struct Vertex
-  /// @brief this structure stores (x,y,z) coordinates of the vertices in the terrain, as well as attributes required
-  /// for the LOD algorithm. The x and y coordinates are passed in as equally spaced positive integers, which are easier
-  /// to use for some aspects of the algorithm, but the coordinates will be transformed for their final positions in the
-  /// NGLscene scene; consequently this struct stores two values for each coordinate, its original value and its final
-  /// scene value
+  /// @brief this structure stores only what the LOD algorithm needs to decide whether a vertex is active: its position
+  /// in the NGLScene scene, its bounding sphere radius and its augmented delta, packed together so that refinement
+  /// reads one small block of memory per vertex. The x and y coordinates are passed in as equally spaced positive
+  /// integers, which are easier to use for some aspects of the algorithm, but are stored transformed to their final
+  /// scene positions; the original coordinates and the normals, tangents and bitangents can be found from the vertex's
+  /// entry in m_heightMapIndices, and its children in the DAG are computed with getChild1() and getChild2()
   //--------------------------------------------------------------------------------------------------------------------
   struct Vertex
   {
+    //------------------------------------------------------------------------------------------------------------------
+    /// @brief default ctor for Vertex Structure
+    //------------------------------------------------------------------------------------------------------------------
+    Vertex()=default;
     //------------------------------------------------------------------------------------------------------------------
     /// @brief ctor for Vertex Structure
     /// @param [in] x, the x coordinate (before transformation)
     /// @param [in] y, the y coordinate (before transformation)
     /// @param [in] z, the z (height) coordinate taken from m_heightmap (before transformation)
     //------------------------------------------------------------------------------------------------------------------
-    Vertex(int _x, int _y, float _z, int _dimension, float _scale,
-           ngl::Vec3 _normal, ngl::Vec3 _tangent, ngl::Vec3 _bitangent);
+    Vertex(int _x, int _y, float _z, int _dimension, float _scale);
     //------------------------------------------------------------------------------------------------------------------
     /// @brief the x coordinate of the vertex as it apears in NGL scene
     //------------------------------------------------------------------------------------------------------------------
-    float sceneX;
+    float sceneX = 0;
     //------------------------------------------------------------------------------------------------------------------
     /// @brief the y coordinate of the vertex as it apears in NGL scene
     //------------------------------------------------------------------------------------------------------------------
-    float sceneY;
+    float sceneY = 0;
     //------------------------------------------------------------------------------------------------------------------
     /// @brief the z (height) coordinate of the vertex as it apears in NGL scene
     //------------------------------------------------------------------------------------------------------------------
-    float sceneZ;
-    //------------------------------------------------------------------------------------------------------------------
-    /// @brief the x coordinate before transformation
-    //------------------------------------------------------------------------------------------------------------------
-    int originalX;
-    //------------------------------------------------------------------------------------------------------------------
-    /// @brief the y coordinate before transformation
-    //------------------------------------------------------------------------------------------------------------------
-    int originalY;
-    //------------------------------------------------------------------------------------------------------------------
-    /// @brief the z coordinate before transformation
-    //------------------------------------------------------------------------------------------------------------------
-    float originalZ;
-    //------------------------------------------------------------------------------------------------------------------
-    /// @brief list of indices of the current vertex's children in the DAG
-    //------------------------------------------------------------------------------------------------------------------
-    std::vector<size_t> childList = {};
+    float sceneZ = 0;
     //------------------------------------------------------------------------------------------------------------------
     /// @brief the radius of the bounding sphere assigned to the vertex for the LOD algorithm
     //------------------------------------------------------------------------------------------------------------------
     float radius = 0;
     //------------------------------------------------------------------------------------------------------------------
-    /// @brief the delta value assigned to the vertex for the LOD algorithm, representing the world space error
-    /// introduced to the scene by removing this vertex
-    //------------------------------------------------------------------------------------------------------------------
-    float delta = 0;
-    //------------------------------------------------------------------------------------------------------------------
-    /// @brief the augmented delta value assigned to the vertex for the LOD algorithm
+    /// @brief the augmented delta value assigned to the vertex for the LOD algorithm - this starts as the delta value,
+    /// the world space error introduced to the scene by removing this vertex, and assignAugmentedDelta() then raises
+    /// it to the largest delta of the vertex's descendants
     //------------------------------------------------------------------------------------------------------------------
     float augmentedDelta = 0;
     //------------------------------------------------------------------------------------------------------------------
-    /// @brief the normal, tangent and bitangent of the vertex, as calculated by m_terrainGen
-    //------------------------------------------------------------------------------------------------------------------
-    ngl::Vec3 normal;
-    ngl::Vec3 tangent;
-    ngl::Vec3 bitangent;
-    //------------------------------------------------------------------------------------------------------------------
     /// @brief method returning the distance between this vertex and another one
     //------------------------------------------------------------------------------------------------------------------
-    float distanceTo(Vertex v) const;
+    float distanceTo(const Vertex &_v) const;
   };
 
   //PUBLIC MEMBER VARIABLES
@@ -133,15 +114,28 @@ public:
   //--------------------------------------------------------------------------------------------------------------------
   std::vector<Vertex> m_vertices = {};
   //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the m_heightMap index of each vertex in m_vertices, for looking up the rest of its attributes
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<GLuint> m_heightMapIndices = {};
+  //--------------------------------------------------------------------------------------------------------------------
   /// @brief list of indices of m_vertices to be sent to NGLScene to allow it to draw the terrain with reduced LOD
-  /// using GL_TRIANGLE_STRIP
+  /// using GL_TRIANGLE_STRIP - stored as GLuints so that they can be copied straight into the index buffer
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<GLuint> m_indices = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the DAG parents of each vertex, two slots per vertex with 0 for an empty slot (vertex 0 is never a parent)
+  /// - a vertex's parents lie on opposite sides of the line from its grandparent through it, which decides which slot
+  /// each one goes in, so the parents of a whole level can be filled in parallel. The children of a vertex are then
+  /// found from its parents with getChild1() and getChild2(). This is only needed while the terrain is being
+  /// constructed or its heights updated, so it is emptied at the end of the constructor and of updateHeights()
   //--------------------------------------------------------------------------------------------------------------------
-  std::vector<size_t> m_indices = {};
+  std::vector<GLuint> m_DAGParents = {};
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief list of list of indices of m_vertices arranged by their level in DAG, to make it easier to assign radius
-  /// and delta values to the vertices
+  /// @brief the vertices at each depth of the DAG are a contiguous range of m_vertices: depth d runs from
+  /// m_graphLevelStarts[d] to m_graphLevelStarts[d+1]-1, with depth 0 being the centre vertex 4 and the last entry
+  /// being the size of m_vertices
   //--------------------------------------------------------------------------------------------------------------------
-  std::vector<std::vector<size_t>> m_verticesArrangedByGraphLevel;
+  std::vector<size_t> m_graphLevelStarts = {};
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief scale used to transform vertices to scene position
   //--------------------------------------------------------------------------------------------------------------------
@@ -159,19 +153,36 @@ public:
   std::vector<ngl::Vec3> m_tangents = {};
   std::vector<ngl::Vec3> m_bitangents = {};
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief buffers to be sent to the terrain shader for rendering
+  /// @brief buffers to be sent to the terrain shader for rendering - these don't depend on the camera, so they are
+  /// filled once on construction and only m_indices changes when the mesh is refined
   //--------------------------------------------------------------------------------------------------------------------
   std::vector<ngl::Vec3> m_vertsToBeRendered = {};
   std::vector<ngl::Vec3> m_normalsToBeRendered = {};
   std::vector<ngl::Vec3> m_tangentsToBeRendered = {};
   std::vector<ngl::Vec3> m_bitangentsToBeRendered = {};
-  std::vector<GLuint> m_indicesToBeRendered = {};
   std::vector<ngl::Vec2> m_UVsToBeRendered = {};
 
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief the number of times along the width of the terrain that the UV coordinates will repeat
   //--------------------------------------------------------------------------------------------------------------------
   int m_UVRepeat = 4;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief how far the camera has to move, in grid cells, before updateRefinement() refines the mesh again
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_refinementThreshold = 0.5f;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief whether refinements refine the four quadrants of the terrain on their own threads - the strip is exactly
+  /// the same either way. A parallel refinement is always finished in one call, so updateRefinement() ignores its
+  /// time budget while this is set
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_parallelRefinement = true;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief whether each refinement first finds which vertices are active a level at a time, testing four vertices
+  /// at once with SSE2 where it is available, so that building the strip only has to look their activity up - the
+  /// strip is exactly the same either way. The activity tests are only part of the cost of a refinement, and on
+  /// a single core the separate pass costs about what it saves, so it is off by default
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_breadthFirstActivity = false;
 
 
   //PUBLIC MEMBER FUNCTION: MESHREFINE
@@ -183,12 +194,48 @@ public:
   /// @param [in] tolerance, the user-specified error tolerance
   /// @param [in] lambda, this should be set equal to the field of view divided by the number of pixels along the
   /// field of view - or can be changed to increase or decrease effect of the tolerance
+  /// @param [in] frustum, the view frustum in the space of m_vertsToBeRendered - vertices whose bounding spheres are
+  /// completely outside it aren't refined, so only the terrain in view is drawn in detail. The default frustum culls
+  /// nothing
+  //--------------------------------------------------------------------------------------------------------------------
+  void meshRefine(ngl::Vec3 _cameraPos, float _tolerance, float _lambda, const Frustum &_frustum=Frustum());
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief refinement cache around meshRefine: does nothing if m_indices was refined for a camera position within
+  /// m_refinementThreshold of this one and the same tolerance, lambda and frustum, otherwise refines the mesh again.
+  /// With a time budget the refinement is spread over as many calls as it needs, with m_indices keeping the last
+  /// complete strip until the new one is finished
+  /// @param [in] cameraPos, tolerance, lambda, as for meshRefine
+  /// @param [in] timeBudget, the time in milliseconds to spend refining in this call, or 0 for no limit (the first
+  /// strip is always finished in one call, so that there is something to draw, as is every strip while
+  /// m_parallelRefinement is set)
+  /// @param [in] frustum, as for meshRefine
+  /// @returns true if m_indices has changed
+  //--------------------------------------------------------------------------------------------------------------------
+  bool updateRefinement(ngl::Vec3 _cameraPos, float _tolerance, float _lambda, double _timeBudget=0,
+                        const Frustum &_frustum=Frustum());
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns true if updateRefinement() ran out of time part way through a refinement
   //--------------------------------------------------------------------------------------------------------------------
-  void meshRefine(ngl::Vec3 _cameraPos, float _tolerance, float _lambda);
+  bool isRefining() const;
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief fills render buffers from m_vertexList
+  /// @brief takes new heights, normals, tangents and bitangents for the same grid from a TerrainGenerator, keeping the
+  /// DAG, which only depends on the grid, and recomputing everything that depends on the heights - the vertex
+  /// heights, bounding sphere radii, deltas and render buffers. The next updateRefinement() refines the mesh again
+  /// @returns false, leaving the terrain unchanged, if the generator's grid differs from this terrain's
   //--------------------------------------------------------------------------------------------------------------------
-  void fillVerticesAndIndicesForRendering();
+  bool updateHeights(TerrainGenerator &_terrainGen);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief sets m_UVRepeat and refills m_UVsToBeRendered, the only thing that depends on it
+  //--------------------------------------------------------------------------------------------------------------------
+  void setUVRepeat(int _UVRepeat);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief fills the vertex render buffers from m_vertices
+  //--------------------------------------------------------------------------------------------------------------------
+  void fillVerticesForRendering();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief fills m_UVsToBeRendered, for fillVerticesForRendering() and setUVRepeat()
+  //--------------------------------------------------------------------------------------------------------------------
+  void fillUVsForRendering();
 
 
   //OTHER PUBLIC MEMBER FUNCTIONS - all these functions could be private as they do not need to be accessed outside the
@@ -214,6 +261,12 @@ public:
   /// @param [in] index, the heightmap index
   //--------------------------------------------------------------------------------------------------------------------
   Vertex getVertex(const size_t _index) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief sets the vertex at an index of m_vertices to the one at a given heightmap index
+  /// @param [in] verticesIndex, the index of m_vertices
+  /// @param [in] heightMapIndex, the heightmap index
+  //--------------------------------------------------------------------------------------------------------------------
+  void setVertex(const size_t _verticesIndex, const size_t _heightMapIndex);
 
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief recursively fills m_vertices with vertices in an order determined by their positions in the white quadtree
@@ -252,31 +305,46 @@ public:
   //--------------------------------------------------------------------------------------------------------------------
   size_t getChild2(size_t _QTParent, size_t _DAGParent) const;
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief recursively fills m_verticesArrangedByGraphLevel and the childList members of each vertex
-  /// @param [in] DAGParent, the index of the current vertex's graph parent
-  /// @param [in] currentVertex, the index of the current vertex whose childList is being filled
-  /// @param [in] refinementLevel, the refinement level (height in the DAG) of the current vertex
+  /// @brief fills m_graphLevelStarts, from which the size of m_vertices is known before it is filled
+  //--------------------------------------------------------------------------------------------------------------------
+  void assignGraphLevels();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns which of a vertex's two m_DAGParents slots the given parent goes in
+  /// @param [in] DAGParent, the index of the parent
+  /// @param [in] currentVertex, the index of the vertex
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t getParentSlot(size_t _DAGParent, size_t _currentVertex) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief writes the DAG children of a vertex other than the root vertex 4 to _children, using m_DAGParents
+  /// @returns the number of children written, up to 4
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t getChildren(size_t _currentVertex, size_t _children[4]) const;
   //--------------------------------------------------------------------------------------------------------------------
-  void assignChildren(size_t _DAGParent, size_t _currentVertex, int _refinementLevel);
+  /// @brief fills m_DAGParents from the top of the DAG down, a level at a time with the vertices of each level shared
+  /// between threads
+  //--------------------------------------------------------------------------------------------------------------------
+  void assignChildren();
 
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief assigns a bounding sphere radius to each vertex using m_verticesArrangedByGraphLevel
+  /// @brief assigns a bounding sphere radius to each vertex from the bottom of the DAG up, a level at a time in the
+  /// same way as assignChildren(), so that each child's radius is final before its parents use it
   //--------------------------------------------------------------------------------------------------------------------
   void assignRadius();
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief recursively assigns a delta value to each vertex
-  /// @param [in] DAGGrandParent, index of the current vertex's grandparent in the DAG
-  /// @param [in] DAGParent, index of the current vertex's parent in the DAG
-  /// @param [in] currentVertex, index of the current vertex being assigned
+  /// @brief assigns a delta value to each vertex in the DAG, stored in its augmentedDelta until
+  /// assignAugmentedDelta() is called - the delta only depends on the vertex's grandparent, which is its quadtree
+  /// parent, so every vertex can be done at once
   //--------------------------------------------------------------------------------------------------------------------
-  void assignDelta(size_t _DAGGrandParent, size_t _DAGParent, size_t _currentVertex, int _refinementLevel);
+  void assignDelta();
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief assigns an augmented delta value to each vertex using m_verticesArrangedByGraphLevel
+  /// @brief assigns an augmented delta value to each vertex in the same way as assignRadius()
   //--------------------------------------------------------------------------------------------------------------------
   void assignAugmentedDelta();
 
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief accessed by meshRefine method to recursively apply LOD algorithm
+  /// @brief accessed by meshRefine method to apply LOD algorithm - rather than recursing, the steps for the vertex's
+  /// children are pushed onto m_refinementStack. The current vertex has already been found to be active, so only
+  /// the child is tested here
   /// @ref based on pseudocode from Lindstrom and Pascucci (2001)
   /// @param [in] currentVertex, index of the current vertex
   /// @param [in] DAGChildVertex, index of a child of the current vertex in the graph
@@ -284,13 +352,14 @@ public:
   /// @param [in] cameraPos, camera position
   /// @param [in] tolerance, the user-specified error tolerance
   /// @param [in] lambda, equal to the field of view divided by the number of pixels along the field of view
+  /// @param [in] planeMask, the planes of m_refinementFrustum that the child still needs testing against
   //--------------------------------------------------------------------------------------------------------------------
   void submeshRefine(size_t _DAGParentVertex, size_t _currentVertex, int _refinementLevel,
-                       ngl::Vec3 _cameraPos, float _tolerance, float _lambda);
+                       ngl::Vec3 _cameraPos, float _tolerance, float _lambda, int _planeMask);
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief accessed by submeshRefine method to add active vertices to m_indices
+  /// @brief accessed by submeshRefine method to add active vertices to the strip being refined
   /// @ref based on pseudocode from Lindstrom and Pascucci (2001)
-  /// @param [in] vertex, the vertex index to be added to m_indices
+  /// @param [in] vertex, the vertex index to be added to the strip
   /// @param [in] parity, determines whether or not to add additional indices to m_indices in order to turn corners in
   /// the triangle strip
   //--------------------------------------------------------------------------------------------------------------------
@@ -303,17 +372,196 @@ public:
   /// @param [in] lambda, equal to the field of view divided by the number of pixels along the field of view
   //--------------------------------------------------------------------------------------------------------------------
   bool isActive(size_t _vertex, ngl::Vec3 _cameraPos, float _tolerance, float _lambda) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief determines whether any of the current vertex's bounding sphere is in the frustum - since the spheres of
+  /// a vertex's descendants are nested inside its own, the planes the sphere is completely inside are removed from
+  /// _planeMask and its descendants are only tested against the rest
+  /// @param [in] vertex, the index of the vertex being considered
+  /// @param [in] frustum, the view frustum
+  /// @param [in,out] planeMask, the planes still to be tested, as for Frustum::testSphere()
+  //--------------------------------------------------------------------------------------------------------------------
+  bool isVisible(size_t _vertex, const Frustum &_frustum, int &_planeMask) const;
 
 
 private:
 
 
+  //PRIVATE STRUCT
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief what findActiveVertices() found out about a vertex: INACTIVE if it isn't active, OUT_OF_VIEW if it is
+  /// active but its bounding sphere is outside the frustum, and ACTIVE if it is active and in view, in which case its
+  /// quadtree children have been tested as well
+  //--------------------------------------------------------------------------------------------------------------------
+  enum Activity {INACTIVE, OUT_OF_VIEW, ACTIVE};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct ActiveVertex
+  /// @brief a vertex found by findActiveVertices() to be active and in view, with the frustum planes that its
+  /// descendants still need testing against
+  //--------------------------------------------------------------------------------------------------------------------
+  struct ActiveVertex
+  {
+    GLuint m_vertex;
+    int m_planeMask;
+  };
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct RefinementTask
+  /// @brief one step left to do in a refinement: either a call to submeshRefine or a call to tstripAppend, kept on
+  /// m_refinementStack so that a refinement can stop part way through and carry on where it left off
+  //--------------------------------------------------------------------------------------------------------------------
+  struct RefinementTask
+  {
+    bool m_isAppend;
+    size_t m_currentVertex;
+    size_t m_DAGChildVertex;
+    int m_refinementLevel;
+    int m_planeMask;
+  };
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct StripAppend
+  /// @brief a call to tstripAppend made while refining a StripFragment, and the state of the fragment after it
+  //--------------------------------------------------------------------------------------------------------------------
+  struct StripAppend
+  {
+    GLuint m_vertex;
+    int m_parity;
+    size_t m_stripSize;
+    int m_stripParity;
+  };
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct StripFragment
+  /// @brief the part of the strip from one quadrant of the terrain, refined on its own thread. The fragment can't know
+  /// how the strip before it ends, so it starts after two placeholder indices, and its first appends are kept so that
+  /// they can be replayed on the real strip when it is joined on, until the two strips reach the same state
+  //--------------------------------------------------------------------------------------------------------------------
+  struct StripFragment
+  {
+    std::vector<GLuint> m_indices;
+    int m_parity = 0;
+    std::vector<RefinementTask> m_stack;
+    std::vector<StripAppend> m_firstAppends;
+    size_t m_numAppends = 0;
+  };
+
   //PRIVATE MEMBER VARIABLES
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief parity used for the mesh refine method, to decide when to "turn corners" in the triangle strip
   //--------------------------------------------------------------------------------------------------------------------
   int m_parity = 0;
   //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the strip being built by the current refinement, swapped into m_indices when it is finished
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<GLuint> m_refinementIndices = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the steps left in the current refinement, the next one at the back
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<RefinementTask> m_refinementStack = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the camera position, tolerance, lambda and frustum of the current refinement and of the strip in m_indices
+  //--------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_refinementCameraPos;
+  float m_refinementTolerance = 0;
+  float m_refinementLambda = 0;
+  Frustum m_refinementFrustum;
+  ngl::Vec3 m_refinedCameraPos;
+  float m_refinedTolerance = 0;
+  float m_refinedLambda = 0;
+  Frustum m_refinedFrustum;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief whether m_indices holds a finished strip yet
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_isRefined = false;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the fragments of the last parallel refinement, kept to reuse their memory
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<StripFragment> m_refinementFragments = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the Activity of each vertex tested by findActiveVertices() for the current refinement, and INACTIVE for
+  /// the rest
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<unsigned char> m_activity = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the vertices findActiveVertices() found to be ACTIVE, a level at a time from the top of the DAG - these
+  /// are also the vertices whose children need setting back to INACTIVE before the next refinement
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<ActiveVertex> m_activeVertices = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief whether m_activity was filled for the current refinement
+  //--------------------------------------------------------------------------------------------------------------------
+  bool m_hasActivity = false;
+
+  //PRIVATE METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief clears m_refinementIndices and fills m_refinementStack with the steps of meshRefine
+  //--------------------------------------------------------------------------------------------------------------------
+  void startRefinement(ngl::Vec3 _cameraPos, float _tolerance, float _lambda, const Frustum &_frustum);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief works through m_refinementStack until it is empty, swapping the finished strip into m_indices, or until
+  /// _timeBudget milliseconds have passed
+  /// @returns true if the refinement was finished
+  //--------------------------------------------------------------------------------------------------------------------
+  bool continueRefinement(double _timeBudget);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief works through m_refinementStack until it is empty or _timeBudget milliseconds have passed
+  /// @returns true if the stack was emptied
+  //--------------------------------------------------------------------------------------------------------------------
+  bool runRefinementSteps(double _timeBudget);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief ends the strip in m_refinementIndices and swaps it into m_indices
+  //--------------------------------------------------------------------------------------------------------------------
+  void finishRefinement();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief pushes the steps of one quadrant of meshRefine onto _stack, in reverse so that the first is at the back -
+  /// the quadrants are refined from the children 6, 7, 8 and 5 of the centre in turn, with corners 1, 2 and 3
+  /// appended before the last three. The centre vertex is tested here, since the steps themselves only test children
+  //--------------------------------------------------------------------------------------------------------------------
+  void pushQuadrantSteps(std::vector<RefinementTask> &_stack, size_t _quadrant) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the body of submeshRefine, pushing the steps onto _stack
+  //--------------------------------------------------------------------------------------------------------------------
+  void pushRefinementSteps(std::vector<RefinementTask> &_stack, size_t _currentVertex, size_t _DAGChildVertex,
+                           int _refinementLevel, ngl::Vec3 _cameraPos, float _tolerance, float _lambda,
+                           int _planeMask) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns whether the current vertex is both in view and active, as the refinement steps need to know -
+  /// from m_activity if findActiveVertices() tested it, or by testing it here if not
+  //--------------------------------------------------------------------------------------------------------------------
+  bool isActiveInView(size_t _vertex, ngl::Vec3 _cameraPos, float _tolerance, float _lambda, int &_planeMask) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief fills m_activity for the current refinement a level at a time: starting from the centre vertex, the four
+  /// quadtree children of each vertex found to be active and in view are tested together with findActiveBlock() -
+  /// every vertex that can be active is tested this way, since a vertex can only be active if its quadtree parent is
+  //--------------------------------------------------------------------------------------------------------------------
+  void findActiveVertices();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief tests the four vertices from _first, which share a quadtree parent and so are next to each other in
+  /// m_vertices, setting their m_activity and adding those that are ACTIVE to m_activeVertices
+  /// @param [in] first, the index of the first of the four vertices
+  /// @param [in] planeMask, the frustum planes that the vertices still need testing against
+  //--------------------------------------------------------------------------------------------------------------------
+  void findActiveBlock(size_t _first, int _planeMask);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the body of tstripAppend, appending to _indices with _stripParity as the strip's parity
+  //--------------------------------------------------------------------------------------------------------------------
+  static void appendToStrip(std::vector<GLuint> &_indices, int &_stripParity, size_t _vertex, int _parity);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief refines the four quadrants of the terrain on their own threads, then joins their fragments into
+  /// m_indices
+  //--------------------------------------------------------------------------------------------------------------------
+  void refineInParallel(ngl::Vec3 _cameraPos, float _tolerance, float _lambda, const Frustum &_frustum);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief works through the stack of a fragment until it is empty, with the settings of the current refinement
+  //--------------------------------------------------------------------------------------------------------------------
+  void refineFragment(StripFragment &_fragment) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief joins a quadrant's fragment onto m_refinementIndices, refining the quadrant again on m_refinementIndices
+  /// if the fragment never reaches the same state as the real strip within its recorded appends
+  //--------------------------------------------------------------------------------------------------------------------
+  void joinFragment(size_t _quadrant);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief splits [0,_count) into one contiguous range per thread and calls _function(start,end) on each of them,
+  /// or just calls _function(0,_count) on this thread when there are too few items for threads to be worthwhile
+  //--------------------------------------------------------------------------------------------------------------------
+  static void parallelFor(size_t _count, const std::function<void(size_t,size_t)> &_function);
 
 };
 
@@ -11,11 +11,14 @@
 #ifndef TERRAINGENERATOR_H_
 #define TERRAINGENERATOR_H_
 
+#include <cstdint>
 #include <iostream>
+#include <string>
 #include <vector>
-#include "noiseutils.h"
 #include "ngl/Vec3.h"
 #include "ngl/Vec2.h"
+#include "PagedHeightMap.h"
+#include "PerlinNoise.h"
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @class TerrainGenerator
@@ -89,15 +92,143 @@ public:
   //--------------------------------------------------------------------------------------------------------------------
   float m_amplitude = 50;
 
+  //CHANGE ENUM
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @enum Change
+  /// @brief what has changed in the settings since the heightmap was last generated, from the least work to redo to
+  /// the most: the amplitude only scales the heights, the noise settings change the heights but not the grid, and
+  /// any change to the grid, or a heightmap read from pages, changes everything
+  //--------------------------------------------------------------------------------------------------------------------
+  enum Change {NO_CHANGE, AMPLITUDE_CHANGE, NOISE_CHANGE, GRID_CHANGE};
+
 
   //PUBLIC MEMBER FUNCTION
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief assigns values to m_heightmap based on current noise attributes
+  /// @brief assigns values to m_heightmap based on current noise attributes, with the same values as the libnoise
+  /// Perlin module (to within PerlinNoise::m_tolerance of the amplitude), together with the normals, tangents and
+  /// bitangents - the rows are split into tiles that are generated on all of the available cores
   //--------------------------------------------------------------------------------------------------------------------
   void generate();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns what has changed in the settings since the heightmap was last generated
+  //--------------------------------------------------------------------------------------------------------------------
+  Change getChange() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief brings the heightmap up to date with the settings, redoing only what getChange() says is needed - an
+  /// amplitude change rescales the heights in place and recomputes the normals instead of evaluating the noise again,
+  /// which gives the same heights to within rounding
+  /// @returns what had changed, so that the caller can update what it made from the heightmap in the same way
+  //--------------------------------------------------------------------------------------------------------------------
+  Change update();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief generates the heightmap into a paged file instead of m_heightMap, for terrains too large to hold in
+  /// memory. The file is reused if it has the same grid, and only its tiles generated with different settings are
+  /// generated again, all at once across the available cores, since loadFromPages() reads from every tile anyway.
+  /// The tiles hold the noise at an amplitude of 1, so that an amplitude edit doesn't make any of them stale
+  /// @param [out] _pages, the paged heightmap, which is opened on the file
+  /// @param [in] _fileName, the file to page the heightmap to
+  /// @returns false if the file couldn't be opened or created
+  //--------------------------------------------------------------------------------------------------------------------
+  bool generatePaged(PagedHeightMap &_pages, const std::string &_fileName) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief fills m_heightMap, the normals, tangents and bitangents, m_dimension and m_scale from every _stride'th
+  /// value of a paged heightmap, scaled by m_amplitude, so that a TerrainData small enough to hold in memory can be
+  /// made from it - that TerrainData refines over these strided samples only, never over the full resolution
+  /// heightmap in the pages
+  /// @param [in] _pages, the paged heightmap
+  /// @param [in] _stride, the spacing of the values used, which should divide the width of the paged grid minus one
+  /// so that the last value is on the edge
+  //--------------------------------------------------------------------------------------------------------------------
+  void loadFromPages(PagedHeightMap &_pages, size_t _stride);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns a stamp of the current noise settings and grid, never 0, which changes whenever any of them does -
+  /// the amplitude isn't part of it, as the pages hold the noise at an amplitude of 1 and are scaled as they are read
+  //--------------------------------------------------------------------------------------------------------------------
+  uint64_t getStamp() const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief loads a heightmap of 16-bit little-endian values with no header, as exported by most terrain tools, and
+  /// computes its normals, tangents and bitangents - the grid keeps its worldspace width, and m_amplitude is set to
+  /// the larger magnitude of _minHeight and _maxHeight so that the heights lie within it as generated ones do
+  /// @param [in] _fileName, the file to load, which must be square with a width of 2^n+1 values
+  /// @param [in] _minHeight, _maxHeight, the heights that the values 0 and 65535 stand for
+  /// @returns false if the file couldn't be loaded
+  //--------------------------------------------------------------------------------------------------------------------
+  bool loadRaw(const std::string &_fileName, float _minHeight, float _maxHeight);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief loads a binary (P5) PGM heightmap of 8 or 16-bit values in the same way as loadRaw(), the largest value
+  /// being the maximum value given in the file
+  //--------------------------------------------------------------------------------------------------------------------
+  bool loadPGM(const std::string &_fileName, float _minHeight, float _maxHeight);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief saves the heightmap as 16-bit little-endian values with no header, a row at a time - heights outside
+  /// the range are clamped to it
+  /// @param [in] _fileName, the file to save to
+  /// @param [in] _minHeight, _maxHeight, the heights that the values 0 and 65535 stand for
+  /// @returns false if the file couldn't be written
+  //--------------------------------------------------------------------------------------------------------------------
+  bool saveRaw(const std::string &_fileName, float _minHeight, float _maxHeight) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief saves the heightmap as a 16-bit binary PGM in the same way as saveRaw()
+  //--------------------------------------------------------------------------------------------------------------------
+  bool savePGM(const std::string &_fileName, float _minHeight, float _maxHeight) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief saves the grid, heightmap, normals, tangents and bitangents exactly as they are, so that loadTerrain()
+  /// can restore them without generating the heightmap or computing its normals
+  /// @returns false if the file couldn't be written
+  //--------------------------------------------------------------------------------------------------------------------
+  bool saveTerrain(const std::string &_fileName) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief loads a file made by saveTerrain(), copying each array straight out of the mapped file
+  /// @returns false if the file couldn't be loaded or wasn't made by saveTerrain()
+  //--------------------------------------------------------------------------------------------------------------------
+  bool loadTerrain(const std::string &_fileName);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief reads the gradient vectors of the libnoise Perlin module back from libnoise, for PerlinNoise
+  //--------------------------------------------------------------------------------------------------------------------
+  static std::vector<float> getPerlinGradients();
 
 private:
 
+  //PRIVATE STRUCTS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct TerrainFileHeader
+  /// @brief the start of a file made by saveTerrain(), followed by the heightmap and then the normals, tangents and
+  /// bitangents as three floats each, all in the byte order of the machine that wrote it
+  //--------------------------------------------------------------------------------------------------------------------
+  struct TerrainFileHeader
+  {
+    char m_magic[8];
+    uint32_t m_version;
+    uint32_t m_dimension;
+    float m_scale;
+    float m_amplitude;
+  };
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct Settings
+  /// @brief the settings the heightmap was last generated with
+  //--------------------------------------------------------------------------------------------------------------------
+  struct Settings
+  {
+    int m_dimension;
+    float m_scale;
+    double m_seed;
+    int m_octaves;
+    double m_frequency;
+    double m_persistence;
+    double m_lacunarity;
+    float m_amplitude;
+  };
+
+  //PRIVATE MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the settings m_heightMap was generated or loaded with, and whether it has any - a heightmap loaded from a
+  /// file has the grid and amplitude it was loaded with and the noise settings of the time, so an amplitude edit
+  /// rescales it as it would a generated one. A heightmap read from pages has none, as its grid is only every n'th
+  /// value of the generator's
+  //--------------------------------------------------------------------------------------------------------------------
+  Settings m_generatedSettings = {};
+  bool m_hasSettings = false;
+
   //PRIVATE MEMBER FUNCTIONS
   //--------------------------------------------------------------------------------------------------------------------
   /// @brief returns the x coordinate in worldSpace corresponding to a particular heightmap index
@@ -125,9 +256,38 @@ private:
   size_t getIndex(const int _gridX, const int _gridZ) const;
 
   //--------------------------------------------------------------------------------------------------------------------
-  /// @brief computes normals, tangents and bitangents of each vertex in the heightmap
+  /// @brief computes normals, tangents and bitangents of the vertices in rows _firstRow to _endRow-1
+  /// @param [in] heights, heightmap values for the rows from _heightsFirstRow on, which must include the given rows
+  /// and the rows either side of them
+  //--------------------------------------------------------------------------------------------------------------------
+  void computeNormals(size_t _firstRow, size_t _endRow, const float *_heights, size_t _heightsFirstRow);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief computes the normals, tangents and bitangents of every vertex from m_heightMap, sharing the rows between
+  /// all of the available cores
+  //--------------------------------------------------------------------------------------------------------------------
+  void computeAllNormals();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief resizes the grid to _dimension, keeping its worldspace width, and sizes the heightmap and the normals,
+  /// tangents and bitangents to match, ready to be filled from a file
+  //--------------------------------------------------------------------------------------------------------------------
+  void resizeGrid(size_t _dimension);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief sets m_generatedSettings to the current settings, once m_heightMap has been generated or loaded with them
+  //--------------------------------------------------------------------------------------------------------------------
+  void recordSettings();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief writes the heightmap as 16-bit values a row at a time, for saveRaw() and savePGM()
+  /// @param [in] _bigEndian, whether the values are written most significant byte first
+  //--------------------------------------------------------------------------------------------------------------------
+  void writeValues(std::ostream &_stream, float _minHeight, float _maxHeight, bool _bigEndian) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns true if TerrainData can be made from a grid of width _dimension, which must be 2^n+1 for n>1
+  //--------------------------------------------------------------------------------------------------------------------
+  static bool isValidDimension(size_t _dimension);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns a PerlinNoise set up with the current noise settings
   //--------------------------------------------------------------------------------------------------------------------
-  void computeNormals();
+  PerlinNoise getPerlinNoise() const;
 
 };
 
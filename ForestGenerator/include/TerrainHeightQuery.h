@@ -0,0 +1,202 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file TerrainHeightQuery.h
+/// @author Ben Carey
+/// @version 1.0
+/// @date 03/10/19
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef TERRAINHEIGHTQUERY_H_
+#define TERRAINHEIGHTQUERY_H_
+
+#include <vector>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ngl/Vec3.h>
+#include "PagedHeightMap.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class TerrainHeightQuery
+/// @brief this class answers terrain height queries in world space by bilinearly sampling a heightmap generated by
+/// TerrainGenerator, so that anything placed on the terrain (painted or scattered trees, mouse picking) agrees with
+/// the rendered terrain without having to evaluate the perlin noise again
+//----------------------------------------------------------------------------------------------------------------------
+
+class TerrainHeightQuery
+{
+public:
+
+  //CONSTRUCTORS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief default ctor for TerrainHeightQuery class, gives a flat terrain of height 0
+  //--------------------------------------------------------------------------------------------------------------------
+  TerrainHeightQuery() = default;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief user ctor for TerrainHeightQuery class
+  /// @param [in] _heightMap, the heightmap values, arranged as in TerrainGenerator (index = dimension*gridZ + gridX)
+  /// @param [in] _dimension, the width of the heightmap grid
+  /// @param [in] _scale, the worldspace distance between neighbouring heightmap values
+  /// @param [in] _amplitude, the amplitude the heightmap was generated with
+  //--------------------------------------------------------------------------------------------------------------------
+  TerrainHeightQuery(const std::vector<float> &_heightMap, int _dimension, float _scale, float _amplitude);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief user ctor for TerrainHeightQuery class, sampling a paged heightmap instead of a copy of the values - the
+  /// levels of the min/max height quadtree whose cells are at least a tile wide are built from the tiles' stored
+  /// ranges, and the levels below them a block at a time as rays reach them
+  /// @param [in] _pages, the paged heightmap, which is shared rather than copied since it may not fit in memory
+  /// @param [in] _amplitude, the amplitude of the terrain - the pages hold the noise at an amplitude of 1, so their
+  /// values are scaled by this as they are read
+  //--------------------------------------------------------------------------------------------------------------------
+  TerrainHeightQuery(std::shared_ptr<PagedHeightMap> _pages, float _amplitude);
+
+  //PUBLIC MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief copy of the heightmap values
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_heightMap = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the paged heightmap, which is sampled instead of m_heightMap when it is set
+  //--------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<PagedHeightMap> m_pages = nullptr;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief dimension of the heightmap grid
+  //--------------------------------------------------------------------------------------------------------------------
+  int m_dimension = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief worldspace distance between neighbouring heightmap values
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_scale = 1;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief amplitude the heightmap was generated with
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_amplitude = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the lowest and highest values in the heightmap
+  //--------------------------------------------------------------------------------------------------------------------
+  float m_minHeight = 0;
+  float m_maxHeight = 0;
+
+  //PUBLIC METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the height of the terrain at worldspace position (x,z), found by bilinear interpolation of the
+  /// four surrounding heightmap values - positions outside the terrain are clamped to its edge
+  //--------------------------------------------------------------------------------------------------------------------
+  float getHeight(float _x, float _z) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief batched version of getHeight(), which samples four positions at a time using SSE where available - a
+  /// paged heightmap is instead read a block of positions at a time, so that its cache is locked once per block
+  /// @param [in] _x, _z, arrays of worldspace coordinates
+  /// @param [out] _heights, array the heights are written to
+  /// @param [in] _count, the length of the arrays
+  //--------------------------------------------------------------------------------------------------------------------
+  void getHeights(const float *_x, const float *_z, float *_heights, size_t _count) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief finds the first point where a ray meets the terrain surface that getHeight() describes, by descending the
+  /// min/max height quadtree front to back and then solving exactly for the ray's intersection with each bilinear
+  /// cell it reaches
+  /// @param [in] _origin, the start of the ray in worldspace
+  /// @param [in] _direction, the direction of the ray, which needn't be normalized
+  /// @param [out] _hit, the point where the ray meets the terrain, which is left unchanged if it doesn't
+  /// @returns true if the ray meets the terrain
+  //--------------------------------------------------------------------------------------------------------------------
+  bool intersectRay(const ngl::Vec3 &_origin, const ngl::Vec3 &_direction, ngl::Vec3 &_hit) const;
+
+private:
+
+  //PRIVATE STRUCTS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct Ray
+  /// @brief a ray in grid coordinates, with its worldspace height - it is traced in double precision, since far from
+  /// the origin a float grid coordinate is only good to a few thousandths of a cell
+  //--------------------------------------------------------------------------------------------------------------------
+  struct Ray
+  {
+    double m_originX, m_originY, m_originZ;
+    double m_directionX, m_directionY, m_directionZ;
+  };
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @struct RangeBlock
+  /// @brief the levels of the min/max height quadtree below m_blockLevel within one cell of m_blockLevel, stored as
+  /// in m_heightRanges but as squares of the cell's full width, with cells past the edge of the grid left empty
+  //--------------------------------------------------------------------------------------------------------------------
+  struct RangeBlock
+  {
+    std::shared_ptr<const std::vector<std::vector<float>>> m_ranges;
+    size_t m_lastUse;
+  };
+
+  //PRIVATE MEMBER VARIABLES
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the min/max height quadtree over the heightmap cells - level 0 holds the lowest and highest corner of
+  /// each cell, and each level after it the range of each 2x2 block of the level before, up to a single range over
+  /// the whole terrain. Each level stores the lowest and highest heights of each of its cells in turn. Paged
+  /// heightmaps are too large to hold all of it, so for them the levels below m_blockLevel are left empty and kept in
+  /// m_rangeBlocks instead
+  //--------------------------------------------------------------------------------------------------------------------
+  std::vector<std::vector<float>> m_heightRanges = {};
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the first quadtree level whose cells are at least a tile of a paged heightmap wide, so that their ranges
+  /// can be found from the tiles' stored ranges
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t m_blockLevel = 0;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief the blocks of the lower levels of a paged heightmap's quadtree that have been built, keyed by their cell
+  /// of m_blockLevel - like the tiles themselves, the least recently used block is dropped once there are more than
+  /// PagedHeightMap::m_maxCachedTiles of them. They are filled in by the const ray casts, so m_rangeBlockMutex guards
+  /// them and the use count
+  //--------------------------------------------------------------------------------------------------------------------
+  mutable std::map<size_t, RangeBlock> m_rangeBlocks = {};
+  mutable size_t m_rangeBlockUseCount = 0;
+  mutable std::mutex m_rangeBlockMutex;
+
+  //PRIVATE METHODS
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief builds m_heightRanges from m_heightMap
+  //--------------------------------------------------------------------------------------------------------------------
+  void buildHeightRanges();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief builds the levels of m_heightRanges from m_blockLevel up for a paged heightmap from its tiles' ranges
+  //--------------------------------------------------------------------------------------------------------------------
+  void buildPagedHeightRanges();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief adds levels to m_heightRanges, each holding the ranges of the 2x2 blocks of the last, until a level has a
+  /// single cell
+  //--------------------------------------------------------------------------------------------------------------------
+  void addParentRanges();
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the lower levels of the quadtree within a cell of m_blockLevel, building them from the paged
+  /// heightmap's values if they aren't in m_rangeBlocks
+  //--------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<const std::vector<std::vector<float>>> getRangeBlock(size_t _blockX, size_t _blockZ) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the number of cells along each side of the grid at a level of the quadtree
+  //--------------------------------------------------------------------------------------------------------------------
+  size_t getNumCells(size_t _level) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief finds the heightmap cell containing worldspace position (x,z), clamped to the edge of the grid, and the
+  /// position's interpolation factors across it
+  //--------------------------------------------------------------------------------------------------------------------
+  void findCell(float _x, float _z, size_t &_cellX, size_t &_cellZ, float &_fracX, float &_fracZ) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the bilinear interpolation of the corners of a cell, in the order given by getCorners()
+  //--------------------------------------------------------------------------------------------------------------------
+  static float interpolate(const float *_corners, float _fracX, float _fracZ);
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief returns the heights of the corners of a heightmap cell in the order (x,z), (x+1,z), (x,z+1), (x+1,z+1)
+  //--------------------------------------------------------------------------------------------------------------------
+  void getCorners(size_t _cellX, size_t _cellZ, float *_corners) const;
+  //--------------------------------------------------------------------------------------------------------------------
+  /// @brief finds the first intersection of the ray with the terrain in a cell of the quadtree and its children, in
+  /// the part of the ray from _start to _end
+  /// @param [in,out] _distance, the distance along the ray of the intersection, if there is one
+  /// @param [in] _block, the lower levels of the quadtree within the cell of m_blockLevel containing this one, for
+  /// cells of a paged heightmap below m_blockLevel
+  /// @returns true if there is an intersection
+  //--------------------------------------------------------------------------------------------------------------------
+  bool intersectCell(const Ray &_ray, size_t _level, size_t _cellX, size_t _cellZ, double _start, double _end,
+                     double &_distance, const std::vector<std::vector<float>> *_block=nullptr) const;
+
+};
+
+#endif //TERRAINHEIGHTQUERY_H_
@@ -0,0 +1,151 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file BoundingVolumeHierarchy.cpp
+/// @brief implementation file for BoundingVolumeHierarchy class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include "BoundingVolumeHierarchy.h"
+
+
+void BoundingVolumeHierarchy::build(const std::vector<ngl::Vec3> &_mins, const std::vector<ngl::Vec3> &_maxs)
+{
+  clear();
+  if(_mins.size()==0)
+  {
+    return;
+  }
+  m_ids.resize(_mins.size());
+  for(size_t i=0; i<m_ids.size(); i++)
+  {
+    m_ids[i] = i;
+  }
+  m_mins = _mins;
+  m_maxs = _maxs;
+  //a binary tree with at least one item per leaf has less than twice as many nodes as items
+  m_nodes.reserve(2*m_ids.size());
+  m_nodes.push_back({ngl::Vec3(), ngl::Vec3(), 0, m_ids.size(), 0});
+  buildNode(0);
+
+  //finally put the boxes in the same order as the ids
+  for(size_t i=0; i<m_ids.size(); i++)
+  {
+    m_mins[i] = _mins[m_ids[i]];
+    m_maxs[i] = _maxs[m_ids[i]];
+  }
+}
+
+void BoundingVolumeHierarchy::buildNode(size_t _node)
+{
+  size_t first = m_nodes[_node].m_first;
+  size_t count = m_nodes[_node].m_count;
+
+  //find the bounds of the node and the bounds of the centres of its items
+  ngl::Vec3 min = m_mins[m_ids[first]];
+  ngl::Vec3 max = m_maxs[m_ids[first]];
+  ngl::Vec3 centreMin = (min+max)*0.5f;
+  ngl::Vec3 centreMax = centreMin;
+  for(size_t i=first+1; i<first+count; i++)
+  {
+    const ngl::Vec3 &itemMin = m_mins[m_ids[i]];
+    const ngl::Vec3 &itemMax = m_maxs[m_ids[i]];
+    ngl::Vec3 centre = (itemMin+itemMax)*0.5f;
+    min.set(std::min(min.m_x,itemMin.m_x), std::min(min.m_y,itemMin.m_y), std::min(min.m_z,itemMin.m_z));
+    max.set(std::max(max.m_x,itemMax.m_x), std::max(max.m_y,itemMax.m_y), std::max(max.m_z,itemMax.m_z));
+    centreMin.set(std::min(centreMin.m_x,centre.m_x), std::min(centreMin.m_y,centre.m_y),
+                  std::min(centreMin.m_z,centre.m_z));
+    centreMax.set(std::max(centreMax.m_x,centre.m_x), std::max(centreMax.m_y,centre.m_y),
+                  std::max(centreMax.m_z,centre.m_z));
+  }
+  m_nodes[_node].m_min = min;
+  m_nodes[_node].m_max = max;
+  if(count<=m_maxLeafSize)
+  {
+    return;
+  }
+
+  //split the items in half along the axis their centres are most spread out on
+  ngl::Vec3 extent = centreMax-centreMin;
+  int axis = 0;
+  if(extent.m_y>extent.m_x)
+  {
+    axis = 1;
+  }
+  if(extent.m_z>extent.m_openGL[axis])
+  {
+    axis = 2;
+  }
+  size_t half = count/2;
+  std::nth_element(m_ids.begin()+long(first), m_ids.begin()+long(first+half), m_ids.begin()+long(first+count),
+                   [this,axis](size_t _a, size_t _b)
+                   {return m_mins[_a].m_openGL[axis]+m_maxs[_a].m_openGL[axis] <
+                           m_mins[_b].m_openGL[axis]+m_maxs[_b].m_openGL[axis];});
+
+  size_t left = m_nodes.size();
+  m_nodes[_node].m_left = left;
+  m_nodes.push_back({ngl::Vec3(), ngl::Vec3(), first, half, 0});
+  m_nodes.push_back({ngl::Vec3(), ngl::Vec3(), first+half, count-half, 0});
+  buildNode(left);
+  buildNode(left+1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void BoundingVolumeHierarchy::findVisible(const Frustum &_frustum,
+                                          std::vector<size_t> &_inside, std::vector<size_t> &_intersecting) const
+{
+  if(m_nodes.size()==0)
+  {
+    return;
+  }
+  std::vector<size_t> stack = {0};
+  while(stack.size()>0)
+  {
+    const Node &node = m_nodes[stack.back()];
+    stack.pop_back();
+    Frustum::Intersection intersection = _frustum.testBox(node.m_min, node.m_max);
+    if(intersection == Frustum::OUTSIDE)
+    {
+      continue;
+    }
+    //everything below a node that is completely in view is in view too, so there's no need to test it
+    if(intersection == Frustum::INSIDE)
+    {
+      _inside.insert(_inside.end(), m_ids.begin()+long(node.m_first), m_ids.begin()+long(node.m_first+node.m_count));
+    }
+    else if(node.m_left != 0)
+    {
+      stack.push_back(node.m_left);
+      stack.push_back(node.m_left+1);
+    }
+    else
+    {
+      for(size_t i=node.m_first; i<node.m_first+node.m_count; i++)
+      {
+        intersection = _frustum.testBox(m_mins[i], m_maxs[i]);
+        if(intersection == Frustum::INSIDE)
+        {
+          _inside.push_back(m_ids[i]);
+        }
+        else if(intersection == Frustum::INTERSECTING)
+        {
+          _intersecting.push_back(m_ids[i]);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+size_t BoundingVolumeHierarchy::size() const
+{
+  return m_ids.size();
+}
+
+void BoundingVolumeHierarchy::clear()
+{
+  m_nodes.clear();
+  m_ids.clear();
+  m_mins.clear();
+  m_maxs.clear();
+}
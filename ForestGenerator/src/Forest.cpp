@@ -5,40 +5,35 @@
 
 #include <math.h>
 #include <chrono>
-#include "noiseutils.h"
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <limits>
 #include "Forest.h"
 
 
 //FOREST CONSTRUCTORS
 //----------------------------------------------------------------------------------------------------------------------
 
-Forest::Forest(const std::vector<LSystem> &_treeTypes, float _width,
-               std::vector<size_t> &_numTrees, int _numHeroTrees,
-               TerrainGenerator _terrainGen,
-               size_t _seed, bool _useSeed) :
+Forest::Forest(const std::vector<std::shared_ptr<const LSystem>> &_treeTypes, float _width,
+               std::vector<size_t> &_numTrees,
+               std::shared_ptr<const TerrainHeightQuery> _terrainHeights,
+               size_t _seed, bool _useSeed, bool _usePoissonDisk, const std::vector<float> &_treeRadii) :
   m_treeTypes(_treeTypes), m_numTrees(_numTrees),
-  m_width(_width), m_numHeroTrees(_numHeroTrees),
-  m_terrainGen(_terrainGen),
+  m_width(_width),
+  m_terrainHeights(_terrainHeights),
+  m_usePoissonDisk(_usePoissonDisk), m_treeRadii(_treeRadii),
   m_seed(_seed), m_useSeed(_useSeed)
 {
-  scatterForest();
-
-  for(auto &treeType : m_treeTypes)
-  {
-    treeType.fillInstanceCache(m_numHeroTrees);
-  }
-  createForest();
+  generateForest();
 }
 
-Forest::Forest(const std::vector<LSystem> &_treeTypes, int _numHeroTrees,
+Forest::Forest(const std::vector<std::shared_ptr<const LSystem>> &_treeTypes,
                size_t _seed, bool _useSeed) :
-  m_treeTypes(_treeTypes), m_numHeroTrees(_numHeroTrees),
-  m_seed(_seed), m_useSeed(_useSeed)
+  m_treeTypes(_treeTypes),
+  m_seed(_seed), m_useSeed(_useSeed),
+  m_trackTransformOwners(true)
 {
-  for(auto &treeType : m_treeTypes)
-  {
-    treeType.fillInstanceCache(m_numHeroTrees);
-  }
   resizeTransformCache();
 }
 
@@ -47,11 +42,19 @@ Forest::Forest(const std::vector<LSystem> &_treeTypes, int _numHeroTrees,
 //----------------------------------------------------------------------------------------------------------------------
 
 Forest::Tree::Tree(size_t _type, ngl::Mat4 _transform) :
-  m_type(_type), m_transform(_transform) {}
+  m_type(_type), m_transform(_transform),
+  m_boundsMin(_transform.m_30, _transform.m_31, _transform.m_32),
+  m_boundsMax(_transform.m_30, _transform.m_31, _transform.m_32) {}
 
 Forest::CacheIndex::CacheIndex(size_t _treeNum, size_t _id, size_t _age, size_t _innerIndex) :
   m_treeNum(_treeNum), m_id(_id), m_age(_age), m_innerIndex(_innerIndex) {}
 
+Forest::TransformHandle::TransformHandle(CacheIndex _cacheIndex, size_t _position) :
+  m_cacheIndex(_cacheIndex), m_position(_position) {}
+
+Forest::TransformOwner::TransformOwner(size_t _tree, size_t _handle) :
+  m_tree(_tree), m_handle(_handle) {}
+
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -59,9 +62,19 @@ void Forest::resizeTransformCache()
 {
   m_transformCache={};
   m_transformCache.resize(m_treeTypes.size());
+  m_firstAdjustedTransform={};
+  m_firstAdjustedTransform.resize(m_treeTypes.size());
+  m_adjustedCacheIndexes={};
+  m_transformOwners={};
+  m_transformOwners.resize(m_treeTypes.size());
+  m_treeHandles={};
   for(size_t t=0; t<m_treeTypes.size(); t++)
   {
-    RESIZE_CACHE_BY_OTHER_CACHE(m_transformCache[t], m_treeTypes[t].m_instanceCache)
+    RESIZE_CACHE_BY_OTHER_CACHE(m_transformCache[t], m_treeTypes[t]->m_instanceCache)
+    RESIZE_CACHE_BY_OTHER_CACHE(m_firstAdjustedTransform[t], m_treeTypes[t]->m_instanceCache)
+    RESIZE_CACHE_BY_OTHER_CACHE(m_transformOwners[t], m_treeTypes[t]->m_instanceCache)
+    FOR_EACH_ELEMENT(m_firstAdjustedTransform[t],
+                     m_firstAdjustedTransform[t][ID][AGE][INDEX] = std::numeric_limits<size_t>::max())
   }
 }
 
@@ -82,6 +95,22 @@ void Forest::seedRandomEngine()
 }
 
 
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::generateForest()
+{
+  if(m_usePoissonDisk)
+  {
+    scatterForestPoissonDisk();
+  }
+  else
+  {
+    scatterForest();
+  }
+  indexTrees();
+  createForest();
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 
 void Forest::scatterForest()
@@ -94,59 +123,303 @@ void Forest::scatterForest()
   std::uniform_real_distribution<float> distRotate(0,360);
   std::uniform_real_distribution<float> distScale(2,3);
 
-  //set perlinModule identically to m_terrainGenerator to ensure forest positions
-  //correspond to the terrain
-  noise::module::Perlin perlinModule;
-  perlinModule.SetOctaveCount(m_terrainGen.m_octaves);
-  perlinModule.SetFrequency(m_terrainGen.m_frequency);
-  perlinModule.SetPersistence(m_terrainGen.m_persistence);
-  perlinModule.SetLacunarity(m_terrainGen.m_lacunarity);
+  size_t totalTrees = 0;
+  for(size_t t=0; t<m_treeTypes.size(); t++)
+  {
+    totalTrees += m_numTrees[t];
+  }
+  std::vector<float> xPositions(totalTrees);
+  std::vector<float> zPositions(totalTrees);
+  std::vector<float> yPositions(totalTrees, 0);
+  std::vector<float> rotations(totalTrees);
 
+  //draw random values in the same order as always, so seeded forests are unchanged
+  for(size_t i=0; i<totalTrees; i++)
+  {
+    distScale(m_gen); //(tree scaling is currently unused)
+    xPositions[i] = distX(m_gen) + m_centreX;
+    zPositions[i] = distZ(m_gen) + m_centreZ;
+    rotations[i] = distRotate(m_gen);
+  }
+
+  //then find all the tree heights from the terrain heightmap in one batch
+  if(m_terrainHeights)
+  {
+    m_terrainHeights->getHeights(xPositions.data(), zPositions.data(), yPositions.data(), totalTrees);
+  }
+
+  m_treeData.reserve(totalTrees);
+  size_t i = 0;
   for(size_t t=0; t<m_treeTypes.size(); t++)
   {
-    for(size_t i=0; i<m_numTrees[t]; i++)
+    for(size_t n=0; n<m_numTrees[t]; n++, i++)
     {
       ngl::Mat4 position;
       ngl::Mat4 orientation;
-      float s = distScale(m_gen);
-      float xPos = distX(m_gen);
-      float zPos = distZ(m_gen);
-      float yPos = float(perlinModule.GetValue(double(xPos),
-                                               double(zPos),
-                                               m_terrainGen.m_seed));
-      yPos *= m_terrainGen.m_amplitude;
-      position.translate(xPos,yPos,zPos);
-      orientation.rotateY(distRotate(m_gen));
-      ngl::Mat4 scale(s, 0, 0, 0,
-                      0, s, 0, 0,
-                      0, 0, s, 0,
-                      0, 0, 0, 1);
-      m_treeData.push_back(Tree(t, position*orientation));//*scale));
+      position.translate(xPositions[i],yPositions[i],zPositions[i]);
+      orientation.rotateY(rotations[i]);
+      m_treeData.push_back(Tree(t, position*orientation));
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::scatterForestPoissonDisk()
+{
+  size_t numTypes = m_treeTypes.size();
+  std::vector<float> radii(numTypes, 0);
+  for(size_t t=0; t<numTypes && m_treeRadii.size()>0; t++)
+  {
+    radii[t] = m_treeRadii[std::min(t, m_treeRadii.size()-1)];
+  }
+  float minRadius = numTypes>0 ? *std::min_element(radii.begin(), radii.end()) : 0;
+  float maxRadius = numTypes>0 ? *std::max_element(radii.begin(), radii.end()) : 0;
+
+  //the background grid has cells small enough that each one can hold at most one tree, so a grid that is too fine
+  //to store sensibly means the spacing is too small for this method to be of any use
+  const int maxGridDimension = 4096;
+  float cellSize = minRadius/float(M_SQRT2);
+  if(minRadius<=0 || m_width/cellSize>maxGridDimension)
+  {
+    std::cout<<"Tree spacing too small for poisson disk scattering, scattering trees uniformly instead\n";
+    scatterForest();
+    return;
+  }
+
+  seedRandomEngine();
+  m_treeData = {};
+  //every tile is given its own random engine, seeded from this value and the tile index, so that the result doesn't
+  //depend on how the tiles are shared between threads
+  unsigned int baseSeed = unsigned(m_gen());
+
+  //tiles are at least maxRadius wide, so trees in two tiles that don't touch can never be too close to each other;
+  //the tiles are then coloured in a 2x2 pattern and all tiles of one colour are filled at the same time
+  int gridDimension = std::max(int(ceilf(m_width/cellSize)), 1);
+  int searchDistance = int(ceilf(maxRadius/cellSize));
+  int tileSize = std::max(searchDistance, 8);
+  int numTilesPerSide = (gridDimension+tileSize-1)/tileSize;
+  size_t numTiles = size_t(numTilesPerSide*numTilesPerSide);
+  float halfWidth = m_width*0.5f;
+
+  struct GridCell
+  {
+    float m_x = 0;
+    float m_z = 0;
+    float m_radius = 0;
+    bool m_occupied = false;
+  };
+  struct Sample
+  {
+    size_t m_type;
+    float m_x;
+    float m_z;
+    float m_rotation;
+  };
+  std::vector<GridCell> grid(size_t(gridDimension*gridDimension));
+  std::vector<std::vector<Sample>> tileSamples(numTiles);
+
+  //species are placed in order of decreasing radius, since the largest trees are the hardest to fit in
+  std::vector<size_t> typeOrder(numTypes);
+  for(size_t t=0; t<numTypes; t++)
+  {
+    typeOrder[t] = t;
+  }
+  std::stable_sort(typeOrder.begin(), typeOrder.end(),
+                   [&radii](size_t _a, size_t _b){return radii[_a]>radii[_b];});
+
+  //each tile's share of the trees is proportional to its area, found from the cumulative area so that the shares
+  //add up exactly to m_numTrees
+  std::vector<double> cumulativeArea(numTiles+1, 0);
+  for(size_t tile=0; tile<numTiles; tile++)
+  {
+    int tileX = int(tile)%numTilesPerSide;
+    int tileZ = int(tile)/numTilesPerSide;
+    float tileWidthX = std::min(float((tileX+1)*tileSize)*cellSize, m_width) - float(tileX*tileSize)*cellSize;
+    float tileWidthZ = std::min(float((tileZ+1)*tileSize)*cellSize, m_width) - float(tileZ*tileSize)*cellSize;
+    cumulativeArea[tile+1] = cumulativeArea[tile] + double(std::max(tileWidthX,0.0f)*std::max(tileWidthZ,0.0f));
+  }
+
+  auto fillTile = [&](size_t _tile)
+  {
+    int tileX = int(_tile)%numTilesPerSide;
+    int tileZ = int(_tile)/numTilesPerSide;
+    float minX = float(tileX*tileSize)*cellSize;
+    float minZ = float(tileZ*tileSize)*cellSize;
+    std::uniform_real_distribution<float> distX(minX, std::min(minX+float(tileSize)*cellSize, m_width));
+    std::uniform_real_distribution<float> distZ(minZ, std::min(minZ+float(tileSize)*cellSize, m_width));
+    std::uniform_real_distribution<float> distRotate(0,360);
+    std::seed_seq seed = {baseSeed, unsigned(_tile)};
+    std::default_random_engine gen(seed);
+
+    const int maxAttempts = 30;
+    for(size_t t : typeOrder)
+    {
+      double total = cumulativeArea[numTiles];
+      size_t quota = size_t(double(m_numTrees[t])*cumulativeArea[_tile+1]/total) -
+                     size_t(double(m_numTrees[t])*cumulativeArea[_tile]/total);
+      for(size_t n=0; n<quota; n++)
+      {
+        for(int attempt=0; attempt<maxAttempts; attempt++)
+        {
+          //positions here are measured from the corner of the forest rather than its centre
+          float x = distX(gen);
+          float z = distZ(gen);
+          int cellX = std::min(int(x/cellSize), gridDimension-1);
+          int cellZ = std::min(int(z/cellSize), gridDimension-1);
+          if(grid[size_t(cellZ*gridDimension+cellX)].m_occupied)
+          {
+            continue;
+          }
+          bool valid = true;
+          for(int j=std::max(cellZ-searchDistance,0); valid && j<=std::min(cellZ+searchDistance,gridDimension-1); j++)
+          {
+            for(int i=std::max(cellX-searchDistance,0); i<=std::min(cellX+searchDistance,gridDimension-1); i++)
+            {
+              const GridCell &cell = grid[size_t(j*gridDimension+i)];
+              float minDist = std::max(radii[t], cell.m_radius);
+              if(cell.m_occupied &&
+                 (cell.m_x-x)*(cell.m_x-x) + (cell.m_z-z)*(cell.m_z-z) < minDist*minDist)
+              {
+                valid = false;
+                break;
+              }
+            }
+          }
+          if(valid)
+          {
+            GridCell &cell = grid[size_t(cellZ*gridDimension+cellX)];
+            cell.m_x = x;
+            cell.m_z = z;
+            cell.m_radius = radii[t];
+            cell.m_occupied = true;
+            tileSamples[_tile].push_back({t, x-halfWidth+m_centreX, z-halfWidth+m_centreZ, distRotate(gen)});
+            break;
+          }
+        }
+      }
+    }
+  };
+
+  size_t numThreads = std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+  for(int colour=0; colour<4; colour++)
+  {
+    std::vector<size_t> tiles;
+    for(size_t tile=0; tile<numTiles; tile++)
+    {
+      if((int(tile)%numTilesPerSide)%2 + 2*((int(tile)/numTilesPerSide)%2) == colour)
+      {
+        tiles.push_back(tile);
+      }
+    }
+    std::atomic<size_t> nextTile(0);
+    auto worker = [&]()
+    {
+      for(size_t i=nextTile++; i<tiles.size(); i=nextTile++)
+      {
+        fillTile(tiles[i]);
+      }
+    };
+    std::vector<std::thread> threads;
+    for(size_t i=1; i<std::min(numThreads, tiles.size()); i++)
+    {
+      threads.push_back(std::thread(worker));
+    }
+    worker();
+    for(auto &thread : threads)
+    {
+      thread.join();
+    }
+  }
+
+  //gather the samples in tile order and group them by tree type, as scatterForest() does
+  std::vector<Sample> samples;
+  for(auto &tile : tileSamples)
+  {
+    samples.insert(samples.end(), tile.begin(), tile.end());
+  }
+  std::stable_sort(samples.begin(), samples.end(),
+                   [](const Sample &_a, const Sample &_b){return _a.m_type<_b.m_type;});
+
+  std::vector<size_t> numPlaced(numTypes, 0);
+  std::vector<float> xPositions(samples.size());
+  std::vector<float> zPositions(samples.size());
+  std::vector<float> yPositions(samples.size(), 0);
+  for(size_t i=0; i<samples.size(); i++)
+  {
+    xPositions[i] = samples[i].m_x;
+    zPositions[i] = samples[i].m_z;
+    numPlaced[samples[i].m_type]++;
+  }
+  if(m_terrainHeights)
+  {
+    m_terrainHeights->getHeights(xPositions.data(), zPositions.data(), yPositions.data(), samples.size());
+  }
+
+  m_treeData.reserve(samples.size());
+  for(size_t i=0; i<samples.size(); i++)
+  {
+    ngl::Mat4 position;
+    ngl::Mat4 orientation;
+    position.translate(xPositions[i],yPositions[i],zPositions[i]);
+    orientation.rotateY(samples[i].m_rotation);
+    m_treeData.push_back(Tree(samples[i].m_type, position*orientation));
+  }
+
+  for(size_t t=0; t<numTypes; t++)
+  {
+    if(numPlaced[t]<m_numTrees[t])
+    {
+      std::cout<<"Only room for "<<numPlaced[t]<<" of "<<m_numTrees[t]<<" trees of type "<<t
+               <<" with the current spacing\n";
     }
   }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-void Forest::createTree(size_t _treeType, ngl::Mat4 _transform, size_t _id, size_t _age)
+void Forest::createTree(size_t _tree, ngl::Mat4 _transform, size_t _id, size_t _age)
 {
   ///@ref Kenwood et al, Efficient Procedural Generation of Forests, 2014
 
-  LSystem &treeType = m_treeTypes[_treeType];
+  size_t treeNum = m_treeData[_tree].m_type;
+  const LSystem &treeType = *m_treeTypes[treeNum];
   size_t size = treeType.m_instanceCache[_id][_age].size();
   //first check there is an instance at the given id and age of the cache
   if(size>0)
   {
     size_t innerIndex = 0;
     //pick a random instance of the given id and age
-    Instance * instance = getInstance(treeType, _id, _age, innerIndex);
+    const Instance * instance = getInstance(treeType, _id, _age, innerIndex);
     //find the worldspace transform of this new instance from the current transform and the relative instance transform
     ngl::Mat4 T = _transform * instance->m_transform.inverse();
     //and add it to the transform cache
-    m_transformCache[_treeType][_id][_age][innerIndex].push_back(T);
-    //add current indexes to m_cacheIndexes to tell NGLScene which VAOs need rebuilding
+    std::vector<ngl::Mat4> &transforms = m_transformCache[treeNum][_id][_age][innerIndex];
+    transforms.push_back(T);
+    //add current indexes to m_adjustedCacheIndexes to tell NGLScene which VAOs need updating
     //(only necessary when used for painting on forests)
-    m_adjustedCacheIndexes.push_back(CacheIndex(_treeType,_id,_age,innerIndex));
+    CacheIndex cacheIndex(treeNum,_id,_age,innerIndex);
+    markAdjusted(cacheIndex, transforms.size()-1);
+    //record where the transform went so the tree's transforms can be found again, and which tree the transform
+    //belongs to so that it can be removed again
+    std::vector<TransformHandle> &handles = m_treeHandles[_tree];
+    if(m_trackTransformOwners)
+    {
+      m_transformOwners[treeNum][_id][_age][innerIndex].push_back(TransformOwner(_tree, handles.size()));
+    }
+    handles.push_back(TransformHandle(cacheIndex, transforms.size()-1));
+
+    //grow the bounds of the tree to hold the bounding sphere of this instance
+    const ngl::Vec3 &c = instance->m_boundingCentre;
+    ngl::Vec3 centre = (T * ngl::Vec4(c.m_x, c.m_y, c.m_z, 1)).toVec3();
+    float radius = instance->m_boundingRadius * getMaxScale(T);
+    Tree &tree = m_treeData[_tree];
+    tree.m_boundsMin.set(std::min(tree.m_boundsMin.m_x, centre.m_x-radius),
+                         std::min(tree.m_boundsMin.m_y, centre.m_y-radius),
+                         std::min(tree.m_boundsMin.m_z, centre.m_z-radius));
+    tree.m_boundsMax.set(std::max(tree.m_boundsMax.m_x, centre.m_x+radius),
+                         std::max(tree.m_boundsMax.m_y, centre.m_y+radius),
+                         std::max(tree.m_boundsMax.m_z, centre.m_z+radius));
 
     //now iterate through exit points to recursively call the function again
     for(size_t i=0; i<instance->m_exitPoints.size(); i++)
@@ -156,17 +429,17 @@ void Forest::createTree(size_t _treeType, ngl::Mat4 _transform, size_t _id, size
       ngl::Mat4 exitTransform = instance->m_exitPoints[i].m_exitTransform;
       //use the worldspace transform of the exit point, found from the current transform and the relative exit transform
       ngl::Mat4 newTransform = _transform * exitTransform;
-      createTree(_treeType, newTransform, newId, newAge);
+      createTree(_tree, newTransform, newId, newAge);
     }
   }
   else
   {
     //note that this shouldn't actually ever occur because createGeometry() ensures that no empty instance is called
-    std::cout<<"Couldn't find instance of tree type "<<_treeType<<" with id "<<_id<<" at age "<<_age<<'\n';
+    std::cout<<"Couldn't find instance of tree type "<<treeNum<<" with id "<<_id<<" at age "<<_age<<'\n';
   }
 }
 
-Instance * Forest::getInstance(LSystem &_treeType, size_t _id, size_t _age, size_t &_innerIndex)
+const Instance * Forest::getInstance(const LSystem &_treeType, size_t _id, size_t _age, size_t &_innerIndex)
 {
   size_t size = _treeType.m_instanceCache.at(_id).at(_age).size();
   std::uniform_int_distribution<size_t> dist(0,size-1);
@@ -180,10 +453,12 @@ void Forest::createForest()
 {
   seedRandomEngine();
   resizeTransformCache();
-  for(auto &tree : m_treeData)
+  m_treeHandles.resize(m_treeData.size());
+  for(size_t i=0; i<m_treeData.size(); i++)
   {
-    createTree(tree.m_type,tree.m_transform,0,0);
+    createTree(i,m_treeData[i].m_transform,0,0);
   }
+  buildTreeBVH();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -195,5 +470,279 @@ void Forest::addTreeToForest(ngl::Vec3 &_point, size_t _treeType)
   orientation.rotateY(distRotate(m_gen));
   ngl::Mat4 position;
   position.translate(_point.m_x, _point.m_y, _point.m_z);
-  createTree(_treeType,position*orientation,0,0);
+  m_treeData.push_back(Tree(_treeType, position*orientation));
+  m_treeHash.insert(m_treeData.size()-1, _point.m_x, _point.m_z);
+  m_treeHandles.push_back({});
+  createTree(m_treeData.size()-1,position*orientation,0,0);
+  m_rebuildTreeBVH = true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::indexTrees()
+{
+  m_treeHash.clear();
+  for(size_t i=0; i<m_treeData.size(); i++)
+  {
+    m_treeHash.insert(i, m_treeData[i].m_transform.m_30, m_treeData[i].m_transform.m_32);
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::removeTree(size_t _tree)
+{
+  if(!m_trackTransformOwners || _tree>=m_treeHandles.size())
+  {
+    std::cout<<"Couldn't find handles to remove tree "<<_tree<<'\n';
+    return;
+  }
+
+  //swap-remove each transform, pointing the handle of the transform that moves into its place at its new position
+  for(auto &handle : m_treeHandles[_tree])
+  {
+    const CacheIndex &c = handle.m_cacheIndex;
+    std::vector<ngl::Mat4> &transforms = m_transformCache[c.m_treeNum][c.m_id][c.m_age][c.m_innerIndex];
+    std::vector<TransformOwner> &owners = m_transformOwners[c.m_treeNum][c.m_id][c.m_age][c.m_innerIndex];
+    size_t last = transforms.size()-1;
+    if(handle.m_position != last)
+    {
+      transforms[handle.m_position] = transforms[last];
+      owners[handle.m_position] = owners[last];
+      const TransformOwner &moved = owners[handle.m_position];
+      m_treeHandles[moved.m_tree][moved.m_handle].m_position = handle.m_position;
+    }
+    transforms.pop_back();
+    owners.pop_back();
+    markAdjusted(c, handle.m_position);
+  }
+
+  //then swap-remove the tree itself, giving the last tree its index
+  size_t last = m_treeData.size()-1;
+  m_treeHash.remove(_tree, m_treeData[_tree].m_transform.m_30, m_treeData[_tree].m_transform.m_32);
+  if(_tree != last)
+  {
+    float x = m_treeData[last].m_transform.m_30;
+    float z = m_treeData[last].m_transform.m_32;
+    m_treeHash.remove(last, x, z);
+    m_treeHash.insert(_tree, x, z);
+    m_treeData[_tree] = m_treeData[last];
+    m_treeHandles[_tree] = std::move(m_treeHandles[last]);
+    for(auto &handle : m_treeHandles[_tree])
+    {
+      const CacheIndex &c = handle.m_cacheIndex;
+      m_transformOwners[c.m_treeNum][c.m_id][c.m_age][c.m_innerIndex][handle.m_position].m_tree = _tree;
+    }
+  }
+  m_treeData.pop_back();
+  m_treeHandles.pop_back();
+  m_rebuildTreeBVH = true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+size_t Forest::eraseTreesWithin(const ngl::Vec3 &_point, float _radius)
+{
+  std::vector<size_t> trees;
+  m_treeHash.findPointsWithin(_point.m_x, _point.m_z, _radius, trees);
+  //removing a tree gives its index to the last tree, so removing from the back means the trees still to be
+  //removed never move
+  std::sort(trees.begin(), trees.end(), [](size_t _a, size_t _b){return _a>_b;});
+  for(size_t tree : trees)
+  {
+    removeTree(tree);
+  }
+  return trees.size();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::buildTreeBVH()
+{
+  std::vector<ngl::Vec3> mins(m_treeData.size());
+  std::vector<ngl::Vec3> maxs(m_treeData.size());
+  for(size_t i=0; i<m_treeData.size(); i++)
+  {
+    mins[i] = m_treeData[i].m_boundsMin;
+    maxs[i] = m_treeData[i].m_boundsMax;
+  }
+  m_treeBVH.build(mins, maxs);
+  m_rebuildTreeBVH = false;
+}
+
+void Forest::updateTreeBVH()
+{
+  if(m_rebuildTreeBVH)
+  {
+    buildTreeBVH();
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::findVisibleTransforms(const Frustum &_frustum,
+                                   std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> &_visibleTransforms) const
+{
+  std::vector<size_t> treeLODs;
+  std::vector<CACHE_STRUCTURE(size_t)> numDetailedTransforms;
+  findVisibleTransforms(_frustum, LODSettings(), treeLODs, _visibleTransforms, numDetailedTransforms);
+}
+
+void Forest::findVisibleTransforms(const Frustum &_frustum, const LODSettings &_lod, std::vector<size_t> &_treeLODs,
+                                   std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> &_visibleTransforms,
+                                   std::vector<CACHE_STRUCTURE(size_t)> &_numDetailedTransforms) const
+{
+  _visibleTransforms.resize(m_transformCache.size());
+  _numDetailedTransforms.resize(m_transformCache.size());
+  for(size_t t=0; t<m_transformCache.size(); t++)
+  {
+    RESIZE_CACHE_BY_OTHER_CACHE(_visibleTransforms[t], m_transformCache[t])
+    RESIZE_CACHE_BY_OTHER_CACHE(_numDetailedTransforms[t], m_transformCache[t])
+    FOR_EACH_ELEMENT(_visibleTransforms[t], _visibleTransforms[t][ID][AGE][INDEX].clear())
+  }
+
+  //list the trees completely in view first, followed by those crossing the edge of the view
+  std::vector<size_t> visibleTrees;
+  std::vector<size_t> intersectingTrees;
+  m_treeBVH.findVisible(_frustum, visibleTrees, intersectingTrees);
+  size_t numInside = visibleTrees.size();
+  visibleTrees.insert(visibleTrees.end(), intersectingTrees.begin(), intersectingTrees.end());
+
+  //choose the level of each visible tree, keeping the levels of trees that have gone out of view for when they
+  //come back into view
+  _treeLODs.resize(m_treeData.size(), std::numeric_limits<size_t>::max());
+  size_t numChanges = 0;
+  for(size_t tree : visibleTrees)
+  {
+    size_t &currentLOD = _treeLODs[tree];
+    ngl::Vec3 centre = (m_treeData[tree].m_boundsMin+m_treeData[tree].m_boundsMax)*0.5f;
+    size_t LOD = chooseLOD(_lod, (centre-_lod.m_cameraPosition).length(), currentLOD);
+    if(currentLOD != std::numeric_limits<size_t>::max() && LOD != currentLOD)
+    {
+      if(_lod.m_maxChangesPerUpdate>0 && numChanges>=_lod.m_maxChangesPerUpdate)
+      {
+        continue;
+      }
+      numChanges++;
+    }
+    currentLOD = LOD;
+  }
+
+  //then add the transforms of the trees drawn in full detail to each slot before those drawn as skeletal lines
+  for(int skeletal=0; skeletal<2; skeletal++)
+  {
+    for(size_t i=0; i<visibleTrees.size(); i++)
+    {
+      size_t tree = visibleTrees[i];
+      const std::vector<size_t> &chain = m_treeTypes[m_treeData[tree].m_type]->m_LODMaxAges;
+      size_t LOD = _treeLODs[tree];
+      if((chain.size()>0 && LOD>=chain.size()) != bool(skeletal))
+      {
+        continue;
+      }
+      size_t maxAge = chain.size()>0 ? chain[std::min(LOD, chain.size()-1)] : std::numeric_limits<size_t>::max();
+      for(auto &handle : m_treeHandles[tree])
+      {
+        const CacheIndex &c = handle.m_cacheIndex;
+        if(c.m_age>maxAge)
+        {
+          continue;
+        }
+        const ngl::Mat4 &T = m_transformCache[c.m_treeNum][c.m_id][c.m_age][c.m_innerIndex][handle.m_position];
+        //trees crossing the edge of the view have each instance tested on its own
+        if(i>=numInside)
+        {
+          const Instance &instance = m_treeTypes[c.m_treeNum]->m_instanceCache[c.m_id][c.m_age][c.m_innerIndex];
+          const ngl::Vec3 &centre = instance.m_boundingCentre;
+          ngl::Vec3 worldCentre = (T * ngl::Vec4(centre.m_x, centre.m_y, centre.m_z, 1)).toVec3();
+          if(!_frustum.intersectsSphere(worldCentre, instance.m_boundingRadius * getMaxScale(T)))
+          {
+            continue;
+          }
+        }
+        _visibleTransforms[c.m_treeNum][c.m_id][c.m_age][c.m_innerIndex].push_back(T);
+      }
+    }
+
+    if(!skeletal)
+    {
+      for(size_t t=0; t<m_transformCache.size(); t++)
+      {
+        FOR_EACH_ELEMENT(_visibleTransforms[t],
+                         _numDetailedTransforms[t][ID][AGE][INDEX] = _visibleTransforms[t][ID][AGE][INDEX].size())
+      }
+    }
+  }
+}
+
+size_t Forest::chooseLOD(const LODSettings &_lod, float _distance, size_t _currentLOD)
+{
+  //the level a tree moving away from the camera would take, and the level a tree moving towards it would take
+  size_t coarserLOD = 0;
+  size_t finerLOD = 0;
+  for(float boundary : _lod.m_distances)
+  {
+    if(_distance > boundary*(1+_lod.m_hysteresis))
+    {
+      coarserLOD++;
+    }
+    if(_distance > boundary*(1-_lod.m_hysteresis))
+    {
+      finerLOD++;
+    }
+  }
+  //a tree without a level yet takes the level halfway between, as if there were no hysteresis
+  if(_currentLOD == std::numeric_limits<size_t>::max())
+  {
+    size_t LOD = 0;
+    for(float boundary : _lod.m_distances)
+    {
+      if(_distance > boundary)
+      {
+        LOD++;
+      }
+    }
+    return LOD;
+  }
+  //otherwise it only changes level when it leaves the band between the two
+  return std::min(std::max(_currentLOD, coarserLOD), finerLOD);
+}
+
+bool Forest::LODSettings::operator==(const LODSettings &_lod) const
+{
+  return m_cameraPosition == _lod.m_cameraPosition && m_distances == _lod.m_distances &&
+         m_hysteresis == _lod.m_hysteresis && m_maxChangesPerUpdate == _lod.m_maxChangesPerUpdate;
+}
+
+float Forest::getMaxScale(const ngl::Mat4 &_transform)
+{
+  const ngl::Mat4 &m = _transform;
+  float x = m.m_00*m.m_00 + m.m_01*m.m_01 + m.m_02*m.m_02;
+  float y = m.m_10*m.m_10 + m.m_11*m.m_11 + m.m_12*m.m_12;
+  float z = m.m_20*m.m_20 + m.m_21*m.m_21 + m.m_22*m.m_22;
+  return sqrtf(std::max(x, std::max(y, z)));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::markAdjusted(const CacheIndex &_cacheIndex, size_t _position)
+{
+  size_t &first = m_firstAdjustedTransform[_cacheIndex.m_treeNum][_cacheIndex.m_id][_cacheIndex.m_age]
+                                          [_cacheIndex.m_innerIndex];
+  if(first == std::numeric_limits<size_t>::max())
+  {
+    m_adjustedCacheIndexes.push_back(_cacheIndex);
+  }
+  first = std::min(first, _position);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void Forest::clearAdjustedCacheIndexes()
+{
+  for(auto &i : m_adjustedCacheIndexes)
+  {
+    m_firstAdjustedTransform[i.m_treeNum][i.m_id][i.m_age][i.m_innerIndex] = std::numeric_limits<size_t>::max();
+  }
+  m_adjustedCacheIndexes.clear();
 }
@@ -0,0 +1,97 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file ForestDrawBatch.cpp
+/// @brief implementation file for ForestDrawBatch class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include "ForestDrawBatch.h"
+
+
+void ForestDrawBatch::setTreeTypes(const std::vector<std::shared_ptr<const LSystem>> &_treeTypes)
+{
+  m_treeTypes = _treeTypes;
+  m_branchOffsets.clear();
+  m_leafOffsets.clear();
+  m_polygonOffsets.clear();
+  m_branchTotals = GeometryOffsets();
+  m_leafTotals = GeometryOffsets();
+  m_polygonTotals = GeometryOffsets();
+  for(auto &treeType : m_treeTypes)
+  {
+    m_branchOffsets.push_back(m_branchTotals);
+    m_leafOffsets.push_back(m_leafTotals);
+    m_polygonOffsets.push_back(m_polygonTotals);
+    m_branchTotals.m_baseVertex += treeType->m_heroVertices.size();
+    m_branchTotals.m_firstIndex += treeType->m_heroIndices.size();
+    m_leafTotals.m_baseVertex += treeType->m_heroLeafVertices.size();
+    m_leafTotals.m_firstIndex += treeType->m_heroLeafIndices.size();
+    m_polygonTotals.m_baseVertex += treeType->m_heroPolygonVertices.size();
+    m_polygonTotals.m_firstIndex += treeType->m_heroPolygonIndices.size();
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void ForestDrawBatch::build(const std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> &_transforms)
+{
+  buildCommands(_transforms, nullptr);
+}
+
+void ForestDrawBatch::build(const std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> &_transforms,
+                            const std::vector<CACHE_STRUCTURE(size_t)> &_numDetailedTransforms)
+{
+  buildCommands(_transforms, &_numDetailedTransforms);
+}
+
+void ForestDrawBatch::buildCommands(const std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> &_transforms,
+                                    const std::vector<CACHE_STRUCTURE(size_t)> *_numDetailedTransforms)
+{
+  clear();
+  for(size_t t=0; t<_transforms.size() && t<m_treeTypes.size(); t++)
+  {
+    const CACHE_STRUCTURE(Instance) &instanceCache = m_treeTypes[t]->m_instanceCache;
+    FOR_EACH_ELEMENT(_transforms[t],
+                     const std::vector<ngl::Mat4> &transforms = _transforms[t][ID][AGE][INDEX];
+                     const Instance &instance = instanceCache[ID][AGE][INDEX];
+                     size_t baseInstance = m_transforms.size();
+                     size_t numTransforms = transforms.size();
+                     size_t numDetailed = numTransforms;
+                     if(_numDetailedTransforms)
+                     {
+                       numDetailed = std::min(numDetailed, (*_numDetailedTransforms)[t][ID][AGE][INDEX]);
+                     }
+                     m_transforms.insert(m_transforms.end(), transforms.begin(), transforms.end());
+
+                     addCommand(m_branchCommands, m_branchOffsets[t], instance.m_instanceStart,
+                                instance.m_instanceEnd, baseInstance, numDetailed);
+                     addCommand(m_leafCommands, m_leafOffsets[t], instance.m_instanceLeafStart,
+                                instance.m_instanceLeafEnd, baseInstance, numDetailed);
+                     addCommand(m_polygonCommands, m_polygonOffsets[t], instance.m_instancePolygonStart,
+                                instance.m_instancePolygonEnd, baseInstance, numDetailed);
+                     addCommand(m_skeletalCommands, m_branchOffsets[t], instance.m_instanceStart,
+                                instance.m_instanceEnd, baseInstance+numDetailed, numTransforms-numDetailed))
+  }
+}
+
+void ForestDrawBatch::addCommand(std::vector<DrawCommand> &_commands, const GeometryOffsets &_offsets,
+                                 size_t _start, size_t _end, size_t _baseInstance, size_t _instanceCount)
+{
+  //slots with no transforms and instances with no geometry of this kind cost nothing
+  if(_instanceCount==0 || _end<=_start)
+  {
+    return;
+  }
+  _commands.push_back({GLuint(_end-_start), GLuint(_instanceCount), GLuint(_offsets.m_firstIndex+_start),
+                       GLint(_offsets.m_baseVertex), GLuint(_baseInstance)});
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void ForestDrawBatch::clear()
+{
+  m_branchCommands.clear();
+  m_leafCommands.clear();
+  m_polygonCommands.clear();
+  m_skeletalCommands.clear();
+  m_transforms.clear();
+}
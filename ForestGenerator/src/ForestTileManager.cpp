@@ -0,0 +1,145 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file ForestTileManager.cpp
+/// @brief implementation file for ForestTileManager class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <math.h>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include "ForestTileManager.h"
+
+
+ForestTileManager::ForestTileManager(const std::vector<std::shared_ptr<const LSystem>> &_treeTypes, float _tileSize,
+                                     const std::vector<size_t> &_numTreesPerTile,
+                                     std::shared_ptr<const TerrainHeightQuery> _terrainHeights,
+                                     size_t _seed, bool _useSeed, bool _usePoissonDisk,
+                                     const std::vector<float> &_treeRadii) :
+  m_treeTypes(_treeTypes), m_tileSize(_tileSize), m_numTreesPerTile(_numTreesPerTile),
+  m_terrainHeights(_terrainHeights), m_usePoissonDisk(_usePoissonDisk), m_treeRadii(_treeRadii),
+  m_worldSeed(_seed)
+{
+  //an unseeded world still needs a fixed seed, so that an evicted tile is the same when it's built again
+  if(!_useSeed)
+  {
+    m_worldSeed = size_t(std::chrono::system_clock::now().time_since_epoch().count());
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+ForestTileManager::TileCoord ForestTileManager::getTileCoord(float _x, float _z) const
+{
+  return TileCoord(int(floorf(_x/m_tileSize)), int(floorf(_z/m_tileSize)));
+}
+
+size_t ForestTileManager::getTileSeed(TileCoord _coord) const
+{
+  //combine the coordinates with the world seed, then mix the bits with the splitmix64 finaliser so that
+  //neighbouring tiles get unrelated seeds
+  uint64_t h = uint64_t(m_worldSeed);
+  h ^= uint64_t(uint32_t(_coord.first))*0x9E3779B97F4A7C15ull;
+  h ^= uint64_t(uint32_t(_coord.second))*0xC2B2AE3D27D4EB4Full;
+  h ^= h>>30;
+  h *= 0xBF58476D1CE4E5B9ull;
+  h ^= h>>27;
+  h *= 0x94D049BB133111EBull;
+  h ^= h>>31;
+  return size_t(h);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+std::unique_ptr<Forest> ForestTileManager::buildTile(TileCoord _coord) const
+{
+  std::unique_ptr<Forest> tile(new Forest());
+  tile->m_treeTypes = m_treeTypes;
+  tile->m_numTrees = m_numTreesPerTile;
+  tile->m_terrainHeights = m_terrainHeights;
+  tile->m_usePoissonDisk = m_usePoissonDisk;
+  tile->m_treeRadii = m_treeRadii;
+  tile->m_seed = getTileSeed(_coord);
+  tile->m_useSeed = true;
+  tile->m_centreX = (float(_coord.first)+0.5f)*m_tileSize;
+  tile->m_centreZ = (float(_coord.second)+0.5f)*m_tileSize;
+  tile->m_width = m_tileSize;
+  if(m_usePoissonDisk && m_treeRadii.size()>0)
+  {
+    //leaving a border of half the largest radius around each tile keeps the spacing across tile edges too
+    float maxRadius = *std::max_element(m_treeRadii.begin(), m_treeRadii.end());
+    tile->m_width = std::max(m_tileSize-maxRadius, 0.0f);
+  }
+  tile->generateForest();
+  return tile;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bool ForestTileManager::update(float _x, float _z)
+{
+  TileCoord centre = getTileCoord(_x, _z);
+  bool changed = false;
+
+  for(auto it = m_tiles.begin(); it != m_tiles.end();)
+  {
+    int distance = std::max(abs(it->first.first-centre.first), abs(it->first.second-centre.second));
+    if(distance > m_residencyRadius+1)
+    {
+      m_evictedTiles.push_back(it->first);
+      it = m_tiles.erase(it);
+      changed = true;
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  //find the missing tiles within the residency radius, nearest first
+  std::vector<std::pair<int,TileCoord>> missingTiles;
+  for(int i=-m_residencyRadius; i<=m_residencyRadius; i++)
+  {
+    for(int j=-m_residencyRadius; j<=m_residencyRadius; j++)
+    {
+      TileCoord coord(centre.first+i, centre.second+j);
+      if(m_worldWidth>0 &&
+         (float(coord.first+1)*m_tileSize <= -m_worldWidth*0.5f || float(coord.first)*m_tileSize >= m_worldWidth*0.5f ||
+          float(coord.second+1)*m_tileSize <= -m_worldWidth*0.5f || float(coord.second)*m_tileSize >= m_worldWidth*0.5f))
+      {
+        continue;
+      }
+      if(m_tiles.find(coord) == m_tiles.end())
+      {
+        missingTiles.push_back(std::pair<int,TileCoord>(i*i+j*j, coord));
+      }
+    }
+  }
+  std::sort(missingTiles.begin(), missingTiles.end());
+
+  for(size_t i=0; i<missingTiles.size() && i<m_maxTilesBuiltPerUpdate; i++)
+  {
+    TileCoord coord = missingTiles[i].second;
+    m_tiles[coord] = buildTile(coord);
+    m_builtTiles.push_back(coord);
+    changed = true;
+  }
+  return changed;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+const Forest * ForestTileManager::getTile(TileCoord _coord) const
+{
+  auto it = m_tiles.find(_coord);
+  if(it == m_tiles.end())
+  {
+    return nullptr;
+  }
+  return it->second.get();
+}
+
+void ForestTileManager::clearChanges()
+{
+  m_builtTiles.clear();
+  m_evictedTiles.clear();
+}
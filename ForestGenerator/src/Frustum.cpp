@@ -0,0 +1,113 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file Frustum.cpp
+/// @brief implementation file for Frustum class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <math.h>
+#include "Frustum.h"
+
+constexpr int Frustum::m_allPlanes;
+
+
+Frustum::Frustum(const ngl::Mat4 &_MVP)
+{
+  //the matrices are column major, so row r of the matrix is (m_0r, m_1r, m_2r, m_3r) - each clipping plane is then
+  //the fourth row plus or minus one of the others (Gribb and Hartmann, 2001)
+  const ngl::Mat4 &m = _MVP;
+  ngl::Vec4 rows[4] = {ngl::Vec4(m.m_00, m.m_10, m.m_20, m.m_30),
+                       ngl::Vec4(m.m_01, m.m_11, m.m_21, m.m_31),
+                       ngl::Vec4(m.m_02, m.m_12, m.m_22, m.m_32),
+                       ngl::Vec4(m.m_03, m.m_13, m.m_23, m.m_33)};
+  for(int i=0; i<3; i++)
+  {
+    const ngl::Vec4 &r = rows[i];
+    const ngl::Vec4 &w = rows[3];
+    m_planes[2*i] = ngl::Vec4(w.m_x+r.m_x, w.m_y+r.m_y, w.m_z+r.m_z, w.m_w+r.m_w);
+    m_planes[2*i+1] = ngl::Vec4(w.m_x-r.m_x, w.m_y-r.m_y, w.m_z-r.m_z, w.m_w-r.m_w);
+  }
+
+  //normalise the planes so that sphere radii can be compared with the plane distances
+  for(auto &plane : m_planes)
+  {
+    float length = sqrtf(plane.m_x*plane.m_x + plane.m_y*plane.m_y + plane.m_z*plane.m_z);
+    if(length>0)
+    {
+      plane = ngl::Vec4(plane.m_x/length, plane.m_y/length, plane.m_z/length, plane.m_w/length);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+Frustum::Intersection Frustum::testBox(const ngl::Vec3 &_min, const ngl::Vec3 &_max) const
+{
+  Intersection result = INSIDE;
+  for(auto &plane : m_planes)
+  {
+    //the corner furthest along the plane normal decides if the box is outside, and the nearest if it's inside
+    float furthest = plane.m_w + plane.m_x*(plane.m_x>=0 ? _max.m_x : _min.m_x)
+                               + plane.m_y*(plane.m_y>=0 ? _max.m_y : _min.m_y)
+                               + plane.m_z*(plane.m_z>=0 ? _max.m_z : _min.m_z);
+    if(furthest<0)
+    {
+      return OUTSIDE;
+    }
+    float nearest = plane.m_w + plane.m_x*(plane.m_x>=0 ? _min.m_x : _max.m_x)
+                              + plane.m_y*(plane.m_y>=0 ? _min.m_y : _max.m_y)
+                              + plane.m_z*(plane.m_z>=0 ? _min.m_z : _max.m_z);
+    if(nearest<0)
+    {
+      result = INTERSECTING;
+    }
+  }
+  return result;
+}
+
+bool Frustum::intersectsSphere(const ngl::Vec3 &_centre, float _radius) const
+{
+  for(auto &plane : m_planes)
+  {
+    if(plane.m_x*_centre.m_x + plane.m_y*_centre.m_y + plane.m_z*_centre.m_z + plane.m_w < -_radius)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+Frustum::Intersection Frustum::testSphere(const ngl::Vec3 &_centre, float _radius, int &_planeMask) const
+{
+  for(int i=0; i<6; i++)
+  {
+    if(!(_planeMask & (1<<i)))
+    {
+      continue;
+    }
+    const ngl::Vec4 &plane = m_planes[i];
+    float distance = plane.m_x*_centre.m_x + plane.m_y*_centre.m_y + plane.m_z*_centre.m_z + plane.m_w;
+    if(distance < -_radius)
+    {
+      return OUTSIDE;
+    }
+    bool isZero = plane.m_x==0 && plane.m_y==0 && plane.m_z==0 && plane.m_w==0;
+    if(distance >= _radius || isZero)
+    {
+      _planeMask &= ~(1<<i);
+    }
+  }
+  return _planeMask==0 ? INSIDE : INTERSECTING;
+}
+
+bool Frustum::operator==(const Frustum &_frustum) const
+{
+  for(int i=0; i<6; i++)
+  {
+    const ngl::Vec4 &a = m_planes[i];
+    const ngl::Vec4 &b = _frustum.m_planes[i];
+    if(a.m_x!=b.m_x || a.m_y!=b.m_y || a.m_z!=b.m_z || a.m_w!=b.m_w)
+    {
+      return false;
+    }
+  }
+  return true;
+}
@@ -1,5 +1,6 @@
 #include "InstanceCacheVAO.h"
 #include <iostream>
+#include <algorithm>
 namespace ngl
 {
   InstanceCacheVAO::~InstanceCacheVAO()
@@ -22,7 +23,7 @@ namespace ngl
     glDrawElementsInstanced(m_mode,
                             static_cast<GLsizei>(m_indicesCount),
                             m_indexType,
-                            static_cast<GLvoid *>(nullptr),
+                            reinterpret_cast<GLvoid *>(m_indexOffset),
                             m_instanceCount);
   }
 
@@ -34,14 +35,23 @@ namespace ngl
     }
     if( m_allocated ==true)
     {
-        glDeleteBuffers(1,&m_buffer);
-        glDeleteBuffers(1,&m_idxBuffer);
-        glDeleteBuffers(1,&m_transformBuffer);
+        deleteBuffers();
     }
     //glDeleteVertexArrays(1,&m_id);
     m_allocated=false;
     }
 
+  void InstanceCacheVAO::deleteBuffers()
+  {
+    // shared vertex and index buffers belong to whoever passed them to setSharedData
+    if(m_ownsBuffers)
+    {
+      glDeleteBuffers(1,&m_buffer);
+      glDeleteBuffers(1,&m_idxBuffer);
+    }
+    glDeleteBuffers(1,&m_transformBuffer);
+  }
+
 
   void InstanceCacheVAO::setData(const AbstractVAO::VertexData &_data)
   {
@@ -52,9 +62,7 @@ namespace ngl
     }
     if( m_allocated ==true)
     {
-        glDeleteBuffers(1,&m_buffer);
-        glDeleteBuffers(1,&m_idxBuffer);
-        glDeleteBuffers(1,&m_transformBuffer);
+        deleteBuffers();
     }
 
     // GLuint vboID;
@@ -81,14 +89,61 @@ namespace ngl
     // Now set the vertex attribute for the vertex array
     // so we can rebind the array buffer to the transform data
     setVertexAttributePointer(0,3,GL_FLOAT,12,0);
+    setTransformData(data.m_transformData, data.m_instanceCount, data.m_mode);
+
+    //and finally pass the remaining input variables to the VAO class
+    m_allocated=true;
+    m_ownsBuffers=true;
+    m_indexOffset=0;
+    m_indexType=data.m_indexType;
+  }
 
+  void InstanceCacheVAO::setSharedData(GLuint _vertexBuffer, GLuint _indexBuffer, unsigned int _indexStart,
+                                       unsigned int _indexCount, unsigned int _instanceCount,
+                                       const GLvoid *_transformData, GLenum _indexType, GLenum _transformUsage)
+  {
+    if(m_bound == false)
+    {
+      msg->addWarning("trying to set VOA data when unbound");
+    }
+    if( m_allocated ==true)
+    {
+        deleteBuffers();
+    }
+    m_buffer = _vertexBuffer;
+    m_idxBuffer = _indexBuffer;
+
+    // the element array binding is part of the VAO state, so binding the shared index buffer here is enough
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_idxBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    setVertexAttributePointer(0,3,GL_FLOAT,12,0);
+    setTransformData(_transformData, _instanceCount, _transformUsage);
+
+    size_t indexSize = sizeof(GLushort);
+    if(_indexType == GL_UNSIGNED_INT)
+    {
+      indexSize = sizeof(GLuint);
+    }
+    else if(_indexType == GL_UNSIGNED_BYTE)
+    {
+      indexSize = sizeof(GLubyte);
+    }
+    m_allocated=true;
+    m_ownsBuffers=false;
+    m_indexOffset=_indexStart*indexSize;
+    m_indexType=_indexType;
+    m_indicesCount=_indexCount;
+  }
+
+  void InstanceCacheVAO::setTransformData(const GLvoid *_transformData, unsigned int _instanceCount, GLenum _usage)
+  {
     // bind the transformBuffer data
     glGenBuffers(1, &m_transformBuffer);
     glBindBuffer(GL_ARRAY_BUFFER, m_transformBuffer);
     glBufferData(GL_ARRAY_BUFFER,
-                 sizeof(ngl::Mat4)*data.m_instanceCount,
-                 data.m_transformData,
-                 GL_STATIC_DRAW);
+                 sizeof(ngl::Mat4)*_instanceCount,
+                 _transformData,
+                 _usage);
 
     // set the array data for indices 1,2,3,4 as each row of the transform matrix
     // data is 64 bytes apart = sizeof(ngl::mat4)
@@ -104,10 +159,73 @@ namespace ngl
     glVertexAttribDivisor(3,1);
     glVertexAttribDivisor(4,1);
 
-    //and finally pass the remaining input variables to the VAO class
-    m_allocated=true;
-    m_indexType=data.m_indexType;
-    m_instanceCount = data.m_instanceCount;
+    m_instanceCount = _instanceCount;
+    m_transformCapacity = _instanceCount;
+  }
+
+  void InstanceCacheVAO::updateTransforms(const GLvoid *_transformData, unsigned int _instanceCount,
+                                          unsigned int _firstChanged)
+  {
+    if(m_allocated == false)
+    {
+      msg->addWarning("trying to update transforms of an unallocated VOA");
+      return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, m_transformBuffer);
+    if(_instanceCount > m_transformCapacity)
+    {
+      // respecifying the storage keeps the same buffer id, so the attribute pointers set up in setData stay valid,
+      // but the old contents are lost and everything has to be uploaded again
+      m_transformCapacity = std::max(_instanceCount, std::max(2*m_transformCapacity, 16u));
+      glBufferData(GL_ARRAY_BUFFER,
+                   sizeof(ngl::Mat4)*m_transformCapacity,
+                   nullptr,
+                   GL_DYNAMIC_DRAW);
+      _firstChanged = 0;
+    }
+    if(_firstChanged < _instanceCount)
+    {
+      glBufferSubData(GL_ARRAY_BUFFER,
+                      sizeof(ngl::Mat4)*_firstChanged,
+                      sizeof(ngl::Mat4)*(_instanceCount-_firstChanged),
+                      static_cast<const ngl::Mat4 *>(_transformData)+_firstChanged);
+    }
+    m_instanceCount = _instanceCount;
+  }
+
+  void InstanceCacheVAO::drawInstances(unsigned int _firstInstance, unsigned int _instanceCount)
+  {
+    if(m_allocated == false)
+    {
+      msg->addWarning("Warning trying to draw an unallocated VOA");
+      return;
+    }
+    if(_instanceCount == 0)
+    {
+      return;
+    }
+    // the attribute pointers are offset in floats, each transform being 16 floats
+    if(_firstInstance != 0)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, m_transformBuffer);
+      for(GLuint i=0; i<4; i++)
+      {
+        setVertexAttributePointer(1+i,4,GL_FLOAT,64,16*_firstInstance+4*i);
+      }
+    }
+    glDrawElementsInstanced(m_mode,
+                            static_cast<GLsizei>(m_indicesCount),
+                            m_indexType,
+                            reinterpret_cast<GLvoid *>(m_indexOffset),
+                            static_cast<GLsizei>(_instanceCount));
+    // then put the pointers back so that draw() starts from the first transform again
+    if(_firstInstance != 0)
+    {
+      for(GLuint i=0; i<4; i++)
+      {
+        setVertexAttributePointer(1+i,4,GL_FLOAT,64,4*i);
+      }
+    }
   }
 
   Real * InstanceCacheVAO::mapBuffer(unsigned int _index, GLenum _accessMode)
@@ -145,4 +145,111 @@ void LSystem::fillInstanceCache(int _numHeroTrees)
   }
 
   m_forestMode = false;
+  computeInstanceBounds();
+  computeLODChain();
+  m_simplifiedMeshes.clear();
+  if(m_bakeSimplifiedMeshes && computeSimplifiedMeshes()==false)
+  {
+    std::cout<<"Warning: some simplified meshes are over their triangle budget\n";
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::computeInstanceBounds()
+{
+  std::vector<ngl::Vec3> points;
+  std::vector<float> padding;
+  for(auto &ids : m_instanceCache)
+  {
+    for(auto &ages : ids)
+    {
+      for(auto &instance : ages)
+      {
+        //gather every point the instance draws (the indices are drawn as unsigned shorts)
+        points.clear();
+        padding.clear();
+        for(size_t i=instance.m_instanceStart; i<instance.m_instanceEnd; i++)
+        {
+          size_t index = size_t(GLushort(m_heroIndices[i]));
+          points.push_back(m_heroVertices[index]);
+          padding.push_back(0.5f*m_heroThicknessValues[index]);
+        }
+        for(size_t i=instance.m_instanceLeafStart; i<instance.m_instanceLeafEnd; i++)
+        {
+          //leaves are drawn as planes from the leaf vertex, half their width to either side and one length forwards
+          size_t index = size_t(GLushort(m_heroLeafIndices[i]));
+          ngl::Vec3 halfRight = m_heroLeafRightVectors[index]*0.5f;
+          ngl::Vec3 dir = m_heroLeafDirections[index];
+          points.push_back(m_heroLeafVertices[index]+halfRight);
+          points.push_back(m_heroLeafVertices[index]-halfRight);
+          points.push_back(m_heroLeafVertices[index]+halfRight+dir);
+          points.push_back(m_heroLeafVertices[index]-halfRight+dir);
+          padding.insert(padding.end(), 4, 0);
+        }
+        for(size_t i=instance.m_instancePolygonStart; i<instance.m_instancePolygonEnd; i++)
+        {
+          points.push_back(m_heroPolygonVertices[size_t(GLushort(m_heroPolygonIndices[i]))]);
+          padding.push_back(0);
+        }
+
+        if(points.size()==0)
+        {
+          instance.m_boundingCentre = ngl::Vec3(instance.m_transform.m_30, instance.m_transform.m_31,
+                                                instance.m_transform.m_32);
+          instance.m_boundingRadius = 0;
+          continue;
+        }
+
+        //centre the sphere on the bounding box of the points, then make it big enough to hold all of them
+        ngl::Vec3 min = points[0];
+        ngl::Vec3 max = points[0];
+        for(auto &p : points)
+        {
+          min.set(std::min(min.m_x,p.m_x), std::min(min.m_y,p.m_y), std::min(min.m_z,p.m_z));
+          max.set(std::max(max.m_x,p.m_x), std::max(max.m_y,p.m_y), std::max(max.m_z,p.m_z));
+        }
+        instance.m_boundingCentre = (min+max)*0.5f;
+        instance.m_boundingRadius = 0;
+        for(size_t i=0; i<points.size(); i++)
+        {
+          float distance = (points[i]-instance.m_boundingCentre).length() + padding[i];
+          instance.m_boundingRadius = std::max(instance.m_boundingRadius, distance);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LSystem::computeLODChain()
+{
+  m_LODMaxAges = {};
+  size_t generation = size_t(std::max(m_generation,0));
+  size_t numLevels = std::max(m_numLODLevels, size_t(1));
+  for(size_t i=0; i<numLevels; i++)
+  {
+    //the trunk (age 0) is always kept, and levels that wouldn't drop any more generations are skipped
+    size_t maxAge = generation - (generation*i)/numLevels;
+    if(m_LODMaxAges.size()==0 || maxAge<m_LODMaxAges.back())
+    {
+      m_LODMaxAges.push_back(maxAge);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bool LSystem::computeSimplifiedMeshes()
+{
+  MeshSimplifier simplifier;
+  m_simplifiedMeshes.clear();
+  bool withinBudget = true;
+  for(auto fraction : m_simplificationFractions)
+  {
+    m_simplifiedMeshes.push_back(MeshSimplifier::Mesh());
+    withinBudget &= simplifier.buildLOD(*this, fraction, m_simplifiedMeshes.back());
+  }
+  return withinBudget;
 }
@@ -6,6 +6,8 @@
 #include "MainWindow.h"
 #include "ui_MainWindow.h"
 #include <QString>
+#include <QFileDialog>
+#include <algorithm>
 
 MainWindow::MainWindow(QWidget *parent) :
   QMainWindow(parent),
@@ -72,6 +74,8 @@ MainWindow::MainWindow(QWidget *parent) :
   //------------------------------------------------------------------------------------
   connect(m_ui->m_terrainSize, SIGNAL(valueChanged(double)), m_gl, SLOT(setTerrainSize(double)));
   connect(m_ui->m_LOD, SIGNAL(valueChanged(int)), m_gl, SLOT(setLOD(int)));
+  connect(m_ui->m_terrainPageStride, SIGNAL(valueChanged(int)), m_gl, SLOT(setTerrainPageStride(int)));
+  connect(m_ui->m_terrainUVRepeat, SIGNAL(valueChanged(int)), m_gl, SLOT(setTerrainUVRepeat(int)));
   connect(m_ui->m_octaves, SIGNAL(valueChanged(int)), m_gl, SLOT(setOctaves(int)));
   connect(m_ui->m_frequency, SIGNAL(valueChanged(double)), m_gl, SLOT(setFrequency(double)));
   connect(m_ui->m_lacunarity, SIGNAL(valueChanged(double)), m_gl, SLOT(setLacunarity(double)));
@@ -88,6 +92,9 @@ MainWindow::MainWindow(QWidget *parent) :
   connect(m_ui->m_treeGenMethod, SIGNAL(currentIndexChanged(int)), m_gl, SLOT(toggleTreeGenMethod(int)));
   connect(m_ui->m_paintBrush, SIGNAL(currentIndexChanged(int)), m_gl, SLOT(setPaintBrush(int)));
   connect(m_ui->m_treeSpacing, SIGNAL(valueChanged(double)), m_gl, SLOT(setTreeSpacing(double)));
+  //painting and poisson disk scattering share the same tree spacing, so keep their spin boxes in sync
+  connect(m_ui->m_treeSpacing, SIGNAL(valueChanged(double)), m_ui->m_scatterSpacing, SLOT(setValue(double)));
+  connect(m_ui->m_scatterSpacing, SIGNAL(valueChanged(double)), m_ui->m_treeSpacing, SLOT(setValue(double)));
   connect(m_ui->m_erasePaint, SIGNAL(clicked()), m_gl, SLOT(erasePaint()));
   connect(m_ui->m_paint, SIGNAL(clicked(bool)), m_gl, SLOT(toggleTreePaintMode(bool)));
   connect(m_ui->m_numTrees_1, SIGNAL(valueChanged(int)), m_gl, SLOT(setNumTrees1(int)));
@@ -96,11 +103,16 @@ MainWindow::MainWindow(QWidget *parent) :
   connect(m_ui->m_updateForest, SIGNAL(clicked()), m_gl, SLOT(remakeForest()));
 
   connect(m_ui->m_numHeroTrees, SIGNAL(valueChanged(int)), m_gl, SLOT(setNumHeroTrees(int)));
+  connect(m_ui->m_bakeSimplifiedMeshes, SIGNAL(toggled(bool)), m_gl, SLOT(toggleBakeSimplifiedMeshes(bool)));
   connect(m_ui->m_seed_forest, SIGNAL(valueChanged(int)), m_gl, SLOT(setSeedForest(int)));
   connect(m_ui->m_seedToggle_forest, SIGNAL(stateChanged(int)), m_gl, SLOT(seedToggleForest(int)));
   connect(m_ui->m_instancingProb, SIGNAL(valueChanged(double)), m_gl, SLOT(setInstancingProb(double)));
   connect(m_ui->m_resetCamera_terrain, SIGNAL(clicked()), m_gl, SLOT(resetCamera()));
   connect(m_ui->m_wireframe_terrain, SIGNAL(toggled(bool)), m_gl, SLOT(toggleTerrainWireframe(bool)));
+  connect(m_ui->m_parallelRefinement_terrain, SIGNAL(toggled(bool)), m_gl, SLOT(toggleTerrainParallelRefinement(bool)));
+  connect(m_ui->m_cull_forest, SIGNAL(toggled(bool)), m_gl, SLOT(toggleForestCulling(bool)));
+  connect(m_ui->m_LOD_forest, SIGNAL(toggled(bool)), m_gl, SLOT(toggleForestLOD(bool)));
+  connect(m_ui->m_multiDraw_forest, SIGNAL(toggled(bool)), m_gl, SLOT(toggleForestMultiDraw(bool)));
 
 }
 
@@ -129,11 +141,33 @@ void MainWindow::on_m_seedToggle_forest_stateChanged(int _clicked)
 
 void MainWindow::on_m_treeGenMethod_currentIndexChanged(int _index)
 {
-    m_ui->m_treeGenMethodStack->setCurrentIndex(_index);
-    if(_index==1)
+    //all scattering methods share the same page of settings
+    m_ui->m_treeGenMethodStack->setCurrentIndex(std::min(_index,1));
+    m_ui->m_scatterSpacing->setEnabled(_index==2);
+    if(_index>=1)
     {
       m_ui->m_paint->setChecked(0);
       m_gl->toggleTreePaintMode(false);
     }
 }
 
+void MainWindow::on_m_importTerrain_clicked()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, "Import Terrain", QString(),
+                                                    "Terrains (*.terrain *.raw *.pgm);;All Files (*)");
+    if(!fileName.isEmpty())
+    {
+      m_gl->importTerrain(fileName);
+    }
+}
+
+void MainWindow::on_m_exportTerrain_clicked()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, "Export Terrain", QString(),
+                                                    "Terrain (*.terrain);;16-bit Raw Heightmap (*.raw);;"
+                                                    "16-bit PGM Heightmap (*.pgm)");
+    if(!fileName.isEmpty())
+    {
+      m_gl->exportTerrain(fileName);
+    }
+}
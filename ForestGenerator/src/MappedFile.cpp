@@ -0,0 +1,93 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file MappedFile.cpp
+/// @brief implementation file for MappedFile class
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+#include "MappedFile.h"
+
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bool MappedFile::open(const std::string &_fileName)
+{
+  close();
+#ifndef _WIN32
+  int file = ::open(_fileName.c_str(), O_RDONLY);
+  if(file<0)
+  {
+    return false;
+  }
+  struct stat fileStats;
+  if(fstat(file, &fileStats)!=0)
+  {
+    ::close(file);
+    return false;
+  }
+  m_size = size_t(fileStats.st_size);
+  //an empty file can't be mapped, but is still opened successfully
+  if(m_size>0)
+  {
+    m_mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if(m_mapping == MAP_FAILED)
+    {
+      m_mapping = nullptr;
+      m_size = 0;
+      ::close(file);
+      return false;
+    }
+  }
+  //the mapping stays valid after the file is closed
+  ::close(file);
+  return true;
+#else
+  std::ifstream file(_fileName, std::ios::binary);
+  if(!file)
+  {
+    return false;
+  }
+  m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  m_size = m_buffer.size();
+  return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#ifndef _WIN32
+  if(m_mapping)
+  {
+    munmap(m_mapping, m_size);
+  }
+#endif
+  m_mapping = nullptr;
+  m_size = 0;
+  m_buffer.clear();
+}
+
+const unsigned char *MappedFile::getData() const
+{
+  if(m_mapping)
+  {
+    return static_cast<const unsigned char*>(m_mapping);
+  }
+  return m_buffer.empty() ? nullptr : m_buffer.data();
+}
+
+size_t MappedFile::getSize() const
+{
+  return m_size;
+}
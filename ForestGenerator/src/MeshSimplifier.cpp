@@ -0,0 +1,550 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file MeshSimplifier.cpp
+/// @brief implementation file for MeshSimplifier class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <math.h>
+#include <map>
+#include <tuple>
+#include <queue>
+#include <algorithm>
+#include <unordered_map>
+#include "MeshSimplifier.h"
+#include "LSystem.h"
+
+
+size_t MeshSimplifier::Mesh::getNumTriangles() const
+{
+  return m_indices.size()/3;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void MeshSimplifier::Quadric::addPlane(const ngl::Vec3 &_normal, const ngl::Vec3 &_point, double _weight)
+{
+  double a = double(_normal.m_x);
+  double b = double(_normal.m_y);
+  double c = double(_normal.m_z);
+  double d = -(a*double(_point.m_x) + b*double(_point.m_y) + c*double(_point.m_z));
+  double plane[10] = {a*a, a*b, a*c, a*d, b*b, b*c, b*d, c*c, c*d, d*d};
+  for(int i=0; i<10; i++)
+  {
+    m_q[i] += _weight*plane[i];
+  }
+}
+
+void MeshSimplifier::Quadric::add(const Quadric &_q)
+{
+  for(int i=0; i<10; i++)
+  {
+    m_q[i] += _q.m_q[i];
+  }
+}
+
+double MeshSimplifier::Quadric::evaluate(const ngl::Vec3 &_point) const
+{
+  double x = double(_point.m_x);
+  double y = double(_point.m_y);
+  double z = double(_point.m_z);
+  return m_q[0]*x*x + 2*m_q[1]*x*y + 2*m_q[2]*x*z + 2*m_q[3]*x
+                    + m_q[4]*y*y   + 2*m_q[5]*y*z + 2*m_q[6]*y
+                                   + m_q[7]*z*z   + 2*m_q[8]*z
+                                                  + m_q[9];
+}
+
+bool MeshSimplifier::Quadric::findMinimum(ngl::Vec3 &_point) const
+{
+  //the gradient is zero where A*p = -b, with A the upper left 3x3 block and b the last column - solve by Cramer's rule
+  double a00 = m_q[0], a01 = m_q[1], a02 = m_q[2];
+  double a11 = m_q[4], a12 = m_q[5], a22 = m_q[7];
+  double b0 = -m_q[3], b1 = -m_q[6], b2 = -m_q[8];
+  double det = a00*(a11*a22-a12*a12) - a01*(a01*a22-a12*a02) + a02*(a01*a12-a11*a02);
+  if(fabs(det) < 1e-12)
+  {
+    return false;
+  }
+  double x = b0*(a11*a22-a12*a12) - a01*(b1*a22-a12*b2) + a02*(b1*a12-a11*b2);
+  double y = a00*(b1*a22-b2*a12) - b0*(a01*a22-a12*a02) + a02*(a01*b2-b1*a02);
+  double z = a00*(a11*b2-a12*b1) - a01*(a01*b2-b1*a02) + b0*(a01*a12-a11*a02);
+  _point = ngl::Vec3(float(x/det), float(y/det), float(z/det));
+  return true;
+}
+
+bool MeshSimplifier::Collapse::operator<(const Collapse &_other) const
+{
+  return m_cost > _other.m_cost;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+MeshSimplifier::Mesh MeshSimplifier::bakeTree(const LSystem &_treeType, float _leafClusterSize) const
+{
+  Mesh mesh;
+  RESIZE_CACHE_BY_OTHER_CACHE(mesh.m_instanceRanges, _treeType.m_instanceCache)
+  std::vector<LeafCard> leaves;
+  std::unordered_map<size_t,GLuint> polygonVertices;
+
+  for(size_t id=0; id<mesh.m_instanceRanges.size(); id++)
+  {
+    for(size_t age=0; age<mesh.m_instanceRanges[id].size(); age++)
+    {
+      for(size_t index=0; index<mesh.m_instanceRanges[id][age].size(); index++)
+      {
+        const Instance &instance = _treeType.m_instanceCache[id][age][index];
+        Range &range = mesh.m_instanceRanges[id][age][index];
+        range.m_start = mesh.m_indices.size();
+
+        bakeBranches(_treeType, instance.m_instanceStart, instance.m_instanceEnd, mesh);
+
+        //polygons are already triangles, but every instance needs its own copy of their vertices
+        polygonVertices.clear();
+        for(size_t i=instance.m_instancePolygonStart; i<instance.m_instancePolygonEnd; i++)
+        {
+          size_t vertex = size_t(GLushort(_treeType.m_heroPolygonIndices[i]));
+          auto it = polygonVertices.find(vertex);
+          if(it == polygonVertices.end())
+          {
+            it = polygonVertices.insert({vertex, GLuint(mesh.m_vertices.size())}).first;
+            mesh.m_vertices.push_back(_treeType.m_heroPolygonVertices[vertex]);
+            mesh.m_fixedVertices.push_back(false);
+          }
+          mesh.m_indices.push_back(it->second);
+        }
+
+        leaves.clear();
+        for(size_t i=instance.m_instanceLeafStart; i<instance.m_instanceLeafEnd; i++)
+        {
+          size_t vertex = size_t(GLushort(_treeType.m_heroLeafIndices[i]));
+          leaves.push_back({_treeType.m_heroLeafVertices[vertex],
+                            _treeType.m_heroLeafDirections[vertex],
+                            _treeType.m_heroLeafRightVectors[vertex]});
+        }
+        if(_leafClusterSize>0)
+        {
+          leaves = clusterLeaves(leaves, _leafClusterSize);
+        }
+        for(auto &leaf : leaves)
+        {
+          bakeLeafCard(leaf, mesh);
+        }
+
+        range.m_end = mesh.m_indices.size();
+      }
+    }
+  }
+
+  return mesh;
+}
+
+void MeshSimplifier::bakeBranches(const LSystem &_treeType, size_t _start, size_t _end, Mesh &_mesh) const
+{
+  //segments meeting at a hero vertex share one ring of vertices around it, so the tubes of a branch are connected
+  std::unordered_map<size_t,GLuint> rings;
+  for(size_t i=_start; i+1<_end; i+=2)
+  {
+    size_t ends[2] = {size_t(GLushort(_treeType.m_heroIndices[i])), size_t(GLushort(_treeType.m_heroIndices[i+1]))};
+    ngl::Vec3 dir = _treeType.m_heroVertices[ends[1]]-_treeType.m_heroVertices[ends[0]];
+    if(dir.length()==0)
+    {
+      continue;
+    }
+    dir.normalize();
+
+    GLuint ringStarts[2];
+    for(int j=0; j<2; j++)
+    {
+      auto it = rings.find(ends[j]);
+      if(it != rings.end())
+      {
+        ringStarts[j] = it->second;
+        continue;
+      }
+      //like the geometry shader, the ring is built around the right vector (made perpendicular to the segment)
+      ngl::Vec3 N = _treeType.m_heroRightVectors[ends[j]];
+      N -= dir*dir.dot(N);
+      if(N.length()<0.0001f)
+      {
+        N = fabsf(dir.m_x)<0.9f ? ngl::Vec3(1,0,0) : ngl::Vec3(0,1,0);
+        N -= dir*dir.dot(N);
+      }
+      N.normalize();
+      ngl::Vec3 E = dir.cross(N);
+      float radius = 0.5f*_treeType.m_heroThicknessValues[ends[j]];
+
+      ringStarts[j] = GLuint(_mesh.m_vertices.size());
+      rings[ends[j]] = ringStarts[j];
+      for(size_t k=0; k<m_numSides; k++)
+      {
+        float angle = float(2*M_PI*k)/m_numSides;
+        _mesh.m_vertices.push_back(_treeType.m_heroVertices[ends[j]] + (N*cosf(angle) + E*sinf(angle))*radius);
+        _mesh.m_fixedVertices.push_back(false);
+      }
+    }
+
+    for(size_t k=0; k<m_numSides; k++)
+    {
+      GLuint a0 = ringStarts[0]+GLuint(k);
+      GLuint a1 = ringStarts[0]+GLuint((k+1)%m_numSides);
+      GLuint b0 = ringStarts[1]+GLuint(k);
+      GLuint b1 = ringStarts[1]+GLuint((k+1)%m_numSides);
+      _mesh.m_indices.insert(_mesh.m_indices.end(), {a0, a1, b0, b0, a1, b1});
+    }
+  }
+}
+
+void MeshSimplifier::bakeLeafCard(const LeafCard &_card, Mesh &_mesh) const
+{
+  //the corners in the same order as the leaf geometry shaders emit their triangle strip
+  GLuint first = GLuint(_mesh.m_vertices.size());
+  ngl::Vec3 halfRight = _card.m_right*0.5f;
+  _mesh.m_vertices.push_back(_card.m_position + halfRight);
+  _mesh.m_vertices.push_back(_card.m_position + halfRight + _card.m_direction);
+  _mesh.m_vertices.push_back(_card.m_position - halfRight);
+  _mesh.m_vertices.push_back(_card.m_position - halfRight + _card.m_direction);
+  _mesh.m_fixedVertices.insert(_mesh.m_fixedVertices.end(), 4, true);
+  _mesh.m_indices.insert(_mesh.m_indices.end(), {first, first+1, first+2, first+2, first+1, first+3});
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+std::vector<MeshSimplifier::LeafCard> MeshSimplifier::clusterLeaves(const std::vector<LeafCard> &_leaves,
+                                                                    float _cellSize)
+{
+  std::vector<LeafCard> sums;
+  std::vector<float> directionLengths;
+  std::vector<float> rightLengths;
+  std::vector<size_t> counts;
+  std::map<std::tuple<int,int,int>,size_t> cells;
+  for(auto &leaf : _leaves)
+  {
+    std::tuple<int,int,int> cell(int(floorf(leaf.m_position.m_x/_cellSize)),
+                                 int(floorf(leaf.m_position.m_y/_cellSize)),
+                                 int(floorf(leaf.m_position.m_z/_cellSize)));
+    auto it = cells.find(cell);
+    if(it == cells.end())
+    {
+      it = cells.insert({cell, sums.size()}).first;
+      sums.push_back({ngl::Vec3(), ngl::Vec3(), ngl::Vec3()});
+      directionLengths.push_back(0);
+      rightLengths.push_back(0);
+      counts.push_back(0);
+    }
+    size_t c = it->second;
+    sums[c].m_position += leaf.m_position;
+    sums[c].m_direction += leaf.m_direction;
+    sums[c].m_right += leaf.m_right;
+    directionLengths[c] += leaf.m_direction.length();
+    rightLengths[c] += leaf.m_right.length();
+    counts[c]++;
+  }
+
+  std::vector<LeafCard> cards;
+  cards.reserve(sums.size());
+  for(size_t c=0; c<sums.size(); c++)
+  {
+    float n = float(counts[c]);
+    float scale = sqrtf(n);
+    LeafCard card = {sums[c].m_position/n, sums[c].m_direction, sums[c].m_right};
+    //leaves pointing in opposite directions can cancel out, in which case the card keeps the length of the average
+    //leaf in an arbitrary direction perpendicular to its right vector
+    if(card.m_right.length()>0)
+    {
+      card.m_right.normalize();
+    }
+    else
+    {
+      card.m_right = ngl::Vec3(1,0,0);
+    }
+    card.m_direction -= card.m_right*card.m_right.dot(card.m_direction);
+    if(card.m_direction.length()>0)
+    {
+      card.m_direction.normalize();
+    }
+    else
+    {
+      card.m_direction = card.m_right.cross(ngl::Vec3(0,0,1));
+      if(card.m_direction.length()==0)
+      {
+        card.m_direction = ngl::Vec3(0,1,0);
+      }
+      card.m_direction.normalize();
+    }
+    card.m_direction *= scale*directionLengths[c]/n;
+    card.m_right *= scale*rightLengths[c]/n;
+    cards.push_back(card);
+  }
+  return cards;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+MeshSimplifier::Collapse MeshSimplifier::findCollapse(GLuint _a, GLuint _b, const std::vector<ngl::Vec3> &_vertices,
+                                                      const std::vector<Quadric> &_quadrics,
+                                                      const std::vector<size_t> &_versions) const
+{
+  Quadric q = _quadrics[_a];
+  q.add(_quadrics[_b]);
+  const ngl::Vec3 &a = _vertices[_a];
+  const ngl::Vec3 &b = _vertices[_b];
+
+  //try the optimal position first, but only trust it if it's near the edge (it can be far away when the quadric is
+  //nearly singular, eg. on flat or straight parts of the mesh) - otherwise pick the best of the ends and the middle
+  std::vector<ngl::Vec3> positions = {a, b, (a+b)*0.5f};
+  ngl::Vec3 optimal;
+  if(q.findMinimum(optimal) && (optimal-(a+b)*0.5f).length() <= (b-a).length())
+  {
+    positions.push_back(optimal);
+  }
+  Collapse collapse = {q.evaluate(a), _a, _b, _versions[_a], _versions[_b], a};
+  for(auto &p : positions)
+  {
+    double cost = q.evaluate(p);
+    if(cost<collapse.m_cost)
+    {
+      collapse.m_cost = cost;
+      collapse.m_position = p;
+    }
+  }
+  return collapse;
+}
+
+MeshSimplifier::Mesh MeshSimplifier::simplify(const Mesh &_mesh, size_t _targetTriangles) const
+{
+  std::vector<ngl::Vec3> vertices = _mesh.m_vertices;
+  std::vector<GLuint> indices = _mesh.m_indices;
+  size_t numVertices = vertices.size();
+  size_t numTriangles = _mesh.getNumTriangles();
+  size_t remainingTriangles = numTriangles;
+
+  std::vector<std::vector<size_t>> vertexTriangles(numVertices);
+  std::vector<bool> removedTriangles(numTriangles, false);
+  std::vector<bool> removedVertices(numVertices, false);
+  std::vector<size_t> versions(numVertices, 0);
+  std::vector<Quadric> quadrics(numVertices);
+
+  //each vertex starts with the planes of its triangles, weighted by area, and every edge is counted to find the open
+  //edges (those used by only one triangle)
+  std::unordered_map<uint64_t,size_t> edges;
+  for(size_t t=0; t<numTriangles; t++)
+  {
+    const GLuint *tri = &indices[3*t];
+    ngl::Vec3 normal = (vertices[tri[1]]-vertices[tri[0]]).cross(vertices[tri[2]]-vertices[tri[0]]);
+    float area = 0.5f*normal.length();
+    for(int i=0; i<3; i++)
+    {
+      vertexTriangles[tri[i]].push_back(t);
+      if(area>0)
+      {
+        quadrics[tri[i]].addPlane(normal/(2*area), vertices[tri[0]], double(area));
+      }
+      GLuint e0 = std::min(tri[i], tri[(i+1)%3]);
+      GLuint e1 = std::max(tri[i], tri[(i+1)%3]);
+      //store the triangle along with the count so that the open edges know which triangle they belong to
+      size_t &edge = edges[(uint64_t(e0)<<32) | e1];
+      edge = (edge==0) ? 3*t+size_t(i)+1 : SIZE_MAX;
+    }
+  }
+  //open edges add a plane through the edge perpendicular to their triangle, to hold the outline in place
+  for(auto &edge : edges)
+  {
+    if(edge.second == SIZE_MAX)
+    {
+      continue;
+    }
+    size_t t = (edge.second-1)/3;
+    int i = int((edge.second-1)%3);
+    const GLuint *tri = &indices[3*t];
+    ngl::Vec3 p0 = vertices[tri[i]];
+    ngl::Vec3 p1 = vertices[tri[(i+1)%3]];
+    ngl::Vec3 normal = (vertices[tri[1]]-vertices[tri[0]]).cross(vertices[tri[2]]-vertices[tri[0]]);
+    ngl::Vec3 boundaryNormal = (p1-p0).cross(normal);
+    if(boundaryNormal.length()==0)
+    {
+      continue;
+    }
+    boundaryNormal.normalize();
+    double weight = double(m_boundaryWeight)*double((p1-p0).lengthSquared());
+    quadrics[tri[i]].addPlane(boundaryNormal, p0, weight);
+    quadrics[tri[(i+1)%3]].addPlane(boundaryNormal, p0, weight);
+  }
+
+  std::priority_queue<Collapse> queue;
+  for(auto &edge : edges)
+  {
+    GLuint a = GLuint(edge.first>>32);
+    GLuint b = GLuint(edge.first & 0xffffffff);
+    if(!_mesh.m_fixedVertices[a] && !_mesh.m_fixedVertices[b])
+    {
+      queue.push(findCollapse(a, b, vertices, quadrics, versions));
+    }
+  }
+
+  std::vector<GLuint> neighbours;
+  while(remainingTriangles>_targetTriangles && !queue.empty())
+  {
+    Collapse collapse = queue.top();
+    queue.pop();
+    GLuint a = collapse.m_a;
+    GLuint b = collapse.m_b;
+    if(removedVertices[a] || removedVertices[b] || versions[a]!=collapse.m_versionA || versions[b]!=collapse.m_versionB)
+    {
+      continue;
+    }
+
+    //reject the collapse if it would flip any of the triangles that survive it
+    bool flips = false;
+    for(GLuint v : {a, b})
+    {
+      for(size_t t : vertexTriangles[v])
+      {
+        const GLuint *tri = &indices[3*t];
+        bool hasA = (tri[0]==a || tri[1]==a || tri[2]==a);
+        bool hasB = (tri[0]==b || tri[1]==b || tri[2]==b);
+        if(removedTriangles[t] || (hasA && hasB))
+        {
+          continue;
+        }
+        ngl::Vec3 p[3];
+        for(int i=0; i<3; i++)
+        {
+          p[i] = (tri[i]==v) ? collapse.m_position : vertices[tri[i]];
+        }
+        ngl::Vec3 oldNormal = (vertices[tri[1]]-vertices[tri[0]]).cross(vertices[tri[2]]-vertices[tri[0]]);
+        ngl::Vec3 newNormal = (p[1]-p[0]).cross(p[2]-p[0]);
+        if(oldNormal.dot(newNormal)<=0 && oldNormal.length()>0)
+        {
+          flips = true;
+          break;
+        }
+      }
+      if(flips)
+      {
+        break;
+      }
+    }
+    if(flips)
+    {
+      continue;
+    }
+
+    //move a and give it the triangles of b, removing the ones that used both
+    vertices[a] = collapse.m_position;
+    quadrics[a].add(quadrics[b]);
+    removedVertices[b] = true;
+    for(size_t t : vertexTriangles[b])
+    {
+      if(removedTriangles[t])
+      {
+        continue;
+      }
+      GLuint *tri = &indices[3*t];
+      if(tri[0]==a || tri[1]==a || tri[2]==a)
+      {
+        removedTriangles[t] = true;
+        remainingTriangles--;
+        continue;
+      }
+      for(int i=0; i<3; i++)
+      {
+        if(tri[i]==b)
+        {
+          tri[i] = a;
+        }
+      }
+      vertexTriangles[a].push_back(t);
+    }
+    vertexTriangles[b].clear();
+    vertexTriangles[a].erase(std::remove_if(vertexTriangles[a].begin(), vertexTriangles[a].end(),
+                                            [&removedTriangles](size_t _t){return removedTriangles[_t];}),
+                             vertexTriangles[a].end());
+    versions[a]++;
+
+    //every edge around a has changed cost
+    neighbours.clear();
+    for(size_t t : vertexTriangles[a])
+    {
+      for(int i=0; i<3; i++)
+      {
+        GLuint v = indices[3*t+size_t(i)];
+        if(v!=a && !_mesh.m_fixedVertices[v] && std::find(neighbours.begin(), neighbours.end(), v)==neighbours.end())
+        {
+          neighbours.push_back(v);
+        }
+      }
+    }
+    for(GLuint v : neighbours)
+    {
+      queue.push(findCollapse(a, v, vertices, quadrics, versions));
+    }
+  }
+
+  //copy the surviving triangles instance by instance, keeping only the vertices they use
+  Mesh simplified;
+  RESIZE_CACHE_BY_OTHER_CACHE(simplified.m_instanceRanges, _mesh.m_instanceRanges)
+  std::vector<GLuint> newIndices(numVertices, GLuint(-1));
+  for(size_t id=0; id<_mesh.m_instanceRanges.size(); id++)
+  {
+    for(size_t age=0; age<_mesh.m_instanceRanges[id].size(); age++)
+    {
+      for(size_t index=0; index<_mesh.m_instanceRanges[id][age].size(); index++)
+      {
+        const Range &oldRange = _mesh.m_instanceRanges[id][age][index];
+        Range &range = simplified.m_instanceRanges[id][age][index];
+        range.m_start = simplified.m_indices.size();
+        for(size_t i=oldRange.m_start; i<oldRange.m_end; i++)
+        {
+          if(removedTriangles[i/3])
+          {
+            continue;
+          }
+          GLuint v = indices[i];
+          if(newIndices[v] == GLuint(-1))
+          {
+            newIndices[v] = GLuint(simplified.m_vertices.size());
+            simplified.m_vertices.push_back(vertices[v]);
+            simplified.m_fixedVertices.push_back(_mesh.m_fixedVertices[v]);
+          }
+          simplified.m_indices.push_back(newIndices[v]);
+        }
+        range.m_end = simplified.m_indices.size();
+      }
+    }
+  }
+  return simplified;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bool MeshSimplifier::buildLOD(const LSystem &_treeType, float _fraction, Mesh &_lod) const
+{
+  Mesh mesh = bakeTree(_treeType, 0);
+  size_t numLeaves = size_t(std::count(mesh.m_fixedVertices.begin(), mesh.m_fixedVertices.end(), true)/4);
+  size_t numBranchTriangles = mesh.getNumTriangles()-2*numLeaves;
+  size_t target = size_t(_fraction*float(mesh.getNumTriangles()));
+  size_t leafTarget = size_t(_fraction*float(2*numLeaves));
+
+  //start by clustering leaves that overlap, then keep doubling the cells until the leaves fit their share
+  float cellSize = 0;
+  for(auto &direction : _treeType.m_heroLeafDirections)
+  {
+    cellSize += direction.length()/float(_treeType.m_heroLeafDirections.size());
+  }
+  size_t numLeafTriangles = 2*numLeaves;
+  for(size_t pass=0; pass<m_maxClusteringPasses && numLeafTriangles>leafTarget && cellSize>0; pass++)
+  {
+    mesh = bakeTree(_treeType, cellSize);
+    numLeafTriangles = 2*size_t(std::count(mesh.m_fixedVertices.begin(), mesh.m_fixedVertices.end(), true)/4);
+    cellSize *= 2;
+  }
+
+  //the branches and polygons get whatever the leaves leave of the budget - leaves are only clustered within their
+  //instance, so if they can't fit the budget on their own the branches are simplified to their own share instead
+  size_t branchTarget = size_t(_fraction*float(numBranchTriangles));
+  if(target>numLeafTriangles)
+  {
+    branchTarget = target-numLeafTriangles;
+  }
+  _lod = simplify(mesh, numLeafTriangles+branchTarget);
+  //the +1 allows for the rounding down of the target
+  return _lod.getNumTriangles() <= target+1;
+}
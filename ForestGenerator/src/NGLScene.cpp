@@ -5,6 +5,8 @@
 
 #include <QMouseEvent>
 #include <QGuiApplication>
+#include <QStandardPaths>
+#include <QDir>
 
 #include <ngl/NGLInit.h>
 #include <ngl/VAOFactory.h>
@@ -33,22 +35,27 @@ NGLScene::NGLScene(QWidget *_parent) : QOpenGLWidget( _parent )
 
   //initialise LSystems, terrain and forests
   initializeLSystems();
+  //the paged heightmap can be regenerated at any time, so it belongs in the cache rather than the working directory
+  QString cacheDirectory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+  if(cacheDirectory.isEmpty() || !QDir().mkpath(cacheDirectory))
+  {
+    cacheDirectory = QDir::tempPath();
+  }
+  m_terrainPageFile = QDir(cacheDirectory).filePath("terrain.pages").toStdString();
   m_terrainGen = TerrainGenerator(m_terrainDimension, m_width);
-  m_scatteredForest = Forest(m_LSystems, m_width,
-                    m_numTrees, m_numHeroTrees, m_terrainGen,
-                    m_forestSeed, m_forestUseSeed);
-  m_paintedForest = Forest(m_LSystems, m_numHeroTrees,
-                           m_forestSeed, m_forestUseSeed);
-  m_terrainGen.generate();
-  m_terrain = TerrainData(m_terrainGen);
-
-  //resize VAO caches
-  m_forestVAOs.resize(m_numTreeTabs);
-  m_forestLeafVAOs.resize(m_numTreeTabs);
-  m_forestPolygonVAOs.resize(m_numTreeTabs);
-  m_paintedForestVAOs.resize(m_numTreeTabs);
-  m_paintedForestLeafVAOs.resize(m_numTreeTabs);
-  m_paintedForestPolygonVAOs.resize(m_numTreeTabs);
+  if(m_terrainStartupFile.empty() || !loadTerrain(m_terrainStartupFile))
+  {
+    generateTerrain();
+  }
+  updateTreeTypes();
+  m_scatteredForest = Forest(m_treeTypes, m_width,
+                    m_numTrees, m_terrainHeights,
+                    m_forestSeed, m_forestUseSeed,
+                    m_usePoissonDisk, std::vector<float>(m_numTreeTabs, m_minTreeDist));
+  m_paintedForest = Forest(m_treeTypes, m_forestSeed, m_forestUseSeed);
+  m_paintedForestVAOs.m_transformUsage = GL_DYNAMIC_DRAW;
+  m_forestLOD.m_distances = {500, 1000, 2000};
+
 
   //initialise cameras and mouse transforms
   m_cameras.resize(m_numSuperTabs);
@@ -72,7 +79,7 @@ NGLScene::~NGLScene()
 {
   std::cout<<"Shutting down NGL, removing VAO's and Shaders\n";
   m_gridVAO->removeVAO();
-  m_terrainVAO->removeVAO();
+  removeTerrainVAO();
   m_paintLineVAO->removeVAO();
   for(size_t i=0; i<m_numTreeTabs; i++)
   {
@@ -80,17 +87,9 @@ NGLScene::~NGLScene()
     m_leafVAOs[i]->removeVAO();
     m_polygonVAOs[i]->removeVAO();
   }
-  for(size_t t=0; t<m_numTreeTabs; t++)
-  {
-    FOR_EACH_ELEMENT(m_forestVAOs[t],
-                     m_forestVAOs[t][ID][AGE][INDEX]->removeVAO();
-                     m_forestLeafVAOs[t][ID][AGE][INDEX]->removeVAO();
-                     m_forestPolygonVAOs[t][ID][AGE][INDEX]->removeVAO())
-    FOR_EACH_ELEMENT(m_paintedForestVAOs[t],
-                     m_paintedForestVAOs[t][ID][AGE][INDEX]->removeVAO();
-                     m_paintedForestLeafVAOs[t][ID][AGE][INDEX]->removeVAO();
-                     m_paintedForestPolygonVAOs[t][ID][AGE][INDEX]->removeVAO())
-  }
+  removeForestVAOs(m_scatteredForestVAOs);
+  removeForestVAOs(m_paintedForestVAOs);
+  removeForestTileVAOs();
 }
 
 //------------------------------------------------------------------------------------------------------------------------
@@ -115,6 +114,14 @@ void NGLScene::initializeGL()
   glEnable(GL_DEPTH_TEST);
   // enable multisampling for smoother drawing
   glEnable(GL_MULTISAMPLE);
+  // multi-draw indirect needs OpenGL 4.3, which we don't get on every platform, so check what the context gives us
+#ifdef GL_VERSION_4_3
+  GLint majorVersion = 0;
+  GLint minorVersion = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+  glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
+  m_supportsMultiDraw = majorVersion>4 || (majorVersion==4 && minorVersion>=3);
+#endif
   // Now we will create a basic camera from the graphics library using the currently selected camera
   m_view=ngl::lookAt(m_currentCamera->m_from, m_currentCamera->m_to, m_currentCamera->m_up);
   // set the shape using FOV 45 Aspect Ratio based on Width and Height
@@ -153,20 +160,311 @@ void NGLScene::drawVAO(std::unique_ptr<ngl::AbstractVAO> &_VAO)
   _VAO->unbind();
 }
 
+void NGLScene::drawForestVAOs(ForestVAOs &_vaos)
+{
+  for(size_t t=0; t<_vaos.m_VAOs.size(); t++)
+  {
+    FOR_EACH_ELEMENT(_vaos.m_VAOs[t], drawForestSlot(_vaos,t,ID,AGE,INDEX))
+  }
+}
+
+void NGLScene::drawForestSlot(ForestVAOs &_vaos, size_t _treeNum, size_t _id, size_t _age, size_t _index)
+{
+  ngl::ShaderLib *shader=ngl::ShaderLib::instance();
+  ngl::InstanceCacheVAO *vaos[3] =
+  {
+    static_cast<ngl::InstanceCacheVAO *>(_vaos.m_VAOs[_treeNum][_id][_age][_index].get()),
+    static_cast<ngl::InstanceCacheVAO *>(_vaos.m_leafVAOs[_treeNum][_id][_age][_index].get()),
+    static_cast<ngl::InstanceCacheVAO *>(_vaos.m_polygonVAOs[_treeNum][_id][_age][_index].get())
+  };
+  unsigned int numTransforms = vaos[0]->getInstanceCount();
+  unsigned int numDetailed = numTransforms;
+  if(_vaos.m_isCulled)
+  {
+    numDetailed = uint(_vaos.m_numDetailedTransforms[_treeNum][_id][_age][_index]);
+  }
+
+  //(slots with every instance culled are skipped entirely)
+  if(numDetailed>0)
+  {
+    const char *shaderNames[3] = {"ForestShader", "ForestLeafShader", "ForestPolygonShader"};
+    for(int i=0; i<3; i++)
+    {
+      (*shader)[shaderNames[i]]->use();
+      vaos[i]->bind();
+      vaos[i]->drawInstances(0, numDetailed);
+      vaos[i]->unbind();
+    }
+  }
+  //distant trees only need their branches drawing as lines, without any geometry shader work
+  if(numTransforms>numDetailed)
+  {
+    (*shader)["SkeletalForestShader"]->use();
+    vaos[0]->bind();
+    vaos[0]->drawInstances(numDetailed, numTransforms-numDetailed);
+    vaos[0]->unbind();
+  }
+}
+
+void NGLScene::drawForest(const Forest &_forest, ForestVAOs &_vaos, const Frustum &_frustum)
+{
+  if(m_supportsMultiDraw && m_useForestMultiDraw)
+  {
+    drawForestBatch(_forest, _vaos, _frustum);
+    return;
+  }
+  if(_vaos.m_VAOs.size() != _forest.m_treeTypes.size())
+  {
+    buildForestSlotVAOs(_forest, _vaos);
+  }
+  if(m_cullForest || m_useForestLOD)
+  {
+    cullForestVAOs(_forest, _vaos, _frustum);
+  }
+  else
+  {
+    uncullForestVAOs(_forest, _vaos);
+  }
+  drawForestVAOs(_vaos);
+}
+
+void NGLScene::drawForestBatch(const Forest &_forest, ForestVAOs &_vaos, const Frustum &_frustum)
+{
+  if(!_vaos.m_batch)
+  {
+    buildForestBatch(_forest, _vaos);
+  }
+  ForestBatch &batch = *_vaos.m_batch;
+  if(m_cullForest || m_useForestLOD)
+  {
+    //the commands only change when the transforms in view do
+    findVisibleForestTransforms(_forest, _vaos, _frustum);
+    if(!batch.m_isCulled || batch.m_culledVersion != _vaos.m_visibleVersion)
+    {
+      batch.m_batch.build(_vaos.m_visibleTransforms, _vaos.m_numDetailedTransforms);
+      uploadForestBatch(batch);
+      batch.m_isCulled = true;
+      batch.m_culledVersion = _vaos.m_visibleVersion;
+    }
+    batch.m_upToDate = false;
+  }
+  else if(!batch.m_upToDate)
+  {
+    batch.m_batch.build(_forest.m_transformCache);
+    uploadForestBatch(batch);
+    batch.m_upToDate = true;
+    batch.m_isCulled = false;
+  }
+
+#ifdef GL_VERSION_4_3
+  //the commands of the four passes are stored one after another in the command buffer, and each pass is drawn with
+  //one call, so the shader only changes four times per forest however many slots it has
+  const ForestDrawBatch &commands = batch.m_batch;
+  const std::vector<ForestDrawBatch::DrawCommand> *passCommands[4] = {&commands.m_branchCommands,
+                                                                      &commands.m_leafCommands,
+                                                                      &commands.m_polygonCommands,
+                                                                      &commands.m_skeletalCommands};
+  const char *shaderNames[4] = {"ForestShader", "ForestLeafShader", "ForestPolygonShader", "SkeletalForestShader"};
+  GLuint vaos[4] = {batch.m_VAOs[0], batch.m_VAOs[1], batch.m_VAOs[2], batch.m_VAOs[0]};
+  GLenum modes[4] = {GL_LINES, GL_POINTS, GL_TRIANGLES, GL_LINES};
+
+  ngl::ShaderLib *shader=ngl::ShaderLib::instance();
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.m_commandBuffer);
+  size_t offset = 0;
+  for(int i=0; i<4; i++)
+  {
+    if(passCommands[i]->size()>0)
+    {
+      (*shader)[shaderNames[i]]->use();
+      glBindVertexArray(vaos[i]);
+      glMultiDrawElementsIndirect(modes[i], GL_UNSIGNED_SHORT, reinterpret_cast<GLvoid *>(offset),
+                                  GLsizei(passCommands[i]->size()), 0);
+    }
+    offset += sizeof(ForestDrawBatch::DrawCommand)*passCommands[i]->size();
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+#endif
+}
+
+Frustum NGLScene::getViewFrustum()
+{
+  return Frustum(m_project*m_view*(*m_currentMouseTransform));
+}
+
+void NGLScene::generateTerrain()
+{
+  bool paged = false;
+  if(m_terrainPageStride>1)
+  {
+    //generate a heightmap m_terrainPageStride times finer than the mesh into the paged file, then build the mesh
+    //from every m_terrainPageStride'th value of it while the height queries sample the full heightmap
+    int dimension = m_terrainGen.m_dimension;
+    float scale = m_terrainGen.m_scale;
+    m_terrainGen.m_dimension = (dimension-1)*m_terrainPageStride+1;
+    m_terrainGen.m_scale = scale/m_terrainPageStride;
+    if(!m_terrainPages)
+    {
+      m_terrainPages = std::make_shared<PagedHeightMap>();
+    }
+    paged = m_terrainGen.generatePaged(*m_terrainPages, m_terrainPageFile);
+    if(paged)
+    {
+      m_terrainGen.loadFromPages(*m_terrainPages, size_t(m_terrainPageStride));
+    }
+    m_terrainGen.m_dimension = dimension;
+    m_terrainGen.m_scale = scale;
+    if(paged)
+    {
+      //the tiles hold the noise at an amplitude of 1, so an amplitude edit regenerates none of them, and the mesh
+      //keeps its DAG whenever the stride and base LOD are unchanged
+      buildTerrain(true, m_terrainPages);
+    }
+    else
+    {
+      std::cout<<"couldn't page the terrain to "<<m_terrainPageFile<<", generating it in memory instead\n";
+    }
+  }
+
+  //only redo what the changed settings affect - a terrain on the same grid keeps its DAG and just takes the new heights
+  if(!paged)
+  {
+    TerrainGenerator::Change change = m_terrainGen.update();
+    if(change!=TerrainGenerator::NO_CHANGE)
+    {
+      buildTerrain(change!=TerrainGenerator::GRID_CHANGE);
+    }
+  }
+}
+
+bool NGLScene::loadTerrain(const std::string &_fileName)
+{
+  //a failed load leaves the generator untouched, so the file is loaded into a new generator which only takes the
+  //grid and noise settings of the current one - not its heightmap and normals, which the file replaces
+  TerrainGenerator terrainGen(m_terrainGen.m_dimension, m_terrainGen.m_scale*m_terrainGen.m_dimension);
+  terrainGen.m_seed = m_terrainGen.m_seed;
+  terrainGen.m_octaves = m_terrainGen.m_octaves;
+  terrainGen.m_frequency = m_terrainGen.m_frequency;
+  terrainGen.m_persistence = m_terrainGen.m_persistence;
+  terrainGen.m_lacunarity = m_terrainGen.m_lacunarity;
+  terrainGen.m_amplitude = m_terrainGen.m_amplitude;
+  std::string extension = _fileName.substr(std::min(_fileName.rfind('.'), _fileName.size()));
+  bool loaded;
+  if(extension==".raw")
+  {
+    loaded = terrainGen.loadRaw(_fileName, m_terrainFileMinHeight, m_terrainFileMaxHeight);
+  }
+  else if(extension==".pgm")
+  {
+    loaded = terrainGen.loadPGM(_fileName, m_terrainFileMinHeight, m_terrainFileMaxHeight);
+  }
+  else
+  {
+    loaded = terrainGen.loadTerrain(_fileName);
+  }
+  if(!loaded)
+  {
+    return false;
+  }
+  m_terrainGen = std::move(terrainGen);
+  m_terrainDimension = m_terrainGen.m_dimension;
+  m_width = m_terrainGen.m_scale*m_terrainDimension;
+  buildTerrain();
+  return true;
+}
+
+void NGLScene::buildTerrain(bool _sameGrid, std::shared_ptr<PagedHeightMap> _pages)
+{
+  if(!_sameGrid || !m_terrain.updateHeights(m_terrainGen))
+  {
+    m_terrain = TerrainData(m_terrainGen);
+    m_terrain.m_parallelRefinement = m_parallelTerrainRefinement;
+    if(m_terrain.m_UVRepeat!=m_terrainUVRepeat)
+    {
+      m_terrain.setUVRepeat(m_terrainUVRepeat);
+    }
+  }
+  m_buildTerrainVAO = true;
+  if(_pages)
+  {
+    m_terrainHeights = std::make_shared<const TerrainHeightQuery>(_pages, m_terrainGen.m_amplitude);
+  }
+  else
+  {
+    m_terrainHeights = std::make_shared<const TerrainHeightQuery>(m_terrainGen.m_heightMap, m_terrainGen.m_dimension,
+                                                                  m_terrainGen.m_scale, m_terrainGen.m_amplitude);
+  }
+}
+
 void NGLScene::refineTerrain()
 {
-  //call meshRefine on terrain using the current eye coordinates
-  ngl::Vec3 from = m_currentCamera->m_from;
-  from = m_initialRotation.inverse() * m_currentMouseTransform->inverse() * from;
-  m_terrain.meshRefine(from, m_tolerance, 100.0);
-  buildTerrainVAO();
+  //the vertices only change when the terrain is regenerated, so only the indices need uploading each refinement
+  if(m_buildTerrainVAO==true)
+  {
+    buildTerrainVAO();
+    m_buildTerrainVAO = false;
+    m_updateTerrainUVs = false;
+  }
+  else if(m_updateTerrainUVs==true)
+  {
+    updateTerrainUVs();
+    m_updateTerrainUVs = false;
+  }
+  //refine the terrain using the current eye coordinates and view, which does nothing if neither has changed
+  Frustum frustum = m_cullTerrain ? getViewFrustum() : Frustum();
+  if(m_terrain.updateRefinement(getCameraPosition(), m_tolerance, 100.0, m_terrainRefinementBudget, frustum))
+  {
+    updateTerrainIndices();
+  }
+  //keep drawing frames until a refinement that ran out of time is finished
+  if(m_terrain.isRefining())
+  {
+    update();
+  }
+}
+
+ngl::Vec3 NGLScene::getCameraPosition()
+{
+  return m_initialRotation.inverse() * m_currentMouseTransform->inverse() * m_currentCamera->m_from;
+}
+
+void NGLScene::updateTreeTypes()
+{
+  m_treeTypes.clear();
+  for(auto &tree : m_LSystems)
+  {
+    m_treeTypes.push_back(m_speciesCache.getTreeType(tree, m_numHeroTrees));
+  }
 }
 
 void NGLScene::updateScatteredForest()
 {
-  m_scatteredForest = Forest(m_LSystems, m_width,
-                             m_numTrees, m_numHeroTrees, m_terrainGen,
-                             m_forestSeed, m_forestUseSeed);
+  updateTreeTypes();
+  if(m_useForestTiles)
+  {
+    updateForestTiles();
+    return;
+  }
+  m_scatteredForest = Forest(m_treeTypes, m_width,
+                             m_numTrees, m_terrainHeights,
+                             m_forestSeed, m_forestUseSeed,
+                             m_usePoissonDisk, std::vector<float>(m_numTreeTabs, m_minTreeDist));
+  m_buildForestVAOs = true;
+}
+
+void NGLScene::updateForestTiles()
+{
+  //keep the same density of trees as a scattered forest covering the whole terrain
+  std::vector<size_t> numTreesPerTile(m_numTrees.size());
+  for(size_t t=0; t<m_numTrees.size(); t++)
+  {
+    numTreesPerTile[t] = size_t(roundf(float(m_numTrees[t])*m_forestTileSize*m_forestTileSize/(m_width*m_width)));
+  }
+  m_forestTiles = ForestTileManager(m_treeTypes, m_forestTileSize, numTreesPerTile, m_terrainHeights,
+                                    m_forestSeed, m_forestUseSeed,
+                                    m_usePoissonDisk, std::vector<float>(m_numTreeTabs, m_minTreeDist));
+  //the terrain has a fixed size, so only stream the tiles that lie on it
+  m_forestTiles.m_worldWidth = m_width;
   m_buildForestVAOs = true;
 }
 
@@ -198,7 +496,14 @@ void NGLScene::paintGL()
   }
   if(m_buildForestVAOs==true)
   {
-    buildScatteredForestVAOs();
+    if(m_useForestTiles)
+    {
+      removeForestTileVAOs();
+    }
+    else
+    {
+      buildScatteredForestVAOs();
+    }
     m_buildForestVAOs = false;
   }
   if(m_buildPaintLineVAO==true)
@@ -245,7 +550,9 @@ void NGLScene::paintGL()
       }
       refineTerrain();
       loadUniformsToShader(shader, "TerrainShader");
-      drawVAO(m_terrainVAO);
+      glBindVertexArray(m_terrainVAO);
+      glDrawElements(GL_TRIANGLE_STRIP, GLsizei(m_terrainIndexCount), GL_UNSIGNED_INT, nullptr);
+      glBindVertexArray(0);
 
       if (m_forestTabNum==1)
       {
@@ -255,41 +562,52 @@ void NGLScene::paintGL()
         loadUniformsToShader(shader, "ForestShader");
         loadUniformsToShader(shader, "ForestLeafShader");
         loadUniformsToShader(shader, "ForestPolygonShader");
+        loadUniformsToShader(shader, "SkeletalForestShader");
 
-        //rebuild adjusted cache indexes if necessary
-        for(auto &i : m_paintedForest.m_adjustedCacheIndexes)
+        //update the transforms of adjusted cache indexes if necessary (culled forests find and upload the transforms
+        //in view again instead, so this is only needed without culling or LOD)
+        if(!m_cullForest && !m_useForestLOD)
         {
-          buildForestVAO(i.m_treeNum, i.m_id, i.m_age, i.m_innerIndex, true);
-          buildForestLeafVAO(i.m_treeNum, i.m_id, i.m_age, i.m_innerIndex, true);
-          buildForestPolygonVAO(i.m_treeNum, i.m_id, i.m_age, i.m_innerIndex, true);
-          m_paintedForest.m_adjustedCacheIndexes.clear();
+          for(auto &i : m_paintedForest.m_adjustedCacheIndexes)
+          {
+            updatePaintedForestVAOs(i.m_treeNum, i.m_id, i.m_age, i.m_innerIndex);
+          }
         }
+        if(m_paintedForest.m_adjustedCacheIndexes.size()>0)
+        {
+          m_paintedForestVAOs.m_visibleUpToDate = false;
+        }
+        m_paintedForest.clearAdjustedCacheIndexes();
+        m_paintedForest.updateTreeBVH();
 
+        Frustum frustum = m_cullForest ? getViewFrustum() : Frustum();
+        m_forestLOD.m_cameraPosition = getCameraPosition();
         if(m_usePaintedForest)
         {
-          for(size_t t=0; t<m_numTreeTabs; t++)
+          drawForest(m_paintedForest, m_paintedForestVAOs, frustum);
+        }
+        else if(m_useForestTiles)
+        {
+          //stream tiles in and out around the camera, then draw the resident ones - only a few tiles are built
+          //each frame, so keep requesting frames until every tile around the camera is resident
+          ngl::Vec3 cameraPosition = getCameraPosition();
+          if(m_forestTiles.update(cameraPosition.m_x, cameraPosition.m_z))
           {
-            FOR_EACH_ELEMENT(m_paintedForestVAOs[t],
-                             (*shader)["ForestShader"]->use();
-                             drawVAO(m_paintedForestVAOs[t][ID][AGE][INDEX]);
-                             (*shader)["ForestLeafShader"]->use();
-                             drawVAO(m_paintedForestLeafVAOs[t][ID][AGE][INDEX]);
-                             (*shader)["ForestPolygonShader"]->use();
-                             drawVAO(m_paintedForestPolygonVAOs[t][ID][AGE][INDEX]))
+            update();
+          }
+          updateForestTileVAOs();
+          for(auto &tile : m_forestTileVAOs)
+          {
+            const Forest *forest = m_forestTiles.getTile(tile.first);
+            if(forest)
+            {
+              drawForest(*forest, tile.second, frustum);
+            }
           }
         }
         else
         {
-          for(size_t t=0; t<m_numTreeTabs; t++)
-          {
-            FOR_EACH_ELEMENT(m_forestVAOs[t],
-                             (*shader)["ForestShader"]->use();
-                             drawVAO(m_forestVAOs[t][ID][AGE][INDEX]);
-                             (*shader)["ForestLeafShader"]->use();
-                             drawVAO(m_forestLeafVAOs[t][ID][AGE][INDEX]);
-                             (*shader)["ForestPolygonShader"]->use();
-                             drawVAO(m_forestPolygonVAOs[t][ID][AGE][INDEX]))
-          }
+          drawForest(m_scatteredForest, m_scatteredForestVAOs, frustum);
         }
       }
 
@@ -23,68 +23,24 @@ ngl::Vec3 NGLScene::getProjectedPointOnTerrain(float _screenX, float _screenY)
   float projDevX = 2*_screenX/m_win.width-1;
   float projDevY = 1-2*_screenY/m_win.height;
 
-  //reverse the process of the MVP matrix to find a vector pointing into the screen from the mouse
-  ngl::Vec4 rayClip = ngl::Vec4(projDevX,projDevY, -1.0, 1.0);
-  ngl::Vec4 rayEye = m_project.inverse() * rayClip;
-  rayEye = {rayEye.m_x, rayEye.m_y, -1, 0};
-  ngl::Vec4 rayWorldDirection = currentTransform.inverse() * m_view.inverse() * rayEye;
-  ngl::Vec3 rayDir = ngl::Vec3(rayWorldDirection.m_x, rayWorldDirection.m_y, rayWorldDirection.m_z);
-  rayDir.normalize();
-
-  //find a position vector rayStart in world space somwhere along the ray from the mouse into the screen
-  //note that rayStart was found in a nonstandard way here somewhat by accident and I believe it's specific to the FOV etc.
-  ngl::Vec4 rayStart4 = MVPinverse * ngl::Vec4(projDevX,projDevY,0.9f,1);
-  ngl::Vec3 rayStart = ngl::Vec3(rayStart4.m_x, rayStart4.m_y, rayStart4.m_z);
-
-  //find point to start searching from that's relatively close to the terrain to reduce search time
-  float maxTerrainHeight = m_terrainGen.m_amplitude*2;
-  float stepSize = m_rayPickTolerance;
-  float n = (maxTerrainHeight-rayStart.m_y)/rayDir.m_y;
-  ngl::Vec3 rayEnd = rayStart + n*rayDir;
-
-  //set perlinModule equal to terrain values
-  m_perlinModule.SetOctaveCount(m_terrainGen.m_octaves);
-  m_perlinModule.SetFrequency(m_terrainGen.m_frequency);
-  m_perlinModule.SetPersistence(m_terrainGen.m_persistence);
-  m_perlinModule.SetLacunarity(m_terrainGen.m_lacunarity);
-
-  bool rayEndHasBeenFound = false;
-  //now move in small steps from that point til we are within an error tolerance of the terrain
-  while(rayEnd.m_y >= -maxTerrainHeight-1 && rayEnd.m_y <= maxTerrainHeight+1)
+  //unproject the mouse position on the near and far planes to find the ray through it, in the terrain's own space
+  ngl::Vec4 nearPoint = MVPinverse * ngl::Vec4(projDevX, projDevY, -1, 1);
+  ngl::Vec4 farPoint = MVPinverse * ngl::Vec4(projDevX, projDevY, 1, 1);
+  ngl::Vec3 rayStart = ngl::Vec3(nearPoint.m_x, nearPoint.m_y, nearPoint.m_z)/nearPoint.m_w;
+  ngl::Vec3 rayEnd = ngl::Vec3(farPoint.m_x, farPoint.m_y, farPoint.m_z)/farPoint.m_w;
+  ngl::Vec3 rayDir = rayEnd - rayStart;
+
+  ngl::Vec3 point;
+  if(m_terrainHeights->intersectRay(rayStart, rayDir, point))
   {
-    n += stepSize;
-    rayEnd = rayStart + n*rayDir;
-    float yPos = m_terrainGen.m_amplitude * float(m_perlinModule.GetValue(double(rayEnd.m_x),
-                                                                          double(rayEnd.m_z),
-                                                                          m_terrainGen.m_seed));
-    if(abs(rayEnd.m_y - yPos) < stepSize)
-    {
-      rayEndHasBeenFound = true;
-      break;
-    }
+    return point;
   }
-
-  //if we were unsuccessful in the first attempt, try going in the opposite direction
-  if(!rayEndHasBeenFound)
+  //a ray that misses the terrain gives the point it meets the plane under the terrain at, or the far point if it
+  //points upwards, neither of which is on the terrain
+  if(rayDir.m_y<0)
   {
-    float n = (maxTerrainHeight-rayStart.m_y)/rayDir.m_y;
-    ngl::Vec3 rayEnd = rayStart + n*rayDir;
-
-    while(rayEnd.m_y >= -maxTerrainHeight-1 && rayEnd.m_y <= maxTerrainHeight+1)
-    {
-      n -= stepSize;
-      rayEnd = rayStart + n*rayDir;
-      float yPos = m_terrainGen.m_amplitude * float(m_perlinModule.GetValue(double(rayEnd.m_x),
-                                                                            double(rayEnd.m_z),
-                                                                            m_terrainGen.m_seed));
-      if(abs(rayEnd.m_y - yPos) < stepSize)
-      {
-        rayEndHasBeenFound = true;
-        break;
-      }
-    }
+    return rayStart + rayDir*((m_terrainHeights->m_minHeight-1-rayStart.m_y)/rayDir.m_y);
   }
-
   return rayEnd;
 }
 
@@ -93,31 +49,31 @@ ngl::Vec3 NGLScene::getProjectedPointOnTerrain(float _screenX, float _screenY)
 
 void NGLScene::addPointToPaintedForest(ngl::Vec3 &_point)
 {
-  float yPos = m_terrainGen.m_amplitude * float(m_perlinModule.GetValue(double(_point.m_x),
-                                                                        double(_point.m_z),
-                                                                        m_terrainGen.m_seed));
+  float yPos = m_terrainHeights->getHeight(_point.m_x, _point.m_z);
 
   //point is only viable if it lies on the terrain
   bool pointIsViable = (abs(_point.m_x)<m_width/2-1 &&
                         abs(_point.m_z)<m_width/2-1 &&
                         abs(_point.m_y-yPos)<m_rayPickTolerance);
-  //and point is not viable if it is too close to some other point
-  if(pointIsViable)
+
+  //the brush after the tree brushes is the eraser, which removes trees within the tree spacing of the point
+  if(m_paintBrushNum>=m_numTreeTabs)
   {
-    for(auto &p : m_paintPoints)
+    if(pointIsViable)
     {
-      if((_point-p).length()<m_minTreeDist)
-      {
-        pointIsViable=false;
-        break;
-      }
+      m_paintedForest.eraseTreesWithin(_point, m_minTreeDist);
     }
+    return;
+  }
+
+  //and point is not viable if it is too close to some other tree in the painted forest
+  if(pointIsViable && m_paintedForest.m_treeHash.hasPointWithin(_point.m_x, _point.m_z, m_minTreeDist))
+  {
+    pointIsViable=false;
   }
 
   if(pointIsViable)
   {
-    m_paintPoints.push_back(_point);
-    m_paintPointIndices.push_back(GLshort(m_paintPoints.size()-1));
     m_paintedForest.addTreeToForest(_point, m_paintBrushNum);
   }
 }
@@ -215,8 +215,7 @@ void NGLScene::setTerrainSeed(double _seed)
 
 void NGLScene::updateTerrain()
 {
-  m_terrainGen.generate();
-  m_terrain = TerrainData(m_terrainGen);
+  generateTerrain();
   erasePaint();
   updateScatteredForest();
   update();
@@ -234,6 +233,32 @@ void NGLScene::toggleTerrainWireframe(bool _mode)
   update();
 }
 
+void NGLScene::toggleTerrainParallelRefinement(bool _mode)
+{
+  //a serial refinement that is part way through is finished serially before the new mode takes over
+  m_parallelTerrainRefinement=_mode;
+  m_terrain.m_parallelRefinement=_mode;
+  update();
+}
+
+void NGLScene::toggleForestCulling(bool _mode)
+{
+  m_cullForest=_mode;
+  update();
+}
+
+void NGLScene::toggleForestLOD(bool _mode)
+{
+  m_useForestLOD=_mode;
+  update();
+}
+
+void NGLScene::toggleForestMultiDraw(bool _mode)
+{
+  m_useForestMultiDraw=_mode;
+  update();
+}
+
 void NGLScene::setTerrainSize(double _terrainSize)
 {
   m_width = float(_terrainSize);
@@ -247,6 +272,47 @@ void NGLScene::setLOD(int _LOD)
   m_terrainGen.m_scale = m_width/m_terrainDimension;
 }
 
+void NGLScene::setTerrainPageStride(int _stride)
+{
+  m_terrainPageStride = _stride;
+}
+
+void NGLScene::setTerrainUVRepeat(int _UVRepeat)
+{
+  m_terrainUVRepeat = _UVRepeat;
+  m_terrain.setUVRepeat(m_terrainUVRepeat);
+  m_updateTerrainUVs = true;
+  update();
+}
+
+void NGLScene::importTerrain(QString _fileName)
+{
+  if(loadTerrain(_fileName.toStdString()))
+  {
+    erasePaint();
+    updateScatteredForest();
+    update();
+  }
+}
+
+void NGLScene::exportTerrain(QString _fileName)
+{
+  std::string fileName = _fileName.toStdString();
+  std::string extension = fileName.substr(std::min(fileName.rfind('.'), fileName.size()));
+  if(extension==".raw")
+  {
+    m_terrainGen.saveRaw(fileName, m_terrainFileMinHeight, m_terrainFileMaxHeight);
+  }
+  else if(extension==".pgm")
+  {
+    m_terrainGen.savePGM(fileName, m_terrainFileMinHeight, m_terrainFileMaxHeight);
+  }
+  else
+  {
+    m_terrainGen.saveTerrain(fileName);
+  }
+}
+
 //------------------------------------------------------------------------------------------------------------------------
 
 void NGLScene::toggleTreePaintMode(bool _mode)
@@ -267,7 +333,8 @@ void NGLScene::setPaintBrush(int _brushNum)
 
 void NGLScene::erasePaint()
 {
-  m_paintedForest = Forest(m_LSystems, m_numHeroTrees, m_forestSeed, m_forestUseSeed);
+  updateTreeTypes();
+  m_paintedForest = Forest(m_treeTypes, m_forestSeed, m_forestUseSeed);
   buildPaintedForestVAOs();
   update();
 }
@@ -276,8 +343,11 @@ void NGLScene::erasePaint()
 
 void NGLScene::toggleTreeGenMethod(int _methodNum)
 {
-  m_usePaintedForest = bool(1-_methodNum);
-  if(_methodNum==1)
+  //method 0 is painting, 1 is uniform scattering, 2 is poisson disk scattering and 3 is streaming tiles
+  m_usePaintedForest = (_methodNum==0);
+  m_usePoissonDisk = (_methodNum==2);
+  m_useForestTiles = (_methodNum==3);
+  if(_methodNum>0)
   {
     updateScatteredForest();
   }
@@ -310,6 +380,15 @@ void NGLScene::setInstancingProb(double _instancingProb)
   }
 }
 
+void NGLScene::toggleBakeSimplifiedMeshes(bool _bake)
+{
+  //this is part of the species cache key, so the next forest update bakes the meshes rather than reusing old types
+  for(auto &tree : m_LSystems)
+  {
+    tree.m_bakeSimplifiedMeshes = _bake;
+  }
+}
+
 void NGLScene::setSeedForest(int _seed)
 {
   m_forestSeed = size_t(_seed);
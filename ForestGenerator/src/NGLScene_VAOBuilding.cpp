@@ -3,6 +3,7 @@
 /// @brief implementation file for NGLScene VAO building methods
 //----------------------------------------------------------------------------------------------------------------------
 
+#include <cstring>
 #include <ngl/NGLInit.h>
 #include <ngl/VAOFactory.h>
 #include <ngl/SimpleIndexVAO.h>
@@ -58,31 +59,161 @@ void NGLScene::buildSimpleIndexVAO(std::unique_ptr<ngl::AbstractVAO> &_vao, std:
 
 //------------------------------------------------------------------------------------------------------------------------
 
-void NGLScene::buildInstanceCacheVAO(std::unique_ptr<ngl::AbstractVAO> &_vao, std::vector<ngl::Vec3> &_vertices,
-                                     std::vector<GLshort> &_indices, std::vector<ngl::Mat4> &_transforms,
-                                     size_t _instanceStart, size_t _instanceEnd, GLenum _mode)
+void NGLScene::buildInstanceCacheVAO(std::unique_ptr<ngl::AbstractVAO> &_vao, GLuint _vertexBuffer, GLuint _indexBuffer,
+                                     const std::vector<ngl::Mat4> &_transforms,
+                                     size_t _instanceStart, size_t _instanceEnd, GLenum _mode,
+                                     GLenum _transformUsage)
 {
   // create a vao using _mode
   _vao=ngl::VAOFactory::createVAO("instanceCacheVAO",_mode);
   _vao->bind();
 
-  // set our data for the VAO:
-  //    (1) vertexBufferSize, (2) vertexBufferStart,
-  //    (3) indexBufferSize, (4) indexBufferStart,
-  //    (5) transformBufferSize, (6) transformBufferStart
-  _vao->setData(ngl::InstanceCacheVAO::VertexData(
-                       sizeof(ngl::Vec3)*_vertices.size(),
-                       _vertices[0].m_x,
-                       uint(_instanceEnd - _instanceStart),
-                       &_indices[_instanceStart],
-                       uint(_transforms.size()),
-                       &_transforms[0].m_00));
-
-  // set number of indices to length of current instance
-  _vao->setNumIndices(_instanceEnd - _instanceStart);
+  // bind the shared buffers, so the VAO only needs its own transform buffer and range of indices
+  static_cast<ngl::InstanceCacheVAO *>(_vao.get())->setSharedData(_vertexBuffer,
+                                                                 _indexBuffer,
+                                                                 uint(_instanceStart),
+                                                                 uint(_instanceEnd - _instanceStart),
+                                                                 uint(_transforms.size()),
+                                                                 _transforms.data(),
+                                                                 GL_UNSIGNED_SHORT,
+                                                                 _transformUsage);
   _vao->unbind();
 }
 
+GLuint NGLScene::createBuffer(GLenum _target, size_t _bufferSize, const GLvoid *_bufferData)
+{
+  GLuint bufferID;
+  glGenBuffers(1, &bufferID);
+  glBindBuffer(_target, bufferID);
+  glBufferData(_target,
+               _bufferSize,
+               _bufferData,
+               GL_STATIC_DRAW);
+  glBindBuffer(_target, 0);
+  return bufferID;
+}
+
+std::shared_ptr<NGLScene::SpeciesBuffers> NGLScene::getSpeciesBuffers(const std::shared_ptr<const LSystem> &_treeType)
+{
+  std::shared_ptr<SpeciesBuffers> buffers = m_speciesBuffers[_treeType.get()].lock();
+  if(buffers)
+  {
+    return buffers;
+  }
+
+  //element array bindings belong to the VAO, so make sure none is bound while the index buffers are created
+  glBindVertexArray(0);
+  const LSystem &treeType = *_treeType;
+  buffers = std::make_shared<SpeciesBuffers>();
+  buffers->m_treeType = _treeType;
+  buffers->m_vertexBuffer = createBuffer(GL_ARRAY_BUFFER, sizeof(ngl::Vec3)*treeType.m_heroVertices.size(),
+                                         treeType.m_heroVertices.data());
+  buffers->m_indexBuffer = createBuffer(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLshort)*treeType.m_heroIndices.size(),
+                                        treeType.m_heroIndices.data());
+  buffers->m_rightBuffer = createBuffer(GL_ARRAY_BUFFER, sizeof(ngl::Vec3)*treeType.m_heroRightVectors.size(),
+                                        treeType.m_heroRightVectors.data());
+  buffers->m_thicknessBuffer = createBuffer(GL_ARRAY_BUFFER, sizeof(float)*treeType.m_heroThicknessValues.size(),
+                                            treeType.m_heroThicknessValues.data());
+  buffers->m_leafVertexBuffer = createBuffer(GL_ARRAY_BUFFER, sizeof(ngl::Vec3)*treeType.m_heroLeafVertices.size(),
+                                             treeType.m_heroLeafVertices.data());
+  buffers->m_leafIndexBuffer = createBuffer(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLshort)*treeType.m_heroLeafIndices.size(),
+                                            treeType.m_heroLeafIndices.data());
+  buffers->m_leafDirectionBuffer = createBuffer(GL_ARRAY_BUFFER,
+                                                sizeof(ngl::Vec3)*treeType.m_heroLeafDirections.size(),
+                                                treeType.m_heroLeafDirections.data());
+  buffers->m_leafRightBuffer = createBuffer(GL_ARRAY_BUFFER, sizeof(ngl::Vec3)*treeType.m_heroLeafRightVectors.size(),
+                                            treeType.m_heroLeafRightVectors.data());
+  buffers->m_polygonVertexBuffer = createBuffer(GL_ARRAY_BUFFER,
+                                                sizeof(ngl::Vec3)*treeType.m_heroPolygonVertices.size(),
+                                                treeType.m_heroPolygonVertices.data());
+  buffers->m_polygonIndexBuffer = createBuffer(GL_ELEMENT_ARRAY_BUFFER,
+                                               sizeof(GLshort)*treeType.m_heroPolygonIndices.size(),
+                                               treeType.m_heroPolygonIndices.data());
+
+  //forget any tree types whose buffers have since been deleted
+  for(auto it = m_speciesBuffers.begin(); it != m_speciesBuffers.end();)
+  {
+    if(it->second.expired())
+    {
+      it = m_speciesBuffers.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  m_speciesBuffers[_treeType.get()] = buffers;
+  return buffers;
+}
+
+NGLScene::SpeciesBuffers::~SpeciesBuffers()
+{
+  GLuint buffers[10] = {m_vertexBuffer, m_indexBuffer, m_rightBuffer, m_thicknessBuffer,
+                        m_leafVertexBuffer, m_leafIndexBuffer, m_leafDirectionBuffer, m_leafRightBuffer,
+                        m_polygonVertexBuffer, m_polygonIndexBuffer};
+  glDeleteBuffers(10, buffers);
+}
+
+std::shared_ptr<NGLScene::BatchBuffers> NGLScene::getBatchBuffers(
+    const std::vector<std::shared_ptr<const LSystem>> &_treeTypes)
+{
+  std::vector<const LSystem *> key;
+  for(auto &treeType : _treeTypes)
+  {
+    key.push_back(treeType.get());
+  }
+  std::shared_ptr<BatchBuffers> batchBuffers = m_batchBuffers[key].lock();
+  if(batchBuffers)
+  {
+    return batchBuffers;
+  }
+
+  //element array bindings belong to the VAO, so make sure none is bound while the index buffers are created
+  glBindVertexArray(0);
+  batchBuffers = std::make_shared<BatchBuffers>();
+  batchBuffers->m_treeTypes = _treeTypes;
+  SpeciesBuffers &buffers = batchBuffers->m_buffers;
+  buffers.m_vertexBuffer = createCombinedBuffer(GL_ARRAY_BUFFER, _treeTypes, &LSystem::m_heroVertices);
+  buffers.m_indexBuffer = createCombinedBuffer(GL_ELEMENT_ARRAY_BUFFER, _treeTypes, &LSystem::m_heroIndices);
+  buffers.m_rightBuffer = createCombinedBuffer(GL_ARRAY_BUFFER, _treeTypes, &LSystem::m_heroRightVectors);
+  buffers.m_thicknessBuffer = createCombinedBuffer(GL_ARRAY_BUFFER, _treeTypes, &LSystem::m_heroThicknessValues);
+  buffers.m_leafVertexBuffer = createCombinedBuffer(GL_ARRAY_BUFFER, _treeTypes, &LSystem::m_heroLeafVertices);
+  buffers.m_leafIndexBuffer = createCombinedBuffer(GL_ELEMENT_ARRAY_BUFFER, _treeTypes, &LSystem::m_heroLeafIndices);
+  buffers.m_leafDirectionBuffer = createCombinedBuffer(GL_ARRAY_BUFFER, _treeTypes, &LSystem::m_heroLeafDirections);
+  buffers.m_leafRightBuffer = createCombinedBuffer(GL_ARRAY_BUFFER, _treeTypes, &LSystem::m_heroLeafRightVectors);
+  buffers.m_polygonVertexBuffer = createCombinedBuffer(GL_ARRAY_BUFFER, _treeTypes, &LSystem::m_heroPolygonVertices);
+  buffers.m_polygonIndexBuffer = createCombinedBuffer(GL_ELEMENT_ARRAY_BUFFER, _treeTypes,
+                                                      &LSystem::m_heroPolygonIndices);
+
+  //forget any lists of tree types whose buffers have since been deleted
+  for(auto it = m_batchBuffers.begin(); it != m_batchBuffers.end();)
+  {
+    if(it->second.expired())
+    {
+      it = m_batchBuffers.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  m_batchBuffers[key] = batchBuffers;
+  return batchBuffers;
+}
+
+template<class dataType>
+GLuint NGLScene::createCombinedBuffer(GLenum _target, const std::vector<std::shared_ptr<const LSystem>> &_treeTypes,
+                                      std::vector<dataType> LSystem::*_data)
+{
+  std::vector<dataType> combinedData;
+  for(auto &treeType : _treeTypes)
+  {
+    const std::vector<dataType> &data = (*treeType).*_data;
+    combinedData.insert(combinedData.end(), data.begin(), data.end());
+  }
+  return createBuffer(_target, sizeof(dataType)*combinedData.size(), combinedData.data());
+}
+
 //------------------------------------------------------------------------------------------------------------------------
 /// Specific methods for each thing we need to draw: grid, tree, leaves, polygons, terrain and forest
 //------------------------------------------------------------------------------------------------------------------------
@@ -148,200 +279,462 @@ void NGLScene::buildPolygonVAO(size_t _treeNum)
 
 void NGLScene::buildTerrainVAO()
 {
-  //note that we need to use GLuints for the terrain because the data can get too large for GLushorts
-  buildSimpleIndexVAO(m_terrainVAO,
-                  m_terrain.m_vertsToBeRendered,
-                  m_terrain.m_indicesToBeRendered,
-                  GL_TRIANGLE_STRIP, GL_UNSIGNED_INT);
-  m_terrainVAO->bind();
-  addBufferToBoundVAO(sizeof(ngl::Vec3)*m_terrain.m_normalsToBeRendered.size(),
-                      &m_terrain.m_normalsToBeRendered[0].m_x,
-                      m_terrainNormalBuffer);
-  m_terrainVAO->setVertexAttributePointer(1,3,GL_FLOAT,12,0);
-  addBufferToBoundVAO(sizeof(ngl::Vec3)*m_terrain.m_tangentsToBeRendered.size(),
-                      &m_terrain.m_tangentsToBeRendered[0].m_x,
-                      m_terrainTangentBuffer);
-  m_terrainVAO->setVertexAttributePointer(2,3,GL_FLOAT,12,0);
-  addBufferToBoundVAO(sizeof(ngl::Vec3)*m_terrain.m_bitangentsToBeRendered.size(),
-                      &m_terrain.m_bitangentsToBeRendered[0].m_x,
-                      m_terrainBitangentBuffer);
-  m_terrainVAO->setVertexAttributePointer(3,3,GL_FLOAT,12,0);
-  addBufferToBoundVAO(sizeof(ngl::Vec2)*m_terrain.m_UVsToBeRendered.size(),
-                      &m_terrain.m_UVsToBeRendered[0].m_x,
-                      m_terrainUVBuffer);
-  m_terrainVAO->setVertexAttributePointer(4,2,GL_FLOAT,8,0);
-  m_terrainVAO->unbind();
-
+  removeTerrainVAO();
+  glGenVertexArrays(1, &m_terrainVAO);
+  glBindVertexArray(m_terrainVAO);
+
+  //note that we need to use GLuints for the terrain because the data can get too large for GLushorts, and that the
+  //index buffer starts empty - it is filled by updateTerrainIndices() below and after each refinement
+  glGenBuffers(1, &m_terrainIndexBuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_terrainIndexBuffer);
+  m_terrainIndexCapacity = 0;
+  m_terrainIndexCount = 0;
+
+  GLuint *buffers[5] = {&m_terrainVertexBuffer, &m_terrainNormalBuffer, &m_terrainTangentBuffer,
+                        &m_terrainBitangentBuffer, &m_terrainUVBuffer};
+  const GLvoid *data[5] = {m_terrain.m_vertsToBeRendered.data(), m_terrain.m_normalsToBeRendered.data(),
+                           m_terrain.m_tangentsToBeRendered.data(), m_terrain.m_bitangentsToBeRendered.data(),
+                           m_terrain.m_UVsToBeRendered.data()};
+  size_t numVertices = m_terrain.m_vertsToBeRendered.size();
+  for(GLuint i=0; i<5; i++)
+  {
+    //every attribute is a Vec3 apart from the UVs
+    GLint size = i<4 ? 3 : 2;
+    glGenBuffers(1, buffers[i]);
+    glBindBuffer(GL_ARRAY_BUFFER, *buffers[i]);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(sizeof(float)*size_t(size)*numVertices), data[i], GL_STATIC_DRAW);
+    glVertexAttribPointer(i, size, GL_FLOAT, GL_FALSE, GLsizei(sizeof(float))*size, nullptr);
+    glEnableVertexAttribArray(i);
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  //the refinement won't necessarily change on the next frame, so upload the indices it already has
+  updateTerrainIndices();
 }
 
-//------------------------------------------------------------------------------------------------------------------------
+void NGLScene::updateTerrainUVs()
+{
+  const std::vector<ngl::Vec2> &UVs = m_terrain.m_UVsToBeRendered;
+  if(UVs.size()==0)
+  {
+    return;
+  }
+  //the UVs are the same size as before, so the existing storage can be overwritten in place
+  glBindBuffer(GL_ARRAY_BUFFER, m_terrainUVBuffer);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(sizeof(ngl::Vec2)*UVs.size()), UVs.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-void NGLScene::buildForestVAO(size_t _treeNum, size_t _id, size_t _age, size_t _index, bool _usePaintedForest)
+void NGLScene::updateTerrainIndices()
 {
-  Forest *forest;
-  std::unique_ptr<ngl::AbstractVAO> *vao;
-  GLuint *rightBuffer;
-  GLuint *thicknessBuffer;
-  if(_usePaintedForest)
+  const std::vector<GLuint> &indices = m_terrain.m_indices;
+  m_terrainIndexCount = indices.size();
+  if(indices.size()==0)
+  {
+    return;
+  }
+  //the element array binding belongs to the VAO, so bind that rather than binding the index buffer on its own
+  glBindVertexArray(m_terrainVAO);
+  size_t size = sizeof(GLuint)*indices.size();
+  if(indices.size()>m_terrainIndexCapacity)
+  {
+    //grow geometrically so that the storage is rarely respecified as the camera moves closer to the terrain
+    m_terrainIndexCapacity = std::max(indices.size(), 2*m_terrainIndexCapacity);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(sizeof(GLuint)*m_terrainIndexCapacity), nullptr, GL_STREAM_DRAW);
+  }
+  GLvoid *mappedIndices = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, GLsizeiptr(size),
+                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if(mappedIndices)
   {
-    forest = &m_paintedForest;
-    vao = &m_paintedForestVAOs[_treeNum][_id][_age][_index];
-    rightBuffer = &m_paintedForestRightBuffers[_treeNum][_id][_age][_index];
-    thicknessBuffer = &m_paintedForestThicknessBuffers[_treeNum][_id][_age][_index];
+    memcpy(mappedIndices, indices.data(), size);
+    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
   }
   else
   {
-    forest = &m_scatteredForest;
-    vao = &m_forestVAOs[_treeNum][_id][_age][_index];
-    rightBuffer = &m_forestRightBuffers[_treeNum][_id][_age][_index];
-    thicknessBuffer = &m_forestThicknessBuffers[_treeNum][_id][_age][_index];
+    std::cout<<"Unable to map terrain index buffer\n";
+    m_terrainIndexCount = 0;
   }
+  glBindVertexArray(0);
+}
+
+void NGLScene::removeTerrainVAO()
+{
+  GLuint buffers[6] = {m_terrainVertexBuffer, m_terrainIndexBuffer, m_terrainNormalBuffer, m_terrainTangentBuffer,
+                       m_terrainBitangentBuffer, m_terrainUVBuffer};
+  glDeleteBuffers(6, buffers);
+  glDeleteVertexArrays(1, &m_terrainVAO);
+  m_terrainVAO = 0;
+  m_terrainVertexBuffer = 0;
+  m_terrainIndexBuffer = 0;
+  m_terrainNormalBuffer = 0;
+  m_terrainTangentBuffer = 0;
+  m_terrainBitangentBuffer = 0;
+  m_terrainUVBuffer = 0;
+}
 
-  LSystem &treeType = forest->m_treeTypes[_treeNum];
-  CACHE_STRUCTURE(Instance) &instanceCache = treeType.m_instanceCache;
-  //std::unique_ptr<ngl::AbstractVAO> &vao = m_forestVAOs[_treeNum][_id][_age][_index];
+//------------------------------------------------------------------------------------------------------------------------
 
-  buildInstanceCacheVAO(*vao,
-                        treeType.m_heroVertices,
-                        treeType.m_heroIndices,
-                        forest->m_transformCache[_treeNum][_id][_age][_index],
-                        instanceCache[_id][_age][_index].m_instanceStart,
-                        instanceCache[_id][_age][_index].m_instanceEnd,
-                        GL_LINES);
+void NGLScene::buildForestVAO(const Forest &_forest, ForestVAOs &_vaos,
+                              size_t _treeNum, size_t _id, size_t _age, size_t _index)
+{
+  std::unique_ptr<ngl::AbstractVAO> &vao = _vaos.m_VAOs[_treeNum][_id][_age][_index];
+  const SpeciesBuffers &buffers = *_vaos.m_speciesBuffers[_treeNum];
+  const Instance &instance = _forest.m_treeTypes[_treeNum]->m_instanceCache[_id][_age][_index];
+
+  buildInstanceCacheVAO(vao,
+                        buffers.m_vertexBuffer,
+                        buffers.m_indexBuffer,
+                        _forest.m_transformCache[_treeNum][_id][_age][_index],
+                        instance.m_instanceStart,
+                        instance.m_instanceEnd,
+                        GL_LINES,
+                        _vaos.m_transformUsage);
+
+  vao->bind();
+  glBindBuffer(GL_ARRAY_BUFFER, buffers.m_rightBuffer);
+  vao->setVertexAttributePointer(5,3,GL_FLOAT,12,0);
+  glBindBuffer(GL_ARRAY_BUFFER, buffers.m_thicknessBuffer);
+  vao->setVertexAttributePointer(6,1,GL_FLOAT,4,0);
+  vao->unbind();
 
-  (*vao)->bind();
-  addBufferToBoundVAO(sizeof(ngl::Vec3)*treeType.m_heroRightVectors.size(),
-                      &treeType.m_heroRightVectors[0].m_x, *rightBuffer);
-  (*vao)->setVertexAttributePointer(5,3,GL_FLOAT,12,0);
-  addBufferToBoundVAO(sizeof(float)*treeType.m_heroThicknessValues.size(),
-                      &treeType.m_heroThicknessValues[0], *thicknessBuffer);
-  (*vao)->setVertexAttributePointer(6,1,GL_FLOAT,4,0);
-  (*vao)->unbind();
+}
 
+void NGLScene::buildForestLeafVAO(const Forest &_forest, ForestVAOs &_vaos,
+                                  size_t _treeNum, size_t _id, size_t _age, size_t _index)
+{
+  std::unique_ptr<ngl::AbstractVAO> &vao = _vaos.m_leafVAOs[_treeNum][_id][_age][_index];
+  const SpeciesBuffers &buffers = *_vaos.m_speciesBuffers[_treeNum];
+  const Instance &instance = _forest.m_treeTypes[_treeNum]->m_instanceCache[_id][_age][_index];
+
+  buildInstanceCacheVAO(vao,
+                        buffers.m_leafVertexBuffer,
+                        buffers.m_leafIndexBuffer,
+                        _forest.m_transformCache[_treeNum][_id][_age][_index],
+                        instance.m_instanceLeafStart,
+                        instance.m_instanceLeafEnd,
+                        GL_POINTS,
+                        _vaos.m_transformUsage);
+
+  vao->bind();
+  glBindBuffer(GL_ARRAY_BUFFER, buffers.m_leafDirectionBuffer);
+  vao->setVertexAttributePointer(5,3,GL_FLOAT,12,0);
+  glBindBuffer(GL_ARRAY_BUFFER, buffers.m_leafRightBuffer);
+  vao->setVertexAttributePointer(6,3,GL_FLOAT,12,0);
+  vao->unbind();
+
+}
+void NGLScene::buildForestPolygonVAO(const Forest &_forest, ForestVAOs &_vaos,
+                                     size_t _treeNum, size_t _id, size_t _age, size_t _index)
+{
+  const SpeciesBuffers &buffers = *_vaos.m_speciesBuffers[_treeNum];
+  const Instance &instance = _forest.m_treeTypes[_treeNum]->m_instanceCache[_id][_age][_index];
+
+  buildInstanceCacheVAO(_vaos.m_polygonVAOs[_treeNum][_id][_age][_index],
+                        buffers.m_polygonVertexBuffer,
+                        buffers.m_polygonIndexBuffer,
+                        _forest.m_transformCache[_treeNum][_id][_age][_index],
+                        instance.m_instancePolygonStart,
+                        instance.m_instancePolygonEnd,
+                        GL_TRIANGLES,
+                        _vaos.m_transformUsage);
 }
 
 //------------------------------------------------------------------------------------------------------------------------
 
-void NGLScene::buildForestLeafVAO(size_t _treeNum, size_t _id, size_t _age, size_t _index, bool _usePaintedForest)
+void NGLScene::updatePaintedForestVAOs(size_t _treeNum, size_t _id, size_t _age, size_t _index)
 {
-  Forest *forest;
-  std::unique_ptr<ngl::AbstractVAO> *vao;
-  GLuint *dirBuffer;
-  GLuint *rightBuffer;
-  if(_usePaintedForest)
+  if(m_paintedForestVAOs.m_batch)
   {
-    forest = &m_paintedForest;
-    vao = &m_paintedForestLeafVAOs[_treeNum][_id][_age][_index];
-    dirBuffer = &m_paintedForestLeafDirectionBuffers[_treeNum][_id][_age][_index];
-    rightBuffer = &m_paintedForestLeafRightBuffers[_treeNum][_id][_age][_index];
+    m_paintedForestVAOs.m_batch->m_upToDate = false;
   }
-  else
+  //the slot VAOs get every transform when they are built, so there is nothing to update until they are
+  if(m_paintedForestVAOs.m_VAOs.empty())
   {
-    forest = &m_scatteredForest;
-    vao = &m_forestLeafVAOs[_treeNum][_id][_age][_index];
-    dirBuffer = &m_forestLeafDirectionBuffers[_treeNum][_id][_age][_index];
-    rightBuffer = &m_forestLeafRightBuffers[_treeNum][_id][_age][_index];
+    return;
   }
+  const std::vector<ngl::Mat4> &transforms = m_paintedForest.m_transformCache[_treeNum][_id][_age][_index];
+  //painting appends transforms and erasing swap-removes them, so only the transforms from the first changed one
+  //onwards need uploading, and the hero geometry doesn't need to be touched at all
+  size_t firstChanged = std::min(m_paintedForest.m_firstAdjustedTransform[_treeNum][_id][_age][_index],
+                                 transforms.size());
+  setForestVAOTransforms(m_paintedForestVAOs, _treeNum, _id, _age, _index, transforms, firstChanged);
+}
 
-  LSystem &treeType = forest->m_treeTypes[_treeNum];
-  CACHE_STRUCTURE(Instance) &instanceCache = treeType.m_instanceCache;
-  //std::unique_ptr<ngl::AbstractVAO> &vao = m_forestLeafVAOs[_treeNum][_id][_age][_index];
+//------------------------------------------------------------------------------------------------------------------------
 
-  buildInstanceCacheVAO(*vao,
-                        treeType.m_heroLeafVertices,
-                        treeType.m_heroLeafIndices,
-                        forest->m_transformCache[_treeNum][_id][_age][_index],
-                        instanceCache[_id][_age][_index].m_instanceLeafStart,
-                        instanceCache[_id][_age][_index].m_instanceLeafEnd,
-                        GL_POINTS);
+void NGLScene::setForestVAOTransforms(ForestVAOs &_vaos, size_t _treeNum, size_t _id, size_t _age, size_t _index,
+                                      const std::vector<ngl::Mat4> &_transforms, size_t _firstChanged)
+{
+  std::unique_ptr<ngl::AbstractVAO> *vaos[3] = {&_vaos.m_VAOs[_treeNum][_id][_age][_index],
+                                                &_vaos.m_leafVAOs[_treeNum][_id][_age][_index],
+                                                &_vaos.m_polygonVAOs[_treeNum][_id][_age][_index]};
+  for(auto vao : vaos)
+  {
+    ngl::InstanceCacheVAO *instanceVAO = static_cast<ngl::InstanceCacheVAO *>(vao->get());
+    instanceVAO->updateTransforms(_transforms.data(), uint(_transforms.size()), uint(_firstChanged));
+  }
+}
 
-  (*vao)->bind();
-  addBufferToBoundVAO(sizeof(ngl::Vec3)*treeType.m_heroLeafDirections.size(),
-                      &treeType.m_heroLeafDirections[0].m_x, *dirBuffer);
-  (*vao)->setVertexAttributePointer(5,3,GL_FLOAT,12,0);
-  addBufferToBoundVAO(sizeof(ngl::Vec3)*treeType.m_heroLeafRightVectors.size(),
-                      &treeType.m_heroLeafRightVectors[0].m_x, *rightBuffer);
-  (*vao)->setVertexAttributePointer(6,3,GL_FLOAT,12,0);
-  (*vao)->unbind();
+//------------------------------------------------------------------------------------------------------------------------
 
+void NGLScene::findVisibleForestTransforms(const Forest &_forest, ForestVAOs &_vaos, const Frustum &_frustum)
+{
+  //without LOD every tree stays at the first level
+  Forest::LODSettings LOD;
+  if(m_useForestLOD)
+  {
+    LOD = m_forestLOD;
+  }
+  //a still camera keeps the same transforms in view, unless the number of trees changing level is capped and some
+  //may still be waiting to change
+  if(_vaos.m_visibleUpToDate && _vaos.m_visibleFrustum == _frustum && _vaos.m_visibleLOD == LOD &&
+     LOD.m_maxChangesPerUpdate == 0)
+  {
+    return;
+  }
+  _forest.findVisibleTransforms(_frustum, LOD, _vaos.m_treeLODs, _vaos.m_visibleTransforms,
+                                _vaos.m_numDetailedTransforms);
+  _vaos.m_visibleFrustum = _frustum;
+  _vaos.m_visibleLOD = LOD;
+  _vaos.m_visibleUpToDate = true;
+  _vaos.m_visibleVersion++;
+}
+
+void NGLScene::cullForestVAOs(const Forest &_forest, ForestVAOs &_vaos, const Frustum &_frustum)
+{
+  findVisibleForestTransforms(_forest, _vaos, _frustum);
+  if(_vaos.m_isCulled && _vaos.m_culledVersion == _vaos.m_visibleVersion)
+  {
+    return;
+  }
+  for(size_t t=0; t<_vaos.m_VAOs.size(); t++)
+  {
+    FOR_EACH_ELEMENT(_vaos.m_VAOs[t],
+                     setForestVAOTransforms(_vaos,t,ID,AGE,INDEX,_vaos.m_visibleTransforms[t][ID][AGE][INDEX],0))
+  }
+  _vaos.m_isCulled = true;
+  _vaos.m_culledVersion = _vaos.m_visibleVersion;
 }
 
 //------------------------------------------------------------------------------------------------------------------------
 
-void NGLScene::buildForestPolygonVAO(size_t _treeNum, size_t _id, size_t _age, size_t _index, bool _usePaintedForest)
+void NGLScene::uncullForestVAOs(const Forest &_forest, ForestVAOs &_vaos)
 {
-  Forest *forest;
-  std::unique_ptr<ngl::AbstractVAO> *vao;
-  if(_usePaintedForest)
+  if(!_vaos.m_isCulled)
   {
-    forest = &m_paintedForest;
-    vao = &m_paintedForestPolygonVAOs[_treeNum][_id][_age][_index];
+    return;
   }
-  else
+  for(size_t t=0; t<_vaos.m_VAOs.size(); t++)
+  {
+    FOR_EACH_ELEMENT(_vaos.m_VAOs[t],
+                     setForestVAOTransforms(_vaos,t,ID,AGE,INDEX,_forest.m_transformCache[t][ID][AGE][INDEX],0))
+  }
+  _vaos.m_isCulled = false;
+}
+
+//------------------------------------------------------------------------------------------------------------------------
+
+void NGLScene::buildForestVAOs(const Forest &_forest, ForestVAOs &_vaos)
+{
+  removeForestVAOs(_vaos);
+  //a forest drawn with multi-draw calls only needs its batch, made when it is first drawn
+  if(m_supportsMultiDraw && m_useForestMultiDraw)
   {
-    forest = &m_scatteredForest;
-    vao = &m_forestPolygonVAOs[_treeNum][_id][_age][_index];
+    return;
   }
+  buildForestSlotVAOs(_forest, _vaos);
+}
 
-  LSystem &treeType = forest->m_treeTypes[_treeNum];
-  CACHE_STRUCTURE(Instance) &instanceCache = treeType.m_instanceCache;
+void NGLScene::buildForestSlotVAOs(const Forest &_forest, ForestVAOs &_vaos)
+{
+  size_t numTreeTypes = _forest.m_treeTypes.size();
+  _vaos.m_VAOs.resize(numTreeTypes);
+  _vaos.m_leafVAOs.resize(numTreeTypes);
+  _vaos.m_polygonVAOs.resize(numTreeTypes);
+  _vaos.m_speciesBuffers.resize(numTreeTypes);
 
-  buildInstanceCacheVAO(*vao,
-                        treeType.m_heroPolygonVertices,
-                        treeType.m_heroPolygonIndices,
-                        forest->m_transformCache[_treeNum][_id][_age][_index],
-                        instanceCache[_id][_age][_index].m_instancePolygonStart,
-                        instanceCache[_id][_age][_index].m_instancePolygonEnd,
-                        GL_TRIANGLES);
+  for(size_t t=0; t<numTreeTypes; t++)
+  {
+    const CACHE_STRUCTURE(Instance) &instanceCache = _forest.m_treeTypes[t]->m_instanceCache;
+    RESIZE_CACHE_BY_OTHER_CACHE(_vaos.m_VAOs[t], instanceCache)
+    RESIZE_CACHE_BY_OTHER_CACHE(_vaos.m_leafVAOs[t], instanceCache)
+    RESIZE_CACHE_BY_OTHER_CACHE(_vaos.m_polygonVAOs[t], instanceCache)
+    _vaos.m_speciesBuffers[t] = getSpeciesBuffers(_forest.m_treeTypes[t]);
+
+    FOR_EACH_ELEMENT(_vaos.m_VAOs[t],
+                     buildForestVAO(_forest,_vaos,t,ID,AGE,INDEX);
+                     buildForestLeafVAO(_forest,_vaos,t,ID,AGE,INDEX);
+                     buildForestPolygonVAO(_forest,_vaos,t,ID,AGE,INDEX))
+  }
+  //the new VAOs hold every transform of the forest
+  _vaos.m_isCulled = false;
 }
 
 //------------------------------------------------------------------------------------------------------------------------
 
-void NGLScene::buildScatteredForestVAOs()
-{  
-  for(size_t t=0; t<m_scatteredForest.m_treeTypes.size(); t++)
+void NGLScene::removeForestVAOs(ForestVAOs &_vaos)
+{
+  for(size_t t=0; t<_vaos.m_VAOs.size(); t++)
   {
-    LSystem &treeType = m_scatteredForest.m_treeTypes[t];
-    CACHE_STRUCTURE(Instance) &instanceCache = treeType.m_instanceCache;
-    std::cout<<instanceCache.size();
-    RESIZE_CACHE_BY_OTHER_CACHE(m_forestVAOs[t], instanceCache)
-    RESIZE_CACHE_BY_OTHER_CACHE(m_forestLeafVAOs[t], instanceCache)
-    RESIZE_CACHE_BY_OTHER_CACHE(m_forestPolygonVAOs[t], instanceCache)
-
-    RESIZE_CACHE_BY_OTHER_CACHE(m_forestRightBuffers[t], instanceCache)
-    RESIZE_CACHE_BY_OTHER_CACHE(m_forestThicknessBuffers[t], instanceCache)
-    RESIZE_CACHE_BY_OTHER_CACHE(m_forestLeafDirectionBuffers[t], instanceCache)
-    RESIZE_CACHE_BY_OTHER_CACHE(m_forestLeafRightBuffers[t], instanceCache)
-
-    FOR_EACH_ELEMENT(m_forestVAOs[t],
-                     buildForestVAO(t,ID,AGE,INDEX,false);
-                     buildForestLeafVAO(t,ID,AGE,INDEX,false);
-                     buildForestPolygonVAO(t,ID,AGE,INDEX,false))
+    FOR_EACH_ELEMENT(_vaos.m_VAOs[t],
+                     _vaos.m_VAOs[t][ID][AGE][INDEX]->removeVAO();
+                     _vaos.m_leafVAOs[t][ID][AGE][INDEX]->removeVAO();
+                     _vaos.m_polygonVAOs[t][ID][AGE][INDEX]->removeVAO())
+  }
+  //this deletes the forest's batch too, along with the species and combined buffers unless another forest is still
+  //using them, the transform usage is a property of the forest rather than of its buffers so it survives
+  GLenum transformUsage = _vaos.m_transformUsage;
+  _vaos = ForestVAOs();
+  _vaos.m_transformUsage = transformUsage;
+}
+
+//------------------------------------------------------------------------------------------------------------------------
+
+void NGLScene::buildForestBatch(const Forest &_forest, ForestVAOs &_vaos)
+{
+  _vaos.m_batch.reset(new ForestBatch());
+  ForestBatch &batch = *_vaos.m_batch;
+  batch.m_batch.setTreeTypes(_forest.m_treeTypes);
+  batch.m_buffers = getBatchBuffers(_forest.m_treeTypes);
+
+  const SpeciesBuffers &buffers = batch.m_buffers->m_buffers;
+  glGenBuffers(1, &batch.m_transformBuffer);
+  glGenBuffers(1, &batch.m_commandBuffer);
+
+  glGenVertexArrays(3, batch.m_VAOs);
+  buildForestBatchVAO(batch.m_VAOs[0], buffers.m_vertexBuffer, buffers.m_indexBuffer, batch.m_transformBuffer,
+                      buffers.m_rightBuffer, 3, buffers.m_thicknessBuffer, 1);
+  buildForestBatchVAO(batch.m_VAOs[1], buffers.m_leafVertexBuffer, buffers.m_leafIndexBuffer, batch.m_transformBuffer,
+                      buffers.m_leafDirectionBuffer, 3, buffers.m_leafRightBuffer, 3);
+  buildForestBatchVAO(batch.m_VAOs[2], buffers.m_polygonVertexBuffer, buffers.m_polygonIndexBuffer,
+                      batch.m_transformBuffer, 0, 0, 0, 0);
+}
 
+void NGLScene::buildForestBatchVAO(GLuint _vao, GLuint _vertexBuffer, GLuint _indexBuffer, GLuint _transformBuffer,
+                                   GLuint _attributeBuffer5, GLint _attributeSize5,
+                                   GLuint _attributeBuffer6, GLint _attributeSize6)
+{
+  glBindVertexArray(_vao);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ngl::Vec3), nullptr);
+  glEnableVertexAttribArray(0);
+
+  //one transform per instance, with the draw commands' base instance picking each slot's transforms
+  glBindBuffer(GL_ARRAY_BUFFER, _transformBuffer);
+  for(GLuint i=0; i<4; i++)
+  {
+    glVertexAttribPointer(1+i, 4, GL_FLOAT, GL_FALSE, sizeof(ngl::Mat4),
+                          reinterpret_cast<GLvoid *>(4*i*sizeof(float)));
+    glEnableVertexAttribArray(1+i);
+    glVertexAttribDivisor(1+i, 1);
   }
+
+  GLuint attributeBuffers[2] = {_attributeBuffer5, _attributeBuffer6};
+  GLint attributeSizes[2] = {_attributeSize5, _attributeSize6};
+  for(GLuint i=0; i<2; i++)
+  {
+    if(attributeBuffers[i]!=0)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, attributeBuffers[i]);
+      glVertexAttribPointer(5+i, attributeSizes[i], GL_FLOAT, GL_FALSE,
+                            GLsizei(sizeof(float))*attributeSizes[i], nullptr);
+      glEnableVertexAttribArray(5+i);
+    }
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void NGLScene::uploadForestBatch(ForestBatch &_batch)
+{
+  const ForestDrawBatch &batch = _batch.m_batch;
+  //respecifying the storage each time lets the driver hand us fresh memory rather than waiting for the GPU to finish
+  //with the commands and transforms of the last frame
+  glBindBuffer(GL_ARRAY_BUFFER, _batch.m_transformBuffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(ngl::Mat4)*batch.m_transforms.size(), batch.m_transforms.data(),
+               GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+#ifdef GL_VERSION_4_3
+  const std::vector<ForestDrawBatch::DrawCommand> *passCommands[4] = {&batch.m_branchCommands,
+                                                                      &batch.m_leafCommands,
+                                                                      &batch.m_polygonCommands,
+                                                                      &batch.m_skeletalCommands};
+  size_t numCommands = 0;
+  for(auto commands : passCommands)
+  {
+    numCommands += commands->size();
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _batch.m_commandBuffer);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(ForestDrawBatch::DrawCommand)*numCommands, nullptr, GL_STREAM_DRAW);
+  size_t offset = 0;
+  for(auto commands : passCommands)
+  {
+    size_t size = sizeof(ForestDrawBatch::DrawCommand)*commands->size();
+    if(size>0)
+    {
+      glBufferSubData(GL_DRAW_INDIRECT_BUFFER, GLintptr(offset), GLsizeiptr(size), commands->data());
+    }
+    offset += size;
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+#endif
+}
+
+NGLScene::ForestBatch::~ForestBatch()
+{
+  glDeleteVertexArrays(3, m_VAOs);
+  glDeleteBuffers(1, &m_transformBuffer);
+  glDeleteBuffers(1, &m_commandBuffer);
+}
+
+//------------------------------------------------------------------------------------------------------------------------
+
+void NGLScene::buildScatteredForestVAOs()
+{
+  buildForestVAOs(m_scatteredForest, m_scatteredForestVAOs);
 }
 
 //------------------------------------------------------------------------------------------------------------------------
 
 void NGLScene::buildPaintedForestVAOs()
 {
-  for(size_t t=0; t<m_paintedForest.m_treeTypes.size(); t++)
+  buildForestVAOs(m_paintedForest, m_paintedForestVAOs);
+}
+
+//------------------------------------------------------------------------------------------------------------------------
+
+void NGLScene::updateForestTileVAOs()
+{
+  for(auto &coord : m_forestTiles.m_evictedTiles)
+  {
+    auto it = m_forestTileVAOs.find(coord);
+    if(it != m_forestTileVAOs.end())
+    {
+      removeForestVAOs(it->second);
+      m_forestTileVAOs.erase(it);
+    }
+  }
+  for(auto &coord : m_forestTiles.m_builtTiles)
+  {
+    //a tile can be built and evicted again before its VAOs are built
+    const Forest *tile = m_forestTiles.getTile(coord);
+    if(tile)
+    {
+      buildForestVAOs(*tile, m_forestTileVAOs[coord]);
+    }
+  }
+  m_forestTiles.clearChanges();
+}
+
+//------------------------------------------------------------------------------------------------------------------------
+
+void NGLScene::removeForestTileVAOs()
+{
+  for(auto &tile : m_forestTileVAOs)
   {
-    LSystem &treeType = m_paintedForest.m_treeTypes[t];
-    CACHE_STRUCTURE(Instance) &instanceCache = treeType.m_instanceCache;
-
-    RESIZE_CACHE_BY_OTHER_CACHE(m_paintedForestVAOs[t], instanceCache)
-    RESIZE_CACHE_BY_OTHER_CACHE(m_paintedForestLeafVAOs[t], instanceCache)
-    RESIZE_CACHE_BY_OTHER_CACHE(m_paintedForestPolygonVAOs[t], instanceCache)
-
-    RESIZE_CACHE_BY_OTHER_CACHE(m_paintedForestRightBuffers[t], instanceCache)
-    RESIZE_CACHE_BY_OTHER_CACHE(m_paintedForestThicknessBuffers[t], instanceCache)
-    RESIZE_CACHE_BY_OTHER_CACHE(m_paintedForestLeafDirectionBuffers[t], instanceCache)
-    RESIZE_CACHE_BY_OTHER_CACHE(m_paintedForestLeafRightBuffers[t], instanceCache)
-
-    FOR_EACH_ELEMENT(m_paintedForestVAOs[t],
-                     buildForestVAO(t,ID,AGE,INDEX,true);
-                     buildForestLeafVAO(t,ID,AGE,INDEX,true);
-                     buildForestPolygonVAO(t,ID,AGE,INDEX,true))
+    removeForestVAOs(tile.second);
   }
+  m_forestTileVAOs.clear();
 }
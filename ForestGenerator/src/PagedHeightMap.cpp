@@ -0,0 +1,407 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file PagedHeightMap.cpp
+/// @brief implementation file for PagedHeightMap class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "PagedHeightMap.h"
+
+constexpr size_t PagedHeightMap::m_notCached;
+
+
+PagedHeightMap::~PagedHeightMap()
+{
+  close();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bool PagedHeightMap::create(const std::string &_fileName, size_t _dimension, float _scale, size_t _tileSize)
+{
+  close();
+#ifndef _WIN32
+  if(_dimension==0 || _tileSize==0)
+  {
+    std::cout<<"Can't create a heightmap file with no tiles\n";
+    return false;
+  }
+  m_file = ::open(_fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(m_file<0)
+  {
+    std::cout<<"Couldn't create heightmap file "<<_fileName<<'\n';
+    return false;
+  }
+  FileHeader header = {{'F','G','H','M','A','P','\0','\0'}, 1, uint32_t(_tileSize), uint64_t(_dimension), _scale, 0};
+  m_dimension = _dimension;
+  m_scale = _scale;
+  m_tileSize = _tileSize;
+
+  //the tiles start on a 64KB boundary, so that they line up with the pages on any machine, and the file is extended
+  //to its full size without writing anything, so every stamp starts as 0
+  size_t numTiles = getNumTilesPerSide()*getNumTilesPerSide();
+  size_t tileBytes = m_tileSize*m_tileSize*sizeof(float);
+  const size_t alignment = 65536;
+  size_t infoBytes = sizeof(FileHeader) + numTiles*sizeof(TileInfo);
+  size_t dataOffset = (infoBytes+alignment-1)/alignment*alignment;
+  if(pwrite(m_file, &header, sizeof(header), 0) != ssize_t(sizeof(header)) ||
+     ftruncate(m_file, off_t(dataOffset + numTiles*tileBytes)) != 0)
+  {
+    std::cout<<"Couldn't write heightmap file "<<_fileName<<'\n';
+    close();
+    return false;
+  }
+  return mapInfo(_fileName);
+#else
+  std::cout<<"Heightmap files need POSIX memory mapping, which isn't available on this platform\n";
+  static_cast<void>(_fileName);
+  static_cast<void>(_dimension);
+  static_cast<void>(_scale);
+  static_cast<void>(_tileSize);
+  return false;
+#endif
+}
+
+bool PagedHeightMap::open(const std::string &_fileName)
+{
+  close();
+#ifndef _WIN32
+  m_file = ::open(_fileName.c_str(), O_RDWR);
+  if(m_file<0)
+  {
+    return false;
+  }
+  FileHeader header;
+  if(pread(m_file, &header, sizeof(header), 0) != ssize_t(sizeof(header)) ||
+     std::memcmp(header.m_magic, "FGHMAP", 6) != 0 || header.m_version != 1 ||
+     header.m_dimension==0 || header.m_tileSize==0)
+  {
+    std::cout<<_fileName<<" isn't a heightmap file\n";
+    close();
+    return false;
+  }
+  m_dimension = size_t(header.m_dimension);
+  m_scale = header.m_scale;
+  m_tileSize = size_t(header.m_tileSize);
+  return mapInfo(_fileName);
+#else
+  static_cast<void>(_fileName);
+  return false;
+#endif
+}
+
+bool PagedHeightMap::mapInfo(const std::string &_fileName)
+{
+#ifndef _WIN32
+  size_t numTiles = getNumTilesPerSide()*getNumTilesPerSide();
+  size_t tileBytes = m_tileSize*m_tileSize*sizeof(float);
+  const size_t alignment = 65536;
+  m_infoMappingLength = sizeof(FileHeader) + numTiles*sizeof(TileInfo);
+  m_dataOffset = (m_infoMappingLength+alignment-1)/alignment*alignment;
+  struct stat fileStats;
+  if(fstat(m_file, &fileStats)!=0 || size_t(fileStats.st_size) < m_dataOffset + numTiles*tileBytes)
+  {
+    std::cout<<"Heightmap file "<<_fileName<<" is too short\n";
+    close();
+    return false;
+  }
+  m_infoMapping = mmap(nullptr, m_infoMappingLength, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+  if(m_infoMapping == MAP_FAILED)
+  {
+    std::cout<<"Couldn't map heightmap file "<<_fileName<<'\n';
+    m_infoMapping = nullptr;
+    close();
+    return false;
+  }
+  m_tileInfo = reinterpret_cast<TileInfo*>(static_cast<char*>(m_infoMapping) + sizeof(FileHeader));
+  m_cachedTiles.clear();
+  m_cacheSlots.assign(numTiles, m_notCached);
+  m_useCount = 0;
+  return true;
+#else
+  static_cast<void>(_fileName);
+  return false;
+#endif
+}
+
+void PagedHeightMap::close()
+{
+#ifndef _WIN32
+  for(auto &tile : m_cachedTiles)
+  {
+    munmap(tile.m_mapping, tile.m_mappingLength);
+  }
+  if(m_infoMapping)
+  {
+    munmap(m_infoMapping, m_infoMappingLength);
+  }
+  if(m_file>=0)
+  {
+    ::close(m_file);
+  }
+#endif
+  m_cachedTiles.clear();
+  m_cacheSlots.clear();
+  m_infoMapping = nullptr;
+  m_tileInfo = nullptr;
+  m_file = -1;
+}
+
+bool PagedHeightMap::isOpen() const
+{
+  return m_file>=0;
+}
+
+size_t PagedHeightMap::getNumTilesPerSide() const
+{
+  return m_tileSize>0 ? (m_dimension+m_tileSize-1)/m_tileSize : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+float PagedHeightMap::getValue(size_t _x, size_t _z)
+{
+  if(_x>=m_dimension || _z>=m_dimension)
+  {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const float *heights = getTile((_z/m_tileSize)*getNumTilesPerSide() + _x/m_tileSize);
+  return heights ? heights[(_z%m_tileSize)*m_tileSize + _x%m_tileSize] : 0;
+}
+
+void PagedHeightMap::getValues(const size_t *_x, const size_t *_z, float *_values, size_t _count)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  //nearby positions usually share a tile, and the last tile looked up is the most recently used so it stays mapped
+  size_t numTiles = getNumTilesPerSide();
+  size_t lastTile = m_notCached;
+  const float *heights = nullptr;
+  for(size_t i=0; i<_count; i++)
+  {
+    if(_x[i]>=m_dimension || _z[i]>=m_dimension)
+    {
+      _values[i] = 0;
+      continue;
+    }
+    size_t tile = (_z[i]/m_tileSize)*numTiles + _x[i]/m_tileSize;
+    if(tile!=lastTile)
+    {
+      heights = getTile(tile);
+      lastTile = tile;
+    }
+    _values[i] = heights ? heights[(_z[i]%m_tileSize)*m_tileSize + _x[i]%m_tileSize] : 0;
+  }
+}
+
+void PagedHeightMap::readRegion(size_t _firstX, size_t _firstZ, size_t _width, size_t _depth, size_t _stride,
+                                float *_values)
+{
+  if(_width==0 || _depth==0)
+  {
+    return;
+  }
+  if(_stride==0 || _firstX+(_width-1)*_stride>=m_dimension || _firstZ+(_depth-1)*_stride>=m_dimension)
+  {
+    std::cout<<"Heightmap region is outside the grid\n";
+    return;
+  }
+  //the samples in [_begin,_end) are the ones between grid coordinates _tileStart and _tileEnd
+  auto findSamples = [_stride](size_t _first, size_t _count, size_t _tileStart, size_t _tileEnd,
+                               size_t &_begin, size_t &_end)
+  {
+    _begin = _tileStart<=_first ? 0 : (_tileStart-_first+_stride-1)/_stride;
+    _end = _tileEnd<=_first ? 0 : std::min(_count, (_tileEnd-_first+_stride-1)/_stride);
+  };
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t numTiles = getNumTilesPerSide();
+  for(size_t tileZ=_firstZ/m_tileSize; tileZ<numTiles; tileZ++)
+  {
+    size_t beginZ, endZ;
+    findSamples(_firstZ, _depth, tileZ*m_tileSize, (tileZ+1)*m_tileSize, beginZ, endZ);
+    if(beginZ>=_depth)
+    {
+      break;
+    }
+    for(size_t tileX=_firstX/m_tileSize; tileX<numTiles; tileX++)
+    {
+      size_t beginX, endX;
+      findSamples(_firstX, _width, tileX*m_tileSize, (tileX+1)*m_tileSize, beginX, endX);
+      if(beginX>=_width)
+      {
+        break;
+      }
+      const float *heights = getTile(tileZ*numTiles + tileX);
+      for(size_t j=beginZ; j<endZ; j++)
+      {
+        size_t z = _firstZ + j*_stride - tileZ*m_tileSize;
+        for(size_t i=beginX; i<endX; i++)
+        {
+          size_t x = _firstX + i*_stride - tileX*m_tileSize;
+          _values[j*_width+i] = heights ? heights[z*m_tileSize + x] : 0;
+        }
+      }
+    }
+  }
+}
+
+size_t PagedHeightMap::generateStaleTiles()
+{
+  if(!isOpen() || !m_generateTile)
+  {
+    return 0;
+  }
+  //the lock is held throughout, so nothing reads a tile while it is being generated - the tiles are generated in
+  //their own mappings, which share their memory with any mapping of the same tile in the cache
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::vector<size_t> staleTiles;
+  for(size_t tile=0; tile<m_cacheSlots.size(); tile++)
+  {
+    if(m_tileInfo[tile].m_stamp != m_stamp)
+    {
+      staleTiles.push_back(tile);
+    }
+  }
+  std::atomic<size_t> nextTile(0);
+  auto worker = [&]()
+  {
+    for(size_t i=nextTile++; i<staleTiles.size(); i=nextTile++)
+    {
+      CachedTile mappedTile;
+      if(mapTile(staleTiles[i], mappedTile))
+      {
+        generateTile(staleTiles[i], mappedTile.m_heights);
+#ifndef _WIN32
+        munmap(mappedTile.m_mapping, mappedTile.m_mappingLength);
+#endif
+      }
+    }
+  };
+  size_t numThreads = std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+  std::vector<std::thread> threads;
+  for(size_t i=1; i<std::min(numThreads, staleTiles.size()); i++)
+  {
+    threads.push_back(std::thread(worker));
+  }
+  worker();
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
+  return staleTiles.size();
+}
+
+PagedHeightMap::TileInfo PagedHeightMap::getTileInfo(size_t _tileX, size_t _tileZ)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(!isOpen() || _tileX>=getNumTilesPerSide() || _tileZ>=getNumTilesPerSide())
+  {
+    return {0, 0, 0};
+  }
+  return m_tileInfo[_tileZ*getNumTilesPerSide() + _tileX];
+}
+
+size_t PagedHeightMap::getNumCachedTiles()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_cachedTiles.size();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+const float *PagedHeightMap::getTile(size_t _tile)
+{
+  if(!isOpen())
+  {
+    return nullptr;
+  }
+  m_useCount++;
+  size_t slot = m_cacheSlots[_tile];
+  if(slot == m_notCached)
+  {
+    //make room by unmapping the least recently used tile, whose slot is then reused
+    if(m_cachedTiles.size() >= std::max(m_maxCachedTiles, size_t(1)))
+    {
+      auto oldest = std::min_element(m_cachedTiles.begin(), m_cachedTiles.end(),
+                                     [](const CachedTile &_a, const CachedTile &_b)
+                                     {return _a.m_lastUse < _b.m_lastUse;});
+#ifndef _WIN32
+      munmap(oldest->m_mapping, oldest->m_mappingLength);
+#endif
+      size_t evictedTile = oldest->m_tile;
+      *oldest = m_cachedTiles.back();
+      m_cacheSlots[oldest->m_tile] = size_t(oldest-m_cachedTiles.begin());
+      m_cachedTiles.pop_back();
+      m_cacheSlots[evictedTile] = m_notCached;
+    }
+    CachedTile mappedTile;
+    if(!mapTile(_tile, mappedTile))
+    {
+      return nullptr;
+    }
+    slot = m_cachedTiles.size();
+    m_cachedTiles.push_back(mappedTile);
+    m_cacheSlots[_tile] = slot;
+  }
+  CachedTile &cachedTile = m_cachedTiles[slot];
+  cachedTile.m_lastUse = m_useCount;
+  return cachedTile.m_heights;
+}
+
+bool PagedHeightMap::mapTile(size_t _tile, CachedTile &_mappedTile) const
+{
+#ifndef _WIN32
+  //mmap offsets must be whole pages, so the mapping starts at the page the tile starts in
+  size_t tileBytes = m_tileSize*m_tileSize*sizeof(float);
+  size_t offset = m_dataOffset + _tile*tileBytes;
+  size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+  size_t pageOffset = offset%pageSize;
+  _mappedTile.m_tile = _tile;
+  _mappedTile.m_mappingLength = tileBytes + pageOffset;
+  _mappedTile.m_mapping = mmap(nullptr, _mappedTile.m_mappingLength, PROT_READ | PROT_WRITE, MAP_SHARED, m_file,
+                               off_t(offset-pageOffset));
+  if(_mappedTile.m_mapping == MAP_FAILED)
+  {
+    std::cout<<"Couldn't map heightmap tile "<<_tile<<'\n';
+    return false;
+  }
+  _mappedTile.m_heights = reinterpret_cast<float*>(static_cast<char*>(_mappedTile.m_mapping) + pageOffset);
+  _mappedTile.m_lastUse = 0;
+  return true;
+#else
+  static_cast<void>(_tile);
+  static_cast<void>(_mappedTile);
+  return false;
+#endif
+}
+
+void PagedHeightMap::generateTile(size_t _tile, float *_heights)
+{
+  size_t numTiles = getNumTilesPerSide();
+  size_t firstX = (_tile%numTiles)*m_tileSize;
+  size_t firstZ = (_tile/numTiles)*m_tileSize;
+  size_t width = std::min(m_tileSize, m_dimension-firstX);
+  size_t depth = std::min(m_tileSize, m_dimension-firstZ);
+  m_generateTile(firstX, firstZ, width, depth, m_tileSize, _heights);
+
+  TileInfo &info = m_tileInfo[_tile];
+  info.m_minHeight = _heights[0];
+  info.m_maxHeight = _heights[0];
+  for(size_t z=0; z<depth; z++)
+  {
+    auto minMax = std::minmax_element(_heights+z*m_tileSize, _heights+z*m_tileSize+width);
+    info.m_minHeight = std::min(info.m_minHeight, *minMax.first);
+    info.m_maxHeight = std::max(info.m_maxHeight, *minMax.second);
+  }
+  info.m_stamp = m_stamp;
+}
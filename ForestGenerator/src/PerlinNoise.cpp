@@ -0,0 +1,202 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file PerlinNoise.cpp
+/// @brief implementation file for PerlinNoise class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdint>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "PerlinNoise.h"
+
+constexpr float PerlinNoise::m_tolerance;
+
+
+double PerlinNoise::getValue(double _x, double _y, double _z) const
+{
+  //libnoise also wraps coordinates beyond +-2^30 back into range, which no terrain comes close to needing
+  double value = 0;
+  double persistence = 1;
+  _x *= m_frequency;
+  _y *= m_frequency;
+  _z *= m_frequency;
+  for(int octave=0; octave<m_octaves; octave++)
+  {
+    value += getCoherentNoise(_x, _y, _z, m_seed+octave) * persistence;
+    _x *= m_lacunarity;
+    _y *= m_lacunarity;
+    _z *= m_lacunarity;
+    persistence *= m_persistence;
+  }
+  return value;
+}
+
+void PerlinNoise::getRow(double _x, double _dx, double _y, double _z, size_t _count, float *_values) const
+{
+  std::fill(_values, _values+_count, 0.0f);
+  double persistence = 1;
+  _x *= m_frequency;
+  _dx *= m_frequency;
+  _y *= m_frequency;
+  _z *= m_frequency;
+  for(int octave=0; octave<m_octaves; octave++)
+  {
+    addOctaveToRow(_x, _dx, _y, _z, m_seed+octave, float(persistence), _count, _values);
+    _x *= m_lacunarity;
+    _dx *= m_lacunarity;
+    _y *= m_lacunarity;
+    _z *= m_lacunarity;
+    persistence *= m_persistence;
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int PerlinNoise::getGradientIndex(int _ix, int _iy, int _iz, int _seed)
+{
+  //the products wrap around in 32 bits and the shift is arithmetic, as they are in libnoise
+  int32_t index = int32_t(uint32_t(1619)*uint32_t(_ix) + uint32_t(31337)*uint32_t(_iy) +
+                          uint32_t(6971)*uint32_t(_iz) + uint32_t(1013)*uint32_t(_seed));
+  index ^= (index >> 8);
+  return index & 0xff;
+}
+
+double PerlinNoise::getGradientNoise(double _x, double _y, double _z, int _ix, int _iy, int _iz, int _seed) const
+{
+  const float *gradient = &m_gradients[3*size_t(getGradientIndex(_ix, _iy, _iz, _seed))];
+  return double(gradient[0])*(_x-_ix) + double(gradient[1])*(_y-_iy) + double(gradient[2])*(_z-_iz);
+}
+
+double PerlinNoise::getCoherentNoise(double _x, double _y, double _z, int _seed) const
+{
+  //libnoise puts whole numbers that aren't positive at the top of the cell below them rather than the bottom of the
+  //cell above, which makes no difference to the value but has to be kept to pick the same gradients
+  int x0 = _x>0.0 ? int(_x) : int(_x)-1;
+  int y0 = _y>0.0 ? int(_y) : int(_y)-1;
+  int z0 = _z>0.0 ? int(_z) : int(_z)-1;
+  double xs = (_x-x0)*(_x-x0)*(3.0-2.0*(_x-x0));
+  double ys = (_y-y0)*(_y-y0)*(3.0-2.0*(_y-y0));
+  double zs = (_z-z0)*(_z-z0)*(3.0-2.0*(_z-z0));
+  double values[4];
+  for(int i=0; i<4; i++)
+  {
+    int y = y0 + i%2;
+    int z = z0 + i/2;
+    double n0 = getGradientNoise(_x, _y, _z, x0, y, z, _seed);
+    double n1 = getGradientNoise(_x, _y, _z, x0+1, y, z, _seed);
+    values[i] = (1.0-xs)*n0 + xs*n1;
+  }
+  double iy0 = (1.0-ys)*values[0] + ys*values[1];
+  double iy1 = (1.0-ys)*values[2] + ys*values[3];
+  return (1.0-zs)*iy0 + zs*iy1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void PerlinNoise::addOctaveToRow(double _x, double _dx, double _y, double _z, int _seed, float _persistence,
+                                 size_t _count, float *_values) const
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  //everything but x is the same along the row, so the y and z parts of the four lattice edges the samples are
+  //interpolated between are worked out once
+  int y0 = _y>0.0 ? int(_y) : int(_y)-1;
+  int z0 = _z>0.0 ? int(_z) : int(_z)-1;
+  float ys = float((_y-y0)*(_y-y0)*(3.0-2.0*(_y-y0)));
+  float zs = float((_z-z0)*(_z-z0)*(3.0-2.0*(_z-z0)));
+  int32_t edgeHashes[4];
+  float edgeDY[4];
+  float edgeDZ[4];
+  for(int edge=0; edge<4; edge++)
+  {
+    int y = y0 + edge%2;
+    int z = z0 + edge/2;
+    edgeHashes[edge] = int32_t(uint32_t(31337)*uint32_t(y) + uint32_t(6971)*uint32_t(z) +
+                               uint32_t(1013)*uint32_t(_seed));
+    edgeDY[edge] = float(_y-y);
+    edgeDZ[edge] = float(_z-z);
+  }
+
+  //SSE2 has no 32 bit multiply that keeps the low half, so the even and odd lanes are multiplied separately
+  auto multiply = [](__m128i _a, __m128i _b)
+  {
+    __m128i even = _mm_mul_epu32(_a, _b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_si128(_a,4), _mm_srli_si128(_b,4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+  };
+  auto lerp = [](__m128 _a, __m128 _b, __m128 _t)
+  {
+    return _mm_add_ps(_a, _mm_mul_ps(_t, _mm_sub_ps(_b, _a)));
+  };
+  //fine grids put many samples in each lattice cell, so when all four samples share a cell each gradient is only
+  //loaded once
+  bool sameCell = false;
+  auto gatherGradients = [this, &sameCell](const int32_t *_indices, size_t _axis)
+  {
+    const float *gradients = m_gradients.data() + _axis;
+    if(sameCell)
+    {
+      return _mm_set1_ps(gradients[3*_indices[0]]);
+    }
+    return _mm_setr_ps(gradients[3*_indices[0]], gradients[3*_indices[1]],
+                       gradients[3*_indices[2]], gradients[3*_indices[3]]);
+  };
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128i byteMask = _mm_set1_epi32(0xff);
+  const __m128i xHash = _mm_set1_epi32(1619);
+
+  for(; i+4<=_count; i+=4)
+  {
+    //the cells and positions in them are found in double precision, so that the samples are as accurate far from
+    //the origin as they are near it
+    alignas(16) int32_t cells[4];
+    float positions[4];
+    for(size_t j=0; j<4; j++)
+    {
+      double x = _x + double(i+j)*_dx;
+      cells[j] = x>0.0 ? int(x) : int(x)-1;
+      positions[j] = float(x-cells[j]);
+    }
+    sameCell = cells[0]==cells[3];
+    __m128i x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(cells));
+    __m128 dx0 = _mm_loadu_ps(positions);
+    __m128 dx1 = _mm_sub_ps(dx0, one);
+    __m128 xs = _mm_mul_ps(_mm_mul_ps(dx0, dx0), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_add_ps(dx0, dx0)));
+    __m128i hash0 = multiply(x0, xHash);
+    __m128i hash1 = _mm_add_epi32(hash0, xHash);
+
+    __m128 edgeValues[4];
+    for(int edge=0; edge<4; edge++)
+    {
+      __m128i index0 = _mm_add_epi32(hash0, _mm_set1_epi32(edgeHashes[edge]));
+      __m128i index1 = _mm_add_epi32(hash1, _mm_set1_epi32(edgeHashes[edge]));
+      index0 = _mm_and_si128(_mm_xor_si128(index0, _mm_srai_epi32(index0, 8)), byteMask);
+      index1 = _mm_and_si128(_mm_xor_si128(index1, _mm_srai_epi32(index1, 8)), byteMask);
+      alignas(16) int32_t indices0[4];
+      alignas(16) int32_t indices1[4];
+      _mm_store_si128(reinterpret_cast<__m128i*>(indices0), index0);
+      _mm_store_si128(reinterpret_cast<__m128i*>(indices1), index1);
+      __m128 dy = _mm_set1_ps(edgeDY[edge]);
+      __m128 dz = _mm_set1_ps(edgeDZ[edge]);
+      __m128 n0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gatherGradients(indices0, 0), dx0),
+                                        _mm_mul_ps(gatherGradients(indices0, 1), dy)),
+                             _mm_mul_ps(gatherGradients(indices0, 2), dz));
+      __m128 n1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gatherGradients(indices1, 0), dx1),
+                                        _mm_mul_ps(gatherGradients(indices1, 1), dy)),
+                             _mm_mul_ps(gatherGradients(indices1, 2), dz));
+      edgeValues[edge] = lerp(n0, n1, xs);
+    }
+    __m128 iy0 = lerp(edgeValues[0], edgeValues[1], _mm_set1_ps(ys));
+    __m128 iy1 = lerp(edgeValues[2], edgeValues[3], _mm_set1_ps(ys));
+    __m128 value = _mm_mul_ps(lerp(iy0, iy1, _mm_set1_ps(zs)), _mm_set1_ps(_persistence));
+    _mm_storeu_ps(_values+i, _mm_add_ps(_mm_loadu_ps(_values+i), value));
+  }
+#endif
+  //the rest of the row, or all of it without SSE2
+  for(; i<_count; i++)
+  {
+    _values[i] += float(getCoherentNoise(_x + double(i)*_dx, _y, _z, _seed) * double(_persistence));
+  }
+}
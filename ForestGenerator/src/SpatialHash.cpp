@@ -0,0 +1,132 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file SpatialHash.cpp
+/// @brief implementation file for SpatialHash class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <math.h>
+#include "SpatialHash.h"
+
+
+SpatialHash::SpatialHash(float _cellSize) :
+  m_cellSize(_cellSize) {}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int SpatialHash::getCell(float _pos) const
+{
+  return int(floorf(_pos/m_cellSize));
+}
+
+uint64_t SpatialHash::getKey(int _cellX, int _cellZ)
+{
+  return (uint64_t(uint32_t(_cellX))<<32) | uint64_t(uint32_t(_cellZ));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void SpatialHash::insert(size_t _id, float _x, float _z)
+{
+  m_cells[getKey(getCell(_x),getCell(_z))].push_back({_id, _x, _z});
+  m_size++;
+}
+
+bool SpatialHash::remove(size_t _id, float _x, float _z)
+{
+  auto cell = m_cells.find(getKey(getCell(_x),getCell(_z)));
+  if(cell == m_cells.end())
+  {
+    return false;
+  }
+  std::vector<Entry> &entries = cell->second;
+  for(size_t i=0; i<entries.size(); i++)
+  {
+    if(entries[i].m_id == _id)
+    {
+      //order within a cell doesn't matter, so swap with the last entry rather than shifting the rest down
+      entries[i] = entries.back();
+      entries.pop_back();
+      if(entries.size()==0)
+      {
+        m_cells.erase(cell);
+      }
+      m_size--;
+      return true;
+    }
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+template<typename F>
+void SpatialHash::forEachPointWithin(float _x, float _z, float _radius, F _func) const
+{
+  int minX = getCell(_x-_radius);
+  int maxX = getCell(_x+_radius);
+  int minZ = getCell(_z-_radius);
+  int maxZ = getCell(_z+_radius);
+  float radiusSquared = _radius*_radius;
+  auto visitCell = [&](const std::vector<Entry> &_entries)
+  {
+    for(auto &entry : _entries)
+    {
+      float dx = entry.m_x-_x;
+      float dz = entry.m_z-_z;
+      if(dx*dx+dz*dz < radiusSquared && !_func(entry))
+      {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  //for a query covering more cells than are occupied, it's quicker to visit the occupied cells directly
+  if(double(maxX-minX+1)*double(maxZ-minZ+1) > double(m_cells.size()))
+  {
+    for(auto &cell : m_cells)
+    {
+      if(!visitCell(cell.second))
+      {
+        return;
+      }
+    }
+    return;
+  }
+
+  for(int cellX=minX; cellX<=maxX; cellX++)
+  {
+    for(int cellZ=minZ; cellZ<=maxZ; cellZ++)
+    {
+      auto cell = m_cells.find(getKey(cellX,cellZ));
+      if(cell != m_cells.end() && !visitCell(cell->second))
+      {
+        return;
+      }
+    }
+  }
+}
+
+bool SpatialHash::hasPointWithin(float _x, float _z, float _radius) const
+{
+  bool found = false;
+  forEachPointWithin(_x, _z, _radius, [&found](const Entry &){found = true; return false;});
+  return found;
+}
+
+void SpatialHash::findPointsWithin(float _x, float _z, float _radius, std::vector<size_t> &_ids) const
+{
+  forEachPointWithin(_x, _z, _radius, [&_ids](const Entry &_entry){_ids.push_back(_entry.m_id); return true;});
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+size_t SpatialHash::size() const
+{
+  return m_size;
+}
+
+void SpatialHash::clear()
+{
+  m_cells.clear();
+  m_size = 0;
+}
@@ -0,0 +1,119 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file SpeciesCache.cpp
+/// @brief implementation file for SpeciesCache class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include "SpeciesCache.h"
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+std::shared_ptr<const LSystem> SpeciesCache::getTreeType(const LSystem &_LSystem, int _numHeroTrees)
+{
+  m_requestCount++;
+  std::string key = getKey(_LSystem, _numHeroTrees);
+  auto it = m_species.find(key);
+  if(it != m_species.end())
+  {
+    it->second.m_lastUsed = m_requestCount;
+    return it->second.m_treeType;
+  }
+
+  Entry entry;
+  entry.m_treeType = createTreeType(_LSystem, _numHeroTrees);
+  entry.m_lastUsed = m_requestCount;
+  m_species[key] = entry;
+  pruneUnusedSpecies();
+  return entry.m_treeType;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+std::shared_ptr<const LSystem> SpeciesCache::createTreeType(const LSystem &_LSystem, int _numHeroTrees)
+{
+  //fillInstanceCache() rewrites the axiom and rules with instancing commands, so we work on a copy and leave the
+  //user-facing LSystem untouched
+  std::shared_ptr<LSystem> treeType = std::make_shared<LSystem>(_LSystem);
+  treeType->fillInstanceCache(_numHeroTrees);
+  return treeType;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+std::string SpeciesCache::getKey(const LSystem &_LSystem, int _numHeroTrees)
+{
+  //floats are written with enough precision to round trip, so any change made through the ui changes the key
+  std::ostringstream key;
+  key.precision(9);
+  key<<_LSystem.m_axiom<<'\n';
+  for(auto &rule : _LSystem.m_rules)
+  {
+    key<<rule.m_LHS<<'=';
+    for(size_t i=0; i<rule.m_RHS.size(); i++)
+    {
+      key<<rule.m_RHS[i]<<':'<<rule.m_prob[i]<<'|';
+    }
+    key<<'\n';
+  }
+  key<<_LSystem.m_stepSize<<' '<<_LSystem.m_stepScale<<' '
+     <<_LSystem.m_angle<<' '<<_LSystem.m_angleScale<<' '
+     <<_LSystem.m_thickness<<' '<<_LSystem.m_thicknessScale<<' '
+     <<_LSystem.m_generation<<' '
+     <<_LSystem.m_instancingProb<<' '<<_LSystem.m_maxInstancePerLevel<<' '
+     <<_numHeroTrees<<' ';
+  for(auto fraction : _LSystem.m_simplificationFractions)
+  {
+    key<<fraction<<' ';
+  }
+  //the LOD chain is built with the species, so a change to the number of levels needs a new species too
+  key<<"lods "<<_LSystem.m_numLODLevels<<' '<<_LSystem.m_bakeSimplifiedMeshes<<' ';
+  //an unseeded LSystem is seeded by time, so any set of heroes is as valid as any other and the seed is ignored
+  if(_LSystem.m_useSeed)
+  {
+    key<<"seed "<<_LSystem.m_seed;
+  }
+  return key.str();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+size_t SpeciesCache::size() const
+{
+  return m_species.size();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void SpeciesCache::clear()
+{
+  m_species.clear();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void SpeciesCache::pruneUnusedSpecies()
+{
+  //a use count of 1 means the only reference to a species is the one held by the cache
+  std::vector<std::map<std::string, Entry>::iterator> unused;
+  for(auto it = m_species.begin(); it != m_species.end(); ++it)
+  {
+    if(it->second.m_treeType.use_count() == 1)
+    {
+      unused.push_back(it);
+    }
+  }
+  if(unused.size() <= m_maxUnusedSpecies)
+  {
+    return;
+  }
+  std::sort(unused.begin(), unused.end(),
+            [](const std::map<std::string, Entry>::iterator &_a, const std::map<std::string, Entry>::iterator &_b)
+            {return _a->second.m_lastUsed < _b->second.m_lastUsed;});
+  for(size_t i=0; i<unused.size()-m_maxUnusedSpecies; i++)
+  {
+    m_species.erase(unused[i]);
+  }
+}
@@ -6,6 +6,11 @@
 #include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <chrono>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "TerrainData.h"
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -17,71 +22,72 @@ TerrainData::TerrainData(TerrainGenerator &_terrainGen) :
     m_dimension(_terrainGen.m_dimension), m_heightMap(_terrainGen.m_heightMap), m_scale(_terrainGen.m_scale),
     m_normals(_terrainGen.m_normals), m_tangents(_terrainGen.m_tangents), m_bitangents(_terrainGen.m_bitangents)
 {
-  //Fill m_vertices
+  //Fill m_vertices - allocated at its final size up front, since the five quadtrees fill separate parts of it and
+  //can then be filled at the same time
   size_t dimension = size_t(m_dimension);
-  m_vertices.resize(9,Vertex(0,0,0,m_dimension, m_scale, {0,1,0}, {0,1,0}, {0,1,0}));
-  m_vertices[0] = getVertex(dimension*dimension - dimension);          //SW corner
-  m_vertices[1] = getVertex(dimension*dimension - 1);                  //SE corner
-  m_vertices[2] = getVertex(dimension - 1);                            //NE corner
-  m_vertices[3] = getVertex(0);                                        //NW corner
-  m_vertices[4] = getVertex((dimension*dimension - 1)/2);              //centre
-  m_vertices[5] = getVertex((dimension*dimension - dimension)/2);      //left middle
-  m_vertices[6] = getVertex(dimension*dimension - (dimension+1)/2);    //bottom middle
-  m_vertices[7] = getVertex((dimension*dimension + dimension - 2)/2);  //right middle
-  m_vertices[8] = getVertex((dimension - 1)/2);                        //top middle
-
-  createVerticesWQT((dimension*dimension - 1)/2,             4,3,(m_dimension-1)/4); //fill from root of white quadtree
-  createVerticesBQT((dimension*dimension - dimension)/2,     5,4,(m_dimension-1)/4); //fill from root of first black quadtree
-  createVerticesBQT(dimension*dimension - (dimension+1)/2,   6,4,(m_dimension-1)/4); //fill from root of second black quadtree
-  createVerticesBQT((dimension*dimension + dimension - 2)/2, 7,4,(m_dimension-1)/4); //fill from root of third black quadtree
-  createVerticesBQT((dimension - 1)/2,                       8,4,(m_dimension-1)/4); //fill from root of fourth black quadtree
+  assignGraphLevels();
+  m_vertices.resize(m_graphLevelStarts.back(),Vertex(0,0,0,m_dimension, m_scale));
+  m_heightMapIndices.resize(m_vertices.size(),0);
+  setVertex(0, dimension*dimension - dimension);          //SW corner
+  setVertex(1, dimension*dimension - 1);                  //SE corner
+  setVertex(2, dimension - 1);                            //NE corner
+  setVertex(3, 0);                                        //NW corner
+  setVertex(4, (dimension*dimension - 1)/2);              //centre
+  setVertex(5, (dimension*dimension - dimension)/2);      //left middle
+  setVertex(6, dimension*dimension - (dimension+1)/2);    //bottom middle
+  setVertex(7, (dimension*dimension + dimension - 2)/2);  //right middle
+  setVertex(8, (dimension - 1)/2);                        //top middle
+
+  std::vector<std::thread> threads;
+  //fill from roots of the four black quadtrees
+  threads.push_back(std::thread(&TerrainData::createVerticesBQT, this,
+                                (dimension*dimension - dimension)/2,     5,4,(m_dimension-1)/4));
+  threads.push_back(std::thread(&TerrainData::createVerticesBQT, this,
+                                dimension*dimension - (dimension+1)/2,   6,4,(m_dimension-1)/4));
+  threads.push_back(std::thread(&TerrainData::createVerticesBQT, this,
+                                (dimension*dimension + dimension - 2)/2, 7,4,(m_dimension-1)/4));
+  threads.push_back(std::thread(&TerrainData::createVerticesBQT, this,
+                                (dimension - 1)/2,                       8,4,(m_dimension-1)/4));
+  //fill from root of white quadtree
+  createVerticesWQT((dimension*dimension - 1)/2,             4,3,(m_dimension-1)/4);
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
 
   //Assign Children
-  m_verticesArrangedByGraphLevel.resize(size_t(m_maxRefinementLevel),{});
-  m_verticesArrangedByGraphLevel[size_t(m_maxRefinementLevel)-2]={5,6,7,8};
-  m_verticesArrangedByGraphLevel[size_t(m_maxRefinementLevel)-1]={4};
-  assignChildren(4,5,m_maxRefinementLevel-2);
-  assignChildren(4,6,m_maxRefinementLevel-2);
-  assignChildren(4,7,m_maxRefinementLevel-2);
-  assignChildren(4,8,m_maxRefinementLevel-2);
-  m_vertices[4].childList = {5,6,7,8};
+  assignChildren();
 
   //Assign Bounding Sphere Radii
   assignRadius();
 
   //Assign Delta Values;
-  assignDelta(0,4,5,2);
-  assignDelta(1,4,6,2);
-  assignDelta(2,4,7,2);
-  assignDelta(3,4,8,2);
+  assignDelta();
 
   //Assign Augmented Delta Values;
   assignAugmentedDelta();
+  std::vector<GLuint>().swap(m_DAGParents);
+
+  //Fill Vertex Render Buffers
+  fillVerticesForRendering();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 ///VERTEX METHODS
 //----------------------------------------------------------------------------------------------------------------------
 
-TerrainData::Vertex::Vertex(int _x, int _y, float _z, int _dimension, float _scale,
-                            ngl::Vec3 _normal, ngl::Vec3 _tangent, ngl::Vec3 _bitangent)
+TerrainData::Vertex::Vertex(int _x, int _y, float _z, int _dimension, float _scale)
 {
-  originalX = _x;
-  originalY = _y;
-  originalZ = _z;
-  normal = _normal;
-  tangent = _tangent;
-  bitangent = _bitangent;
   //for scene coordinates, centre the grid at (0,0) then scale
   sceneX = (float(_x-_dimension/2))*_scale;
   sceneY = (float(_y-_dimension/2))*_scale;
   sceneZ = _z;//*_scale;
 }
-float TerrainData::Vertex::distanceTo(Vertex v) const
+float TerrainData::Vertex::distanceTo(const Vertex &_v) const
 {
-  return std::sqrt((v.sceneX-sceneX)*(v.sceneX-sceneX) +
-                   (v.sceneY-sceneY)*(v.sceneY-sceneY) +
-                   (v.sceneZ-sceneZ)*(v.sceneZ-sceneZ));
+  return std::sqrt((_v.sceneX-sceneX)*(_v.sceneX-sceneX) +
+                   (_v.sceneY-sceneY)*(_v.sceneY-sceneY) +
+                   (_v.sceneZ-sceneZ)*(_v.sceneZ-sceneZ));
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -91,50 +97,349 @@ float TerrainData::Vertex::distanceTo(Vertex v) const
 /// basically this method starts at the root of the DAG and then moves through the DAG, checking at each stage
 /// whether the current vertex should be active based on the camera view and tolerance
 
-void TerrainData::meshRefine(ngl::Vec3 _cameraPos, float _tolerance, float _lambda)
+void TerrainData::meshRefine(ngl::Vec3 _cameraPos, float _tolerance, float _lambda, const Frustum &_frustum)
+{
+  if(m_parallelRefinement)
+  {
+    refineInParallel(_cameraPos, _tolerance, _lambda, _frustum);
+    return;
+  }
+  startRefinement(_cameraPos, _tolerance, _lambda, _frustum);
+  continueRefinement(0);
+}
+
+bool TerrainData::updateRefinement(ngl::Vec3 _cameraPos, float _tolerance, float _lambda, double _timeBudget,
+                                   const Frustum &_frustum)
 {
-  m_indices = {};
+  if(!isRefining())
+  {
+    //the strip only needs refining again if the view has changed enough to make a difference
+    float threshold = m_refinementThreshold*m_scale;
+    if(m_isRefined &&
+       (_cameraPos-m_refinedCameraPos).lengthSquared() <= threshold*threshold &&
+       _tolerance == m_refinedTolerance && _lambda == m_refinedLambda && _frustum == m_refinedFrustum)
+    {
+      return false;
+    }
+    //the quadrants are refined at the same time instead of a few steps a call, so the whole strip is ready at once
+    if(m_parallelRefinement)
+    {
+      refineInParallel(_cameraPos, _tolerance, _lambda, _frustum);
+      return true;
+    }
+    startRefinement(_cameraPos, _tolerance, _lambda, _frustum);
+  }
+  if(!m_isRefined)
+  {
+    _timeBudget = 0;
+  }
+  return continueRefinement(_timeBudget);
+}
+
+bool TerrainData::isRefining() const
+{
+  return m_refinementStack.size()>0;
+}
+
+void TerrainData::startRefinement(ngl::Vec3 _cameraPos, float _tolerance, float _lambda, const Frustum &_frustum)
+{
+  //clearing rather than reassigning keeps the capacity from the last refinement
+  m_refinementIndices.clear();
+  m_refinementStack.clear();
   m_parity = 0;
-  m_indices.push_back(0);
-  m_indices.push_back(0);
-  submeshRefine(4,6,1, _cameraPos, _tolerance, _lambda);
-  tstripAppend(1,0);
-  submeshRefine(4,7,1, _cameraPos, _tolerance, _lambda);
-  tstripAppend(2,0);
-  submeshRefine(4,8,1, _cameraPos, _tolerance, _lambda);
-  tstripAppend(3,0);
-  submeshRefine(4,5,1, _cameraPos, _tolerance, _lambda);
-  m_indices.push_back(0);
+  m_refinementIndices.push_back(0);
+  m_refinementIndices.push_back(0);
+  m_refinementCameraPos = _cameraPos;
+  m_refinementTolerance = _tolerance;
+  m_refinementLambda = _lambda;
+  m_refinementFrustum = _frustum;
+  findActiveVertices();
+
+  //the top of the DAG, pushed in reverse so that the first step is at the back of the stack
+  for(size_t quadrant=4; quadrant>0; quadrant--)
+  {
+    pushQuadrantSteps(m_refinementStack, quadrant-1);
+  }
+}
 
-  fillVerticesAndIndicesForRendering();
+bool TerrainData::continueRefinement(double _timeBudget)
+{
+  if(!runRefinementSteps(_timeBudget))
+  {
+    return false;
+  }
+  finishRefinement();
+  return true;
 }
 
-void TerrainData::fillVerticesAndIndicesForRendering()
+bool TerrainData::runRefinementSteps(double _timeBudget)
 {
-  m_vertsToBeRendered = {};
-  m_indicesToBeRendered = {};
-  m_normalsToBeRendered = {};
-  m_tangentsToBeRendered = {};
-  m_bitangentsToBeRendered = {};
-  m_UVsToBeRendered = {};
-  for(auto &vert : m_vertices)
+  auto start = std::chrono::steady_clock::now();
+  size_t numSteps = 0;
+  while(m_refinementStack.size()>0)
   {
-    //Note that I used a different convention in my ASE project and had z as the vertical axis,
-    //but for this project the z-coordinate is depth (in keeping with openGL conventions)
-    //hence I have swapped z and y below
-    m_vertsToBeRendered.push_back(ngl::Vec3(vert.sceneX, vert.sceneZ, vert.sceneY));
-    m_normalsToBeRendered.push_back(vert.normal);
-    m_tangentsToBeRendered.push_back(vert.tangent);
-    m_bitangentsToBeRendered.push_back(vert.bitangent);
+    RefinementTask task = m_refinementStack.back();
+    m_refinementStack.pop_back();
+    if(task.m_isAppend)
+    {
+      tstripAppend(task.m_currentVertex, task.m_refinementLevel);
+    }
+    else
+    {
+      submeshRefine(task.m_currentVertex, task.m_DAGChildVertex, task.m_refinementLevel,
+                    m_refinementCameraPos, m_refinementTolerance, m_refinementLambda, task.m_planeMask);
+    }
+    //only check the clock every so often, since it costs more than a step
+    numSteps++;
+    if(_timeBudget>0 && numSteps%1024==0 && m_refinementStack.size()>0)
+    {
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now()-start;
+      if(elapsed.count()>_timeBudget)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
 
-    int size = m_dimension/m_UVRepeat;
-    float U = float(vert.originalX % size) / size;
-    float V = float(vert.originalY % size) / size;
-    m_UVsToBeRendered.push_back(ngl::Vec2(U,V));
+void TerrainData::finishRefinement()
+{
+  m_refinementIndices.push_back(0);
+  m_indices.swap(m_refinementIndices);
+  m_refinedCameraPos = m_refinementCameraPos;
+  m_refinedTolerance = m_refinementTolerance;
+  m_refinedLambda = m_refinementLambda;
+  m_refinedFrustum = m_refinementFrustum;
+  m_isRefined = true;
+}
+
+void TerrainData::pushQuadrantSteps(std::vector<RefinementTask> &_stack, size_t _quadrant) const
+{
+  int planeMask = Frustum::m_allPlanes;
+  if(isActiveInView(4, m_refinementCameraPos, m_refinementTolerance, m_refinementLambda, planeMask))
+  {
+    _stack.push_back({false, 4, 5+(_quadrant+1)%4, 1, planeMask});
   }
-  for(auto ind : m_indices)
+  if(_quadrant>0)
   {
-    m_indicesToBeRendered.push_back(GLuint(ind));
+    _stack.push_back({true, _quadrant, 0, 0, 0});
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void TerrainData::refineInParallel(ngl::Vec3 _cameraPos, float _tolerance, float _lambda, const Frustum &_frustum)
+{
+  //this replaces any refinement that updateRefinement() is part way through
+  m_refinementStack.clear();
+  m_refinementCameraPos = _cameraPos;
+  m_refinementTolerance = _tolerance;
+  m_refinementLambda = _lambda;
+  m_refinementFrustum = _frustum;
+  findActiveVertices();
+
+  //the first quadrant starts the strip, so it can start from the strip's real beginning - the others start after two
+  //placeholders that no vertex matches, and are fixed up as they are joined on
+  const GLuint placeholder = GLuint(-1);
+  m_refinementFragments.resize(4);
+  for(size_t quadrant=0; quadrant<4; quadrant++)
+  {
+    StripFragment &fragment = m_refinementFragments[quadrant];
+    fragment.m_indices.clear();
+    fragment.m_indices.push_back(quadrant==0 ? 0 : placeholder);
+    fragment.m_indices.push_back(quadrant==0 ? 0 : placeholder);
+    fragment.m_parity = 0;
+    fragment.m_stack.clear();
+    fragment.m_firstAppends.clear();
+    fragment.m_numAppends = 0;
+    pushQuadrantSteps(fragment.m_stack, quadrant);
+  }
+  std::vector<std::thread> threads;
+  for(size_t quadrant=1; quadrant<4; quadrant++)
+  {
+    threads.push_back(std::thread(&TerrainData::refineFragment, this, std::ref(m_refinementFragments[quadrant])));
+  }
+  refineFragment(m_refinementFragments[0]);
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
+
+  m_refinementIndices.swap(m_refinementFragments[0].m_indices);
+  m_parity = m_refinementFragments[0].m_parity;
+  for(size_t quadrant=1; quadrant<4; quadrant++)
+  {
+    joinFragment(quadrant);
+  }
+  finishRefinement();
+}
+
+void TerrainData::refineFragment(StripFragment &_fragment) const
+{
+  //the strips match within two to four appends in practice, so only the first few need keeping
+  const size_t numRecordedAppends = 64;
+  while(_fragment.m_stack.size()>0)
+  {
+    RefinementTask task = _fragment.m_stack.back();
+    _fragment.m_stack.pop_back();
+    if(task.m_isAppend)
+    {
+      appendToStrip(_fragment.m_indices, _fragment.m_parity, task.m_currentVertex, task.m_refinementLevel);
+      if(_fragment.m_firstAppends.size()<numRecordedAppends)
+      {
+        _fragment.m_firstAppends.push_back({GLuint(task.m_currentVertex), task.m_refinementLevel,
+                                            _fragment.m_indices.size(), _fragment.m_parity});
+      }
+      _fragment.m_numAppends++;
+    }
+    else
+    {
+      pushRefinementSteps(_fragment.m_stack, task.m_currentVertex, task.m_DAGChildVertex, task.m_refinementLevel,
+                          m_refinementCameraPos, m_refinementTolerance, m_refinementLambda, task.m_planeMask);
+    }
+  }
+}
+
+void TerrainData::joinFragment(size_t _quadrant)
+{
+  //the appends are replayed on the real strip until it reaches the same state as the fragment did after the same
+  //append - from then on the fragment holds exactly what the real strip would get
+  StripFragment &fragment = m_refinementFragments[_quadrant];
+  size_t joinSize = m_refinementIndices.size();
+  int joinParity = m_parity;
+  for(auto &append : fragment.m_firstAppends)
+  {
+    tstripAppend(append.m_vertex, append.m_parity);
+    size_t l = m_refinementIndices.size();
+    if(m_parity == append.m_stripParity &&
+       m_refinementIndices[l-1] == fragment.m_indices[append.m_stripSize-1] &&
+       m_refinementIndices[l-2] == fragment.m_indices[append.m_stripSize-2])
+    {
+      m_refinementIndices.insert(m_refinementIndices.end(),
+                                 fragment.m_indices.begin()+long(append.m_stripSize), fragment.m_indices.end());
+      m_parity = fragment.m_parity;
+      return;
+    }
+  }
+  //every append was replayed, so the strip is complete
+  if(fragment.m_numAppends == fragment.m_firstAppends.size())
+  {
+    return;
+  }
+  //otherwise the quadrant is refined again on the real strip
+  m_refinementIndices.resize(joinSize);
+  m_parity = joinParity;
+  pushQuadrantSteps(m_refinementStack, _quadrant);
+  runRefinementSteps(0);
+}
+
+bool TerrainData::updateHeights(TerrainGenerator &_terrainGen)
+{
+  if(_terrainGen.m_dimension!=m_dimension || _terrainGen.m_scale!=m_scale || m_vertices.size()==0)
+  {
+    return false;
+  }
+  m_heightMap = _terrainGen.m_heightMap;
+  m_normals = _terrainGen.m_normals;
+  m_tangents = _terrainGen.m_tangents;
+  m_bitangents = _terrainGen.m_bitangents;
+
+  //any refinement in progress was for the old heights, but m_indices is kept to draw until the next one finishes
+  m_refinementStack.clear();
+  m_isRefined = false;
+
+  parallelFor(m_vertices.size(), [this](size_t _start, size_t _end)
+  {
+    for(size_t i=_start; i<_end; i++)
+    {
+      //the slots of the DAG levels that no vertex was put in have heightmap index 0 and stay at height 0 as they
+      //were constructed - the only real vertex at index 0 is the NW corner, vertex 3
+      Vertex &v = m_vertices[i];
+      v.sceneZ = (m_heightMapIndices[i]!=0 || i==3) ? m_heightMap[m_heightMapIndices[i]] : 0;
+      v.radius = 0;
+      v.augmentedDelta = 0;
+    }
+  });
+  //the radii and deltas are found from the children, which need m_DAGParents again
+  assignChildren();
+  assignRadius();
+  assignDelta();
+  assignAugmentedDelta();
+  std::vector<GLuint>().swap(m_DAGParents);
+  fillVerticesForRendering();
+  return true;
+}
+
+void TerrainData::setUVRepeat(int _UVRepeat)
+{
+  m_UVRepeat = _UVRepeat;
+  fillUVsForRendering();
+}
+
+void TerrainData::fillVerticesForRendering()
+{
+  m_vertsToBeRendered.resize(m_vertices.size());
+  m_normalsToBeRendered.resize(m_vertices.size());
+  m_tangentsToBeRendered.resize(m_vertices.size());
+  m_bitangentsToBeRendered.resize(m_vertices.size());
+  parallelFor(m_vertices.size(), [this](size_t _start, size_t _end)
+  {
+    for(size_t i=_start; i<_end; i++)
+    {
+      const Vertex &vert = m_vertices[i];
+      size_t heightMapIndex = m_heightMapIndices[i];
+      //Note that I used a different convention in my ASE project and had z as the vertical axis,
+      //but for this project the z-coordinate is depth (in keeping with openGL conventions)
+      //hence I have swapped z and y below
+      m_vertsToBeRendered[i] = ngl::Vec3(vert.sceneX, vert.sceneZ, vert.sceneY);
+      m_normalsToBeRendered[i] = m_normals[heightMapIndex];
+      m_tangentsToBeRendered[i] = m_tangents[heightMapIndex];
+      m_bitangentsToBeRendered[i] = m_bitangents[heightMapIndex];
+    }
+  });
+  fillUVsForRendering();
+}
+
+void TerrainData::fillUVsForRendering()
+{
+  m_UVsToBeRendered.resize(m_vertices.size());
+  //a texture can't repeat more than once per grid cell
+  int size = std::max(m_dimension/std::max(m_UVRepeat, 1), 1);
+  parallelFor(m_vertices.size(), [this, size](size_t _start, size_t _end)
+  {
+    for(size_t i=_start; i<_end; i++)
+    {
+      size_t heightMapIndex = m_heightMapIndices[i];
+      float U = float(getX(heightMapIndex) % size) / size;
+      float V = float(getY(heightMapIndex) % size) / size;
+      m_UVsToBeRendered[i] = ngl::Vec2(U,V);
+    }
+  });
+}
+
+void TerrainData::parallelFor(size_t _count, const std::function<void(size_t,size_t)> &_function)
+{
+  //below this many items per thread, starting the threads costs more than they save
+  const size_t minItemsPerThread = 8192;
+  size_t numThreads = std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+  numThreads = std::min(numThreads, _count/minItemsPerThread);
+  if(numThreads<=1)
+  {
+    _function(0, _count);
+    return;
+  }
+  size_t itemsPerThread = (_count+numThreads-1)/numThreads;
+  std::vector<std::thread> threads;
+  for(size_t i=1; i<numThreads; i++)
+  {
+    threads.push_back(std::thread(_function, std::min(i*itemsPerThread, _count),
+                                  std::min((i+1)*itemsPerThread, _count)));
+  }
+  _function(0, itemsPerThread);
+  for(auto &thread : threads)
+  {
+    thread.join();
   }
 }
 
@@ -160,8 +465,13 @@ size_t TerrainData::getHeightMapIndex(const int _x, const int _y) const
 
 TerrainData::Vertex TerrainData::getVertex(const size_t _index) const
 {
-  return Vertex(getX(_index), getY(_index), m_heightMap[_index], m_dimension, m_scale,
-                m_normals[_index], m_tangents[_index], m_bitangents[_index]);
+  return Vertex(getX(_index), getY(_index), m_heightMap[_index], m_dimension, m_scale);
+}
+
+void TerrainData::setVertex(const size_t _verticesIndex, const size_t _heightMapIndex)
+{
+  m_vertices[_verticesIndex] = getVertex(_heightMapIndex);
+  m_heightMapIndices[_verticesIndex] = GLuint(_heightMapIndex);
 }
 
 
@@ -181,20 +491,16 @@ void TerrainData::createVerticesWQT(size_t _QTParentHeightMapIndex, size_t _QTPa
     size_t verticesIndexChild2 = verticesIndexChild1 + 1;
     size_t verticesIndexChild3 = verticesIndexChild2 + 1;
     size_t verticesIndexChild4 = verticesIndexChild3 + 1;
-    if(m_vertices.size()<verticesIndexChild4+1)
-    {
-      m_vertices.resize(verticesIndexChild4+1,Vertex(0,0,0,m_dimension,m_scale,{0,1,0},{0,1,0},{0,1,0}));
-    }
 
     size_t heightMapIndexChild1 = getHeightMapIndex(x - _distance, y + _distance);
     size_t heightMapIndexChild2 = getHeightMapIndex(x + _distance, y + _distance);
     size_t heightMapIndexChild3 = getHeightMapIndex(x + _distance, y - _distance);
     size_t heightMapIndexChild4 = getHeightMapIndex(x - _distance, y - _distance);
 
-    m_vertices[verticesIndexChild1] = getVertex(heightMapIndexChild1);
-    m_vertices[verticesIndexChild2] = getVertex(heightMapIndexChild2);
-    m_vertices[verticesIndexChild3] = getVertex(heightMapIndexChild3);
-    m_vertices[verticesIndexChild4] = getVertex(heightMapIndexChild4);
+    setVertex(verticesIndexChild1, heightMapIndexChild1);
+    setVertex(verticesIndexChild2, heightMapIndexChild2);
+    setVertex(verticesIndexChild3, heightMapIndexChild3);
+    setVertex(verticesIndexChild4, heightMapIndexChild4);
 
     createVerticesWQT(heightMapIndexChild1, verticesIndexChild1,
                                    _refinementLevel + 2, _distance/2);
@@ -219,36 +525,32 @@ void TerrainData::createVerticesBQT(size_t _QTParentHeightMapIndex, size_t _QTPa
     size_t verticesIndexChild2 = verticesIndexChild1 + 1;
     size_t verticesIndexChild3 = verticesIndexChild2 + 1;
     size_t verticesIndexChild4 = verticesIndexChild3 + 1;
-    if(m_vertices.size()<verticesIndexChild4+1)
-    {
-      m_vertices.resize(verticesIndexChild4+1,Vertex(0,0,0,m_dimension, m_scale, {0,1,0},{0,1,0},{0,1,0}));
-    }
 
     if(y>0)
     {
       size_t heightMapIndexChild1 = getHeightMapIndex(x, y - _distance);
-      m_vertices[verticesIndexChild1] = getVertex(heightMapIndexChild1);
+      setVertex(verticesIndexChild1, heightMapIndexChild1);
       createVerticesBQT(heightMapIndexChild1, verticesIndexChild1,
                                      _refinementLevel + 2, _distance/2);
     }
     if(x<m_dimension-1)
     {
       size_t heightMapIndexChild2 = getHeightMapIndex(x + _distance, y);
-      m_vertices[verticesIndexChild2] = getVertex(heightMapIndexChild2);
+      setVertex(verticesIndexChild2, heightMapIndexChild2);
       createVerticesBQT(heightMapIndexChild2, verticesIndexChild2,
                                      _refinementLevel + 2, _distance/2);
     }
     if(y<m_dimension-1)
     {
       size_t heightMapIndexChild3 = getHeightMapIndex(x, y + _distance);
-      m_vertices[verticesIndexChild3] = getVertex(heightMapIndexChild3);
+      setVertex(verticesIndexChild3, heightMapIndexChild3);
       createVerticesBQT(heightMapIndexChild3, verticesIndexChild3,
                                      _refinementLevel + 2, _distance/2);
     }
     if(x>0)
     {
       size_t heightMapIndexChild4 = getHeightMapIndex(x - _distance, y);
-      m_vertices[verticesIndexChild4] = getVertex(heightMapIndexChild4);
+      setVertex(verticesIndexChild4, heightMapIndexChild4);
       createVerticesBQT(heightMapIndexChild4, verticesIndexChild4,
                                      _refinementLevel + 2, _distance/2);
     }
@@ -272,19 +574,71 @@ size_t TerrainData::getChild2(size_t _QTParent, size_t _DAGParent) const
   return child2;
 }
 
-void TerrainData::assignChildren(size_t _DAGParent, size_t _currentVertex, int _refinementLevel)
+void TerrainData::assignGraphLevels()
 {
-  if(_refinementLevel != 0)
+  //the children of vertex n in the quadtrees are 4n-7 to 4n-4, and each level of the DAG alternates between the white
+  //and black quadtrees, so the children of one level's range are the range two levels down
+  m_graphLevelStarts = {4,5};
+  for(int level=2; level<=m_maxRefinementLevel; level++)
   {
-    size_t child1 = getChild1(_DAGParent,_currentVertex);
-    size_t child2 = getChild2(_DAGParent,_currentVertex);
-    m_vertices[_currentVertex].childList.push_back(child1);
-    m_vertices[_currentVertex].childList.push_back(child2);
-    assignChildren(_currentVertex, child1, _refinementLevel-1);
-    assignChildren(_currentVertex, child2, _refinementLevel-1);
+    m_graphLevelStarts.push_back(4*m_graphLevelStarts[size_t(level)-2]-7);
+  }
+}
+
+size_t TerrainData::getParentSlot(size_t _DAGParent, size_t _currentVertex) const
+{
+  //the roots of the black quadtrees only have the centre as a parent
+  if(_currentVertex<9)
+  {
+    return 0;
+  }
+  size_t grandParent = m_heightMapIndices[(_currentVertex+7)/4];
+  size_t vertex = m_heightMapIndices[_currentVertex];
+  size_t parent = m_heightMapIndices[_DAGParent];
+  int cross = (getX(vertex)-getX(grandParent))*(getY(parent)-getY(vertex)) -
+              (getY(vertex)-getY(grandParent))*(getX(parent)-getX(vertex));
+  return cross>0 ? 0 : 1;
+}
+
+size_t TerrainData::getChildren(size_t _currentVertex, size_t _children[4]) const
+{
+  size_t numChildren = 0;
+  for(size_t slot=0; slot<2; slot++)
+  {
+    size_t parent = m_DAGParents[2*_currentVertex+slot];
+    if(parent != 0)
+    {
+      _children[numChildren++] = getChild1(parent,_currentVertex);
+      _children[numChildren++] = getChild2(parent,_currentVertex);
+    }
+  }
+  return numChildren;
+}
 
-    m_verticesArrangedByGraphLevel[size_t(_refinementLevel)-1].push_back(child1);
-    m_verticesArrangedByGraphLevel[size_t(_refinementLevel)-1].push_back(child2);
+void TerrainData::assignChildren()
+{
+  m_DAGParents.assign(2*m_vertices.size(), 0);
+  for(size_t i=5; i<=8; i++)
+  {
+    m_DAGParents[2*i] = 4;
+  }
+  //the last level has no children - every child has its own slot for each of its parents, so the vertices of a level
+  //never write to the same place
+  for(size_t level=1; level+2<m_graphLevelStarts.size(); level++)
+  {
+    size_t start = m_graphLevelStarts[level];
+    parallelFor(m_graphLevelStarts[level+1]-start, [this, start](size_t _start, size_t _end)
+    {
+      size_t children[4];
+      for(size_t i=start+_start; i<start+_end; i++)
+      {
+        size_t numChildren = getChildren(i, children);
+        for(size_t c=0; c<numChildren; c++)
+        {
+          m_DAGParents[2*children[c] + getParentSlot(i,children[c])] = GLuint(i);
+        }
+      }
+    });
   }
 }
 
@@ -294,52 +648,79 @@ void TerrainData::assignChildren(size_t _DAGParent, size_t _currentVertex, int _
 
 void TerrainData::assignRadius()
 {
-  for (auto list : m_verticesArrangedByGraphLevel)
+  //the levels go from the bottom of the DAG up, starting from the last level with children, and each vertex of a
+  //level only writes to itself
+  for(size_t level=m_graphLevelStarts.size()-3; level>=1; level--)
   {
-    for (auto i : list)
+    size_t start = m_graphLevelStarts[level];
+    parallelFor(m_graphLevelStarts[level+1]-start, [this, start](size_t _start, size_t _end)
     {
-      Vertex v = m_vertices[i];
-      for (auto j : v.childList)
+      size_t children[4];
+      for(size_t i=start+_start; i<start+_end; i++)
       {
-        Vertex w = m_vertices[j];
-        if(m_vertices[i].radius < v.distanceTo(w) + w.radius)
+        Vertex &v = m_vertices[i];
+        size_t numChildren = getChildren(i, children);
+        for(size_t c=0; c<numChildren; c++)
         {
-          m_vertices[i].radius = v.distanceTo(w) + w.radius;
+          const Vertex &w = m_vertices[children[c]];
+          v.radius = std::max(v.radius, v.distanceTo(w) + w.radius);
         }
       }
-    }
+    });
+  }
+  //the root has the four black quadtree roots as children
+  Vertex &root = m_vertices[4];
+  for(size_t i=5; i<=8; i++)
+  {
+    root.radius = std::max(root.radius, root.distanceTo(m_vertices[i]) + m_vertices[i].radius);
   }
 }
 
-void TerrainData::assignDelta(size_t _DAGGrandParent, size_t _DAGParent, size_t _currentVertex, int _refinementLevel)
+void TerrainData::assignDelta()
 {
-  if(_refinementLevel <= m_maxRefinementLevel)
+  parallelFor(m_vertices.size()-5, [this](size_t _start, size_t _end)
   {
-    Vertex B = m_vertices[_currentVertex];
-    Vertex A = m_vertices[_DAGGrandParent];
-    Vertex C = getVertex(getHeightMapIndex(2*B.originalX-A.originalX, 2*B.originalY - A.originalY));
-    m_vertices[_currentVertex].delta = std::abs(2*B.sceneZ - C.sceneZ - A.sceneZ);
-    assignDelta(_DAGParent,_currentVertex,getChild1(_DAGParent,_currentVertex),_refinementLevel+1);
-    assignDelta(_DAGParent,_currentVertex,getChild2(_DAGParent,_currentVertex),_refinementLevel+1);
-  }
+    for(size_t i=_start+5; i<_end+5; i++)
+    {
+      //vertices outside the DAG are left with no delta
+      if(m_DAGParents[2*i]==0 && m_DAGParents[2*i+1]==0)
+      {
+        continue;
+      }
+      //the grandparent is the quadtree parent, apart from the black quadtree roots whose grandparents are corners
+      size_t grandParent = i<9 ? i-5 : (i+7)/4;
+      size_t B = m_heightMapIndices[i];
+      size_t A = m_heightMapIndices[grandParent];
+      size_t C = getHeightMapIndex(2*getX(B)-getX(A), 2*getY(B) - getY(A));
+      m_vertices[i].augmentedDelta = std::abs(2*m_heightMap[B] - m_heightMap[C] - m_heightMap[A]);
+    }
+  });
 }
 
 void TerrainData::assignAugmentedDelta()
 {
-  for (auto list : m_verticesArrangedByGraphLevel)
+  //each augmentedDelta starts as the vertex's delta, and the levels go from the bottom of the DAG up
+  for(size_t level=m_graphLevelStarts.size()-3; level>=1; level--)
   {
-    for (auto i : list)
+    size_t start = m_graphLevelStarts[level];
+    parallelFor(m_graphLevelStarts[level+1]-start, [this, start](size_t _start, size_t _end)
     {
-      m_vertices[i].augmentedDelta = m_vertices[i].delta;
-      for (auto j : m_vertices[i].childList)
+      size_t children[4];
+      for(size_t i=start+_start; i<start+_end; i++)
       {
-        Vertex w = m_vertices[j];
-        if(m_vertices[i].augmentedDelta < w.augmentedDelta)
+        Vertex &v = m_vertices[i];
+        size_t numChildren = getChildren(i, children);
+        for(size_t c=0; c<numChildren; c++)
         {
-          m_vertices[i].augmentedDelta = w.augmentedDelta;
+          v.augmentedDelta = std::max(v.augmentedDelta, m_vertices[children[c]].augmentedDelta);
         }
       }
-    }
+    });
+  }
+  Vertex &root = m_vertices[4];
+  for(size_t i=5; i<=8; i++)
+  {
+    root.augmentedDelta = std::max(root.augmentedDelta, m_vertices[i].augmentedDelta);
   }
 }
 
@@ -349,44 +730,197 @@ void TerrainData::assignAugmentedDelta()
 ///@ref based on pseudocode from Lindstrom and Pascucci, 2001
 
 void TerrainData::submeshRefine(size_t _currentVertex, size_t _DAGChildVertex, int _refinementLevel,
-                                ngl::Vec3 _cameraPos, float _tolerance, float _lambda)
-{
-  if(_refinementLevel <= m_maxRefinementLevel &&
-     isActive(_currentVertex, _cameraPos, _tolerance, _lambda))
-  {
-    submeshRefine(_DAGChildVertex,
-                  4 * _currentVertex + (2 * _currentVertex + _DAGChildVertex - 6) % 4 - 7,
-                  _refinementLevel + 1, _cameraPos, _tolerance, _lambda);
-    tstripAppend(_currentVertex, _refinementLevel % 2);
-    submeshRefine(_DAGChildVertex,
-                  4 * _currentVertex + (2 * _currentVertex + _DAGChildVertex - 5) % 4 - 7,
-                  _refinementLevel + 1, _cameraPos, _tolerance, _lambda);
+                                ngl::Vec3 _cameraPos, float _tolerance, float _lambda, int _planeMask)
+{
+  pushRefinementSteps(m_refinementStack, _currentVertex, _DAGChildVertex, _refinementLevel,
+                      _cameraPos, _tolerance, _lambda, _planeMask);
+}
+
+void TerrainData::pushRefinementSteps(std::vector<RefinementTask> &_stack, size_t _currentVertex,
+                                      size_t _DAGChildVertex, int _refinementLevel,
+                                      ngl::Vec3 _cameraPos, float _tolerance, float _lambda, int _planeMask) const
+{
+  //the current vertex is already known to be active, and the child is refined by both of the steps it would get, so
+  //it is tested once here rather than in each of them - an inactive child gets no steps at all
+  //a vertex out of view is treated as inactive - its descendants' spheres are inside its own, so none of them can be
+  //active either and the strip stays free of cracks, just coarse outside the view
+  int planeMask = _planeMask;
+  bool isChildActive = _refinementLevel + 1 <= m_maxRefinementLevel &&
+                       isActiveInView(_DAGChildVertex, _cameraPos, _tolerance, _lambda, planeMask);
+  //the steps are pushed in reverse, so that the first child is refined first, then the current vertex appended and
+  //then the second child refined, as in the recursive version
+  if(isChildActive)
+  {
+    _stack.push_back({false, _DAGChildVertex,
+                      4 * _currentVertex + (2 * _currentVertex + _DAGChildVertex - 5) % 4 - 7,
+                      _refinementLevel + 1, planeMask});
+  }
+  _stack.push_back({true, _currentVertex, 0, _refinementLevel % 2, 0});
+  if(isChildActive)
+  {
+    _stack.push_back({false, _DAGChildVertex,
+                      4 * _currentVertex + (2 * _currentVertex + _DAGChildVertex - 6) % 4 - 7,
+                      _refinementLevel + 1, planeMask});
+  }
+}
+
+bool TerrainData::isActiveInView(size_t _vertex, ngl::Vec3 _cameraPos, float _tolerance, float _lambda,
+                                 int &_planeMask) const
+{
+  //findActiveVertices() tested the vertex if it found its quadtree parent active and in view - the parents of the
+  //vertices 5 to 8 are corners, so they were tested with the centre vertex 4 instead
+  if(m_hasActivity)
+  {
+    size_t QTParent = _vertex<9 ? 4 : (_vertex+7)/4;
+    if(m_activity[QTParent]==ACTIVE)
+    {
+      //the frustum test is repeated here, with the planes left from the vertex's path through the DAG, so that the
+      //strip is exactly the same as it would be without m_activity
+      return m_activity[_vertex]!=INACTIVE && isVisible(_vertex, m_refinementFrustum, _planeMask);
     }
+  }
+  return isVisible(_vertex, m_refinementFrustum, _planeMask) && isActive(_vertex, _cameraPos, _tolerance, _lambda);
 }
 
 void TerrainData::tstripAppend(size_t _vertex, int _parity)
 {
-  size_t l = m_indices.size();
-  if (m_indices[l-1] != _vertex && m_indices[l-2] != _vertex)
+  appendToStrip(m_refinementIndices, m_parity, _vertex, _parity);
+}
+
+void TerrainData::appendToStrip(std::vector<GLuint> &_indices, int &_stripParity, size_t _vertex, int _parity)
+{
+  size_t l = _indices.size();
+  if (_indices[l-1] != _vertex && _indices[l-2] != _vertex)
   {
-    if(_parity != m_parity)
+    if(_parity != _stripParity)
     {
-      m_parity = _parity;
+      _stripParity = _parity;
     }
     else
     {
-      m_indices.push_back(m_indices[l-2]);
+      _indices.push_back(_indices[l-2]);
     }
-    m_indices.push_back(_vertex);
+    _indices.push_back(GLuint(_vertex));
     }
 }
 
 bool TerrainData::isActive(size_t _vertex, ngl::Vec3 _cameraPos, float _tolerance, float _lambda) const
 {
   float mu = _lambda/_tolerance;
-  Vertex v = m_vertices[_vertex];
+  const Vertex &v = m_vertices[_vertex];
   return (mu * v.augmentedDelta + v.radius)*(mu * v.augmentedDelta + v.radius) >
                                         (v.sceneX-_cameraPos.m_x)*(v.sceneX-_cameraPos.m_x)
                                       + (v.sceneY-_cameraPos.m_y)*(v.sceneY-_cameraPos.m_y)
                                       + (v.sceneZ-_cameraPos.m_z)*(v.sceneZ-_cameraPos.m_z);
 }
+
+bool TerrainData::isVisible(size_t _vertex, const Frustum &_frustum, int &_planeMask) const
+{
+  //once a sphere is completely inside the frustum, so is everything below it
+  if(_planeMask==0)
+  {
+    return true;
+  }
+  const Vertex &v = m_vertices[_vertex];
+  return _frustum.testSphere(ngl::Vec3(v.sceneX, v.sceneZ, v.sceneY), v.radius, _planeMask) != Frustum::OUTSIDE;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void TerrainData::findActiveVertices()
+{
+  m_hasActivity = m_breadthFirstActivity;
+  if(!m_hasActivity)
+  {
+    return;
+  }
+  //only the blocks set by the last refinement need clearing
+  if(m_activity.size() != m_vertices.size())
+  {
+    m_activity.assign(m_vertices.size(), INACTIVE);
+    m_activeVertices.clear();
+  }
+  for(auto &vertex : m_activeVertices)
+  {
+    size_t first = 4*size_t(vertex.m_vertex)-7;
+    if(first+4 <= m_activity.size())
+    {
+      std::fill(m_activity.begin()+long(first), m_activity.begin()+long(first+4), INACTIVE);
+    }
+  }
+  std::fill(m_activity.begin()+4, m_activity.begin()+9, INACTIVE);
+  m_activeVertices.clear();
+
+  //the centre vertex is tested on its own and then the vertices 5 to 8 with it, since their quadtree parents are
+  //the corners - after that each vertex found is followed by its quadtree children, so the vertices are found a
+  //level at a time
+  int planeMask = Frustum::m_allPlanes;
+  if(!isActive(4, m_refinementCameraPos, m_refinementTolerance, m_refinementLambda))
+  {
+    return;
+  }
+  if(!isVisible(4, m_refinementFrustum, planeMask))
+  {
+    m_activity[4] = OUT_OF_VIEW;
+    return;
+  }
+  m_activity[4] = ACTIVE;
+  m_activeVertices.push_back({4, planeMask});
+  findActiveBlock(5, planeMask);
+  for(size_t i=0; i<m_activeVertices.size(); i++)
+  {
+    size_t first = 4*size_t(m_activeVertices[i].m_vertex)-7;
+    if(first+4 <= m_vertices.size())
+    {
+      findActiveBlock(first, m_activeVertices[i].m_planeMask);
+    }
+  }
+}
+
+void TerrainData::findActiveBlock(size_t _first, int _planeMask)
+{
+  int activeVertices = 0;
+#ifdef __SSE2__
+  //the same sums as isActive() in the same order, so the results are exactly the same
+  const Vertex *v = &m_vertices[_first];
+  __m128 mu = _mm_set1_ps(m_refinementLambda/m_refinementTolerance);
+  __m128 bound = _mm_add_ps(_mm_mul_ps(mu, _mm_setr_ps(v[0].augmentedDelta, v[1].augmentedDelta,
+                                                       v[2].augmentedDelta, v[3].augmentedDelta)),
+                            _mm_setr_ps(v[0].radius, v[1].radius, v[2].radius, v[3].radius));
+  __m128 dx = _mm_sub_ps(_mm_setr_ps(v[0].sceneX, v[1].sceneX, v[2].sceneX, v[3].sceneX),
+                         _mm_set1_ps(m_refinementCameraPos.m_x));
+  __m128 dy = _mm_sub_ps(_mm_setr_ps(v[0].sceneY, v[1].sceneY, v[2].sceneY, v[3].sceneY),
+                         _mm_set1_ps(m_refinementCameraPos.m_y));
+  __m128 dz = _mm_sub_ps(_mm_setr_ps(v[0].sceneZ, v[1].sceneZ, v[2].sceneZ, v[3].sceneZ),
+                         _mm_set1_ps(m_refinementCameraPos.m_z));
+  __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+  activeVertices = _mm_movemask_ps(_mm_cmpgt_ps(_mm_mul_ps(bound, bound), distance));
+#else
+  for(size_t i=0; i<4; i++)
+  {
+    if(isActive(_first+i, m_refinementCameraPos, m_refinementTolerance, m_refinementLambda))
+    {
+      activeVertices |= 1<<i;
+    }
+  }
+#endif
+  //only the active vertices are tested against the frustum
+  for(size_t i=0; i<4; i++)
+  {
+    size_t vertex = _first+i;
+    int planeMask = _planeMask;
+    if(!(activeVertices & (1<<i)))
+    {
+      m_activity[vertex] = INACTIVE;
+    }
+    else if(!isVisible(vertex, m_refinementFrustum, planeMask))
+    {
+      m_activity[vertex] = OUT_OF_VIEW;
+    }
+    else
+    {
+      m_activity[vertex] = ACTIVE;
+      m_activeVertices.push_back({GLuint(vertex), planeMask});
+    }
+  }
+}
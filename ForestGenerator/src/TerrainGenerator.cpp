@@ -3,7 +3,12 @@
 /// @brief implementation file for TerrainGenerator class
 //----------------------------------------------------------------------------------------------------------------------
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
 #include <ngl/Vec2.h>
+#include "noiseutils.h"
 #include "TerrainGenerator.h"
 #include "PrintFunctions.h"
 
@@ -12,33 +17,209 @@ TerrainGenerator::TerrainGenerator(int _dimension, float _width) :
 
 void TerrainGenerator::generate()
 {
-  noise::module::Perlin perlinModule;
+  PerlinNoise perlinNoise = getPerlinNoise();
 
-  perlinModule.SetOctaveCount(m_octaves);
-  perlinModule.SetFrequency(m_frequency);
-  perlinModule.SetPersistence(m_persistence);
-  perlinModule.SetLacunarity(m_lacunarity);
+  size_t dimension = size_t(m_dimension);
+  m_heightMap.assign(dimension*dimension, 0);
+  m_normals.assign(m_heightMap.size(), {0,1,0});
+  m_tangents.assign(m_heightMap.size(), {0,1,0});
+  m_bitangents.assign(m_heightMap.size(), {0,1,0});
 
-  m_heightMap = {};
+  //the rows are shared between the threads a tile at a time - each tile also finds the heights of the rows either
+  //side of it, so that it can compute its own normals without waiting for the neighbouring tiles
+  const size_t rowsPerTile = 32;
+  size_t numTiles = (dimension+rowsPerTile-1)/rowsPerTile;
+  std::atomic<size_t> nextTile(0);
+  auto worker = [&]()
+  {
+    std::vector<float> heights;
+    for(size_t tile=nextTile++; tile<numTiles; tile=nextTile++)
+    {
+      size_t firstRow = tile*rowsPerTile;
+      size_t endRow = std::min(firstRow+rowsPerTile, dimension);
+      size_t firstHeightsRow = firstRow>0 ? firstRow-1 : 0;
+      size_t endHeightsRow = std::min(endRow+1, dimension);
+      heights.resize((endHeightsRow-firstHeightsRow)*dimension);
+      for(size_t z=firstHeightsRow; z<endHeightsRow; z++)
+      {
+        float *row = &heights[(z-firstHeightsRow)*dimension];
+        perlinNoise.getRow(getSceneX(0), double(m_scale), getSceneZ(int(z*dimension)), m_seed, dimension, row);
+        for(size_t x=0; x<dimension; x++)
+        {
+          row[x] *= m_amplitude;
+        }
+      }
+      std::copy(heights.begin()+long((firstRow-firstHeightsRow)*dimension),
+                heights.begin()+long((endRow-firstHeightsRow)*dimension),
+                m_heightMap.begin()+long(firstRow*dimension));
+      computeNormals(firstRow, endRow, heights.data(), firstHeightsRow);
+    }
+  };
+
+  size_t numThreads = std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+  std::vector<std::thread> threads;
+  for(size_t i=1; i<std::min(numThreads, numTiles); i++)
+  {
+    threads.push_back(std::thread(worker));
+  }
+  worker();
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
+  recordSettings();
+}
+
+TerrainGenerator::Change TerrainGenerator::getChange() const
+{
+  const Settings &settings = m_generatedSettings;
+  if(!m_hasSettings || settings.m_dimension!=m_dimension || settings.m_scale!=m_scale)
+  {
+    return GRID_CHANGE;
+  }
+  //a heightmap generated with no amplitude is flat, so it can't be rescaled
+  if(settings.m_seed!=m_seed || settings.m_octaves!=m_octaves || settings.m_frequency!=m_frequency ||
+     settings.m_persistence!=m_persistence || settings.m_lacunarity!=m_lacunarity ||
+     (settings.m_amplitude!=m_amplitude && settings.m_amplitude==0))
+  {
+    return NOISE_CHANGE;
+  }
+  return settings.m_amplitude!=m_amplitude ? AMPLITUDE_CHANGE : NO_CHANGE;
+}
+
+TerrainGenerator::Change TerrainGenerator::update()
+{
+  Change change = getChange();
+  if(change==AMPLITUDE_CHANGE)
+  {
+    float heightScale = m_amplitude/m_generatedSettings.m_amplitude;
+    for(auto &height : m_heightMap)
+    {
+      height *= heightScale;
+    }
+    computeAllNormals();
+    m_generatedSettings.m_amplitude = m_amplitude;
+  }
+  else if(change!=NO_CHANGE)
+  {
+    generate();
+  }
+  return change;
+}
 
-  for (int i=0; i<m_dimension*m_dimension; ++i)
+bool TerrainGenerator::generatePaged(PagedHeightMap &_pages, const std::string &_fileName) const
+{
+  if(!_pages.open(_fileName) || _pages.m_dimension!=size_t(m_dimension) || _pages.m_scale!=m_scale)
   {
-    float height = float(perlinModule.GetValue(getSceneX(i),getSceneZ(i),m_seed));
-    m_heightMap.push_back(m_amplitude*height);
+    if(!_pages.create(_fileName, size_t(m_dimension), m_scale))
+    {
+      return false;
+    }
   }
 
-  computeNormals();
+  //the tiles are generated from copies of the settings, so the pages don't depend on this generator staying as it is
+  PerlinNoise perlinNoise = getPerlinNoise();
+  int dimension = m_dimension;
+  double scale = double(m_scale);
+  double seed = m_seed;
+  _pages.m_stamp = getStamp();
+  _pages.m_generateTile = [perlinNoise, dimension, scale, seed]
+                          (size_t _firstX, size_t _firstZ, size_t _width, size_t _depth, size_t _rowLength,
+                           float *_heights)
+  {
+    //the same positions as generate() gives each value
+    double sceneX = double(int(_firstX)-dimension/2)*scale;
+    for(size_t z=0; z<_depth; z++)
+    {
+      float *row = _heights + z*_rowLength;
+      perlinNoise.getRow(sceneX, scale, double(int(_firstZ+z)-dimension/2)*scale, seed, _width, row);
+    }
+  };
+  _pages.generateStaleTiles();
+  return true;
 }
 
-void TerrainGenerator::computeNormals()
+void TerrainGenerator::loadFromPages(PagedHeightMap &_pages, size_t _stride)
 {
-  m_normals = {};
-  m_tangents = {};
-  m_bitangents = {};
-  m_normals.resize(m_heightMap.size(),{0,1,0});
-  m_tangents.resize(m_heightMap.size(),{0,1,0});
-  m_bitangents.resize(m_heightMap.size(),{0,1,0});
-  for (size_t i=0; i<m_normals.size(); i++)
+  m_hasSettings = false;
+  m_dimension = int((_pages.m_dimension-1)/_stride + 1);
+  m_scale = _pages.m_scale*float(_stride);
+  size_t dimension = size_t(m_dimension);
+  m_heightMap.assign(dimension*dimension, 0);
+  m_normals.assign(m_heightMap.size(), {0,1,0});
+  m_tangents.assign(m_heightMap.size(), {0,1,0});
+  m_bitangents.assign(m_heightMap.size(), {0,1,0});
+  _pages.readRegion(0, 0, dimension, dimension, _stride, m_heightMap.data());
+  for(auto &height : m_heightMap)
+  {
+    height *= m_amplitude;
+  }
+  computeAllNormals();
+}
+
+uint64_t TerrainGenerator::getStamp() const
+{
+  //FNV-1a hash of the settings' bytes
+  uint64_t stamp = 14695981039346656037ull;
+  auto addToStamp = [&stamp](const void *_data, size_t _size)
+  {
+    const unsigned char *bytes = static_cast<const unsigned char*>(_data);
+    for(size_t i=0; i<_size; i++)
+    {
+      stamp = (stamp ^ bytes[i]) * 1099511628211ull;
+    }
+  };
+  addToStamp(&m_dimension, sizeof(m_dimension));
+  addToStamp(&m_scale, sizeof(m_scale));
+  addToStamp(&m_seed, sizeof(m_seed));
+  addToStamp(&m_octaves, sizeof(m_octaves));
+  addToStamp(&m_frequency, sizeof(m_frequency));
+  addToStamp(&m_persistence, sizeof(m_persistence));
+  addToStamp(&m_lacunarity, sizeof(m_lacunarity));
+  return stamp==0 ? 1 : stamp;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+PerlinNoise TerrainGenerator::getPerlinNoise() const
+{
+  PerlinNoise perlinNoise;
+  perlinNoise.m_octaves = m_octaves;
+  perlinNoise.m_frequency = m_frequency;
+  perlinNoise.m_persistence = m_persistence;
+  perlinNoise.m_lacunarity = m_lacunarity;
+  perlinNoise.m_gradients = getPerlinGradients();
+  return perlinNoise;
+}
+
+std::vector<float> TerrainGenerator::getPerlinGradients()
+{
+  //libnoise keeps its gradient table to itself, but its gradient noise one unit along an axis from a lattice point is
+  //that component of the (scaled) gradient the point hashes to, so the table can be read back a lattice point at a
+  //time - the first 790 points along the x axis between them hash to all 256 gradients
+  std::vector<float> gradients(768, 0.0f);
+  std::vector<bool> found(256, false);
+  size_t numFound = 0;
+  for(int x=0; numFound<found.size(); x++)
+  {
+    size_t index = size_t(PerlinNoise::getGradientIndex(x,0,0,0));
+    if(!found[index])
+    {
+      found[index] = true;
+      numFound++;
+      gradients[3*index]   = float(noise::GradientNoise3D(x+1, 0, 0, x, 0, 0, 0));
+      gradients[3*index+1] = float(noise::GradientNoise3D(x,   1, 0, x, 0, 0, 0));
+      gradients[3*index+2] = float(noise::GradientNoise3D(x,   0, 1, x, 0, 0, 0));
+    }
+  }
+  return gradients;
+}
+
+void TerrainGenerator::computeNormals(size_t _firstRow, size_t _endRow, const float *_heights, size_t _heightsFirstRow)
+{
+  size_t dimension = size_t(m_dimension);
+  size_t offset = _heightsFirstRow*dimension;
+  for (size_t i=_firstRow*dimension; i<_endRow*dimension; i++)
   {
     int x=getGridX(int(i));
     int z=getGridZ(int(i));
@@ -51,10 +232,10 @@ void TerrainGenerator::computeNormals()
 
     if(x!=0 && x!=m_dimension-1 && z!=0 && z!=m_dimension-1)
     {
-      float T = m_heightMap[getIndex(x,z-1)];
-      float L = m_heightMap[getIndex(x-1,z)];
-      float R = m_heightMap[getIndex(x+1,z)];
-      float B = m_heightMap[getIndex(x,z+1)];
+      float T = _heights[getIndex(x,z-1)-offset];
+      float L = _heights[getIndex(x-1,z)-offset];
+      float R = _heights[getIndex(x+1,z)-offset];
+      float B = _heights[getIndex(x,z+1)-offset];
 
       ngl::Vec3 normal(L-R, 2*m_scale, T-B);
       ngl::Vec3 tangent(2*m_scale,R-L,0);
@@ -71,6 +252,39 @@ void TerrainGenerator::computeNormals()
   }
 }
 
+void TerrainGenerator::recordSettings()
+{
+  m_generatedSettings = {m_dimension, m_scale, m_seed, m_octaves, m_frequency, m_persistence, m_lacunarity,
+                         m_amplitude};
+  m_hasSettings = true;
+}
+
+void TerrainGenerator::computeAllNormals()
+{
+  size_t dimension = size_t(m_dimension);
+  const size_t rowsPerTile = 32;
+  size_t numTiles = (dimension+rowsPerTile-1)/rowsPerTile;
+  std::atomic<size_t> nextTile(0);
+  auto worker = [&]()
+  {
+    for(size_t tile=nextTile++; tile<numTiles; tile=nextTile++)
+    {
+      computeNormals(tile*rowsPerTile, std::min((tile+1)*rowsPerTile, dimension), m_heightMap.data(), 0);
+    }
+  };
+
+  size_t numThreads = std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+  std::vector<std::thread> threads;
+  for(size_t i=1; i<std::min(numThreads, numTiles); i++)
+  {
+    threads.push_back(std::thread(worker));
+  }
+  worker();
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
+}
 
 double TerrainGenerator::getSceneX(const int _index) const
 {
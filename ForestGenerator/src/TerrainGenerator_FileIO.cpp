@@ -0,0 +1,230 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file TerrainGenerator_FileIO.cpp
+/// @brief implementation file for TerrainGenerator class file import and export methods
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include "TerrainGenerator.h"
+#include "MappedFile.h"
+
+bool TerrainGenerator::loadRaw(const std::string &_fileName, float _minHeight, float _maxHeight)
+{
+  MappedFile file;
+  if(!file.open(_fileName))
+  {
+    std::cout<<"Couldn't open heightmap file "<<_fileName<<'\n';
+    return false;
+  }
+  size_t dimension = size_t(std::sqrt(double(file.getSize()/2)) + 0.5);
+  if(file.getSize()!=2*dimension*dimension || !isValidDimension(dimension))
+  {
+    std::cout<<_fileName<<" isn't a square 16-bit heightmap of width 2^n+1\n";
+    return false;
+  }
+  resizeGrid(dimension);
+  const unsigned char *values = file.getData();
+  float heightScale = (_maxHeight-_minHeight)/65535.0f;
+  for(size_t i=0; i<m_heightMap.size(); i++)
+  {
+    m_heightMap[i] = _minHeight + float(values[2*i] | (values[2*i+1]<<8))*heightScale;
+  }
+  //the shaders and height queries expect the heights to lie within the amplitude, as generated ones do
+  m_amplitude = std::max(std::abs(_minHeight), std::abs(_maxHeight));
+  computeAllNormals();
+  recordSettings();
+  return true;
+}
+
+bool TerrainGenerator::loadPGM(const std::string &_fileName, float _minHeight, float _maxHeight)
+{
+  MappedFile file;
+  if(!file.open(_fileName))
+  {
+    std::cout<<"Couldn't open heightmap file "<<_fileName<<'\n';
+    return false;
+  }
+
+  //the header is "P5" followed by the width, height and maximum value, separated by whitespace and comments, and a
+  //single whitespace character before the values
+  const unsigned char *data = file.getData();
+  size_t size = file.getSize();
+  size_t position = 2;
+  auto readNumber = [data, size, &position]()
+  {
+    while(position<size && (std::isspace(data[position]) || data[position]=='#'))
+    {
+      if(data[position]=='#')
+      {
+        while(position<size && data[position]!='\n')
+        {
+          position++;
+        }
+      }
+      else
+      {
+        position++;
+      }
+    }
+    size_t number = 0;
+    size_t firstDigit = position;
+    while(position<size && std::isdigit(data[position]) && position-firstDigit<10)
+    {
+      number = number*10 + size_t(data[position++]-'0');
+    }
+    return position>firstDigit ? number : 0;
+  };
+  if(size<2 || data[0]!='P' || data[1]!='5')
+  {
+    std::cout<<_fileName<<" isn't a binary PGM file\n";
+    return false;
+  }
+  size_t width = readNumber();
+  size_t height = readNumber();
+  size_t maxValue = readNumber();
+  position++;
+  size_t bytesPerValue = maxValue>255 ? 2 : 1;
+  if(width!=height || !isValidDimension(width) || maxValue==0 || maxValue>65535 ||
+     position>size || size-position < width*height*bytesPerValue)
+  {
+    std::cout<<_fileName<<" isn't a square heightmap of width 2^n+1\n";
+    return false;
+  }
+
+  resizeGrid(width);
+  const unsigned char *values = data + position;
+  float heightScale = (_maxHeight-_minHeight)/float(maxValue);
+  for(size_t i=0; i<m_heightMap.size(); i++)
+  {
+    //16-bit PGM values are most significant byte first
+    int value = bytesPerValue==2 ? (values[2*i]<<8) | values[2*i+1] : values[i];
+    m_heightMap[i] = _minHeight + float(value)*heightScale;
+  }
+  m_amplitude = std::max(std::abs(_minHeight), std::abs(_maxHeight));
+  computeAllNormals();
+  recordSettings();
+  return true;
+}
+
+bool TerrainGenerator::saveRaw(const std::string &_fileName, float _minHeight, float _maxHeight) const
+{
+  std::ofstream file(_fileName, std::ios::binary);
+  writeValues(file, _minHeight, _maxHeight, false);
+  if(!file)
+  {
+    std::cout<<"Couldn't write heightmap file "<<_fileName<<'\n';
+    return false;
+  }
+  return true;
+}
+
+bool TerrainGenerator::savePGM(const std::string &_fileName, float _minHeight, float _maxHeight) const
+{
+  std::ofstream file(_fileName, std::ios::binary);
+  file<<"P5\n"<<m_dimension<<' '<<m_dimension<<"\n65535\n";
+  writeValues(file, _minHeight, _maxHeight, true);
+  if(!file)
+  {
+    std::cout<<"Couldn't write heightmap file "<<_fileName<<'\n';
+    return false;
+  }
+  return true;
+}
+
+bool TerrainGenerator::saveTerrain(const std::string &_fileName) const
+{
+  static_assert(sizeof(ngl::Vec3)==3*sizeof(float), "terrain files store each ngl::Vec3 as three floats");
+  std::ofstream file(_fileName, std::ios::binary);
+  TerrainFileHeader header = {{'F','G','T','E','R','R','\0','\0'}, 1, uint32_t(m_dimension), m_scale, m_amplitude};
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(m_heightMap.data()), long(m_heightMap.size()*sizeof(float)));
+  for(auto vectors : {&m_normals, &m_tangents, &m_bitangents})
+  {
+    file.write(reinterpret_cast<const char*>(vectors->data()), long(vectors->size()*sizeof(ngl::Vec3)));
+  }
+  if(!file)
+  {
+    std::cout<<"Couldn't write terrain file "<<_fileName<<'\n';
+    return false;
+  }
+  return true;
+}
+
+bool TerrainGenerator::loadTerrain(const std::string &_fileName)
+{
+  MappedFile file;
+  if(!file.open(_fileName))
+  {
+    std::cout<<"Couldn't open terrain file "<<_fileName<<'\n';
+    return false;
+  }
+  TerrainFileHeader header;
+  size_t numValues = 0;
+  if(file.getSize()>=sizeof(header))
+  {
+    std::memcpy(&header, file.getData(), sizeof(header));
+    numValues = size_t(header.m_dimension)*size_t(header.m_dimension);
+  }
+  if(file.getSize()<sizeof(header) || std::memcmp(header.m_magic, "FGTERR", 6)!=0 || header.m_version!=1 ||
+     !isValidDimension(header.m_dimension) ||
+     file.getSize() != sizeof(header) + numValues*(sizeof(float) + 3*sizeof(ngl::Vec3)))
+  {
+    std::cout<<_fileName<<" isn't a terrain file\n";
+    return false;
+  }
+
+  m_dimension = int(header.m_dimension);
+  m_scale = header.m_scale;
+  m_amplitude = header.m_amplitude;
+  const unsigned char *data = file.getData() + sizeof(header);
+  m_heightMap.resize(numValues);
+  std::memcpy(m_heightMap.data(), data, numValues*sizeof(float));
+  data += numValues*sizeof(float);
+  for(auto vectors : {&m_normals, &m_tangents, &m_bitangents})
+  {
+    vectors->resize(numValues);
+    std::memcpy(vectors->data(), data, numValues*sizeof(ngl::Vec3));
+    data += numValues*sizeof(ngl::Vec3);
+  }
+  recordSettings();
+  return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void TerrainGenerator::resizeGrid(size_t _dimension)
+{
+  m_hasSettings = false;
+  m_scale *= float(m_dimension)/float(_dimension);
+  m_dimension = int(_dimension);
+  m_heightMap.assign(_dimension*_dimension, 0);
+  m_normals.assign(m_heightMap.size(), {0,1,0});
+  m_tangents.assign(m_heightMap.size(), {0,1,0});
+  m_bitangents.assign(m_heightMap.size(), {0,1,0});
+}
+
+void TerrainGenerator::writeValues(std::ostream &_stream, float _minHeight, float _maxHeight, bool _bigEndian) const
+{
+  size_t dimension = size_t(m_dimension);
+  float valueScale = _maxHeight>_minHeight ? 65535.0f/(_maxHeight-_minHeight) : 0;
+  std::vector<char> row(2*dimension);
+  for(size_t z=0; z<dimension && _stream; z++)
+  {
+    for(size_t x=0; x<dimension; x++)
+    {
+      float value = std::min(std::max((m_heightMap[z*dimension+x]-_minHeight)*valueScale, 0.0f), 65535.0f);
+      unsigned int roundedValue = static_cast<unsigned int>(value+0.5f);
+      row[2*x + (_bigEndian ? 1 : 0)] = char(roundedValue & 0xff);
+      row[2*x + (_bigEndian ? 0 : 1)] = char(roundedValue >> 8);
+    }
+    _stream.write(row.data(), long(row.size()));
+  }
+}
+
+bool TerrainGenerator::isValidDimension(size_t _dimension)
+{
+  return _dimension>=5 && ((_dimension-1) & (_dimension-2))==0;
+}
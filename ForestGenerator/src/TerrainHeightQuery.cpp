@@ -0,0 +1,609 @@
+//----------------------------------------------------------------------------------------------------------------------
+/// @file TerrainHeightQuery.cpp
+/// @brief implementation file for TerrainHeightQuery class
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "TerrainHeightQuery.h"
+
+
+TerrainHeightQuery::TerrainHeightQuery(const std::vector<float> &_heightMap, int _dimension, float _scale,
+                                       float _amplitude) :
+  m_heightMap(_heightMap), m_dimension(_dimension), m_scale(_scale), m_amplitude(_amplitude)
+{
+  if(m_heightMap.size()>0)
+  {
+    auto minMax = std::minmax_element(m_heightMap.begin(), m_heightMap.end());
+    m_minHeight = *minMax.first;
+    m_maxHeight = *minMax.second;
+  }
+  buildHeightRanges();
+}
+
+TerrainHeightQuery::TerrainHeightQuery(std::shared_ptr<PagedHeightMap> _pages, float _amplitude) :
+  m_pages(_pages), m_dimension(int(_pages->m_dimension)), m_scale(_pages->m_scale), m_amplitude(_amplitude)
+{
+  //the range is taken from the tiles' stored ranges rather than by reading every value, skipping stale tiles
+  bool first = true;
+  size_t numTiles = m_pages->getNumTilesPerSide();
+  for(size_t tileZ=0; tileZ<numTiles; tileZ++)
+  {
+    for(size_t tileX=0; tileX<numTiles; tileX++)
+    {
+      PagedHeightMap::TileInfo info = m_pages->getTileInfo(tileX, tileZ);
+      if(info.m_stamp==m_pages->m_stamp)
+      {
+        m_minHeight = first ? info.m_minHeight : std::min(m_minHeight, info.m_minHeight);
+        m_maxHeight = first ? info.m_maxHeight : std::max(m_maxHeight, info.m_maxHeight);
+        first = false;
+      }
+    }
+  }
+  m_minHeight *= m_amplitude;
+  m_maxHeight *= m_amplitude;
+  if(m_minHeight>m_maxHeight)
+  {
+    std::swap(m_minHeight, m_maxHeight);
+  }
+  buildPagedHeightRanges();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+float TerrainHeightQuery::getHeight(float _x, float _z) const
+{
+  if(m_dimension<2 || (!m_pages && m_heightMap.size()<size_t(m_dimension*m_dimension)))
+  {
+    return 0;
+  }
+
+  size_t cellX, cellZ;
+  float fracX, fracZ;
+  findCell(_x, _z, cellX, cellZ, fracX, fracZ);
+  float corners[4];
+  getCorners(cellX, cellZ, corners);
+  return interpolate(corners, fracX, fracZ);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void TerrainHeightQuery::getHeights(const float *_x, const float *_z, float *_heights, size_t _count) const
+{
+  size_t i=0;
+
+#ifdef __SSE2__
+  if(!m_pages && m_dimension>=2 && m_heightMap.size()>=size_t(m_dimension*m_dimension))
+  {
+    const __m128 invScale = _mm_set1_ps(1.0f/m_scale);
+    const __m128 offset = _mm_set1_ps(float(m_dimension/2));
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 maxCoord = _mm_set1_ps(float(m_dimension-1));
+    const __m128 maxCell = _mm_set1_ps(float(m_dimension-2));
+    const size_t dimension = size_t(m_dimension);
+
+    alignas(16) int cellX[4];
+    alignas(16) int cellZ[4];
+    alignas(16) float h00[4];
+    alignas(16) float h10[4];
+    alignas(16) float h01[4];
+    alignas(16) float h11[4];
+
+    for(; i+4<=_count; i+=4)
+    {
+      __m128 gridX = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(_x+i), invScale), offset);
+      __m128 gridZ = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(_z+i), invScale), offset);
+      gridX = _mm_min_ps(_mm_max_ps(gridX, zero), maxCoord);
+      gridZ = _mm_min_ps(_mm_max_ps(gridZ, zero), maxCoord);
+
+      //grid coordinates are non-negative here, so truncation is the same as floor
+      __m128 cellXf = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(gridX)), maxCell);
+      __m128 cellZf = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(gridZ)), maxCell);
+      __m128 fracX = _mm_sub_ps(gridX, cellXf);
+      __m128 fracZ = _mm_sub_ps(gridZ, cellZf);
+
+      //SSE2 has no gather, so the four corners of each cell are fetched individually
+      _mm_store_si128(reinterpret_cast<__m128i *>(cellX), _mm_cvttps_epi32(cellXf));
+      _mm_store_si128(reinterpret_cast<__m128i *>(cellZ), _mm_cvttps_epi32(cellZf));
+      for(int j=0; j<4; j++)
+      {
+        size_t index = dimension*size_t(cellZ[j]) + size_t(cellX[j]);
+        h00[j] = m_heightMap[index];
+        h10[j] = m_heightMap[index+1];
+        h01[j] = m_heightMap[index+dimension];
+        h11[j] = m_heightMap[index+dimension+1];
+      }
+
+      __m128 a = _mm_load_ps(h00);
+      __m128 b = _mm_load_ps(h10);
+      __m128 c = _mm_load_ps(h01);
+      __m128 d = _mm_load_ps(h11);
+      __m128 h0 = _mm_add_ps(a, _mm_mul_ps(fracX, _mm_sub_ps(b,a)));
+      __m128 h1 = _mm_add_ps(c, _mm_mul_ps(fracX, _mm_sub_ps(d,c)));
+      _mm_storeu_ps(_heights+i, _mm_add_ps(h0, _mm_mul_ps(fracZ, _mm_sub_ps(h1,h0))));
+    }
+  }
+#endif
+
+  if(m_pages && m_dimension>=2)
+  {
+    //the corners of a block of positions are read together, in the same order as getCorners() reads them
+    const size_t blockSize = 64;
+    size_t cornerX[4*blockSize];
+    size_t cornerZ[4*blockSize];
+    float corners[4*blockSize];
+    float fracX[blockSize];
+    float fracZ[blockSize];
+    for(; i<_count; i+=blockSize)
+    {
+      size_t numPositions = std::min(blockSize, _count-i);
+      for(size_t j=0; j<numPositions; j++)
+      {
+        size_t cellX, cellZ;
+        findCell(_x[i+j], _z[i+j], cellX, cellZ, fracX[j], fracZ[j]);
+        for(size_t k=0; k<4; k++)
+        {
+          cornerX[4*j+k] = cellX + k%2;
+          cornerZ[4*j+k] = cellZ + k/2;
+        }
+      }
+      m_pages->getValues(cornerX, cornerZ, corners, 4*numPositions);
+      for(size_t j=0; j<numPositions; j++)
+      {
+        for(size_t k=0; k<4; k++)
+        {
+          corners[4*j+k] *= m_amplitude;
+        }
+        _heights[i+j] = interpolate(&corners[4*j], fracX[j], fracZ[j]);
+      }
+    }
+  }
+
+  //scalar path for the remainder (and for builds without SSE)
+  for(; i<_count; i++)
+  {
+    _heights[i] = getHeight(_x[i], _z[i]);
+  }
+}
+
+bool TerrainHeightQuery::intersectRay(const ngl::Vec3 &_origin, const ngl::Vec3 &_direction, ngl::Vec3 &_hit) const
+{
+  if(m_dimension<2 || (!m_pages && m_heightMap.size()<size_t(m_dimension*m_dimension)))
+  {
+    return false;
+  }
+
+  //the ray is traced in grid coordinates, converted in the same way as in getHeight(), so that distances along it are
+  //the same as in worldspace
+  double invScale = 1.0/double(m_scale);
+  double offset = double(m_dimension/2);
+  Ray ray = {double(_origin.m_x)*invScale + offset, double(_origin.m_y), double(_origin.m_z)*invScale + offset,
+             double(_direction.m_x)*invScale, double(_direction.m_y), double(_direction.m_z)*invScale};
+  size_t topLevel = 0;
+  while(getNumCells(topLevel)>1)
+  {
+    topLevel++;
+  }
+  //a paged heightmap no wider than a tile is all in one block
+  std::shared_ptr<const std::vector<std::vector<float>>> block = nullptr;
+  if(m_pages && topLevel<m_blockLevel)
+  {
+    block = getRangeBlock(0, 0);
+  }
+  double distance;
+  if(!intersectCell(ray, topLevel, 0, 0, 0, std::numeric_limits<double>::max(), distance, block.get()))
+  {
+    return false;
+  }
+  _hit = _origin + _direction*float(distance);
+  return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void TerrainHeightQuery::buildHeightRanges()
+{
+  m_heightRanges.clear();
+  if(m_dimension<2 || m_heightMap.size()<size_t(m_dimension*m_dimension))
+  {
+    return;
+  }
+
+  size_t numCells = getNumCells(0);
+  m_heightRanges.push_back(std::vector<float>(2*numCells*numCells));
+  for(size_t z=0; z<numCells; z++)
+  {
+    for(size_t x=0; x<numCells; x++)
+    {
+      float corners[4];
+      getCorners(x, z, corners);
+      auto minMax = std::minmax_element(corners, corners+4);
+      m_heightRanges[0][2*(z*numCells+x)] = *minMax.first;
+      m_heightRanges[0][2*(z*numCells+x)+1] = *minMax.second;
+    }
+  }
+
+  addParentRanges();
+}
+
+void TerrainHeightQuery::buildPagedHeightRanges()
+{
+  m_heightRanges.clear();
+  size_t tileSize = m_pages->m_tileSize;
+  if(m_dimension<2 || tileSize==0)
+  {
+    return;
+  }
+  m_blockLevel = 0;
+  while((size_t(1)<<m_blockLevel)<tileSize)
+  {
+    m_blockLevel++;
+  }
+  //a heightmap no wider than a tile has no levels above the blocks
+  if(m_blockLevel>0 && getNumCells(m_blockLevel-1)<=1)
+  {
+    return;
+  }
+
+  //each cell takes the ranges of the tiles its values are in, including the last row and column it shares with the
+  //next cell, so its range may be a little wider than it needs to be but never narrower
+  size_t numTiles = m_pages->getNumTilesPerSide();
+  std::vector<float> tileRanges(2*numTiles*numTiles);
+  for(size_t tileZ=0; tileZ<numTiles; tileZ++)
+  {
+    for(size_t tileX=0; tileX<numTiles; tileX++)
+    {
+      //every tile counts here, stale or not, since the ranges describe the values the file holds
+      PagedHeightMap::TileInfo info = m_pages->getTileInfo(tileX, tileZ);
+      float minHeight = info.m_minHeight*m_amplitude;
+      float maxHeight = info.m_maxHeight*m_amplitude;
+      tileRanges[2*(tileZ*numTiles+tileX)] = std::min(minHeight, maxHeight);
+      tileRanges[2*(tileZ*numTiles+tileX)+1] = std::max(minHeight, maxHeight);
+    }
+  }
+  size_t blockSize = size_t(1)<<m_blockLevel;
+  size_t maxCoord = size_t(m_dimension-1);
+  size_t numCells = getNumCells(m_blockLevel);
+  m_heightRanges.assign(m_blockLevel, std::vector<float>());
+  m_heightRanges.push_back(std::vector<float>(2*numCells*numCells));
+  for(size_t z=0; z<numCells; z++)
+  {
+    for(size_t x=0; x<numCells; x++)
+    {
+      float &minHeight = m_heightRanges.back()[2*(z*numCells+x)];
+      float &maxHeight = m_heightRanges.back()[2*(z*numCells+x)+1];
+      minHeight = std::numeric_limits<float>::max();
+      maxHeight = std::numeric_limits<float>::lowest();
+      for(size_t tileZ=z*blockSize/tileSize; tileZ<=std::min((z+1)*blockSize, maxCoord)/tileSize; tileZ++)
+      {
+        for(size_t tileX=x*blockSize/tileSize; tileX<=std::min((x+1)*blockSize, maxCoord)/tileSize; tileX++)
+        {
+          minHeight = std::min(minHeight, tileRanges[2*(tileZ*numTiles+tileX)]);
+          maxHeight = std::max(maxHeight, tileRanges[2*(tileZ*numTiles+tileX)+1]);
+        }
+      }
+    }
+  }
+  addParentRanges();
+}
+
+void TerrainHeightQuery::addParentRanges()
+{
+  //each cell covers the cells of the level below it in a 2x2 block, which is cut short at the edge of the grid
+  size_t numCells = getNumCells(m_heightRanges.size()-1);
+  while(numCells>1)
+  {
+    size_t numChildCells = numCells;
+    numCells = (numCells+1)/2;
+    std::vector<float> ranges(2*numCells*numCells);
+    const std::vector<float> &childRanges = m_heightRanges.back();
+    for(size_t z=0; z<numCells; z++)
+    {
+      for(size_t x=0; x<numCells; x++)
+      {
+        float &minHeight = ranges[2*(z*numCells+x)];
+        float &maxHeight = ranges[2*(z*numCells+x)+1];
+        minHeight = childRanges[2*(2*z*numChildCells+2*x)];
+        maxHeight = childRanges[2*(2*z*numChildCells+2*x)+1];
+        for(size_t childZ=2*z; childZ<std::min(2*z+2, numChildCells); childZ++)
+        {
+          for(size_t childX=2*x; childX<std::min(2*x+2, numChildCells); childX++)
+          {
+            minHeight = std::min(minHeight, childRanges[2*(childZ*numChildCells+childX)]);
+            maxHeight = std::max(maxHeight, childRanges[2*(childZ*numChildCells+childX)+1]);
+          }
+        }
+      }
+    }
+    m_heightRanges.push_back(std::move(ranges));
+  }
+}
+
+size_t TerrainHeightQuery::getNumCells(size_t _level) const
+{
+  size_t numCells = size_t(m_dimension-1);
+  for(size_t level=0; level<_level; level++)
+  {
+    numCells = (numCells+1)/2;
+  }
+  return numCells;
+}
+
+void TerrainHeightQuery::findCell(float _x, float _z, size_t &_cellX, size_t &_cellZ, float &_fracX,
+                                  float &_fracZ) const
+{
+  //convert to grid coordinates in the same way as TerrainGenerator, then clamp to the edge of the grid
+  //(the arithmetic here matches getHeights() exactly, so the scalar and SIMD paths give identical results)
+  float invScale = 1.0f/m_scale;
+  float offset = float(m_dimension/2);
+  float maxCoord = float(m_dimension-1);
+  float gridX = std::min(std::max(_x*invScale + offset, 0.0f), maxCoord);
+  float gridZ = std::min(std::max(_z*invScale + offset, 0.0f), maxCoord);
+
+  //the last row and column use the cell before them, with an interpolation factor of 1
+  float cellX = std::min(float(int(gridX)), maxCoord-1);
+  float cellZ = std::min(float(int(gridZ)), maxCoord-1);
+  _fracX = gridX - cellX;
+  _fracZ = gridZ - cellZ;
+  _cellX = size_t(cellX);
+  _cellZ = size_t(cellZ);
+}
+
+float TerrainHeightQuery::interpolate(const float *_corners, float _fracX, float _fracZ)
+{
+  float h0 = _corners[0] + _fracX*(_corners[1]-_corners[0]);
+  float h1 = _corners[2] + _fracX*(_corners[3]-_corners[2]);
+  return h0 + _fracZ*(h1-h0);
+}
+
+std::shared_ptr<const std::vector<std::vector<float>>> TerrainHeightQuery::getRangeBlock(size_t _blockX,
+                                                                                         size_t _blockZ) const
+{
+  std::lock_guard<std::mutex> lock(m_rangeBlockMutex);
+  size_t key = _blockZ*getNumCells(m_blockLevel) + _blockX;
+  m_rangeBlockUseCount++;
+  auto found = m_rangeBlocks.find(key);
+  if(found!=m_rangeBlocks.end())
+  {
+    found->second.m_lastUse = m_rangeBlockUseCount;
+    return found->second.m_ranges;
+  }
+  if(m_rangeBlocks.size() >= std::max(m_pages->m_maxCachedTiles, size_t(1)))
+  {
+    //a ray still descending the dropped block keeps it alive through its own pointer
+    auto oldest = std::min_element(m_rangeBlocks.begin(), m_rangeBlocks.end(),
+                                   [](const std::pair<const size_t, RangeBlock> &_a,
+                                      const std::pair<const size_t, RangeBlock> &_b)
+                                   {return _a.second.m_lastUse < _b.second.m_lastUse;});
+    m_rangeBlocks.erase(oldest);
+  }
+
+  //the values of the block's cells, including the last row and column they share with the next block
+  size_t blockSize = size_t(1)<<m_blockLevel;
+  size_t maxCoord = size_t(m_dimension-1);
+  size_t firstX = _blockX*blockSize;
+  size_t firstZ = _blockZ*blockSize;
+  size_t width = std::min(blockSize, maxCoord-firstX)+1;
+  size_t depth = std::min(blockSize, maxCoord-firstZ)+1;
+  std::vector<float> values(width*depth);
+  m_pages->readRegion(firstX, firstZ, width, depth, 1, values.data());
+  for(auto &value : values)
+  {
+    value *= m_amplitude;
+  }
+
+  //cells past the edge of the grid are given an empty range, so that they leave their parents' ranges alone
+  auto ranges = std::make_shared<std::vector<std::vector<float>>>();
+  for(size_t level=0; level<m_blockLevel; level++)
+  {
+    size_t numCells = blockSize>>level;
+    std::vector<float> levelRanges(2*numCells*numCells);
+    for(size_t i=0; i<numCells*numCells; i++)
+    {
+      levelRanges[2*i] = std::numeric_limits<float>::max();
+      levelRanges[2*i+1] = std::numeric_limits<float>::lowest();
+    }
+    for(size_t z=0; z<numCells; z++)
+    {
+      for(size_t x=0; x<numCells; x++)
+      {
+        float &minHeight = levelRanges[2*(z*numCells+x)];
+        float &maxHeight = levelRanges[2*(z*numCells+x)+1];
+        if(level==0)
+        {
+          if(x+1<width && z+1<depth)
+          {
+            const float *row = &values[z*width+x];
+            auto minMax = std::minmax({row[0], row[1], row[width], row[width+1]});
+            minHeight = minMax.first;
+            maxHeight = minMax.second;
+          }
+          continue;
+        }
+        const std::vector<float> &childRanges = ranges->back();
+        for(size_t childZ=2*z; childZ<2*z+2; childZ++)
+        {
+          for(size_t childX=2*x; childX<2*x+2; childX++)
+          {
+            minHeight = std::min(minHeight, childRanges[2*(childZ*2*numCells+childX)]);
+            maxHeight = std::max(maxHeight, childRanges[2*(childZ*2*numCells+childX)+1]);
+          }
+        }
+      }
+    }
+    ranges->push_back(std::move(levelRanges));
+  }
+  m_rangeBlocks[key] = {ranges, m_rangeBlockUseCount};
+  return ranges;
+}
+
+void TerrainHeightQuery::getCorners(size_t _cellX, size_t _cellZ, float *_corners) const
+{
+  if(m_pages)
+  {
+    //the four corners are read with one lock of the cache
+    size_t cornerX[4] = {_cellX, _cellX+1, _cellX, _cellX+1};
+    size_t cornerZ[4] = {_cellZ, _cellZ, _cellZ+1, _cellZ+1};
+    m_pages->getValues(cornerX, cornerZ, _corners, 4);
+    for(size_t i=0; i<4; i++)
+    {
+      _corners[i] *= m_amplitude;
+    }
+  }
+  else
+  {
+    size_t index = size_t(m_dimension)*_cellZ + _cellX;
+    _corners[0] = m_heightMap[index];
+    _corners[1] = m_heightMap[index+1];
+    _corners[2] = m_heightMap[index+size_t(m_dimension)];
+    _corners[3] = m_heightMap[index+size_t(m_dimension)+1];
+  }
+}
+
+bool TerrainHeightQuery::intersectCell(const Ray &_ray, size_t _level, size_t _cellX, size_t _cellZ, double _start,
+                                       double _end, double &_distance,
+                                       const std::vector<std::vector<float>> *_block) const
+{
+  //clips [start,end] to the part of the ray between two planes across one axis
+  double start = _start;
+  double end = _end;
+  auto clip = [&start, &end](double _origin, double _direction, double _low, double _high)
+  {
+    if(_direction==0.0)
+    {
+      return _origin>=_low && _origin<=_high;
+    }
+    double first = (_low-_origin)/_direction;
+    double last = (_high-_origin)/_direction;
+    start = std::max(start, std::min(first, last));
+    end = std::min(end, std::max(first, last));
+    return start<=end;
+  };
+
+  //the part of the ray over the cell
+  size_t cellSize = size_t(1)<<_level;
+  size_t maxCoord = size_t(m_dimension-1);
+  if(!clip(_ray.m_originX, _ray.m_directionX, double(_cellX*cellSize), double(std::min((_cellX+1)*cellSize, maxCoord))) ||
+     !clip(_ray.m_originZ, _ray.m_directionZ, double(_cellZ*cellSize), double(std::min((_cellZ+1)*cellSize, maxCoord))))
+  {
+    return false;
+  }
+  double cellStart = start;
+  double cellEnd = end;
+
+  //and the part of that within the cell's height range, padded slightly so that rays grazing flat cells aren't lost
+  double minHeight = m_minHeight;
+  double maxHeight = m_maxHeight;
+  if(_level<m_heightRanges.size() && m_heightRanges[_level].size()>0)
+  {
+    size_t index = 2*(_cellZ*getNumCells(_level)+_cellX);
+    minHeight = m_heightRanges[_level][index];
+    maxHeight = m_heightRanges[_level][index+1];
+  }
+  else if(_block)
+  {
+    //the block is (blockSize>>level) cells wide at each level, starting from a multiple of that
+    size_t numBlockCells = (size_t(1)<<m_blockLevel)>>_level;
+    size_t index = 2*((_cellZ%numBlockCells)*numBlockCells + _cellX%numBlockCells);
+    minHeight = (*_block)[_level][index];
+    maxHeight = (*_block)[_level][index+1];
+  }
+  double padding = 1e-4*(1.0 + std::max(std::abs(minHeight), std::abs(maxHeight)));
+  if(!clip(_ray.m_originY, _ray.m_directionY, minHeight-padding, maxHeight+padding))
+  {
+    return false;
+  }
+
+  if(_level>0)
+  {
+    //the children the ray passes through are visited in the order it reaches them, so the first hit is the nearest -
+    //it can only pass through one of the two children off its diagonal
+    size_t numChildCells = getNumCells(_level-1);
+    std::shared_ptr<const std::vector<std::vector<float>>> block = nullptr;
+    if(m_pages && _level==m_blockLevel)
+    {
+      block = getRangeBlock(_cellX, _cellZ);
+      _block = block.get();
+    }
+    size_t firstX = _ray.m_directionX<0 ? 1 : 0;
+    size_t firstZ = _ray.m_directionZ<0 ? 1 : 0;
+    size_t childOrder[4][2] = {{firstX, firstZ}, {1-firstX, firstZ}, {firstX, 1-firstZ}, {1-firstX, 1-firstZ}};
+    for(auto &child : childOrder)
+    {
+      size_t childX = 2*_cellX + child[0];
+      size_t childZ = 2*_cellZ + child[1];
+      if(childX<numChildCells && childZ<numChildCells &&
+         intersectCell(_ray, _level-1, childX, childZ, start, end, _distance, _block))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //the terrain over the cell is h00 + u*(h10-h00) + v*(h01-h00) + u*v*(h00-h10-h01+h11), and the ray's height above
+  //it is then a quadratic in the distance along the ray, which is solved from where the ray enters the cell
+  float corners[4];
+  getCorners(_cellX, _cellZ, corners);
+  double slopeX = double(corners[1])-double(corners[0]);
+  double slopeZ = double(corners[2])-double(corners[0]);
+  double twist = double(corners[0])-double(corners[1])-double(corners[2])+double(corners[3]);
+  double u = _ray.m_originX + _ray.m_directionX*cellStart - double(_cellX);
+  double v = _ray.m_originZ + _ray.m_directionZ*cellStart - double(_cellZ);
+  double y = _ray.m_originY + _ray.m_directionY*cellStart;
+  double a = -twist*_ray.m_directionX*_ray.m_directionZ;
+  double b = _ray.m_directionY - slopeX*_ray.m_directionX - slopeZ*_ray.m_directionZ -
+             twist*(u*_ray.m_directionZ + v*_ray.m_directionX);
+  double c = y - (double(corners[0]) + slopeX*u + slopeZ*v + twist*u*v);
+
+  double length = cellEnd-cellStart;
+  double tolerance = 1e-6*(1.0+length);
+  double roots[2];
+  size_t numRoots = 0;
+  if(std::abs(a)<=1e-12*(std::abs(b)+std::abs(c)))
+  {
+    if(b!=0.0)
+    {
+      roots[numRoots++] = -c/b;
+    }
+    else if(c==0.0)
+    {
+      roots[numRoots++] = 0;
+    }
+  }
+  else
+  {
+    double discriminant = b*b - 4*a*c;
+    if(discriminant>=0)
+    {
+      //the form of the quadratic formula that doesn't lose precision when b*b is much larger than 4ac
+      double q = -0.5*(b + std::copysign(std::sqrt(discriminant), b));
+      roots[numRoots++] = q/a;
+      if(q!=0.0)
+      {
+        roots[numRoots++] = c/q;
+      }
+    }
+  }
+
+  bool hit = false;
+  double nearest = length+tolerance;
+  for(size_t i=0; i<numRoots; i++)
+  {
+    if(roots[i]>=-tolerance && roots[i]<=nearest)
+    {
+      nearest = roots[i];
+      hit = true;
+    }
+  }
+  if(hit)
+  {
+    _distance = cellStart + std::min(std::max(nearest, 0.0), length);
+  }
+  return hit;
+}
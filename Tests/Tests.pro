@@ -7,12 +7,28 @@ CONFIG -= app_bundle
 CONFIG += thread
 CONFIG -= qt
 
-INCLUDEPATH += ../ForestGenerator/include/
+INCLUDEPATH += ../ForestGenerator/include/ \
+               ../ForestGenerator/include/noiseutils
 SOURCES += main.cpp \
             ../ForestGenerator/src/LSystem.cpp \
             ../ForestGenerator/src/LSystem_CreateGeometry.cpp \
             ../ForestGenerator/src/LSystem_InstanceMethods.cpp \
-            ../ForestGenerator/src/Instance.cpp
+            ../ForestGenerator/src/Instance.cpp \
+            ../ForestGenerator/src/SpeciesCache.cpp \
+            ../ForestGenerator/src/TerrainHeightQuery.cpp \
+            ../ForestGenerator/src/Forest.cpp \
+            ../ForestGenerator/src/SpatialHash.cpp \
+            ../ForestGenerator/src/ForestTileManager.cpp \
+            ../ForestGenerator/src/Frustum.cpp \
+            ../ForestGenerator/src/BoundingVolumeHierarchy.cpp \
+            ../ForestGenerator/src/MeshSimplifier.cpp \
+            ../ForestGenerator/src/ForestDrawBatch.cpp \
+            ../ForestGenerator/src/PerlinNoise.cpp \
+            ../ForestGenerator/src/PagedHeightMap.cpp \
+            ../ForestGenerator/src/MappedFile.cpp \
+            ../ForestGenerator/src/TerrainData.cpp \
+            ../ForestGenerator/src/TerrainGenerator.cpp \
+            ../ForestGenerator/src/TerrainGenerator_FileIO.cpp
 
 NGLPATH=$$(NGLDIR)
 isEmpty(NGLPATH){ # note brace must be here
@@ -23,3 +39,12 @@ else{ # note brace must be here
         message("Using custom NGL location")
         include($(NGLDIR)/UseNGL.pri)
 }
+
+#add libnoise library, which the PerlinNoise tests compare against
+unix: LIBS += -L$$(HOME)/libnoise/lib -lnoise -lnoiseutils
+unix: INCLUDEPATH += $$(HOME)/libnoise/include
+
+win32:CONFIG(release, debug|release): LIBS += -L$(HOME)/Users/Ben/Libnoise/bin/ -llibnoise
+else:win32:CONFIG(debug, debug|release): LIBS += -L$(HOME)/Users/Ben/Libnoise/bin/ -llibnoised
+
+win32:INCLUDEPATH += $(HOME)/Users/Ben/Libnoise/include
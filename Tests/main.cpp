@@ -1,5 +1,25 @@
 #include <gtest/gtest.h>
+#include <algorithm>
 #include "LSystem.h"
+#include "SpeciesCache.h"
+#include "TerrainHeightQuery.h"
+#include "Forest.h"
+#include "SpatialHash.h"
+#include "ForestTileManager.h"
+#include "Frustum.h"
+#include "BoundingVolumeHierarchy.h"
+#include "MeshSimplifier.h"
+#include "ForestDrawBatch.h"
+#include "PerlinNoise.h"
+#include "PagedHeightMap.h"
+#include "MappedFile.h"
+#include "TerrainData.h"
+#include "TerrainGenerator.h"
+#include "noiseutils.h"
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <functional>
 
 
 int main(int argc, char *argv[])
@@ -9,6 +29,45 @@ int main(int argc, char *argv[])
 }
 
 
+//--------------------------------------------------------------------------------------------------------------------
+///HELPER FUNCTIONS
+//--------------------------------------------------------------------------------------------------------------------
+/// @brief the seeded LSystem shared by the species and forest tests, so that they all get the same heroes
+LSystem createTestLSystem()
+{
+  LSystem L("FFFA",{"A=![B]////[B]////B", "B=FFFA"},2,0.9f,30,0.9f,3,1,1);
+  L.m_useSeed = true;
+  return L;
+}
+
+/// @brief a tree type made from createTestLSystem() with two hero trees
+std::shared_ptr<const LSystem> createTestTreeType()
+{
+  return SpeciesCache::createTreeType(createTestLSystem(),2);
+}
+
+/// @brief a terrain with spacing 2 and a fixed bumpy heightmap, filled in directly rather than generated so that the
+/// TerrainData tests don't depend on the noise
+TerrainGenerator createTestTerrain(int _dimension)
+{
+  TerrainGenerator terrainGen;
+  terrainGen.m_dimension = _dimension;
+  terrainGen.m_scale = 2;
+  size_t size = size_t(_dimension*_dimension);
+  terrainGen.m_heightMap.resize(size);
+  for(int z=0; z<_dimension; z++)
+  {
+    for(int x=0; x<_dimension; x++)
+    {
+      terrainGen.m_heightMap[size_t(z*_dimension+x)] = float((3*x*x+5*z+x*z)%17)*0.25f-2;
+    }
+  }
+  terrainGen.m_normals.assign(size, ngl::Vec3(0,1,0));
+  terrainGen.m_tangents.assign(size, ngl::Vec3(1,0,0));
+  terrainGen.m_bitangents.assign(size, ngl::Vec3(0,0,1));
+  return terrainGen;
+}
+
 //--------------------------------------------------------------------------------------------------------------------
 ///TESTS
 //--------------------------------------------------------------------------------------------------------------------
@@ -139,3 +198,1408 @@ TEST(LSystem, addInstancingCommands_nestedBranches)
   EXPECT_EQ(L.m_branches[2],"B");
   EXPECT_EQ(L.m_branches[3],"C[FFF]");
 }
+
+TEST(SpeciesCache, reuseTreeType)
+{
+  LSystem L = createTestLSystem();
+  SpeciesCache cache;
+
+  std::shared_ptr<const LSystem> treeType = cache.getTreeType(L,2);
+  EXPECT_EQ(cache.getTreeType(L,2),treeType);
+  EXPECT_EQ(cache.size(),1);
+  //the cached species is filled with instancing commands but the original LSystem is left alone
+  EXPECT_EQ(L.m_axiom,"FFFA");
+  EXPECT_NE(treeType->m_heroVertices.size(),0);
+
+  EXPECT_NE(cache.getTreeType(L,3),treeType);
+  L.m_angle = 25;
+  EXPECT_NE(cache.getTreeType(L,2),treeType);
+  EXPECT_EQ(cache.size(),3);
+  L.m_numLODLevels += 1;
+  EXPECT_NE(cache.getTreeType(L,2),treeType);
+  EXPECT_EQ(cache.size(),4);
+}
+
+TEST(SpeciesCache, pruneUnusedSpecies)
+{
+  std::string axiom = "FFFA";
+  std::vector<std::string> rules = {"A=![B]////[B]////B", "B=FFFA"};
+  LSystem L(axiom,rules,2,0.9f,30,0.9f,2,1,1);
+  SpeciesCache cache;
+  cache.m_maxUnusedSpecies = 1;
+
+  std::shared_ptr<const LSystem> kept = cache.getTreeType(L,1);
+  for(int numHeroTrees=2; numHeroTrees<6; numHeroTrees++)
+  {
+    cache.getTreeType(L,numHeroTrees);
+  }
+  //the referenced species survives, along with at most one unused species and the newest one
+  EXPECT_EQ(cache.size(),3);
+  EXPECT_EQ(cache.getTreeType(L,1),kept);
+}
+
+TEST(TerrainHeightQuery, bilinearSampling)
+{
+  //3x3 grid with spacing 10, centred on the origin, whose height is x+2z in grid units
+  std::vector<float> heightMap = {0,1,2,
+                                  2,3,4,
+                                  4,5,6};
+  TerrainHeightQuery terrainHeights(heightMap,3,10,1);
+
+  EXPECT_FLOAT_EQ(terrainHeights.getHeight(0,0),3);
+  EXPECT_FLOAT_EQ(terrainHeights.getHeight(-10,-10),0);
+  EXPECT_FLOAT_EQ(terrainHeights.getHeight(10,10),6);
+  EXPECT_FLOAT_EQ(terrainHeights.getHeight(5,-5),2.5f);
+  //points off the terrain are clamped to its edge
+  EXPECT_FLOAT_EQ(terrainHeights.getHeight(100,0),4);
+  EXPECT_FLOAT_EQ(terrainHeights.getHeight(-100,-100),0);
+  EXPECT_FLOAT_EQ(terrainHeights.m_minHeight,0);
+  EXPECT_FLOAT_EQ(terrainHeights.m_maxHeight,6);
+}
+
+TEST(TerrainHeightQuery, batchMatchesSingleQueries)
+{
+  std::vector<float> heightMap(17*17);
+  for(size_t i=0; i<heightMap.size(); i++)
+  {
+    heightMap[i] = float((i*7919)%101)*0.1f;
+  }
+  TerrainHeightQuery terrainHeights(heightMap,17,3.5f,10);
+
+  std::vector<float> x, z;
+  for(int i=0; i<23; i++)
+  {
+    x.push_back(-35.0f + 3.3f*i);
+    z.push_back(31.0f - 2.9f*i);
+  }
+  std::vector<float> heights(x.size());
+  terrainHeights.getHeights(x.data(),z.data(),heights.data(),x.size());
+  for(size_t i=0; i<x.size(); i++)
+  {
+    EXPECT_FLOAT_EQ(heights[i],terrainHeights.getHeight(x[i],z[i]));
+  }
+}
+
+TEST(TerrainHeightQuery, intersectRay)
+{
+  std::vector<float> heightMap(33*33);
+  for(size_t i=0; i<heightMap.size(); i++)
+  {
+    heightMap[i] = float((i*7919)%101)*0.1f;
+  }
+  TerrainHeightQuery terrainHeights(heightMap,33,2.5f,10);
+
+  //straight down onto the terrain
+  ngl::Vec3 hit;
+  ASSERT_TRUE(terrainHeights.intersectRay(ngl::Vec3(3.3f,50,-7.1f),ngl::Vec3(0,-2,0),hit));
+  EXPECT_FLOAT_EQ(hit.m_x,3.3f);
+  EXPECT_NEAR(hit.m_y,terrainHeights.getHeight(3.3f,-7.1f),1e-4f);
+  EXPECT_FLOAT_EQ(hit.m_z,-7.1f);
+
+  //slanted rays hit the surface, and no point on them before the hit is below it
+  for(int i=0; i<20; i++)
+  {
+    ngl::Vec3 origin(-35.0f+3.5f*i, 20.0f, 30.0f-3.0f*i);
+    ngl::Vec3 direction(1.0f-0.1f*i, -0.4f, 0.3f+0.05f*i);
+    ASSERT_TRUE(terrainHeights.intersectRay(origin,direction,hit));
+    EXPECT_NEAR(hit.m_y,terrainHeights.getHeight(hit.m_x,hit.m_z),1e-3f);
+    float distance = (hit-origin).length()/direction.length();
+    for(float t=0; t<distance-1e-3f; t+=0.01f)
+    {
+      ngl::Vec3 point = origin+direction*t;
+      ASSERT_GE(point.m_y,terrainHeights.getHeight(point.m_x,point.m_z)-1e-3f);
+    }
+  }
+
+  //rays pointing away from the terrain, passing over it or off its edge miss it
+  EXPECT_FALSE(terrainHeights.intersectRay(ngl::Vec3(0,20,0),ngl::Vec3(0.1f,1,0),hit));
+  EXPECT_FALSE(terrainHeights.intersectRay(ngl::Vec3(-50,20,0),ngl::Vec3(1,0,0),hit));
+  EXPECT_FALSE(terrainHeights.intersectRay(ngl::Vec3(100,20,0),ngl::Vec3(0,-1,0),hit));
+}
+
+TEST(Forest, scatterForestPoissonDisk)
+{
+  Forest forest;
+  forest.m_treeTypes = {std::make_shared<LSystem>(), std::make_shared<LSystem>()};
+  forest.m_width = 400;
+  forest.m_numTrees = {60,200};
+  forest.m_treeRadii = {20,8};
+  forest.m_seed = 3;
+  forest.m_useSeed = true;
+  forest.scatterForestPoissonDisk();
+
+  //both quotas fit comfortably in the forest, so every tree should be placed
+  ASSERT_EQ(forest.m_treeData.size(),260);
+  std::vector<size_t> numPlaced(2,0);
+  for(size_t i=0; i<forest.m_treeData.size(); i++)
+  {
+    const Forest::Tree &a = forest.m_treeData[i];
+    numPlaced[a.m_type]++;
+    EXPECT_LE(fabsf(a.m_transform.m_30),200);
+    EXPECT_LE(fabsf(a.m_transform.m_32),200);
+    for(size_t j=0; j<i; j++)
+    {
+      const Forest::Tree &b = forest.m_treeData[j];
+      float dx = a.m_transform.m_30-b.m_transform.m_30;
+      float dz = a.m_transform.m_32-b.m_transform.m_32;
+      EXPECT_GE(sqrtf(dx*dx+dz*dz), std::max(forest.m_treeRadii[a.m_type],forest.m_treeRadii[b.m_type]));
+    }
+  }
+  EXPECT_EQ(numPlaced[0],60);
+  EXPECT_EQ(numPlaced[1],200);
+
+  //a seeded forest is the same every time, however the tiles are shared between threads
+  Forest other = forest;
+  other.scatterForestPoissonDisk();
+  ASSERT_EQ(other.m_treeData.size(),forest.m_treeData.size());
+  for(size_t i=0; i<forest.m_treeData.size(); i++)
+  {
+    EXPECT_EQ(other.m_treeData[i].m_transform.m_30,forest.m_treeData[i].m_transform.m_30);
+    EXPECT_EQ(other.m_treeData[i].m_transform.m_32,forest.m_treeData[i].m_transform.m_32);
+  }
+}
+
+TEST(SpatialHash, neighbourQueries)
+{
+  SpatialHash hash(10);
+  hash.insert(0,0,0);
+  hash.insert(1,9,0);
+  hash.insert(2,-25,-25);
+  hash.insert(3,100,-3);
+  EXPECT_EQ(hash.size(),4);
+
+  EXPECT_TRUE(hash.hasPointWithin(-5,1,6));
+  //distances equal to the radius don't count, matching the spacing check used for painting
+  EXPECT_FALSE(hash.hasPointWithin(-20,-25,5));
+  EXPECT_TRUE(hash.hasPointWithin(-20,-25,5.01f));
+
+  std::vector<size_t> ids;
+  hash.findPointsWithin(4,0,6,ids);
+  std::sort(ids.begin(),ids.end());
+  EXPECT_EQ(ids,std::vector<size_t>({0,1}));
+
+  //a radius covering more cells than are occupied gives the same result
+  ids.clear();
+  hash.findPointsWithin(0,0,1000,ids);
+  EXPECT_EQ(ids.size(),4);
+
+  EXPECT_TRUE(hash.remove(1,9,0));
+  EXPECT_FALSE(hash.remove(1,9,0));
+  EXPECT_FALSE(hash.remove(3,0,0));
+  EXPECT_EQ(hash.size(),3);
+  EXPECT_FALSE(hash.hasPointWithin(9,0,5));
+}
+
+TEST(Forest, adjustedCacheIndexesAreUnique)
+{
+  Forest forest({createTestTreeType()},0,true);
+
+  //painting the same species twice uses the same cache slots again, but each slot should only be listed once
+  ngl::Vec3 a(0,0,0);
+  ngl::Vec3 b(50,0,0);
+  forest.addTreeToForest(a,0);
+  size_t numAdjusted = forest.m_adjustedCacheIndexes.size();
+  EXPECT_NE(numAdjusted,0);
+  forest.addTreeToForest(b,0);
+  EXPECT_GE(forest.m_adjustedCacheIndexes.size(),numAdjusted);
+  for(size_t i=0; i<forest.m_adjustedCacheIndexes.size(); i++)
+  {
+    for(size_t j=0; j<i; j++)
+    {
+      const Forest::CacheIndex &x = forest.m_adjustedCacheIndexes[i];
+      const Forest::CacheIndex &y = forest.m_adjustedCacheIndexes[j];
+      EXPECT_FALSE(x.m_treeNum==y.m_treeNum && x.m_id==y.m_id && x.m_age==y.m_age && x.m_innerIndex==y.m_innerIndex);
+    }
+  }
+
+  forest.clearAdjustedCacheIndexes();
+  EXPECT_EQ(forest.m_adjustedCacheIndexes.size(),0);
+  forest.addTreeToForest(a,0);
+  EXPECT_NE(forest.m_adjustedCacheIndexes.size(),0);
+  EXPECT_EQ(forest.m_treeData.size(),3);
+}
+
+TEST(Forest, eraseTreesWithin)
+{
+  Forest forest({createTestTreeType()},0,true);
+
+  for(int i=0; i<10; i++)
+  {
+    ngl::Vec3 point(float(i*30),0,0);
+    forest.addTreeToForest(point,0);
+  }
+  forest.clearAdjustedCacheIndexes();
+
+  //the brush covers the trees at 60, 90 and 120
+  ngl::Vec3 brush(90,0,0);
+  EXPECT_EQ(forest.eraseTreesWithin(brush,35),3);
+  EXPECT_EQ(forest.m_treeData.size(),7);
+  EXPECT_FALSE(forest.m_treeHash.hasPointWithin(90,0,35));
+  EXPECT_NE(forest.m_adjustedCacheIndexes.size(),0);
+
+  //every remaining transform should still be owned by a handle pointing back at it
+  size_t numHandles = 0;
+  for(size_t tree=0; tree<forest.m_treeHandles.size(); tree++)
+  {
+    for(size_t h=0; h<forest.m_treeHandles[tree].size(); h++)
+    {
+      const Forest::TransformHandle &handle = forest.m_treeHandles[tree][h];
+      const Forest::CacheIndex &c = handle.m_cacheIndex;
+      const Forest::TransformOwner &owner =
+          forest.m_transformOwners[c.m_treeNum][c.m_id][c.m_age][c.m_innerIndex].at(handle.m_position);
+      EXPECT_EQ(owner.m_tree,tree);
+      EXPECT_EQ(owner.m_handle,h);
+      numHandles++;
+    }
+  }
+  size_t numTransforms = 0;
+  FOR_EACH_ELEMENT(forest.m_transformCache[0], numTransforms += forest.m_transformCache[0][ID][AGE][INDEX].size())
+  EXPECT_EQ(numTransforms,numHandles);
+
+  //each remaining tree is still indexed at its own position, and none of them were under the brush
+  for(auto &tree : forest.m_treeData)
+  {
+    EXPECT_TRUE(forest.m_treeHash.hasPointWithin(tree.m_transform.m_30,tree.m_transform.m_32,0.01f));
+    EXPECT_FALSE(fabsf(tree.m_transform.m_30-90)<35);
+  }
+}
+
+TEST(ForestTileManager, streamTilesAroundCamera)
+{
+  std::shared_ptr<const LSystem> treeType = createTestTreeType();
+  ForestTileManager tiles({treeType},100,{5},nullptr,7,true);
+  tiles.m_residencyRadius = 1;
+  tiles.m_maxTilesBuiltPerUpdate = 4;
+
+  //the 3x3 tiles around the camera are built over three updates, nearest first
+  EXPECT_TRUE(tiles.update(50,50));
+  EXPECT_EQ(tiles.m_tiles.size(),4);
+  EXPECT_NE(tiles.getTile(ForestTileManager::TileCoord(0,0)),nullptr);
+  EXPECT_TRUE(tiles.update(50,50));
+  EXPECT_TRUE(tiles.update(50,50));
+  EXPECT_FALSE(tiles.update(50,50));
+  EXPECT_EQ(tiles.m_tiles.size(),9);
+  EXPECT_EQ(tiles.m_builtTiles.size(),9);
+  tiles.clearChanges();
+
+  //each tile's trees lie inside the tile
+  const Forest *tile = tiles.getTile(ForestTileManager::TileCoord(-1,0));
+  ASSERT_NE(tile,nullptr);
+  ASSERT_EQ(tile->m_treeData.size(),5);
+  std::vector<float> xPositions;
+  for(auto &tree : tile->m_treeData)
+  {
+    EXPECT_GE(tree.m_transform.m_30,-100);
+    EXPECT_LE(tree.m_transform.m_30,0);
+    EXPECT_GE(tree.m_transform.m_32,0);
+    EXPECT_LE(tree.m_transform.m_32,100);
+    xPositions.push_back(tree.m_transform.m_30);
+  }
+
+  //moving far away evicts every tile, and coming back rebuilds the same trees
+  for(int i=0; i<5; i++)
+  {
+    tiles.update(5050,50);
+  }
+  EXPECT_EQ(tiles.getTile(ForestTileManager::TileCoord(-1,0)),nullptr);
+  EXPECT_EQ(tiles.m_evictedTiles.size(),9);
+  EXPECT_EQ(tiles.m_tiles.size(),9);
+  for(int i=0; i<5; i++)
+  {
+    tiles.update(50,50);
+  }
+  tile = tiles.getTile(ForestTileManager::TileCoord(-1,0));
+  ASSERT_NE(tile,nullptr);
+  for(size_t i=0; i<xPositions.size(); i++)
+  {
+    EXPECT_EQ(tile->m_treeData[i].m_transform.m_30,xPositions[i]);
+  }
+
+  //tiles outside the world are never built
+  ForestTileManager boundedTiles({treeType},100,{1},nullptr,7,true);
+  boundedTiles.m_worldWidth = 200;
+  boundedTiles.m_maxTilesBuiltPerUpdate = 100;
+  boundedTiles.update(0,0);
+  EXPECT_EQ(boundedTiles.m_tiles.size(),4);
+}
+
+TEST(Frustum, cullBoxesWithHierarchy)
+{
+  //a perspective projection looking down -z, with a near plane at 1 and a far plane at 100
+  float n = 1;
+  float f = 100;
+  ngl::Mat4 project(1, 0, 0,               0,
+                    0, 1, 0,               0,
+                    0, 0, (f+n)/(n-f),    -1,
+                    0, 0, 2*f*n/(n-f),     0);
+  Frustum frustum(project);
+  EXPECT_EQ(frustum.testBox(ngl::Vec3(-1,-1,-11),ngl::Vec3(1,1,-9)),Frustum::INSIDE);
+  EXPECT_EQ(frustum.testBox(ngl::Vec3(-1,-1,-1.5f),ngl::Vec3(1,1,-0.5f)),Frustum::INTERSECTING);
+  EXPECT_EQ(frustum.testBox(ngl::Vec3(-1,-1,9),ngl::Vec3(1,1,11)),Frustum::OUTSIDE);
+  EXPECT_EQ(frustum.testBox(ngl::Vec3(20,-1,-11),ngl::Vec3(22,1,-9)),Frustum::OUTSIDE);
+  EXPECT_TRUE(frustum.intersectsSphere(ngl::Vec3(11,0,-10),1.5f));
+  EXPECT_FALSE(frustum.intersectsSphere(ngl::Vec3(12,0,-10),1.0f));
+  EXPECT_FALSE(frustum.intersectsSphere(ngl::Vec3(0,0,-102),1.5f));
+
+  //the hierarchy should find exactly the boxes a brute force test finds
+  std::vector<ngl::Vec3> mins;
+  std::vector<ngl::Vec3> maxs;
+  for(int x=-20; x<20; x++)
+  {
+    for(int z=-60; z<10; z++)
+    {
+      mins.push_back(ngl::Vec3(float(x)*3,-1,float(z)*3));
+      maxs.push_back(ngl::Vec3(float(x)*3+2,1,float(z)*3+2));
+    }
+  }
+  BoundingVolumeHierarchy bvh;
+  bvh.build(mins,maxs);
+  EXPECT_EQ(bvh.size(),mins.size());
+  std::vector<size_t> inside;
+  std::vector<size_t> intersecting;
+  bvh.findVisible(frustum,inside,intersecting);
+  std::vector<size_t> visible = inside;
+  visible.insert(visible.end(),intersecting.begin(),intersecting.end());
+  std::sort(visible.begin(),visible.end());
+  std::vector<size_t> expected;
+  for(size_t i=0; i<mins.size(); i++)
+  {
+    if(frustum.testBox(mins[i],maxs[i]) != Frustum::OUTSIDE)
+    {
+      expected.push_back(i);
+    }
+  }
+  EXPECT_NE(expected.size(),0);
+  EXPECT_LT(expected.size(),mins.size());
+  EXPECT_EQ(visible,expected);
+  for(size_t i : inside)
+  {
+    EXPECT_EQ(frustum.testBox(mins[i],maxs[i]),Frustum::INSIDE);
+  }
+}
+
+TEST(Frustum, nestedSpheresWithPlaneMask)
+{
+  float n = 1;
+  float f = 100;
+  ngl::Mat4 project(1, 0, 0,               0,
+                    0, 1, 0,               0,
+                    0, 0, (f+n)/(n-f),    -1,
+                    0, 0, 2*f*n/(n-f),     0);
+  Frustum frustum(project);
+
+  //a sphere across the right plane keeps only that plane in its mask
+  int planeMask = Frustum::m_allPlanes;
+  EXPECT_EQ(frustum.testSphere(ngl::Vec3(10,0,-10),2,planeMask),Frustum::INTERSECTING);
+  EXPECT_EQ(planeMask,1<<1);
+  //so a sphere nested in it is only tested against the right plane
+  int nestedMask = planeMask;
+  EXPECT_EQ(frustum.testSphere(ngl::Vec3(11.5f,0,-10),0.2f,nestedMask),Frustum::OUTSIDE);
+  nestedMask = planeMask;
+  EXPECT_EQ(frustum.testSphere(ngl::Vec3(8.5f,0,-10),0.2f,nestedMask),Frustum::INSIDE);
+  EXPECT_EQ(nestedMask,0);
+  //an empty mask tests nothing
+  nestedMask = 0;
+  EXPECT_EQ(frustum.testSphere(ngl::Vec3(0,0,500),1,nestedMask),Frustum::INSIDE);
+
+  //the default frustum culls nothing and lets the mask empty straight away
+  planeMask = Frustum::m_allPlanes;
+  EXPECT_EQ(Frustum().testSphere(ngl::Vec3(0,0,500),1,planeMask),Frustum::INSIDE);
+  EXPECT_TRUE(Frustum() == Frustum());
+  EXPECT_FALSE(frustum == Frustum());
+}
+
+TEST(Forest, findVisibleTransforms)
+{
+  std::shared_ptr<const LSystem> treeType = createTestTreeType();
+
+  //every vertex of each instance lies inside its bounding sphere
+  for(auto &ids : treeType->m_instanceCache)
+  {
+    for(auto &ages : ids)
+    {
+      for(auto &instance : ages)
+      {
+        for(size_t i=instance.m_instanceStart; i<instance.m_instanceEnd; i++)
+        {
+          ngl::Vec3 v = treeType->m_heroVertices[size_t(GLushort(treeType->m_heroIndices[i]))];
+          EXPECT_LE((v-instance.m_boundingCentre).length(),instance.m_boundingRadius+0.001f);
+        }
+      }
+    }
+  }
+
+  std::vector<size_t> numTrees = {200};
+  Forest forest({treeType},1000,numTrees,nullptr,3,true);
+  ASSERT_EQ(forest.m_treeBVH.size(),200);
+  for(auto &tree : forest.m_treeData)
+  {
+    EXPECT_LE(tree.m_boundsMin.m_x,tree.m_transform.m_30);
+    EXPECT_GE(tree.m_boundsMax.m_x,tree.m_transform.m_30);
+  }
+
+  //an orthographic view of the box x,z in [-250,250] keeps the trees in it and culls the rest
+  ngl::Mat4 view(1.0f/250, 0, 0,         0,
+                 0,        0, -1.0f/500, 0,
+                 0,        1.0f/250, 0,  0,
+                 0,        0, 0,         1);
+  Frustum frustum(view);
+  std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> visible;
+  forest.findVisibleTransforms(frustum,visible);
+  size_t numVisible = 0;
+  size_t numTotal = 0;
+  FOR_EACH_ELEMENT(visible[0], numVisible += visible[0][ID][AGE][INDEX].size())
+  FOR_EACH_ELEMENT(forest.m_transformCache[0], numTotal += forest.m_transformCache[0][ID][AGE][INDEX].size())
+  EXPECT_NE(numVisible,0);
+  EXPECT_LT(numVisible,numTotal);
+
+  //no tree well inside the view loses any transforms
+  for(size_t tree=0; tree<forest.m_treeData.size(); tree++)
+  {
+    const Forest::Tree &t = forest.m_treeData[tree];
+    if(t.m_boundsMin.m_x>-250 && t.m_boundsMax.m_x<250 && t.m_boundsMin.m_z>-250 && t.m_boundsMax.m_z<250)
+    {
+      for(auto &handle : forest.m_treeHandles[tree])
+      {
+        const Forest::CacheIndex &c = handle.m_cacheIndex;
+        const ngl::Mat4 &T = forest.m_transformCache[0][c.m_id][c.m_age][c.m_innerIndex][handle.m_position];
+        const std::vector<ngl::Mat4> &v = visible[0][c.m_id][c.m_age][c.m_innerIndex];
+        EXPECT_TRUE(std::find_if(v.begin(),v.end(),[&T](const ngl::Mat4 &_m)
+                                 {return _m.m_30==T.m_30 && _m.m_31==T.m_31 && _m.m_32==T.m_32;}) != v.end());
+      }
+    }
+  }
+
+  //the default frustum keeps everything, and calling again reuses the lists rather than appending to them
+  forest.findVisibleTransforms(Frustum(),visible);
+  numVisible = 0;
+  FOR_EACH_ELEMENT(visible[0], numVisible += visible[0][ID][AGE][INDEX].size())
+  EXPECT_EQ(numVisible,numTotal);
+}
+
+TEST(Forest, levelOfDetail)
+{
+  std::string axiom = "FFFA";
+  std::vector<std::string> rules = {"A=![B]////[B]////B", "B=FFFA"};
+  LSystem L(axiom,rules,4,0.9f,30,0.9f,3,1,1);
+  L.m_useSeed = true;
+  std::shared_ptr<const LSystem> treeType = SpeciesCache::createTreeType(L,2);
+
+  //the chain starts with every generation and drops generations at each level
+  ASSERT_GT(treeType->m_LODMaxAges.size(),0);
+  EXPECT_EQ(treeType->m_LODMaxAges[0],size_t(treeType->m_generation));
+  for(size_t i=1; i<treeType->m_LODMaxAges.size(); i++)
+  {
+    EXPECT_LT(treeType->m_LODMaxAges[i],treeType->m_LODMaxAges[i-1]);
+  }
+
+  //levels only change once a tree is past the hysteresis band around each distance
+  Forest::LODSettings lod;
+  lod.m_distances = {100,200};
+  lod.m_hysteresis = 0.1f;
+  EXPECT_EQ(Forest::chooseLOD(lod,50,SIZE_MAX),0);
+  EXPECT_EQ(Forest::chooseLOD(lod,150,SIZE_MAX),1);
+  EXPECT_EQ(Forest::chooseLOD(lod,250,SIZE_MAX),2);
+  EXPECT_EQ(Forest::chooseLOD(lod,105,0),0);
+  EXPECT_EQ(Forest::chooseLOD(lod,115,0),1);
+  EXPECT_EQ(Forest::chooseLOD(lod,95,1),1);
+  EXPECT_EQ(Forest::chooseLOD(lod,85,1),0);
+  EXPECT_EQ(Forest::chooseLOD(lod,250,0),2);
+
+  std::vector<size_t> numTrees = {100};
+  Forest forest({treeType},1000,numTrees,nullptr,3,true);
+  size_t numTotal = 0;
+  FOR_EACH_ELEMENT(forest.m_transformCache[0], numTotal += forest.m_transformCache[0][ID][AGE][INDEX].size())
+
+  //with the camera far away every tree is skeletal, so every slot draws its transforms with no detailed ones
+  std::vector<size_t> treeLODs;
+  std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> visible;
+  std::vector<CACHE_STRUCTURE(size_t)> numDetailed;
+  lod.m_cameraPosition = ngl::Vec3(0,100000,0);
+  forest.findVisibleTransforms(Frustum(),lod,treeLODs,visible,numDetailed);
+  ASSERT_EQ(treeLODs.size(),100);
+  size_t numVisible = 0;
+  FOR_EACH_ELEMENT(visible[0], numVisible += visible[0][ID][AGE][INDEX].size();
+                               EXPECT_EQ(numDetailed[0][ID][AGE][INDEX],0))
+  EXPECT_GT(numVisible,0);
+  EXPECT_LE(numVisible,numTotal);
+
+  //with the camera in the middle the near trees are detailed, and the detailed transforms come first in each slot
+  lod.m_cameraPosition = ngl::Vec3(0,0,0);
+  lod.m_distances = {300,400};
+  forest.findVisibleTransforms(Frustum(),lod,treeLODs,visible,numDetailed);
+  size_t totalDetailed = 0;
+  FOR_EACH_ELEMENT(visible[0], EXPECT_LE(numDetailed[0][ID][AGE][INDEX],visible[0][ID][AGE][INDEX].size());
+                               totalDetailed += numDetailed[0][ID][AGE][INDEX])
+  EXPECT_GT(totalDetailed,0);
+
+  //a change budget stops more than that many trees changing level in one update
+  lod.m_cameraPosition = ngl::Vec3(0,100000,0);
+  lod.m_maxChangesPerUpdate = 5;
+  std::vector<size_t> oldLODs = treeLODs;
+  forest.findVisibleTransforms(Frustum(),lod,treeLODs,visible,numDetailed);
+  size_t numChanged = 0;
+  for(size_t i=0; i<treeLODs.size(); i++)
+  {
+    numChanged += (treeLODs[i]!=oldLODs[i]);
+  }
+  EXPECT_LE(numChanged,5);
+}
+
+TEST(MeshSimplifier, simplifyBakedTree)
+{
+  std::string axiom = "FFFA";
+  std::vector<std::string> rules = {"A=![BJ]////[BJ]////BJ", "B=&FFFA"};
+  LSystem L(axiom,rules,2,0.9f,30,0.9f,1,0.7f,4);
+  L.m_useSeed = true;
+  //the simplified meshes are only baked when asked for
+  EXPECT_EQ(SpeciesCache::createTreeType(L,2)->m_simplifiedMeshes.size(),0);
+  L.m_bakeSimplifiedMeshes = true;
+  std::shared_ptr<const LSystem> treeType = SpeciesCache::createTreeType(L,2);
+
+  //every instance gets its own range of whole triangles, with a tube around each of its branch segments and a card
+  //for each of its leaves
+  MeshSimplifier simplifier;
+  MeshSimplifier::Mesh mesh = simplifier.bakeTree(*treeType,0);
+  ASSERT_EQ(mesh.m_instanceRanges.size(),treeType->m_instanceCache.size());
+  FOR_EACH_ELEMENT(treeType->m_instanceCache,
+                   const Instance &instance = treeType->m_instanceCache[ID][AGE][INDEX];
+                   const MeshSimplifier::Range &range = mesh.m_instanceRanges[ID][AGE][INDEX];
+                   EXPECT_EQ(range.m_start%3,0);
+                   EXPECT_EQ(range.m_end-range.m_start,
+                             3*simplifier.m_numSides*(instance.m_instanceEnd-instance.m_instanceStart) +
+                             6*(instance.m_instanceLeafEnd-instance.m_instanceLeafStart) +
+                             instance.m_instancePolygonEnd-instance.m_instancePolygonStart))
+  EXPECT_GT(mesh.getNumTriangles(),0);
+
+  //the precomputed meshes meet their budgets and keep every instance range inside their buffers
+  ASSERT_EQ(treeType->m_simplifiedMeshes.size(),3);
+  size_t lastSize = mesh.getNumTriangles();
+  for(size_t i=0; i<treeType->m_simplifiedMeshes.size(); i++)
+  {
+    const MeshSimplifier::Mesh &simplified = treeType->m_simplifiedMeshes[i];
+    EXPECT_LT(simplified.getNumTriangles(),lastSize);
+    EXPECT_LE(simplified.getNumTriangles(),
+              size_t(treeType->m_simplificationFractions[i]*mesh.getNumTriangles())+1);
+    lastSize = simplified.getNumTriangles();
+    MeshSimplifier::Mesh lod;
+    EXPECT_TRUE(simplifier.buildLOD(*treeType,treeType->m_simplificationFractions[i],lod));
+    EXPECT_EQ(lod.getNumTriangles(),simplified.getNumTriangles());
+    for(auto index : simplified.m_indices)
+    {
+      EXPECT_LT(index,simplified.m_vertices.size());
+    }
+    FOR_EACH_ELEMENT(simplified.m_instanceRanges,
+                     EXPECT_LE(simplified.m_instanceRanges[ID][AGE][INDEX].m_start,
+                               simplified.m_instanceRanges[ID][AGE][INDEX].m_end);
+                     EXPECT_LE(simplified.m_instanceRanges[ID][AGE][INDEX].m_end,simplified.m_indices.size()))
+  }
+
+  //leaf cards are never collapsed away, so an empty budget can't be met and is reported
+  MeshSimplifier::Mesh lod;
+  EXPECT_FALSE(simplifier.buildLOD(*treeType,0,lod));
+  EXPECT_GT(lod.getNumTriangles(),0);
+
+  //two overlapping leaves become one larger card, and a leaf further away is left alone
+  std::vector<MeshSimplifier::LeafCard> leaves = {{ngl::Vec3(0.1f,0.1f,0.1f),ngl::Vec3(0,1,0),ngl::Vec3(1,0,0)},
+                                                  {ngl::Vec3(0.3f,0.2f,0.1f),ngl::Vec3(0,1,0),ngl::Vec3(1,0,0)},
+                                                  {ngl::Vec3(5,0,0),ngl::Vec3(0,1,0),ngl::Vec3(1,0,0)}};
+  std::vector<MeshSimplifier::LeafCard> cards = MeshSimplifier::clusterLeaves(leaves,1);
+  ASSERT_EQ(cards.size(),2);
+  EXPECT_FLOAT_EQ(cards[0].m_position.m_x,0.2f);
+  EXPECT_FLOAT_EQ(cards[0].m_direction.length(),sqrtf(2));
+  EXPECT_FLOAT_EQ(cards[0].m_right.length(),sqrtf(2));
+  EXPECT_FLOAT_EQ(cards[1].m_position.m_x,5);
+  EXPECT_FLOAT_EQ(cards[1].m_direction.length(),1);
+}
+
+TEST(ForestDrawBatch, buildCommandLists)
+{
+  std::vector<std::string> rules = {"A=![B]////[B]////B", "B=FFFA"};
+  LSystem L1("FFFA",rules,4,0.9f,30,0.9f,3,1,1);
+  LSystem L2("FA",rules,3,0.9f,30,0.9f,3,1,1);
+  L1.m_useSeed = true;
+  L2.m_useSeed = true;
+  std::vector<std::shared_ptr<const LSystem>> treeTypes = {SpeciesCache::createTreeType(L1,2),
+                                                           SpeciesCache::createTreeType(L2,2)};
+  std::vector<size_t> numTrees = {60,40};
+  Forest forest(treeTypes,1000,numTrees,nullptr,3,true);
+
+  //the tree types are laid out one after another in the combined buffers
+  ForestDrawBatch batch;
+  batch.setTreeTypes(treeTypes);
+  ASSERT_EQ(batch.m_branchOffsets.size(),2);
+  EXPECT_EQ(batch.m_branchOffsets[0].m_baseVertex,0);
+  EXPECT_EQ(batch.m_branchOffsets[1].m_baseVertex,treeTypes[0]->m_heroVertices.size());
+  EXPECT_EQ(batch.m_branchOffsets[1].m_firstIndex,treeTypes[0]->m_heroIndices.size());
+  EXPECT_EQ(batch.m_leafOffsets[1].m_firstIndex,treeTypes[0]->m_heroLeafIndices.size());
+  EXPECT_EQ(batch.m_branchTotals.m_firstIndex,
+            treeTypes[0]->m_heroIndices.size()+treeTypes[1]->m_heroIndices.size());
+
+  //every transform is drawn once by the branch pass, and slots with no transforms get no commands
+  batch.build(forest.m_transformCache);
+  size_t numTransforms = 0;
+  size_t numFilledSlots = 0;
+  for(size_t t=0; t<2; t++)
+  {
+    FOR_EACH_ELEMENT(forest.m_transformCache[t],
+                     numTransforms += forest.m_transformCache[t][ID][AGE][INDEX].size();
+                     numFilledSlots += forest.m_transformCache[t][ID][AGE][INDEX].size()>0 ? 1 : 0)
+  }
+  EXPECT_GT(numTransforms,0);
+  EXPECT_EQ(batch.m_transforms.size(),numTransforms);
+  EXPECT_LE(batch.m_branchCommands.size(),numFilledSlots);
+  EXPECT_EQ(batch.m_skeletalCommands.size(),0);
+  size_t numInstances = 0;
+  for(auto &command : batch.m_branchCommands)
+  {
+    EXPECT_GT(command.m_count,0);
+    EXPECT_GT(command.m_instanceCount,0);
+    EXPECT_LE(command.m_baseInstance+command.m_instanceCount,numTransforms);
+    EXPECT_LE(command.m_firstIndex+command.m_count,batch.m_branchTotals.m_firstIndex);
+    numInstances += command.m_instanceCount;
+  }
+  EXPECT_LE(numInstances,numTransforms);
+
+  //the first command draws the first non-empty instance of the first tree type from the start of the transforms
+  ASSERT_GT(batch.m_branchCommands.size(),0);
+  EXPECT_EQ(batch.m_branchCommands[0].m_baseInstance,0);
+  EXPECT_EQ(batch.m_branchCommands[0].m_baseVertex,0);
+  EXPECT_EQ(batch.m_branchCommands.back().m_baseVertex,GLint(treeTypes[0]->m_heroVertices.size()));
+
+  //with LOD the skeletal transforms of each slot follow its detailed ones
+  Forest::LODSettings lod;
+  lod.m_distances = {300,400};
+  std::vector<size_t> treeLODs;
+  std::vector<CACHE_STRUCTURE(std::vector<ngl::Mat4>)> visible;
+  std::vector<CACHE_STRUCTURE(size_t)> numDetailed;
+  forest.findVisibleTransforms(Frustum(),lod,treeLODs,visible,numDetailed);
+  batch.build(visible,numDetailed);
+  size_t numDetailedInstances = 0;
+  size_t numSkeletalInstances = 0;
+  for(size_t t=0; t<2; t++)
+  {
+    FOR_EACH_ELEMENT(visible[t],
+                     numDetailedInstances += numDetailed[t][ID][AGE][INDEX];
+                     numSkeletalInstances += visible[t][ID][AGE][INDEX].size()-numDetailed[t][ID][AGE][INDEX])
+  }
+  EXPECT_GT(numSkeletalInstances,0);
+  size_t numSkeletalDrawn = 0;
+  for(auto &command : batch.m_skeletalCommands)
+  {
+    EXPECT_LE(command.m_baseInstance+command.m_instanceCount,batch.m_transforms.size());
+    numSkeletalDrawn += command.m_instanceCount;
+  }
+  EXPECT_LE(numSkeletalDrawn,numSkeletalInstances);
+  for(auto &command : batch.m_branchCommands)
+  {
+    EXPECT_LE(command.m_instanceCount,numDetailedInstances);
+  }
+
+  batch.clear();
+  EXPECT_EQ(batch.m_branchCommands.size(),0);
+  EXPECT_EQ(batch.m_transforms.size(),0);
+}
+
+TEST(PerlinNoise, rowMatchesValue)
+{
+  //random unit gradients, scaled as libnoise scales them
+  PerlinNoise noise;
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<float> dist(-1,1);
+  for(size_t i=0; i<256; i++)
+  {
+    ngl::Vec3 gradient(dist(gen),dist(gen),dist(gen)+2.0f);
+    gradient.normalize();
+    noise.m_gradients[3*i] = gradient.m_x*2.12f;
+    noise.m_gradients[3*i+1] = gradient.m_y*2.12f;
+    noise.m_gradients[3*i+2] = gradient.m_z*2.12f;
+  }
+
+  //gradient noise is zero at the lattice points
+  noise.m_octaves = 1;
+  EXPECT_DOUBLE_EQ(noise.getValue(3,-4,5),0.0);
+  EXPECT_NE(noise.getValue(3.5,-4.25,5.1),0.0);
+
+  //rows match single values everywhere, including across zero and at rows whose length isn't a multiple of 4
+  noise.m_octaves = 3;
+  noise.m_frequency = 0.05;
+  noise.m_persistence = 0.8;
+  noise.m_lacunarity = 0.5;
+  std::vector<float> row(103);
+  for(double z : {-31.7, 0.0, 12.25})
+  {
+    noise.getRow(-50.0, 0.97, 0.3*z, z, row.size(), row.data());
+    for(size_t i=0; i<row.size(); i++)
+    {
+      EXPECT_NEAR(row[i], noise.getValue(-50.0+0.97*i, 0.3*z, z), PerlinNoise::m_tolerance);
+    }
+  }
+}
+
+TEST(PerlinNoise, matchesLibnoise)
+{
+  //the gradients are read back from libnoise, so the rows should match the libnoise Perlin module itself
+  PerlinNoise noise;
+  noise.m_gradients = TerrainGenerator::getPerlinGradients();
+  noise::module::Perlin perlin;
+
+  struct Settings {int octaves; double frequency; double persistence; double lacunarity; int seed;};
+  std::vector<Settings> settings = {{1, 1,    0.5,  2,    0},
+                                    {6, 1,    0.5,  2,    0},
+                                    {8, 0.03, 0.6,  2.2,  0},
+                                    {3, 4.5,  0.25, 1.75, 5}};
+  std::vector<float> row(67);
+  for(auto &setting : settings)
+  {
+    noise.m_octaves = setting.octaves;
+    noise.m_frequency = setting.frequency;
+    noise.m_persistence = setting.persistence;
+    noise.m_lacunarity = setting.lacunarity;
+    noise.m_seed = setting.seed;
+    perlin.SetOctaveCount(setting.octaves);
+    perlin.SetFrequency(setting.frequency);
+    perlin.SetPersistence(setting.persistence);
+    perlin.SetLacunarity(setting.lacunarity);
+    perlin.SetSeed(setting.seed);
+    for(double z : {-13.3, 0.0, 2.71})
+    {
+      noise.getRow(-20.0, 0.61, 0.5*z, z, row.size(), row.data());
+      for(size_t i=0; i<row.size(); i++)
+      {
+        EXPECT_LE(std::abs(row[i]-perlin.GetValue(-20.0+0.61*i, 0.5*z, z)), PerlinNoise::m_tolerance);
+      }
+    }
+  }
+}
+
+TEST(TerrainGenerator, fileRoundTrips)
+{
+  //heights from -2 to 2 on a 33x33 grid two units apart
+  TerrainGenerator terrainGen = createTestTerrain(33);
+  terrainGen.m_amplitude = 7;
+  std::string rawFile = "TerrainGeneratorTest.raw";
+  std::string pgmFile = "TerrainGeneratorTest.pgm";
+  std::string terrainFile = "TerrainGeneratorTest.terrain";
+  ASSERT_TRUE(terrainGen.saveRaw(rawFile,-2,2));
+  ASSERT_TRUE(terrainGen.savePGM(pgmFile,-2,2));
+  ASSERT_TRUE(terrainGen.saveTerrain(terrainFile));
+
+  //16-bit heightmaps give the heights back to within half a step, on a grid of the same worldspace width, and take
+  //their amplitude from the range they were loaded with
+  TerrainGenerator rawTerrain(9,66);
+  ASSERT_TRUE(rawTerrain.loadRaw(rawFile,-2,2));
+  EXPECT_EQ(rawTerrain.m_dimension,33);
+  EXPECT_FLOAT_EQ(rawTerrain.m_scale,2);
+  EXPECT_FLOAT_EQ(rawTerrain.m_amplitude,2);
+  ASSERT_EQ(rawTerrain.m_heightMap.size(),terrainGen.m_heightMap.size());
+  for(size_t i=0; i<terrainGen.m_heightMap.size(); i++)
+  {
+    EXPECT_NEAR(rawTerrain.m_heightMap[i],terrainGen.m_heightMap[i],2.0f/65535);
+  }
+  EXPECT_EQ(rawTerrain.m_normals.size(),terrainGen.m_heightMap.size());
+
+  //the same values in a PGM give the same terrain
+  TerrainGenerator pgmTerrain(9,66);
+  ASSERT_TRUE(pgmTerrain.loadPGM(pgmFile,-2,2));
+  EXPECT_EQ(pgmTerrain.m_dimension,33);
+  EXPECT_FLOAT_EQ(pgmTerrain.m_amplitude,2);
+  EXPECT_EQ(pgmTerrain.m_heightMap,rawTerrain.m_heightMap);
+  for(size_t i=0; i<rawTerrain.m_normals.size(); i++)
+  {
+    EXPECT_EQ(pgmTerrain.m_normals[i],rawTerrain.m_normals[i]);
+    EXPECT_EQ(pgmTerrain.m_tangents[i],rawTerrain.m_tangents[i]);
+    EXPECT_EQ(pgmTerrain.m_bitangents[i],rawTerrain.m_bitangents[i]);
+  }
+
+  //a terrain file gives everything back exactly
+  TerrainGenerator loadedTerrain(9,66);
+  ASSERT_TRUE(loadedTerrain.loadTerrain(terrainFile));
+  EXPECT_EQ(loadedTerrain.m_dimension,33);
+  EXPECT_FLOAT_EQ(loadedTerrain.m_scale,2);
+  EXPECT_FLOAT_EQ(loadedTerrain.m_amplitude,7);
+  EXPECT_EQ(loadedTerrain.m_heightMap,terrainGen.m_heightMap);
+  ASSERT_EQ(loadedTerrain.m_normals.size(),terrainGen.m_normals.size());
+  for(size_t i=0; i<terrainGen.m_normals.size(); i++)
+  {
+    EXPECT_EQ(loadedTerrain.m_normals[i],terrainGen.m_normals[i]);
+    EXPECT_EQ(loadedTerrain.m_tangents[i],terrainGen.m_tangents[i]);
+    EXPECT_EQ(loadedTerrain.m_bitangents[i],terrainGen.m_bitangents[i]);
+  }
+
+  //a file of the wrong kind is turned down without touching the terrain
+  EXPECT_FALSE(loadedTerrain.loadTerrain(rawFile));
+  EXPECT_FALSE(loadedTerrain.loadPGM(rawFile,-2,2));
+  EXPECT_EQ(loadedTerrain.m_heightMap,terrainGen.m_heightMap);
+
+  std::remove(rawFile.c_str());
+  std::remove(pgmFile.c_str());
+  std::remove(terrainFile.c_str());
+}
+
+TEST(TerrainGenerator, updateAmplitude)
+{
+  //an amplitude edit rescales the generated heights, giving those a new generate() would
+  TerrainGenerator terrainGen(33,66);
+  terrainGen.m_frequency = 0.05;
+  terrainGen.generate();
+  terrainGen.m_amplitude = 20;
+  EXPECT_EQ(terrainGen.getChange(),TerrainGenerator::AMPLITUDE_CHANGE);
+  EXPECT_EQ(terrainGen.update(),TerrainGenerator::AMPLITUDE_CHANGE);
+  EXPECT_EQ(terrainGen.getChange(),TerrainGenerator::NO_CHANGE);
+  TerrainGenerator generated(33,66);
+  generated.m_frequency = 0.05;
+  generated.m_amplitude = 20;
+  generated.generate();
+  ASSERT_EQ(terrainGen.m_heightMap.size(),generated.m_heightMap.size());
+  for(size_t i=0; i<generated.m_heightMap.size(); i++)
+  {
+    EXPECT_NEAR(terrainGen.m_heightMap[i],generated.m_heightMap[i],1e-4f);
+    EXPECT_EQ(terrainGen.m_normals[i],generated.m_normals[i]);
+  }
+
+  //an imported heightmap is rescaled in the same way rather than replaced by noise
+  std::string rawFile = "TerrainGeneratorAmplitudeTest.raw";
+  ASSERT_TRUE(generated.saveRaw(rawFile,-20,20));
+  TerrainGenerator loaded(33,66);
+  ASSERT_TRUE(loaded.loadRaw(rawFile,-20,20));
+  std::remove(rawFile.c_str());
+  EXPECT_EQ(loaded.getChange(),TerrainGenerator::NO_CHANGE);
+  std::vector<float> loadedHeights = loaded.m_heightMap;
+  loaded.m_amplitude = 5;
+  EXPECT_EQ(loaded.update(),TerrainGenerator::AMPLITUDE_CHANGE);
+  for(size_t i=0; i<loadedHeights.size(); i++)
+  {
+    EXPECT_NEAR(loaded.m_heightMap[i],loadedHeights[i]*0.25f,1e-5f);
+  }
+  loaded.m_seed = 3;
+  EXPECT_EQ(loaded.getChange(),TerrainGenerator::NOISE_CHANGE);
+
+  //the pages hold the noise at an amplitude of 1, so an amplitude edit leaves every tile as it is
+  std::string pageFile = "TerrainGeneratorAmplitudeTest.pages";
+  PagedHeightMap pages;
+  ASSERT_TRUE(generated.generatePaged(pages,pageFile));
+  generated.m_amplitude = 35;
+  uint64_t stamp = generated.getStamp();
+  ASSERT_TRUE(generated.generatePaged(pages,pageFile));
+  EXPECT_EQ(generated.getStamp(),stamp);
+  EXPECT_EQ(pages.generateStaleTiles(),0);
+  TerrainGenerator paged(33,66);
+  paged.m_amplitude = 35;
+  paged.loadFromPages(pages,1);
+  generated.generate();
+  for(size_t i=0; i<generated.m_heightMap.size(); i++)
+  {
+    EXPECT_NEAR(paged.m_heightMap[i],generated.m_heightMap[i],1e-4f);
+  }
+  pages.close();
+  std::remove(pageFile.c_str());
+}
+
+TEST(PagedHeightMap, generateAndPageTiles)
+{
+  //a 33x33 grid of 8x8 tiles, whose value at (x,z) is x+100z plus an offset that changes with the settings
+  std::string fileName = "PagedHeightMapTest.pages";
+  std::shared_ptr<PagedHeightMap> pages = std::make_shared<PagedHeightMap>();
+  ASSERT_TRUE(pages->create(fileName,33,2.0f,8));
+  EXPECT_EQ(pages->getNumTilesPerSide(),5);
+  std::atomic<size_t> numGenerated(0);
+  float offset = 0;
+  pages->m_generateTile = [&](size_t _firstX, size_t _firstZ, size_t _width, size_t _depth, size_t _rowLength,
+                              float *_heights)
+  {
+    numGenerated++;
+    for(size_t z=0; z<_depth; z++)
+    {
+      for(size_t x=0; x<_width; x++)
+      {
+        _heights[z*_rowLength+x] = float(_firstX+x) + 100*float(_firstZ+z) + offset;
+      }
+    }
+  };
+  pages->m_maxCachedTiles = 4;
+
+  EXPECT_EQ(pages->generateStaleTiles(),25);
+  EXPECT_EQ(numGenerated,25);
+  EXPECT_EQ(pages->generateStaleTiles(),0);
+  EXPECT_FLOAT_EQ(pages->getValue(0,0),0);
+  EXPECT_FLOAT_EQ(pages->getValue(32,32),3232);
+  EXPECT_FLOAT_EQ(pages->getValue(9,17),1709);
+  EXPECT_FLOAT_EQ(pages->getTileInfo(4,4).m_maxHeight,3232);
+  EXPECT_FLOAT_EQ(pages->getTileInfo(1,2).m_minHeight,1608);
+
+  //every 4th value, read across every tile with no more than 4 of them mapped at once
+  std::vector<float> region(9*9);
+  pages->readRegion(0,0,9,9,4,region.data());
+  for(size_t z=0; z<9; z++)
+  {
+    for(size_t x=0; x<9; x++)
+    {
+      EXPECT_FLOAT_EQ(region[z*9+x],float(4*x+400*z));
+    }
+  }
+  EXPECT_LE(pages->getNumCachedTiles(),4);
+
+  //the paged height query matches one over the same values in memory
+  std::vector<float> heightMap(33*33);
+  for(size_t i=0; i<heightMap.size(); i++)
+  {
+    heightMap[i] = float(i%33) + 100*float(i/33);
+  }
+  TerrainHeightQuery terrainHeights(heightMap,33,2.0f,1);
+  TerrainHeightQuery pagedHeights(pages,1);
+  EXPECT_FLOAT_EQ(pagedHeights.m_minHeight,terrainHeights.m_minHeight);
+  EXPECT_FLOAT_EQ(pagedHeights.m_maxHeight,terrainHeights.m_maxHeight);
+  for(float x : {-40.0f, -13.7f, 0.0f, 5.5f, 31.9f})
+  {
+    EXPECT_FLOAT_EQ(pagedHeights.getHeight(x,0.7f*x+3),terrainHeights.getHeight(x,0.7f*x+3));
+  }
+
+  //several values read at once, across tiles and off the edge of the grid
+  std::vector<size_t> valueX = {0, 9, 32, 9, 33, 1};
+  std::vector<size_t> valueZ = {0, 17, 32, 17, 0, 1};
+  std::vector<float> values(valueX.size());
+  pages->getValues(valueX.data(),valueZ.data(),values.data(),values.size());
+  std::vector<float> expectedValues = {0, 1709, 3232, 1709, 0, 101};
+  EXPECT_EQ(values,expectedValues);
+
+  //and the batched heights, which read more positions than fit in one block
+  std::vector<float> xs(150);
+  std::vector<float> zs(150);
+  for(size_t i=0; i<xs.size(); i++)
+  {
+    xs[i] = -40.0f + 0.6f*float(i);
+    zs[i] = 35.0f - 0.45f*float(i%77);
+  }
+  std::vector<float> pagedBatch(xs.size());
+  pagedHeights.getHeights(xs.data(),zs.data(),pagedBatch.data(),xs.size());
+  for(size_t i=0; i<xs.size(); i++)
+  {
+    EXPECT_FLOAT_EQ(pagedBatch[i],terrainHeights.getHeight(xs[i],zs[i]));
+  }
+  EXPECT_LE(pages->getNumCachedTiles(),4);
+
+  //reading a stale tile doesn't generate it again - that is left to generateStaleTiles()
+  offset = 0.5f;
+  pages->m_stamp = 2;
+  numGenerated = 0;
+  EXPECT_FLOAT_EQ(pages->getValue(20,3),320);
+  EXPECT_EQ(numGenerated,0);
+  EXPECT_EQ(pages->getTileInfo(2,0).m_stamp,1);
+  pages->readRegion(0,0,9,9,4,region.data());
+  EXPECT_EQ(numGenerated,0);
+  EXPECT_EQ(pages->generateStaleTiles(),25);
+  EXPECT_EQ(numGenerated,25);
+  EXPECT_FLOAT_EQ(pages->getValue(20,3),320.5f);
+  EXPECT_EQ(pages->getTileInfo(2,0).m_stamp,2);
+
+  //the tiles and their stamps are kept in the file
+  pages->close();
+  ASSERT_TRUE(pages->open(fileName));
+  EXPECT_EQ(pages->m_dimension,33);
+  EXPECT_FLOAT_EQ(pages->m_scale,2.0f);
+  EXPECT_FLOAT_EQ(pages->getValue(20,3),320.5f);
+  EXPECT_FLOAT_EQ(pages->getValue(32,32),3232.5f);
+  EXPECT_EQ(pages->getTileInfo(3,0).m_stamp,2);
+  EXPECT_EQ(numGenerated,25);
+  pages->close();
+  std::remove(fileName.c_str());
+}
+
+TEST(PagedHeightMap, intersectRay)
+{
+  //the same bumpy heightmap paged with tiles smaller than, not a power of two and larger than the grid, for the
+  //quadtree levels made from the tiles' ranges and those built a block at a time
+  std::string fileName = "PagedHeightMapRayTest.pages";
+  const size_t dimension = 45;
+  auto value = [](size_t _x, size_t _z)
+  {
+    return std::sin(0.37f*float(_x))*std::cos(0.23f*float(_z)) + 0.01f*float((_x*7919+_z*104729)%97);
+  };
+  for(float amplitude : {6.0f, -4.0f})
+  {
+    std::vector<float> heightMap(dimension*dimension);
+    for(size_t i=0; i<heightMap.size(); i++)
+    {
+      heightMap[i] = value(i%dimension,i/dimension)*amplitude;
+    }
+    TerrainHeightQuery terrainHeights(heightMap,int(dimension),2.0f,amplitude);
+    for(size_t tileSize : {1, 6, 8, 64})
+    {
+      std::shared_ptr<PagedHeightMap> pages = std::make_shared<PagedHeightMap>();
+      ASSERT_TRUE(pages->create(fileName,dimension,2.0f,tileSize));
+      pages->m_generateTile = [&](size_t _firstX, size_t _firstZ, size_t _width, size_t _depth, size_t _rowLength,
+                                  float *_heights)
+      {
+        for(size_t z=0; z<_depth; z++)
+        {
+          for(size_t x=0; x<_width; x++)
+          {
+            _heights[z*_rowLength+x] = value(_firstX+x,_firstZ+z);
+          }
+        }
+      };
+      pages->m_maxCachedTiles = 2;
+      pages->generateStaleTiles();
+      TerrainHeightQuery pagedHeights(pages,amplitude);
+
+      //rays from all around, steep and shallow, some of which miss
+      for(int i=0; i<60; i++)
+      {
+        float angle = 0.41f*float(i);
+        ngl::Vec3 origin(60*std::cos(angle), 8.0f+0.2f*float(i%13), 60*std::sin(angle));
+        ngl::Vec3 direction(-std::cos(angle)+0.05f*float(i%7), -0.05f-0.02f*float(i%11), -std::sin(angle));
+        ngl::Vec3 hit;
+        ngl::Vec3 pagedHit;
+        bool isHit = terrainHeights.intersectRay(origin,direction,hit);
+        ASSERT_EQ(pagedHeights.intersectRay(origin,direction,pagedHit),isHit);
+        if(isHit)
+        {
+          EXPECT_NEAR(pagedHit.m_x,hit.m_x,1e-3f);
+          EXPECT_NEAR(pagedHit.m_y,hit.m_y,1e-3f);
+          EXPECT_NEAR(pagedHit.m_z,hit.m_z,1e-3f);
+        }
+      }
+      EXPECT_LE(pages->getNumCachedTiles(),2);
+      pages->close();
+    }
+  }
+  std::remove(fileName.c_str());
+}
+
+TEST(MappedFile, mapWholeFile)
+{
+  std::string fileName = "MappedFileTest.bin";
+  std::vector<unsigned char> bytes(70000);
+  for(size_t i=0; i<bytes.size(); i++)
+  {
+    bytes[i] = static_cast<unsigned char>((i*31)%251);
+  }
+  std::ofstream(fileName, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), long(bytes.size()));
+
+  MappedFile file;
+  ASSERT_TRUE(file.open(fileName));
+  ASSERT_EQ(file.getSize(),bytes.size());
+  EXPECT_TRUE(std::equal(bytes.begin(),bytes.end(),file.getData()));
+  file.close();
+  EXPECT_EQ(file.getData(),nullptr);
+  EXPECT_EQ(file.getSize(),0);
+
+  //an empty file opens with no data, and a missing one doesn't open
+  std::ofstream(fileName, std::ios::binary | std::ios::trunc);
+  EXPECT_TRUE(file.open(fileName));
+  EXPECT_EQ(file.getSize(),0);
+  EXPECT_EQ(file.getData(),nullptr);
+  std::remove(fileName.c_str());
+  EXPECT_FALSE(file.open(fileName));
+}
+
+TEST(TerrainData, budgetedRefinement)
+{
+  TerrainGenerator terrainGen = createTestTerrain(129);
+  TerrainData budgeted(terrainGen);
+  TerrainData reference(terrainGen);
+  budgeted.m_parallelRefinement = false;
+  reference.m_parallelRefinement = false;
+
+  //the first refinement is never budgeted, so the rest are each spread over several calls
+  std::vector<ngl::Vec3> cameras = {{0,20,0}, {-60,8,40}, {100,30,-90}, {10,4,12}};
+  size_t maxCalls = 0;
+  for(auto &camera : cameras)
+  {
+    size_t numCalls = 1;
+    while(budgeted.updateRefinement(camera,0.5f,1,1e-6) == false)
+    {
+      numCalls++;
+    }
+    maxCalls = std::max(maxCalls, numCalls);
+    reference.meshRefine(camera,0.5f,1);
+    EXPECT_EQ(budgeted.m_indices,reference.m_indices);
+  }
+  EXPECT_GT(maxCalls,1);
+}
+
+TEST(TerrainData, vertexRadiiAndDeltas)
+{
+  TerrainGenerator terrainGen = createTestTerrain(9);
+  TerrainData terrain(terrainGen);
+  ASSERT_EQ(terrain.m_vertices.size(),109);
+
+  //every vertex sits at the scene position of its heightmap point - the slots of children that would be off the
+  //edge of the grid are never filled, and are left at heightmap index 0 like the NW corner, vertex 3
+  std::vector<int> timesFilled(81,0);
+  for(size_t i=0; i<terrain.m_vertices.size(); i++)
+  {
+    const TerrainData::Vertex &vertex = terrain.m_vertices[i];
+    size_t heightMapIndex = terrain.m_heightMapIndices[i];
+    if(heightMapIndex==0 && i!=3)
+    {
+      continue;
+    }
+    timesFilled[heightMapIndex]++;
+    EXPECT_EQ(vertex.sceneX,float(int(heightMapIndex%9)-4)*2);
+    EXPECT_EQ(vertex.sceneY,float(int(heightMapIndex/9)-4)*2);
+    EXPECT_EQ(vertex.sceneZ,terrainGen.m_heightMap[heightMapIndex]);
+  }
+  //which is once for every point of the heightmap
+  EXPECT_EQ(timesFilled,std::vector<int>(81,1));
+
+  //the corners, then the centre, the middle of each edge and the first level of quadtree children, with the values
+  //the original unpacked layout gave for the same heightmap
+  std::vector<std::vector<float>> expected = {{-8,  8, -0.5f,  0,          0},
+                                              { 8,  8, -0.25f, 0,          0},
+                                              { 8, -8, -0.75f, 0,          0},
+                                              {-8, -8, -2,     0,          0},
+                                              { 0,  0,  2,     27.928520f, 7},
+                                              {-8,  0, -1.25f, 19.293562f, 7},
+                                              { 0,  8, -1.75f, 18.620329f, 7},
+                                              { 8,  0, -0.5f,  19.085629f, 7},
+                                              { 0, -8,  1.5f,  19.234528f, 7},
+                                              {-4,  4, -1.25f, 11.979083f, 7},
+                                              { 4,  4, -1,     12.913973f, 7},
+                                              { 4, -4,  0.75f, 13.292315f, 7},
+                                              {-4, -4,  0.25f, 13.441212f, 6.5f},
+                                              {-8, -4,  0.5f,  6.8071137f, 4.25f},
+                                              {-4,  0, -0.5f,  7.6736984f, 6.5f},
+                                              {-8,  4,  1.25f, 6.3265429f, 6.5f}};
+  for(size_t i=0; i<expected.size(); i++)
+  {
+    const TerrainData::Vertex &vertex = terrain.m_vertices[i];
+    EXPECT_EQ(vertex.sceneX,expected[i][0]);
+    EXPECT_EQ(vertex.sceneY,expected[i][1]);
+    EXPECT_EQ(vertex.sceneZ,expected[i][2]);
+    EXPECT_NEAR(vertex.radius,expected[i][3],1e-4f);
+    EXPECT_NEAR(vertex.augmentedDelta,expected[i][4],1e-4f);
+  }
+}
+
+TEST(TerrainData, refinedStrip)
+{
+  TerrainGenerator terrainGen = createTestTerrain(9);
+  TerrainData terrain(terrainGen);
+
+  //the strips the original single threaded construction and recursive refinement gave, as vertex positions
+  std::vector<ngl::Vec3> cameras = {{20,2,1}, {8,10,-8}};
+  std::vector<std::vector<ngl::Vec3>> expected =
+  {
+    {{-8,8,-0.5f}, {-8,8,-0.5f}, {0,0,2}, {8,8,-0.25f}, {0,0,2}, {8,0,-0.5f}, {0,0,2}, {8,-8,-0.75f}, {0,0,2},
+     {-8,-8,-2}, {-8,8,-0.5f}},
+    {{-8,8,-0.5f}, {-8,8,-0.5f}, {-8,8,-0.5f}, {0,8,-1.75f}, {0,0,2}, {0,8,-1.75f}, {4,4,-1}, {8,8,-0.25f}, {4,4,-1},
+     {8,0,-0.5f}, {0,0,2}, {8,-8,-0.75f}, {0,0,2}, {-8,-8,-2}, {0,0,2}, {-8,0,-1.25f}, {-8,8,-0.5f}}
+  };
+  for(size_t i=0; i<cameras.size(); i++)
+  {
+    terrain.meshRefine(cameras[i],8,1);
+    ASSERT_EQ(terrain.m_indices.size(),expected[i].size());
+    for(size_t j=0; j<expected[i].size(); j++)
+    {
+      const TerrainData::Vertex &vertex = terrain.m_vertices[terrain.m_indices[j]];
+      EXPECT_EQ(ngl::Vec3(vertex.sceneX,vertex.sceneY,vertex.sceneZ),expected[i][j]);
+    }
+  }
+
+  //the quadtrees are filled on their own threads, which must not change the result
+  TerrainGenerator largeTerrainGen = createTestTerrain(65);
+  TerrainData first(largeTerrainGen);
+  TerrainData second(largeTerrainGen);
+  ASSERT_EQ(first.m_vertices.size(),second.m_vertices.size());
+  EXPECT_EQ(first.m_heightMapIndices,second.m_heightMapIndices);
+  for(size_t i=0; i<first.m_vertices.size(); i++)
+  {
+    EXPECT_EQ(first.m_vertices[i].radius,second.m_vertices[i].radius);
+    EXPECT_EQ(first.m_vertices[i].augmentedDelta,second.m_vertices[i].augmentedDelta);
+  }
+}
+
+TEST(TerrainData, parallelRefinement)
+{
+  TerrainGenerator terrainGen = createTestTerrain(129);
+  TerrainData parallel(terrainGen);
+  TerrainData serial(terrainGen);
+  parallel.m_parallelRefinement = true;
+  serial.m_parallelRefinement = false;
+
+  //the quadrant strips are joined into exactly the strip a single thread makes, wherever the camera is
+  std::vector<ngl::Vec3> cameras = {{0,20,0}, {-60,8,40}, {100,30,-90}, {10,4,12}, {-127,2,-127}, {300,50,0}};
+  for(auto &camera : cameras)
+  {
+    for(float tolerance : {0.1f, 0.5f, 4.0f})
+    {
+      parallel.meshRefine(camera,tolerance,1);
+      serial.meshRefine(camera,tolerance,1);
+      EXPECT_EQ(parallel.m_indices,serial.m_indices);
+    }
+  }
+
+  //budgeted refinements are refined in parallel too, and so finish in the call that starts them
+  for(auto &camera : cameras)
+  {
+    EXPECT_TRUE(parallel.updateRefinement(camera,0.5f,1,1e-6));
+    EXPECT_FALSE(parallel.isRefining());
+    serial.meshRefine(camera,0.5f,1);
+    EXPECT_EQ(parallel.m_indices,serial.m_indices);
+  }
+}
+
+TEST(TerrainData, refinementStepsMatchRecursion)
+{
+  TerrainGenerator terrainGen = createTestTerrain(129);
+  TerrainData terrain(terrainGen);
+
+  //the recursive refinement of Lindstrom and Pascucci (2001) that the refinement steps replace, testing each vertex
+  //as it is reached rather than testing each child once from its parent
+  ngl::Vec3 camera;
+  float tolerance = 1;
+  Frustum frustum;
+  std::vector<GLuint> indices;
+  int parity = 0;
+  auto append = [&](size_t _vertex, int _parity)
+  {
+    size_t l = indices.size();
+    if(indices[l-1] != _vertex && indices[l-2] != _vertex)
+    {
+      if(_parity != parity)
+      {
+        parity = _parity;
+      }
+      else
+      {
+        indices.push_back(indices[l-2]);
+      }
+      indices.push_back(GLuint(_vertex));
+    }
+  };
+  std::function<void(size_t,size_t,int,int)> refine = [&](size_t _currentVertex, size_t _DAGChildVertex,
+                                                          int _refinementLevel, int _planeMask)
+  {
+    if(_refinementLevel <= terrain.m_maxRefinementLevel &&
+       terrain.isVisible(_currentVertex, frustum, _planeMask) &&
+       terrain.isActive(_currentVertex, camera, tolerance, 1))
+    {
+      refine(_DAGChildVertex, 4*_currentVertex + (2*_currentVertex + _DAGChildVertex - 6)%4 - 7,
+             _refinementLevel+1, _planeMask);
+      append(_currentVertex, _refinementLevel%2);
+      refine(_DAGChildVertex, 4*_currentVertex + (2*_currentVertex + _DAGChildVertex - 5)%4 - 7,
+             _refinementLevel+1, _planeMask);
+    }
+  };
+  auto recursiveRefine = [&]()
+  {
+    indices = {0,0};
+    parity = 0;
+    refine(4,6,1,Frustum::m_allPlanes);
+    append(1,0);
+    refine(4,7,1,Frustum::m_allPlanes);
+    append(2,0);
+    refine(4,8,1,Frustum::m_allPlanes);
+    append(3,0);
+    refine(4,5,1,Frustum::m_allPlanes);
+    indices.push_back(0);
+  };
+
+  //a perspective projection looking down -z from the origin, so that half of the terrain is out of view
+  float n = 1;
+  float f = 100;
+  ngl::Mat4 project(1, 0, 0,               0,
+                    0, 1, 0,               0,
+                    0, 0, (f+n)/(n-f),    -1,
+                    0, 0, 2*f*n/(n-f),     0);
+  std::vector<ngl::Vec3> cameras = {{0,20,0}, {-60,8,40}, {100,30,-90}, {10,4,12}, {-127,2,-127}, {300,50,0}};
+  for(auto &view : {Frustum(), Frustum(project)})
+  {
+    frustum = view;
+    for(auto &cameraPos : cameras)
+    {
+      camera = cameraPos;
+      for(float cameraTolerance : {0.1f, 0.5f, 4.0f})
+      {
+        tolerance = cameraTolerance;
+        recursiveRefine();
+        for(bool parallelRefinement : {false, true})
+        {
+          terrain.m_parallelRefinement = parallelRefinement;
+          terrain.meshRefine(camera,tolerance,1,frustum);
+          EXPECT_EQ(terrain.m_indices,indices);
+        }
+      }
+    }
+  }
+}
+
+TEST(TerrainData, breadthFirstActivity)
+{
+  TerrainGenerator terrainGen = createTestTerrain(257);
+  TerrainData breadthFirst(terrainGen);
+  TerrainData reference(terrainGen);
+  breadthFirst.m_breadthFirstActivity = true;
+  reference.m_parallelRefinement = false;
+
+  //the same terrain is refined from each camera in turn, so the activity left by one refinement has to be cleared
+  //properly before the next
+  float n = 1;
+  float f = 100;
+  ngl::Mat4 project(1, 0, 0,               0,
+                    0, 1, 0,               0,
+                    0, 0, (f+n)/(n-f),    -1,
+                    0, 0, 2*f*n/(n-f),     0);
+  std::vector<ngl::Vec3> cameras = {{0,20,0}, {10,4,12}, {-250,2,-250}, {-60,8,40}, {200,30,-180}, {600,50,0}};
+  for(auto &frustum : {Frustum(), Frustum(project)})
+  {
+    for(auto &camera : cameras)
+    {
+      for(float tolerance : {0.1f, 0.5f, 4.0f})
+      {
+        reference.meshRefine(camera,tolerance,1,frustum);
+        for(bool parallelRefinement : {false, true})
+        {
+          breadthFirst.m_parallelRefinement = parallelRefinement;
+          breadthFirst.meshRefine(camera,tolerance,1,frustum);
+          EXPECT_EQ(breadthFirst.m_indices,reference.m_indices);
+        }
+      }
+    }
+  }
+}
+
+TEST(TerrainData, updateHeights)
+{
+  //new heights and normals on the same grid, with a different amplitude and pattern
+  TerrainGenerator terrainGen = createTestTerrain(65);
+  TerrainGenerator newTerrainGen = createTestTerrain(65);
+  for(size_t i=0; i<newTerrainGen.m_heightMap.size(); i++)
+  {
+    newTerrainGen.m_heightMap[i] = newTerrainGen.m_heightMap[i]*3 + float((i*7)%11)*0.1f;
+    newTerrainGen.m_normals[i] = ngl::Vec3(0.6f,0.8f,0);
+  }
+
+  //an updated terrain is the same as one built from the new heights
+  TerrainData updated(terrainGen);
+  updated.m_parallelRefinement = false;
+  ASSERT_TRUE(updated.updateHeights(newTerrainGen));
+  TerrainData fresh(newTerrainGen);
+  fresh.m_parallelRefinement = false;
+  ASSERT_EQ(updated.m_vertices.size(),fresh.m_vertices.size());
+  for(size_t i=0; i<fresh.m_vertices.size(); i++)
+  {
+    EXPECT_EQ(updated.m_vertices[i].sceneX,fresh.m_vertices[i].sceneX);
+    EXPECT_EQ(updated.m_vertices[i].sceneY,fresh.m_vertices[i].sceneY);
+    EXPECT_EQ(updated.m_vertices[i].sceneZ,fresh.m_vertices[i].sceneZ);
+    EXPECT_EQ(updated.m_vertices[i].radius,fresh.m_vertices[i].radius);
+    EXPECT_EQ(updated.m_vertices[i].augmentedDelta,fresh.m_vertices[i].augmentedDelta);
+    EXPECT_EQ(updated.m_vertsToBeRendered[i],fresh.m_vertsToBeRendered[i]);
+    EXPECT_EQ(updated.m_normalsToBeRendered[i],fresh.m_normalsToBeRendered[i]);
+    EXPECT_EQ(updated.m_UVsToBeRendered[i],fresh.m_UVsToBeRendered[i]);
+  }
+  EXPECT_EQ(updated.m_heightMapIndices,fresh.m_heightMapIndices);
+  for(auto &camera : std::vector<ngl::Vec3>{{0,20,0}, {-40,8,30}, {60,3,-60}})
+  {
+    updated.meshRefine(camera,0.5f,1);
+    fresh.meshRefine(camera,0.5f,1);
+    EXPECT_EQ(updated.m_indices,fresh.m_indices);
+  }
+
+  //heights on a different grid can't be taken, and leave the terrain as it was
+  TerrainGenerator smallTerrainGen = createTestTerrain(33);
+  EXPECT_FALSE(updated.updateHeights(smallTerrainGen));
+  EXPECT_EQ(updated.m_vertices.size(),fresh.m_vertices.size());
+}